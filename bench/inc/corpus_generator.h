@@ -0,0 +1,83 @@
+#ifndef CORPUS_GENERATOR_H
+#define CORPUS_GENERATOR_H
+
+#include <stdbool.h>
+
+#include "stdint.h"
+
+#include "../../inc/png_parser.h"
+#include "../../inc/png_filtration.h"
+
+// Boundaries
+#define CORPUS_MIN_EDGE 64
+#define CORPUS_MAX_EDGE 16384
+
+/**
+ * @brief Content of a synthetic carrier
+ *
+ * Noise is the worst case for filters and compression, flat regions the best,
+ * gradients sit in between and favour Sub, Up and Paeth.
+ */
+typedef enum
+{
+    CORPUS_PATTERN_NOISE,
+    CORPUS_PATTERN_GRADIENT,
+    CORPUS_PATTERN_FLAT,
+    CORPUS_PATTERN_COUNT
+
+} corpus_pattern;
+
+/**
+ * @brief Description of one synthetic RGBA carrier
+ *
+ * The same description always produces the same pixels.
+ * m_idat_chunk_size splits the compressed stream into IDAT chunks of that size,
+ * 0 writes a single IDAT chunk.
+ */
+typedef struct
+{
+    uint32_t m_width;
+    uint32_t m_height;
+    corpus_pattern m_pattern;
+    uint32_t m_seed;
+    unsigned long int m_idat_chunk_size;
+
+} corpus_carrier;
+
+/**
+ * @brief Get printable name of pattern
+ *
+ * @param pattern Pattern
+ * @return Name
+ */
+const char *corpus_pattern_name(const corpus_pattern pattern);
+
+/**
+ * @brief Build IHDR of an 8 bit RGBA image, CRC included
+ *
+ * @param width Image width
+ * @param height Image height
+ * @return IHDR
+ */
+IHDR_chunk corpus_make_ihdr(const uint32_t width, const uint32_t height);
+
+/**
+ * @brief Generate pixels of carrier
+ *
+ * Memory comes from image_alloc, release with free_rgba_png.
+ *
+ * @param carrier Carrier description
+ * @return RGBA_pixel** 2D Image array, NULL if not successful
+ */
+RGBA_pixel **corpus_generate_image(const corpus_carrier *const carrier);
+
+/**
+ * @brief Generate carrier and save it as PNG
+ *
+ * @param file_name Path of output image
+ * @param carrier Carrier description
+ * @return True if successful, false if not
+ */
+bool corpus_write_png(const char *file_name, const corpus_carrier *const carrier);
+
+#endif // ~CORPUS_GENERATOR_H
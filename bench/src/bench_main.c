@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "../inc/corpus_generator.h"
+#include "../../inc/global_config.h"
+#include "../../inc/png_parser.h"
+#include "../../inc/png_filtration.h"
+#include "../../inc/png_data_encoder.h"
+#include "../../inc/image_arena.h"
+#include "../../inc/codec.h"
+#include "../../inc/deflate_backend.h"
+
+// Flags
+#define FLAG_HELP "-help"
+#define FLAG_MIN_EDGE "-min"
+#define FLAG_MAX_EDGE "-max"
+#define FLAG_ITERATIONS "-iter"
+#define FLAG_CORPUS_DIR "-dir"
+#define FLAG_PAGES "-pages"
+
+// Defaults
+#define DEFAULT_MAX_EDGE 1024
+#define DEFAULT_ITERATIONS 5
+#define DEFAULT_CORPUS_DIR "bench_corpus"
+#define DEFAULT_SEED 0x9E3779B9
+
+// Edges grow by this factor from min to max
+#define EDGE_STEP 4
+
+#define BYTES_IN_MEGABYTE (1024.0 * 1024.0)
+#define MAX_PATH_LENGTH 512
+
+// IDAT chunkings of the end to end corpus, 0 is a single chunk
+static const unsigned long int g_idat_chunk_sizes[] = {0, 65536, 8192};
+#define IDAT_CHUNKING_COUNT (sizeof(g_idat_chunk_sizes) / sizeof(g_idat_chunk_sizes[0]))
+
+/**
+ * @brief Inputs prepared once per carrier, shared by all kernels
+ */
+typedef struct
+{
+    corpus_carrier m_carrier;
+    IHDR_chunk m_ihdr;
+
+    RGBA_pixel **m_image;
+    unsigned char *m_filtered_data;
+    unsigned long int m_filtered_data_len;
+    unsigned char *m_compressed_data;
+    unsigned long int m_compressed_data_len;
+    unsigned char *m_payload;
+    uint32_t m_payload_len;
+
+    image_arena *m_arena;
+
+} bench_input;
+
+typedef bool (*bench_kernel)(bench_input *input);
+
+// Helper functions
+
+static inline double seconds_now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int compare_seconds(const void *a, const void *b)
+{
+    double left = *(const double *)a;
+    double right = *(const double *)b;
+
+    return (left > right) - (left < right);
+}
+
+static inline void print_help_menu(char const *program_name)
+{
+    printf("Usage: %s [" FLAG_MIN_EDGE " <edge>] [" FLAG_MAX_EDGE " <edge>] [" FLAG_ITERATIONS " <count>] [" FLAG_CORPUS_DIR " <dir>]"
+           " [" FLAG_PAGES " <policy>]\n\n"
+           "\t" FLAG_MIN_EDGE " <edge>\n"
+           "\t\tsmallest carrier is <edge>x<edge>; defaults to %d\n\n"
+           "\t" FLAG_MAX_EDGE " <edge>\n"
+           "\t\tlargest carrier is <edge>x<edge>, up to %d; defaults to %d\n\n"
+           "\t" FLAG_ITERATIONS " <count>\n"
+           "\t\ttimed runs per measurement; defaults to %d\n\n"
+           "\t" FLAG_CORPUS_DIR " <dir>\n"
+           "\t\tdirectory the synthetic corpus is written to; defaults to " DEFAULT_CORPUS_DIR "\n\n"
+           "\t" FLAG_PAGES " <policy>\n"
+           "\t\tpages of arena blocks: " IMAGE_ARENA_PAGES_NAME_SMALL ", " IMAGE_ARENA_PAGES_NAME_TRANSPARENT " or "
+           IMAGE_ARENA_PAGES_NAME_HUGETLB "; defaults to " IMAGE_ARENA_PAGES_NAME_TRANSPARENT "\n\n"
+           "Results are printed as one JSON object per line.\n",
+           program_name, CORPUS_MIN_EDGE, CORPUS_MAX_EDGE, DEFAULT_MAX_EDGE, DEFAULT_ITERATIONS);
+}
+
+static void print_result(const char *kind, const char *name, const corpus_carrier *const carrier,
+                         double *seconds, const int iterations, const double bytes, const bool is_ok)
+{
+    qsort(seconds, iterations, sizeof(double), compare_seconds);
+
+    printf("{\"kind\":\"%s\",\"name\":\"%s\",\"backend\":\"%s\",\"pages\":\"%s\",\"pattern\":\"%s\",\"width\":%u,\"height\":%u,\"idat_chunk\":%lu,"
+           "\"iterations\":%d,\"ok\":%s,\"ms_min\":%.3f,\"ms_median\":%.3f,\"mb_per_s\":%.2f,\"items_per_s\":%.2f}\n",
+           kind, name, deflate_backend_current()->m_name, image_arena_page_policy_name(), corpus_pattern_name(carrier->m_pattern), carrier->m_width, carrier->m_height,
+           carrier->m_idat_chunk_size, iterations, is_ok ? "true" : "false",
+           seconds[0] * 1000.0, seconds[iterations / 2] * 1000.0,
+           seconds[iterations / 2] > 0 ? bytes / BYTES_IN_MEGABYTE / seconds[iterations / 2] : 0.0,
+           seconds[iterations / 2] > 0 ? 1.0 / seconds[iterations / 2] : 0.0);
+
+    fflush(stdout);
+}
+
+// Kernels, every buffer they allocate comes from the bound arena
+
+static bool kernel_unfilter(bench_input *input)
+{
+    RGBA_pixel **image = unfilter_rgba_png(input->m_filtered_data, input->m_ihdr);
+
+    return image != NULL;
+}
+
+static bool kernel_filter(bench_input *input)
+{
+    unsigned long int length = 0;
+
+    return filter_rgba_png(input->m_ihdr, input->m_image, &length) != NULL;
+}
+
+static bool kernel_select_filters(bench_input *input)
+{
+    unsigned char *filter_types = (unsigned char *)image_alloc(input->m_ihdr.m_height);
+
+    return filter_types != NULL && select_rgba_png_filters(input->m_ihdr, input->m_image, filter_types);
+}
+
+static bool kernel_encode_data(bench_input *input)
+{
+    return encode_data_rgba(input->m_image, input->m_ihdr, input->m_payload, input->m_payload_len, 0);
+}
+
+static bool kernel_decode_data(bench_input *input)
+{
+    unsigned char *data = NULL;
+    uint32_t length = 0;
+    uint32_t flags = 0;
+
+    // Decoded length counts the appended '\0'
+    return decode_data_rgba(input->m_image, input->m_ihdr, &data, &length, &flags) && length == input->m_payload_len + 1;
+}
+
+static bool kernel_uncompress(bench_input *input)
+{
+    unsigned long int length = 0;
+
+    return uncompress_data(input->m_ihdr, input->m_compressed_data, input->m_compressed_data_len, &length) != NULL;
+}
+
+static bool kernel_compress(bench_input *input)
+{
+    unsigned long int length = 0;
+
+    return compress_data(&length, input->m_filtered_data, input->m_filtered_data_len) != NULL;
+}
+
+/**
+ * @brief Kernel table, decode_data_rgba must run after encode_data_rgba
+ *
+ * calc_filter_type is internal to png_filtration and is measured through
+ * select_rgba_png_filters, which runs it on every row.
+ */
+static const struct
+{
+    const char *m_name;
+    bench_kernel m_kernel;
+    bool m_is_compressed_input;
+    bool m_is_per_backend;
+
+} g_kernels[] = {
+    {"unfilter_rgba_png", kernel_unfilter, false, false},
+    {"filter_rgba_png", kernel_filter, false, false},
+    {"select_rgba_png_filters", kernel_select_filters, false, false},
+    {"encode_data_rgba", kernel_encode_data, false, false},
+    {"decode_data_rgba", kernel_decode_data, false, false},
+    {"uncompress_data", kernel_uncompress, true, true},
+    {"compress_data", kernel_compress, false, true},
+};
+
+#define KERNEL_COUNT (sizeof(g_kernels) / sizeof(g_kernels[0]))
+
+// Benchmarks
+
+static bool prepare_input(bench_input *input, const corpus_carrier *const carrier)
+{
+    memset(input, 0, sizeof(bench_input));
+
+    input->m_carrier = *carrier;
+    input->m_ihdr = corpus_make_ihdr(carrier->m_width, carrier->m_height);
+    input->m_arena = image_arena_create();
+    input->m_image = corpus_generate_image(carrier);
+
+    if (input->m_arena == NULL || input->m_image == NULL)
+    {
+        return false;
+    }
+
+    input->m_filtered_data = filter_rgba_png(input->m_ihdr, input->m_image, &input->m_filtered_data_len);
+
+    if (input->m_filtered_data == NULL)
+    {
+        return false;
+    }
+
+    input->m_compressed_data = compress_data(&input->m_compressed_data_len, input->m_filtered_data,
+                                             input->m_filtered_data_len);
+
+    // Half of the carrier capacity
+    input->m_payload_len = (uint64_t)carrier->m_width * carrier->m_height * RGBA_PIXEL_SIZE / 8 / 2;
+    input->m_payload = (unsigned char *)malloc(input->m_payload_len + 1);
+
+    if (input->m_compressed_data == NULL || input->m_payload == NULL)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < input->m_payload_len; i++)
+    {
+        input->m_payload[i] = 'a' + i % 26;
+    }
+
+    return true;
+}
+
+static void release_input(bench_input *input)
+{
+    free_rgba_png(input->m_image);
+    image_free(input->m_filtered_data);
+    image_free(input->m_compressed_data);
+    free(input->m_payload);
+    image_arena_destroy(input->m_arena);
+}
+
+static bool select_backend(const deflate_backend_id id)
+{
+    const deflate_backend *backend = deflate_backend_get(id);
+
+    return backend != NULL && deflate_backend_select(backend->m_name);
+}
+
+static bool measure_kernel(bench_input *input, const bench_kernel kernel, const int iterations, double *seconds)
+{
+    bool is_ok = true;
+
+    // Warm up once so the arena is sized and codec state exists
+    image_arena_bind(input->m_arena);
+    is_ok = kernel(input);
+    image_arena_bind(NULL);
+    image_arena_reset(input->m_arena);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        image_arena_bind(input->m_arena);
+
+        double start = seconds_now();
+        is_ok = kernel(input) && is_ok;
+        seconds[i] = seconds_now() - start;
+
+        image_arena_bind(NULL);
+        image_arena_reset(input->m_arena);
+    }
+
+    return is_ok;
+}
+
+static void bench_kernels(const corpus_carrier *const carrier, const int iterations)
+{
+    const char *default_backend = deflate_backend_current()->m_name;
+    bench_input input = {0};
+    double *seconds = (double *)malloc(iterations * sizeof(double));
+    double image_bytes = (double)carrier->m_width * carrier->m_height * RGBA_PIXEL_SIZE;
+
+    if (seconds == NULL || prepare_input(&input, carrier) == false)
+    {
+        fprintf(stderr, "[Error] Could not prepare %ux%u %s carrier\n", carrier->m_width, carrier->m_height,
+                corpus_pattern_name(carrier->m_pattern));
+        release_input(&input);
+        free(seconds);
+        return;
+    }
+
+    for (size_t k = 0; k < KERNEL_COUNT; k++)
+    {
+        // Throughput is relative to the raw image, compressed input is reported as such
+        double bytes = g_kernels[k].m_is_compressed_input ? (double)input.m_compressed_data_len : image_bytes;
+
+        if (g_kernels[k].m_is_per_backend == false)
+        {
+            bool is_ok = measure_kernel(&input, g_kernels[k].m_kernel, iterations, seconds);
+            print_result("kernel", g_kernels[k].m_name, carrier, seconds, iterations, bytes, is_ok);
+            continue;
+        }
+
+        // Compare every available backend on the same input
+        for (int id = 0; id < DEFLATE_BACKEND_COUNT; id++)
+        {
+            if (select_backend(id) == true)
+            {
+                bool is_ok = measure_kernel(&input, g_kernels[k].m_kernel, iterations, seconds);
+                print_result("kernel", g_kernels[k].m_name, carrier, seconds, iterations, bytes, is_ok);
+            }
+        }
+
+        deflate_backend_select(default_backend);
+    }
+
+    release_input(&input);
+    free(seconds);
+}
+
+static void bench_end_to_end(const corpus_carrier *const carrier, const char *corpus_dir, const int iterations)
+{
+    char input_name[MAX_PATH_LENGTH];
+    char output_name[MAX_PATH_LENGTH];
+    double *seconds = (double *)malloc(iterations * sizeof(double));
+    image_arena_pool arenas;
+    unsigned long int bytes = 0;
+    bool is_ok = true;
+
+    snprintf(input_name, sizeof(input_name), "%s/%s_%ux%u_c%lu.png", corpus_dir,
+             corpus_pattern_name(carrier->m_pattern), carrier->m_width, carrier->m_height, carrier->m_idat_chunk_size);
+    snprintf(output_name, sizeof(output_name), "%s/%s_%ux%u_c%lu_out.png", corpus_dir,
+             corpus_pattern_name(carrier->m_pattern), carrier->m_width, carrier->m_height, carrier->m_idat_chunk_size);
+
+    if (seconds == NULL || image_arena_pool_init(&arenas) == false)
+    {
+        free(seconds);
+        return;
+    }
+
+    if (corpus_write_png(input_name, carrier) == false)
+    {
+        fprintf(stderr, "[Error] Could not write %s\n", input_name);
+        image_arena_pool_free(&arenas);
+        free(seconds);
+        return;
+    }
+
+    // Same path as a batch job: arena from pool, whole job on this thread, first run warms up
+    for (int i = -1; i < iterations; i++)
+    {
+        codec_job job;
+        static const unsigned char payload[] = "synthetic benchmark payload";
+
+        codec_job_init(&job, input_name, output_name, true);
+        job.m_hidden_data = payload;
+        job.m_hidden_data_len = sizeof(payload) - 1;
+        job.m_arena_pool = &arenas;
+
+        double start = seconds_now();
+        is_ok = codec_run(&job) && is_ok;
+        double elapsed = seconds_now() - start;
+
+        bytes = job.m_bytes_in + job.m_bytes_out;
+        codec_job_release(&job);
+
+        if (i >= 0)
+        {
+            seconds[i] = elapsed;
+        }
+    }
+
+    print_result("end_to_end", "encode_image", carrier, seconds, iterations, (double)bytes, is_ok);
+
+    image_arena_pool_free(&arenas);
+    free(seconds);
+}
+
+int main(int argc, char const *argv[])
+{
+    uint32_t min_edge = CORPUS_MIN_EDGE;
+    uint32_t max_edge = DEFAULT_MAX_EDGE;
+    int iterations = DEFAULT_ITERATIONS;
+    const char *corpus_dir = DEFAULT_CORPUS_DIR;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(FLAG_MIN_EDGE, argv[i]) == 0 && i + 1 < argc)
+        {
+            min_edge = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(FLAG_MAX_EDGE, argv[i]) == 0 && i + 1 < argc)
+        {
+            max_edge = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(FLAG_ITERATIONS, argv[i]) == 0 && i + 1 < argc)
+        {
+            iterations = atoi(argv[++i]);
+        }
+        else if (strcmp(FLAG_CORPUS_DIR, argv[i]) == 0 && i + 1 < argc)
+        {
+            corpus_dir = argv[++i];
+        }
+        else if (strcmp(FLAG_PAGES, argv[i]) == 0 && i + 1 < argc && image_arena_set_page_policy(argv[i + 1]) == true)
+        {
+            i++;
+        }
+        else
+        {
+            print_help_menu(argv[0]);
+            return strcmp(FLAG_HELP, argv[i]) == 0 ? PROGRAM_OK : PROGRAM_ERROR;
+        }
+    }
+
+    if (min_edge < CORPUS_MIN_EDGE || max_edge > CORPUS_MAX_EDGE || min_edge > max_edge || iterations < 1)
+    {
+        print_help_menu(argv[0]);
+        return PROGRAM_ERROR;
+    }
+
+    if (mkdir(corpus_dir, 0755) != 0 && errno != EEXIST)
+    {
+        perror("Could not create corpus directory!\n");
+        return PROGRAM_ERROR;
+    }
+
+    for (uint64_t edge = min_edge; edge <= max_edge; edge *= EDGE_STEP)
+    {
+        for (int pattern = 0; pattern < CORPUS_PATTERN_COUNT; pattern++)
+        {
+            corpus_carrier carrier = {edge, edge, pattern, DEFAULT_SEED, 0};
+
+            bench_kernels(&carrier, iterations);
+
+            for (size_t c = 0; c < IDAT_CHUNKING_COUNT; c++)
+            {
+                carrier.m_idat_chunk_size = g_idat_chunk_sizes[c];
+
+                for (int id = 0; id < DEFLATE_BACKEND_COUNT; id++)
+                {
+                    if (select_backend(id) == true)
+                    {
+                        bench_end_to_end(&carrier, corpus_dir, iterations);
+                    }
+                }
+
+                deflate_backend_select(DEFLATE_BACKEND_AUTO);
+            }
+        }
+    }
+
+    return PROGRAM_OK;
+}
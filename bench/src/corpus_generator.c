@@ -0,0 +1,203 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "zlib.h"
+
+#include "../inc/corpus_generator.h"
+#include "../../inc/image_arena.h"
+
+#define IHDR_DATA_LENGTH 13
+#define BIT_DEPTH_8 8
+
+static const char *const g_pattern_names[CORPUS_PATTERN_COUNT] = {
+    "noise",
+    "gradient",
+    "flat",
+};
+
+// Helper functions
+
+static inline uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t value = *state;
+
+    value ^= value << 13;
+    value ^= value >> 17;
+    value ^= value << 5;
+
+    *state = value;
+
+    return value;
+}
+
+static inline void store_be32(unsigned char *dest, const uint32_t value)
+{
+    dest[0] = value >> 24;
+    dest[1] = value >> 16;
+    dest[2] = value >> 8;
+    dest[3] = value;
+}
+
+static void fill_row(RGBA_pixel *const row, const corpus_carrier *const carrier, const uint32_t y, uint32_t *state)
+{
+    const uint32_t width_span = carrier->m_width > 1 ? carrier->m_width - 1 : 1;
+    const uint32_t height_span = carrier->m_height > 1 ? carrier->m_height - 1 : 1;
+
+    for (uint32_t x = 0; x < carrier->m_width; x++)
+    {
+        switch (carrier->m_pattern)
+        {
+        case CORPUS_PATTERN_NOISE:
+        {
+            uint32_t value = xorshift32(state);
+
+            row[x].m_red = value;
+            row[x].m_green = value >> 8;
+            row[x].m_blue = value >> 16;
+            row[x].m_alpha = 0xFF;
+            break;
+        }
+
+        case CORPUS_PATTERN_GRADIENT:
+            row[x].m_red = (uint64_t)x * 0xFF / width_span;
+            row[x].m_green = (uint64_t)y * 0xFF / height_span;
+            row[x].m_blue = ((uint64_t)x + y) * 0xFF / (width_span + height_span);
+            row[x].m_alpha = 0xFF;
+            break;
+
+        default:
+            // Flat colour picked by the seed
+            row[x].m_red = carrier->m_seed;
+            row[x].m_green = carrier->m_seed >> 8;
+            row[x].m_blue = carrier->m_seed >> 16;
+            row[x].m_alpha = 0xFF;
+            break;
+        }
+    }
+}
+
+// Header defined functions
+
+const char *corpus_pattern_name(const corpus_pattern pattern)
+{
+    return pattern < CORPUS_PATTERN_COUNT ? g_pattern_names[pattern] : "unknown";
+}
+
+IHDR_chunk corpus_make_ihdr(const uint32_t width, const uint32_t height)
+{
+    IHDR_chunk result;
+    unsigned char crc_input[TYPE_SIGNATURE_LENGTH + IHDR_DATA_LENGTH];
+
+    memset(&result, 0, sizeof(IHDR_chunk));
+
+    result.m_width = width;
+    result.m_height = height;
+    result.m_bit_depth = BIT_DEPTH_8;
+    result.m_color_type = COLOR_TYPE_RGBA;
+
+    result.m_outside_chunk.m_data_length = IHDR_DATA_LENGTH;
+    memcpy(result.m_outside_chunk.m_type, IHDR_SIGNATURE, TYPE_SIGNATURE_LENGTH);
+
+    // CRC covers type and data in file byte order
+    memcpy(crc_input, IHDR_SIGNATURE, TYPE_SIGNATURE_LENGTH);
+    store_be32(&crc_input[4], width);
+    store_be32(&crc_input[8], height);
+    crc_input[12] = result.m_bit_depth;
+    crc_input[13] = result.m_color_type;
+    crc_input[14] = result.m_compression_method;
+    crc_input[15] = result.m_filter_method;
+    crc_input[16] = result.m_interlace_method;
+
+    result.m_outside_chunk.m_CRC_32 = crc32(0, crc_input, sizeof(crc_input));
+
+    return result;
+}
+
+RGBA_pixel **corpus_generate_image(const corpus_carrier *const carrier)
+{
+    RGBA_pixel **result = NULL;
+    RGBA_pixel *pixels = NULL;
+
+    // Same layout as unfilter_rgba_png, so free_rgba_png releases it
+    result = (RGBA_pixel **)image_alloc(carrier->m_height * sizeof(RGBA_pixel *));
+    pixels = (RGBA_pixel *)image_alloc((size_t)carrier->m_width * carrier->m_height * RGBA_PIXEL_SIZE);
+
+    if (result == NULL || pixels == NULL)
+    {
+        image_free(result);
+        image_free(pixels);
+        return NULL;
+    }
+
+    // Seed 0 would keep xorshift at 0
+    uint32_t state = carrier->m_seed != 0 ? carrier->m_seed : 1;
+
+    for (uint32_t y = 0; y < carrier->m_height; y++)
+    {
+        result[y] = &pixels[(size_t)y * carrier->m_width];
+        fill_row(result[y], carrier, y, &state);
+    }
+
+    return result;
+}
+
+bool corpus_write_png(const char *file_name, const corpus_carrier *const carrier)
+{
+    IHDR_chunk ihdr = corpus_make_ihdr(carrier->m_width, carrier->m_height);
+    RGBA_pixel **image = corpus_generate_image(carrier);
+    unsigned char *filtered_data = NULL;
+    unsigned long int filtered_data_len = 0;
+    unsigned char *compressed_data = NULL;
+    unsigned long int compressed_data_len = 0;
+    bool result = true;
+
+    if (image == NULL)
+    {
+        return false;
+    }
+
+    filtered_data = filter_rgba_png(ihdr, image, &filtered_data_len);
+    free_rgba_png(image);
+
+    if (filtered_data == NULL)
+    {
+        return false;
+    }
+
+    compressed_data = compress_data(&compressed_data_len, filtered_data, filtered_data_len);
+    image_free(filtered_data);
+
+    if (compressed_data == NULL)
+    {
+        return false;
+    }
+
+    if (png_open(file_name, "wb") == false)
+    {
+        image_free(compressed_data);
+        return false;
+    }
+
+    result = write_png_IHDR(ihdr);
+
+    // Split compressed stream into the requested IDAT chunking
+    for (unsigned long int offset = 0; result == true && offset < compressed_data_len;)
+    {
+        unsigned long int length = compressed_data_len - offset;
+
+        if (carrier->m_idat_chunk_size != 0 && length > carrier->m_idat_chunk_size)
+        {
+            length = carrier->m_idat_chunk_size;
+        }
+
+        result = write_png_IDAT(&compressed_data[offset], length);
+        offset += length;
+    }
+
+    result = result && write_png_IEND();
+    result = png_close() && result;
+
+    image_free(compressed_data);
+
+    return result;
+}
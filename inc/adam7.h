@@ -0,0 +1,40 @@
+#ifndef ADAM7_H
+#define ADAM7_H
+
+#include <stdbool.h>
+
+#include "../inc/png_parser.h"
+#include "../inc/png_filtration.h"
+#include "../inc/thread_pool.h"
+
+/**
+ * @brief Unfilter an Adam7 interlaced image into a plain image array
+ *
+ * Every pass is a small image with its own filter chain, so passes are
+ * unfiltered as independent tasks on pool and scattered into their pixels
+ * of the full image. Pass 7 holds half of the pixels, which caps the speedup
+ * near two threads.
+ *
+ * @param filtered_buffer Inflated image, png_filtered_length bytes
+ * @param ihdr IHDR of an interlaced, supported image
+ * @param pool Pool the passes run on, NULL runs them on calling thread
+ * @return RGBA_pixel** 2D Image array, release with free_rgba_png, NULL if not successful
+ */
+RGBA_pixel **adam7_unfilter(const unsigned char *const filtered_buffer, const IHDR_chunk ihdr, thread_pool *pool);
+
+/**
+ * @brief Gather the passes of an image and filter them, Adam7 interlaced
+ *
+ * Rows of every pass are filtered by the heuristic of filter_rgba_row,
+ * passes run as independent tasks on pool.
+ *
+ * @param ihdr IHDR of the output image, interlaced
+ * @param image 2D Image array
+ * @param pool Pool the passes run on, NULL runs them on calling thread
+ * @param length Outputs filtered length
+ * @return Filtered image, png_filtered_length bytes, NULL if not successful
+ */
+unsigned char *adam7_filter(const IHDR_chunk ihdr, RGBA_pixel **image, thread_pool *pool,
+                            unsigned long int *const length);
+
+#endif // ~ADAM7_H
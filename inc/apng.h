@@ -0,0 +1,62 @@
+#ifndef APNG_H
+#define APNG_H
+
+#include <stdbool.h>
+
+#include "stdint.h"
+
+#include "../inc/png_parser.h"
+
+// Frames of one image, bounded so a broken acTL cannot ask for huge tables
+#define APNG_MAX_FRAMES 65536
+
+/**
+ * @brief Check if image is animated (has an acTL chunk)
+ *
+ * Standard input cannot be read twice and is always taken as a still image.
+ *
+ * @param file_name Path to png file
+ * @return True if animated, false if not or if it cannot be read
+ */
+bool apng_is_animated(const char *file_name);
+
+/**
+ * @brief Encode data across the frames of an animated image
+ *
+ * Length header and data form one stream that fills the frames in file order,
+ * the default image first. Every frame the stream reaches is inflated,
+ * unfiltered, embedded, filtered, and deflated as one task on a thread pool;
+ * the other frames are copied compressed, never inflated. Sequence numbers are
+ * written again, every frame ends up in a single IDAT or fdAT chunk. Other
+ * chunks are carried over as read_png_chunk_index picks them. Tasks run
+ * on pool threads, so no image arena is used.
+ *
+ * @param input_name Path to input image
+ * @param output_name Path to output image or PNG_STANDARD_STREAM_NAME
+ * @param data Data to encode
+ * @param data_length Length of data
+ * @param flags PAYLOAD_FLAG_ bits stored with the length
+ * @param error Outputs the reason of failure
+ * @return True if successful, false if not
+ */
+bool apng_encode(const char *input_name, const char *output_name, const unsigned char *const data,
+                 const uint32_t data_length, const uint32_t flags, const char **error);
+
+/**
+ * @brief Decode data spread across the frames of an animated image
+ *
+ * The default image is decoded first for the length header, then only the
+ * frames holding the rest of the data, in parallel. The payload is returned
+ * as embedded, the caller reverses what flags say was done to it.
+ *
+ * @param input_name Path to input image
+ * @param data Outputs data with '\0' appended, free with free
+ * @param data_length Outputs length of data, '\0' included
+ * @param flags Outputs PAYLOAD_FLAG_ bits read with the length
+ * @param error Outputs the reason of failure
+ * @return True if successful, false if not
+ */
+bool apng_decode(const char *input_name, unsigned char **data, uint32_t *data_length, uint32_t *flags,
+                 const char **error);
+
+#endif // ~APNG_H
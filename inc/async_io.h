@@ -0,0 +1,114 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Boundaries
+#define ASYNC_IO_MAX_DEPTH 256
+
+// Backend names
+#define ASYNC_IO_BACKEND_NAME_IO_URING "io_uring"
+#define ASYNC_IO_BACKEND_NAME_THREADS "threads"
+
+/**
+ * @brief How requests reach the storage
+ *
+ * ASYNC_IO_BACKEND_IO_URING queues open, read and write on an io_uring and
+ * completes them on one reaper thread. ASYNC_IO_BACKEND_THREADS runs blocking
+ * calls on a pool of depth threads; it is used when io_uring is not available.
+ */
+typedef enum
+{
+    ASYNC_IO_BACKEND_IO_URING,
+    ASYNC_IO_BACKEND_THREADS,
+    ASYNC_IO_BACKEND_AUTO
+
+} async_io_backend;
+
+/**
+ * @brief Totals of an async_io instance
+ */
+typedef struct
+{
+    unsigned long int m_reads;
+    unsigned long int m_read_bytes;
+    unsigned long int m_writes;
+    unsigned long int m_write_bytes;
+    unsigned long int m_failed_writes;
+
+} async_io_stats;
+
+/**
+ * @brief Opaque asynchronous file reader and writer of a batch
+ *
+ * Inputs are whole files known up front and read by index, up to depth of them
+ * ahead of the latest one asked for. Outputs are written in the background,
+ * with at most depth writes in flight.
+ */
+typedef struct async_io async_io;
+
+/**
+ * @brief Create async I/O for a batch
+ *
+ * @param input_names Files read by index, kept by caller until destroy, may be NULL
+ * @param input_count Number of input names
+ * @param depth Inputs read ahead and writes in flight, 1 to ASYNC_IO_MAX_DEPTH
+ * @param backend Backend, ASYNC_IO_BACKEND_AUTO prefers io_uring and falls back to threads
+ * @return Pointer to async I/O, NULL if not successful, also if io_uring was asked for and is not available
+ */
+async_io *async_io_create(const char *const *input_names, const size_t input_count, const size_t depth,
+                          const async_io_backend backend);
+
+/**
+ * @brief Get whole content of input file
+ *
+ * Starts reads up to depth inputs past index, then waits for this one.
+ * Safe to call concurrently.
+ *
+ * @param io Async I/O
+ * @param index Input index
+ * @param length Outputs file length
+ * @return File content owned by io until async_io_release, NULL if it could not be read
+ */
+const unsigned char *async_io_read(async_io *io, const size_t index, size_t *length);
+
+/**
+ * @brief Free content of input file
+ *
+ * @param io Async I/O
+ * @param index Input index
+ */
+void async_io_release(async_io *io, const size_t index);
+
+/**
+ * @brief Write whole file in the background
+ *
+ * Blocks while depth writes are in flight. Failures are counted and reported
+ * on stderr when the write completes.
+ *
+ * @param io Async I/O
+ * @param output_name Path to output file
+ * @param data File content from malloc, owned by io from now on
+ * @param length Content length
+ * @return True if write was queued, false if not; data is freed either way
+ */
+bool async_io_write(async_io *io, const char *output_name, unsigned char *data, const size_t length);
+
+/**
+ * @brief Get name of backend in use
+ *
+ * @param io Async I/O
+ * @return Name
+ */
+const char *async_io_backend_name(const async_io *io);
+
+/**
+ * @brief Wait for every request and free async I/O
+ *
+ * @param io Async I/O
+ * @param stats Outputs totals, may be NULL
+ */
+void async_io_destroy(async_io *io, async_io_stats *stats);
+
+#endif // ~ASYNC_IO_H
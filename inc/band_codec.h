@@ -0,0 +1,36 @@
+#ifndef BAND_CODEC_H
+#define BAND_CODEC_H
+
+#include <stdbool.h>
+
+#include "stdint.h"
+
+// Compressed output gathered before it is written as one IDAT chunk
+#define BAND_CODEC_IDAT_BYTES (1024 * 1024)
+
+/**
+ * @brief Encode data in image a band of rows at a time
+ *
+ * For images whose pixels do not fit in memory. IDAT chunks are read one by
+ * one and every band of band_rows rows is inflated, unfiltered, filtered, and
+ * deflated before the next one, so memory holds two bands and never the whole
+ * image. The first band also covers every row the payload goes in. Output is
+ * written in IDAT chunks of BAND_CODEC_IDAT_BYTES as it is compressed, between
+ * the chunks carried over from the input (see read_png_chunk_index).
+ *
+ * Always compresses with zlib at the default level, filters are chosen as
+ * select_rgba_png_filters does; neither seek index nor optimizer is used.
+ *
+ * @param input_name Path to png file or PNG_STANDARD_STREAM_NAME for stdin
+ * @param output_name Path to png file or PNG_STANDARD_STREAM_NAME for stdout
+ * @param data Payload
+ * @param data_length Payload length
+ * @param flags PAYLOAD_FLAG_ bits stored with the length
+ * @param band_rows Rows of one band
+ * @param error Outputs the reason if not successful
+ * @return True if successful, false if not
+ */
+bool band_encode(const char *input_name, const char *output_name, const unsigned char *const data,
+                 const uint32_t data_length, const uint32_t flags, const uint32_t band_rows, const char **error);
+
+#endif // ~BAND_CODEC_H
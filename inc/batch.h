@@ -0,0 +1,106 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "stdint.h"
+
+#include "../inc/png_optimizer.h"
+#include "../inc/async_io.h"
+#include "../inc/row_scatter.h"
+
+// Boundaries
+#define BATCH_MAX_LINE_LENGTH 1024
+
+// Manifest format
+#define BATCH_COMMENT_CHARACTER '#'
+#define BATCH_FIELD_SEPARATORS " \t\r\n"
+
+/**
+ * @brief Single manifest entry
+ */
+typedef struct
+{
+    char *m_input_name;
+    char *m_payload_name;
+    char *m_output_name;
+    size_t m_line;
+
+} batch_job;
+
+/**
+ * @brief How jobs of a batch are scheduled
+ *
+ * BATCH_SCHEDULER_POOL runs every job start to end on a work-stealing pool,
+ * BATCH_SCHEDULER_PIPELINE overlaps the stages of different jobs through bounded queues
+ */
+typedef enum
+{
+    BATCH_SCHEDULER_POOL,
+    BATCH_SCHEDULER_PIPELINE
+
+} batch_scheduler;
+
+/**
+ * @brief Settings shared by every job of a batch
+ *
+ * m_worker_count 0 sizes the pool to the online cores. Empty m_stats_name
+ * writes no statistics, empty m_cache_directory uses no carrier cache.
+ * m_index_band_rows 0 writes no seek index. m_interlace is the interlace
+ * method of the outputs, INTERLACE_METHOD_KEEP keeps the one of each input.
+ * m_prefetch_depth, if not 0, reads that many inputs ahead and writes outputs
+ * in the background through m_io_backend. m_compress compresses every payload
+ * before it is embedded, m_key, if not NULL, encrypts it with that key.
+ * m_scatter, if not NULL, embeds every payload in rows in that order.
+ */
+typedef struct
+{
+    size_t m_worker_count;
+    batch_scheduler m_scheduler;
+    const char *m_stats_name;
+    png_optimize_mode m_optimize;
+    uint32_t m_index_band_rows;
+    int m_interlace;
+    const char *m_cache_directory;
+    unsigned long int m_cache_max_bytes;
+    size_t m_prefetch_depth;
+    async_io_backend m_io_backend;
+    bool m_compress;
+    const unsigned char *m_key;
+    const row_scatter *m_scatter;
+
+} batch_options;
+
+/**
+ * @brief Run every job from manifest
+ *
+ * Manifest holds one job per line: <input_image> <payload_file> <output_image>.
+ * Empty lines and lines starting with '#' are skipped.
+ * Lines with another field count, or longer than BATCH_MAX_LINE_LENGTH - 1
+ * characters, are reported and count as failed jobs.
+ * Prints status per job and aggregate throughput at the end.
+ *
+ * @param manifest_name Path to manifest file
+ * @param options Settings of the batch
+ * @return Program status, PROGRAM_ERROR if any job failed
+ */
+int run_batch(const char *manifest_name, const batch_options *const options);
+
+/**
+ * @brief Encode many payloads into one carrier
+ *
+ * Manifest holds one job per line: <payload_file> <output_image>, with the
+ * same comment rules as run_batch. The carrier is read, inflated, unfiltered,
+ * and filtered once; jobs then run in parallel, each copying only the rows its
+ * payload reaches and reusing the carrier's filter choice and filtered bytes
+ * for every other row.
+ *
+ * @param carrier_name Path to carrier image
+ * @param manifest_name Path to manifest file
+ * @param options Settings of the batch
+ * @return Program status, PROGRAM_ERROR if the carrier or any job failed
+ */
+int run_fanout(const char *carrier_name, const char *manifest_name, const batch_options *const options);
+
+#endif // ~BATCH_H
@@ -0,0 +1,144 @@
+#ifndef CARRIER_CACHE_H
+#define CARRIER_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "stdint.h"
+
+#include "../inc/png_parser.h"
+#include "../inc/png_filtration.h"
+
+// Configuration
+#define CARRIER_CACHE_DEFAULT_MAX_MB 1024
+#define CARRIER_CACHE_BYTES_IN_MEGABYTE (1024UL * 1024UL)
+#define CARRIER_CACHE_MAX_PATH_LENGTH 4096
+#define CARRIER_CACHE_PAGE_SIZE 4096
+
+// Entry file format
+#define CARRIER_CACHE_MAGIC "STGCARR3"
+#define CARRIER_CACHE_MAGIC_LENGTH 8
+#define CARRIER_CACHE_EXTENSION ".rgba"
+
+/**
+ * @brief Identity of a carrier
+ *
+ * IDAT streams with the same length, CRC-32 and zlib trailer (Adler-32 of
+ * the filtered image) under the same IHDR are taken to decode to the same pixels.
+ */
+typedef struct
+{
+    uint32_t m_width;
+    uint32_t m_height;
+    unsigned char m_bit_depth;
+    unsigned char m_color_type;
+    unsigned char m_compression_method;
+    unsigned char m_filter_method;
+    unsigned char m_interlace_method;
+    uint32_t m_pixel_size;
+    unsigned long int m_idat_length;
+    uint32_t m_idat_crc;
+    uint32_t m_idat_adler;
+
+} carrier_cache_key;
+
+/**
+ * @brief Mapped cache entry backing an image
+ *
+ * The mapping is private and writable, pixels changed by embedding are
+ * copied on write and never reach the cache file.
+ */
+typedef struct
+{
+    void *m_address;
+    size_t m_length;
+
+} carrier_cache_mapping;
+
+/**
+ * @brief On-disk store of decoded carriers
+ *
+ * Every entry is one file in m_directory holding the unfiltered RGBA pixels
+ * and the filter type of every row of the original carrier.
+ * The file modification time is the LRU clock: hits touch it and inserts
+ * evict the oldest entries while the directory holds more than m_max_bytes.
+ * Safe to use from several threads and processes sharing the directory.
+ */
+typedef struct
+{
+    char m_directory[CARRIER_CACHE_MAX_PATH_LENGTH];
+    unsigned long int m_max_bytes;
+
+    atomic_ulong m_hits;
+    atomic_ulong m_misses;
+    atomic_ulong m_evictions;
+
+    pthread_mutex_t m_evict_lock;
+
+} carrier_cache;
+
+/**
+ * @brief Open cache, creating its directory if needed
+ *
+ * @param cache Cache to initialize
+ * @param directory Cache directory
+ * @param max_bytes Size cap of all entries
+ * @return True if successful, false if not
+ */
+bool carrier_cache_open(carrier_cache *cache, const char *directory, const unsigned long int max_bytes);
+
+/**
+ * @brief Release resources of cache, entries stay on disk
+ *
+ * @param cache Cache to close
+ */
+void carrier_cache_close(carrier_cache *cache);
+
+/**
+ * @brief Compute key of carrier
+ *
+ * @param ihdr IHDR of carrier
+ * @param compressed_data All IDAT data of carrier
+ * @param compressed_data_length Length of IDAT data
+ * @return Key
+ */
+carrier_cache_key carrier_cache_key_of(const IHDR_chunk ihdr, const unsigned char *const compressed_data,
+                                       const unsigned long int compressed_data_length);
+
+/**
+ * @brief Map cached pixels of carrier
+ *
+ * Row pointers come from image_alloc, release with carrier_cache_unmap.
+ *
+ * @param cache Cache
+ * @param key Key of carrier
+ * @param mapping Outputs the mapping backing the image
+ * @param filter_types Outputs the filter type of every row of the carrier, valid until unmap
+ * @return RGBA_pixel** 2D Image array, NULL on a miss
+ */
+RGBA_pixel **carrier_cache_map(carrier_cache *cache, const carrier_cache_key *const key,
+                               carrier_cache_mapping *const mapping, const unsigned char **filter_types);
+
+/**
+ * @brief Release image returned by carrier_cache_map
+ *
+ * @param mapping Mapping of the image, reset to empty
+ * @param image 2D Image array
+ */
+void carrier_cache_unmap(carrier_cache_mapping *const mapping, RGBA_pixel **image);
+
+/**
+ * @brief Add decoded carrier to cache, evicting old entries over the size cap
+ *
+ * @param cache Cache
+ * @param key Key of carrier
+ * @param image Unfiltered pixels with contiguous rows, as from unfilter_rgba_png
+ * @param filter_types Filter type of every row of the carrier
+ * @return True if successful, false if not
+ */
+bool carrier_cache_store(carrier_cache *cache, const carrier_cache_key *const key, RGBA_pixel **image,
+                         const unsigned char *const filter_types);
+
+#endif // ~CARRIER_CACHE_H
@@ -0,0 +1,47 @@
+#ifndef CHUNK_CHANNEL_H
+#define CHUNK_CHANNEL_H
+
+#include <stdbool.h>
+
+#include "stdint.h"
+
+/**
+ * @brief Encode data in a private chunk instead of the pixels
+ *
+ * The payload goes in one stPL chunk before IEND, replacing any there was,
+ * and the rest of the file is copied as it is (see png_splice_chunk): nothing
+ * is inflated, unfiltered, filtered, or deflated, so it runs at disk speed.
+ * Hides nothing from anyone listing the chunks.
+ *
+ * @param input_name Path to png file or PNG_STANDARD_STREAM_NAME for stdin
+ * @param output_name Path to png file or PNG_STANDARD_STREAM_NAME for stdout
+ * @param data Payload
+ * @param data_length Payload length, up to PNG_MAX_CHUNK_LENGTH
+ * @param error Outputs the reason if not successful
+ * @return True if successful, false if not
+ */
+bool chunk_channel_encode(const char *input_name, const char *output_name, const unsigned char *const data,
+                          const uint32_t data_length, const char **error);
+
+/**
+ * @brief Check if image carries its payload in a chunk
+ *
+ * Standard input cannot be read twice and is always taken as a pixel carrier.
+ *
+ * @param file_name Path to png file
+ * @return True if it has an stPL chunk, false if not or if it cannot be read
+ */
+bool chunk_channel_is_used(const char *file_name);
+
+/**
+ * @brief Decode data from the stPL chunk
+ *
+ * @param input_name Path to png file
+ * @param data Outputs data with '\0' appended, free with free
+ * @param data_length Outputs length of data, '\0' included
+ * @param error Outputs the reason if not successful
+ * @return True if successful, false if not
+ */
+bool chunk_channel_decode(const char *input_name, unsigned char **data, uint32_t *data_length, const char **error);
+
+#endif // ~CHUNK_CHANNEL_H
@@ -1,7 +1,238 @@
 #ifndef ENC_DEC_H
 #define ENC_DEC_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "stdint.h"
+
 #include "../inc/program_input_parser.h"
+#include "../inc/png_filtration.h"
+#include "../inc/png_optimizer.h"
+#include "../inc/carrier_cache.h"
+#include "../inc/image_arena.h"
+#include "../inc/async_io.h"
+#include "../inc/thread_pool.h"
+#include "../inc/row_scatter.h"
+
+/**
+ * @brief Stages of a single encode/decode, in execution order
+ *
+ * Select, filter and deflate stages do nothing in decoding mode.
+ * Select picks the filter type of every row, filter applies them.
+ * With optimization on, the deflate stage searches filters and compression
+ * itself and select and filter do nothing.
+ */
+typedef enum
+{
+    CODEC_STAGE_READ,
+    CODEC_STAGE_INFLATE,
+    CODEC_STAGE_UNFILTER,
+    CODEC_STAGE_EMBED,
+    CODEC_STAGE_SELECT,
+    CODEC_STAGE_FILTER,
+    CODEC_STAGE_DEFLATE,
+    CODEC_STAGE_WRITE,
+    CODEC_STAGE_COUNT
+
+} codec_stage;
+
+/**
+ * @brief Measurements of one stage of a job
+ *
+ * m_bytes_in and m_bytes_out are the buffer bytes held by the job before and
+ * after the stage, except for read (bytes read from file) and write (bytes written).
+ * m_peak_bytes adds everything allocated during the stage to m_bytes_in.
+ */
+typedef struct
+{
+    double m_seconds;
+    unsigned long int m_bytes_in;
+    unsigned long int m_bytes_out;
+    unsigned long int m_peak_bytes;
+
+} codec_stage_stats;
+
+/**
+ * @brief State of a single image passing through the stages
+ *
+ * Every stage frees the buffers of the previous stage,
+ * so a job only holds one image representation at a time.
+ * m_payload_name is read in the read stage instead of m_hidden_data.
+ * m_compress compresses the payload if it shrinks, see payload_compress.
+ * m_key encrypts the payload, see payload_encrypt.
+ * m_payload_flags are the PAYLOAD_FLAG_ bits written or read.
+ * m_scatter embeds the payload in rows in that order, see row_scatter.h.
+ * m_chunks are the input chunks an encoded image carries over.
+ * m_index_band_rows, if not 0, writes a seek index, see seek_index.
+ * m_decoded_rows are the rows a decode inflates and unfilters.
+ * m_cache maps carrier pixels and filter types on a hit, see carrier_cache.h.
+ * m_carrier is a shared carrier encoded into instead of m_input_name.
+ * m_private_rows are the carrier rows the payload reaches.
+ * m_io holds input m_io_index read ahead and writes the output, see async_io.h.
+ * m_overlap_rows runs whole-image stages on two threads, see row_overlap.h.
+ * m_interlace is the output interlace method, or INTERLACE_METHOD_KEEP.
+ * m_pass_pool filters Adam7 passes in parallel.
+ * m_optimize trades encoding time for size, m_optimize_report says how.
+ * m_arena_pool lends the arena for all buffers, else m_arena or the heap.
+ * m_error is NULL until a stage fails.
+ */
+typedef struct codec_job
+{
+    const char *m_input_name;
+    const char *m_output_name;
+    const char *m_payload_name;
+    bool m_encode;
+
+    const unsigned char *m_hidden_data;
+    unsigned char *m_owned_hidden_data;
+    uint32_t m_hidden_data_len;
+    bool m_compress;
+    const unsigned char *m_key;
+    uint32_t m_payload_flags;
+    const row_scatter *m_scatter;
+
+    IHDR_chunk m_ihdr;
+    seek_index m_seek_index;
+    png_chunk_index m_chunks;
+    uint32_t m_index_band_rows;
+    uint32_t m_decoded_rows;
+
+    carrier_cache *m_cache;
+    carrier_cache_key m_cache_key;
+    carrier_cache_mapping m_cache_mapping;
+    const unsigned char *m_carrier_filter_types;
+    bool m_cache_hit;
+
+    const struct codec_carrier *m_carrier;
+    uint32_t m_private_rows;
+
+    async_io *m_io;
+    size_t m_io_index;
+
+    bool m_overlap_rows;
+
+    int m_interlace;
+    thread_pool *m_pass_pool;
+
+    unsigned char *m_compressed_data;
+    unsigned long int m_compressed_data_len;
+
+    unsigned char *m_uncompressed_data;
+    unsigned long int m_uncompressed_data_len;
+
+    RGBA_pixel **m_image;
+
+    unsigned char *m_filter_types;
+
+    unsigned char *m_filtered_data;
+    unsigned long int m_filtered_data_len;
+
+    unsigned char *m_decoded_data;
+    uint32_t m_decoded_data_len;
+
+    png_optimize_mode m_optimize;
+    png_optimize_report m_optimize_report;
+
+    double m_seconds;
+    unsigned long int m_bytes_in;
+    unsigned long int m_bytes_out;
+    codec_stage_stats m_stats[CODEC_STAGE_COUNT];
+
+    image_arena *m_arena;
+    image_arena_pool *m_arena_pool;
+
+    const char *m_error;
+
+} codec_job;
+
+/**
+ * @brief Carrier decoded once and shared read-only by several encode jobs
+ *
+ * m_job holds the carrier pixels and the filter types picked for them,
+ * m_filtered_data the carrier filtered with those types.
+ */
+typedef struct codec_carrier
+{
+    codec_job m_job;
+
+    unsigned char *m_filtered_data;
+    unsigned long int m_filtered_data_len;
+
+} codec_carrier;
+
+/**
+ * @brief Initialize job
+ *
+ * @param job Job to initialize
+ * @param input_name Path to input image
+ * @param output_name Path to output image or txt file
+ * @param encode True for encoding, false for decoding
+ */
+void codec_job_init(codec_job *job, const char *input_name, const char *output_name, const bool encode);
+
+/**
+ * @brief Run single stage of job
+ *
+ * Safe to call concurrently for different jobs.
+ *
+ * @param job Job to process
+ * @param stage Stage to run
+ * @return True if successful, false if this or an earlier stage failed
+ */
+bool codec_run_stage(codec_job *job, const codec_stage stage);
+
+/**
+ * @brief Run all stages of job in sequence
+ *
+ * @param job Job to process
+ * @return True if successful, false if not
+ */
+bool codec_run(codec_job *job);
+
+/**
+ * @brief Free every buffer still held by job
+ *
+ * @param job Job to release
+ */
+void codec_job_release(codec_job *job);
+
+/**
+ * @brief Decode carrier for jobs that share it
+ *
+ * Reads, inflates, unfilters, and filters the carrier once. Pixels come from
+ * cache if given, and band start rows are restricted the same way as jobs
+ * with index_band_rows do it, so shared filtered rows stay valid for them.
+ * On failure carrier->m_job.m_error says why; release the carrier either way.
+ *
+ * @param carrier Carrier to load
+ * @param input_name Path to carrier image
+ * @param cache Carrier cache, NULL for none
+ * @param index_band_rows Seek index band height of the jobs, 0 for none
+ * @return True if successful, false if not
+ */
+bool codec_carrier_load(codec_carrier *carrier, const char *input_name, carrier_cache *cache,
+                        const uint32_t index_band_rows);
+
+/**
+ * @brief Free every buffer held by carrier
+ *
+ * Jobs sharing the carrier must be released first.
+ *
+ * @param carrier Carrier to release
+ */
+void codec_carrier_release(codec_carrier *carrier);
+
+/**
+ * @brief Append statistics of job as one JSON line
+ *
+ * Lines of concurrent callers do not interleave.
+ *
+ * @param fp File to write to
+ * @param job Finished job
+ * @return True if successful, false if not
+ */
+bool codec_write_stats(FILE *fp, const codec_job *job);
 
 /**
  * @brief Function responsible for encoding
@@ -19,4 +250,29 @@ int encoding(program_inp input);
  */
 int decoding(program_inp input);
 
+/**
+ * @brief Encode data buffer in image and save the result
+ *
+ * Safe to call concurrently from different threads.
+ *
+ * @param input_name Path to input image
+ * @param output_name Path to output image
+ * @param hidden_data Buffer with data that will be encoded
+ * @param hidden_data_len Length of data buffer
+ * @return Program status
+ */
+int encode_image(const char *input_name, const char *output_name,
+                 const unsigned char *const hidden_data, const uint32_t hidden_data_len);
+
+/**
+ * @brief Decode data from image and save it in output file
+ *
+ * Safe to call concurrently from different threads.
+ *
+ * @param input_name Path to input image
+ * @param output_name Path to output file
+ * @return Program status
+ */
+int decode_image(const char *input_name, const char *output_name);
+
 #endif // ~ENC_DEC_H
@@ -0,0 +1,84 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+
+#include "../inc/program_input_parser.h"
+#include "../inc/payload_cipher.h"
+
+// Protocol
+#define DAEMON_PROTOCOL_MAGIC 0x53544732 // "STG2"
+#define DAEMON_MAX_MESSAGE_LENGTH 4096
+#define DAEMON_FD_COUNT 2
+#define DAEMON_LISTEN_BACKLOG 64
+
+// Request options
+#define DAEMON_OPTION_KEY 0x1
+#define DAEMON_OPTION_SCATTER 0x2
+#define DAEMON_OPTION_COMPRESS 0x4
+
+/**
+ * @brief Request sent from client to daemon
+ *
+ * Followed by m_payload_length payload bytes, m_input_name_length and
+ * m_output_name_length bytes of absolute paths. Input and output file
+ * descriptors travel with it as SCM_RIGHTS when m_fd_count is DAEMON_FD_COUNT,
+ * then the paths are only used in messages.
+ * m_options are DAEMON_OPTION_ bits, m_optimize a png_optimize_mode,
+ * m_index_band_rows and m_interlace are as in codec_job. m_key and m_scatter_key are read by the
+ * client and only used with DAEMON_OPTION_KEY and DAEMON_OPTION_SCATTER.
+ */
+typedef struct
+{
+    uint32_t m_magic;
+    uint32_t m_encode;
+    uint32_t m_fd_count;
+    uint32_t m_payload_length;
+    uint32_t m_input_name_length;
+    uint32_t m_output_name_length;
+    uint32_t m_options;
+    uint32_t m_optimize;
+    uint32_t m_index_band_rows;
+    int32_t m_interlace;
+    unsigned char m_key[PAYLOAD_KEY_LENGTH];
+    unsigned char m_scatter_key[PAYLOAD_KEY_LENGTH];
+
+} daemon_request;
+
+/**
+ * @brief Response sent from daemon to client
+ *
+ * Followed by m_message_length bytes of error message.
+ */
+typedef struct
+{
+    uint32_t m_magic;
+    uint32_t m_status;
+    uint32_t m_message_length;
+
+} daemon_response;
+
+/**
+ * @brief Serve encode/decode requests on Unix domain socket until SIGINT or SIGTERM
+ *
+ * Thread pool, image arenas and compression streams stay warm between requests.
+ *
+ * @param socket_path Path of socket to create
+ * @return Program status
+ */
+int run_daemon(const char *socket_path);
+
+/**
+ * @brief Forward parsed program input to a running daemon
+ *
+ * Input and output files are opened here and passed as file descriptors,
+ * so relative paths and permissions are those of the client. So are
+ * the key files.
+ *
+ * @param socket_path Path of daemon socket
+ * @param input Parsed program input
+ * @return Program status reported by daemon
+ */
+int run_client(const char *socket_path, const program_inp input);
+
+#endif // ~DAEMON_H
@@ -0,0 +1,229 @@
+#ifndef DEFLATE_BACKEND_H
+#define DEFLATE_BACKEND_H
+
+#include <stdbool.h>
+
+// Compression levels
+#define DEFLATE_LEVEL_DEFAULT (-1)
+#define DEFLATE_LEVEL_MAX 9
+
+// Match strategies, same values as zlib, other backends ignore them
+#define DEFLATE_STRATEGY_DEFAULT 0
+#define DEFLATE_STRATEGY_FILTERED 1
+#define DEFLATE_STRATEGY_RLE 3
+
+// Worst case bytes a full flush adds: empty stored block plus partial block padding
+#define DEFLATE_FLUSH_OVERHEAD 16
+
+// Shared libraries of optional backends, loaded on first use
+#define DEFLATE_LIBDEFLATE_LIBRARY "libdeflate.so.0"
+#define DEFLATE_ZLIB_NG_LIBRARY "libz-ng.so.2"
+
+// Name that picks the fastest available backend
+#define DEFLATE_BACKEND_AUTO "auto"
+
+/**
+ * @brief Known backends, in order of preference for DEFLATE_BACKEND_AUTO
+ */
+typedef enum
+{
+    DEFLATE_BACKEND_LIBDEFLATE,
+    DEFLATE_BACKEND_ZLIB_NG,
+    DEFLATE_BACKEND_ZLIB,
+    DEFLATE_BACKEND_COUNT
+
+} deflate_backend_id;
+
+/**
+ * @brief Whole-buffer zlib format codec
+ *
+ * All functions are safe to call concurrently. Per-thread state (warm zlib
+ * streams, libdeflate compressors) is kept and freed when the thread exits.
+ *
+ * m_inflate succeeds only if the stream ends within dest_length bytes,
+ * *out_length is set to the bytes produced.
+ * m_deflate gets the capacity in *dest_length and replaces it with the
+ * compressed size. m_max_level is the slowest, smallest level; for libdeflate
+ * it enables near-optimal (zopfli-class) parsing. m_has_strategies tells if the
+ * strategy argument has any effect.
+ */
+typedef struct
+{
+    const char *m_name;
+    int m_max_level;
+    bool m_has_strategies;
+
+    unsigned long int (*m_bound)(const unsigned long int length);
+
+    bool (*m_inflate)(const unsigned char *const src, const unsigned long int src_length,
+                      unsigned char *const dest, const unsigned long int dest_length, unsigned long int *out_length);
+
+    bool (*m_deflate)(const unsigned char *const src, const unsigned long int src_length,
+                      unsigned char *const dest, unsigned long int *dest_length, const int level, const int strategy);
+
+} deflate_backend;
+
+/**
+ * @brief Receiver of compressed output, see deflate_backend_deflate_drain
+ *
+ * @param context Caller data
+ * @param data Compressed bytes, valid until the function returns
+ * @param length Byte count
+ * @return True if successful, false stops the stream
+ */
+typedef bool (*deflate_backend_sink)(void *context, const unsigned char *const data, const unsigned long int length);
+
+/**
+ * @brief Get backend by id
+ *
+ * @param id Backend id
+ * @return Backend, NULL if it is not available on this system
+ */
+const deflate_backend *deflate_backend_get(const deflate_backend_id id);
+
+/**
+ * @brief Get backend used by compress_data and uncompress_data
+ *
+ * Defaults to the first available backend in order of preference.
+ *
+ * @return Backend, never NULL, zlib is always available
+ */
+const deflate_backend *deflate_backend_current();
+
+/**
+ * @brief Select backend used by compress_data and uncompress_data
+ *
+ * Must be called before worker threads start.
+ *
+ * @param name Backend name or DEFLATE_BACKEND_AUTO
+ * @return True if successful, false if the name is unknown or the backend not available
+ */
+bool deflate_backend_select(const char *name);
+
+/**
+ * @brief Get capacity deflate_backend_deflate_flushed needs
+ *
+ * @param length Input length
+ * @param flush_count Number of flush points
+ * @return Output capacity in bytes
+ */
+unsigned long int deflate_backend_flushed_bound(const unsigned long int length, const unsigned long int flush_count);
+
+/**
+ * @brief Deflate to zlib format with a full flush every flush_interval input bytes
+ *
+ * Always uses zlib, other backends cannot flush in the middle of a stream.
+ * The window is empty after a full flush, so deflate_backend_inflate_segment
+ * can start at every flush point without the data before it.
+ *
+ * @param src Input
+ * @param src_length Input length
+ * @param dest Output
+ * @param dest_length Capacity in, compressed size out
+ * @param level Compression level
+ * @param flush_interval Input bytes between flush points
+ * @param flush_offsets Outputs the stream offset after every flush point, one less than the number of intervals
+ * @return True if successful, false if not
+ */
+bool deflate_backend_deflate_flushed(const unsigned char *const src, const unsigned long int src_length,
+                                     unsigned char *const dest, unsigned long int *dest_length, const int level,
+                                     const unsigned long int flush_interval, unsigned long int *const flush_offsets);
+
+/**
+ * @brief Inflate raw deflate data between two flush points
+ *
+ * Succeeds only if dest_length bytes are produced. The zlib checksum is not
+ * part of a segment and is not checked.
+ *
+ * @param src Segment start, a flush point or the end of the zlib header
+ * @param src_length Bytes up to the next flush point or the end of the stream
+ * @param dest Output
+ * @param dest_length Exact uncompressed length of the segment
+ * @return True if successful, false if not
+ */
+bool deflate_backend_inflate_segment(const unsigned char *const src, const unsigned long int src_length,
+                                     unsigned char *const dest, const unsigned long int dest_length);
+
+/**
+ * @brief Start inflating a zlib stream piece by piece
+ *
+ * Always uses zlib, on the warm stream of the calling thread; the
+ * deflate_backend_inflate_next calls that follow must come from the same thread.
+ *
+ * @param src Compressed stream, or its first part, kept by caller until it is used up
+ * @param src_length Compressed length
+ * @return True if successful, false if not
+ */
+bool deflate_backend_inflate_start(const unsigned char *const src, const unsigned long int src_length);
+
+/**
+ * @brief Give the stream started by deflate_backend_inflate_start its next compressed part
+ *
+ * Only once the part before is used up, that is when deflate_backend_inflate_next
+ * stops short of filling dest before the end of the stream.
+ *
+ * @param src Compressed part, kept by caller until it is used up
+ * @param src_length Compressed part length
+ * @return True if successful, false if not
+ */
+bool deflate_backend_inflate_feed(const unsigned char *const src, const unsigned long int src_length);
+
+/**
+ * @brief Inflate next piece of the stream started by deflate_backend_inflate_start
+ *
+ * Fills dest completely unless the stream ends first or the compressed data
+ * given so far is used up; a stream cut short is seen as fewer bytes.
+ *
+ * @param dest Output
+ * @param dest_length Output capacity
+ * @param out_length Outputs the bytes produced
+ * @param is_end Outputs true once the end of the stream is reached
+ * @return True if successful, false if the stream is broken
+ */
+bool deflate_backend_inflate_next(unsigned char *const dest, const unsigned long int dest_length,
+                                  unsigned long int *out_length, bool *is_end);
+
+/**
+ * @brief Start deflating to zlib format piece by piece
+ *
+ * Always uses zlib, on the warm stream of the calling thread; the
+ * deflate_backend_deflate_next calls that follow must come from the same thread.
+ * Output is the same as one zlib m_deflate call over all pieces.
+ *
+ * @param dest Output, kept by caller until the last piece
+ * @param dest_length Output capacity, the zlib bound of all pieces together
+ * @param level Compression level
+ * @return True if successful, false if not
+ */
+bool deflate_backend_deflate_start(unsigned char *const dest, const unsigned long int dest_length, const int level);
+
+/**
+ * @brief Deflate next piece of the stream started by deflate_backend_deflate_start
+ *
+ * @param src Input piece
+ * @param src_length Input piece length
+ * @param is_last True for the last piece, which ends the stream
+ * @param dest_length Outputs the compressed size so far, final after the last piece
+ * @return True if successful, false if not
+ */
+bool deflate_backend_deflate_next(const unsigned char *const src, const unsigned long int src_length, const bool is_last,
+                                  unsigned long int *dest_length);
+
+/**
+ * @brief Deflate next piece of the stream started by deflate_backend_deflate_start, draining the output
+ *
+ * Output given to deflate_backend_deflate_start may be any size here: every
+ * time it is full, and once the stream ends, sink gets what was written and
+ * the output is used again from its start. Same stream as deflate_backend_deflate_next.
+ *
+ * @param src Input piece
+ * @param src_length Input piece length
+ * @param is_last True for the last piece, which ends the stream
+ * @param sink Receiver of the output
+ * @param context Passed to sink
+ * @return True if successful, false if not or if sink fails
+ */
+bool deflate_backend_deflate_drain(const unsigned char *const src, const unsigned long int src_length, const bool is_last,
+                                   deflate_backend_sink sink, void *context);
+
+#endif // ~DEFLATE_BACKEND_H
@@ -0,0 +1,268 @@
+#ifndef IMAGE_ARENA_H
+#define IMAGE_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "../inc/png_parser.h"
+
+// Configuration
+#define IMAGE_ARENA_ALIGNMENT 64
+#define IMAGE_ARENA_MAX_BLOCKS 32
+#define IMAGE_ARENA_MIN_BLOCK_SIZE (256 * 1024)
+
+// Blocks at least one huge page long are mapped with the page policy, smaller ones use malloc
+#define IMAGE_ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Page policy names
+#define IMAGE_ARENA_PAGES_NAME_SMALL "small"
+#define IMAGE_ARENA_PAGES_NAME_TRANSPARENT "thp"
+#define IMAGE_ARENA_PAGES_NAME_HUGETLB "hugetlb"
+
+// Node of blocks that are not bound to one
+#define IMAGE_ARENA_NO_NODE (-1)
+
+/**
+ * @brief Backing of large arena blocks
+ *
+ * IMAGE_ARENA_PAGES_SMALL keeps every block on malloc'd 4 KB pages.
+ * IMAGE_ARENA_PAGES_TRANSPARENT maps large blocks aligned to the huge page size
+ * and advises transparent huge pages for them.
+ * IMAGE_ARENA_PAGES_HUGETLB takes large blocks from the hugetlb pool, and falls back
+ * to transparent huge pages when the pool is empty.
+ */
+typedef enum
+{
+    IMAGE_ARENA_PAGES_SMALL,
+    IMAGE_ARENA_PAGES_TRANSPARENT,
+    IMAGE_ARENA_PAGES_HUGETLB,
+    IMAGE_ARENA_PAGES_COUNT
+
+} image_arena_page_policy;
+
+/**
+ * @brief Allocation counters
+ *
+ * m_alloc_* count every allocation served by arena,
+ * m_system_alloc_* count the blocks requested from the system.
+ * In steady state only the first pair grows.
+ * m_huge_page_bytes are system bytes on huge pages (hugetlb or advised THP),
+ * m_node_local_bytes system bytes bound to the NUMA node of the allocating thread.
+ */
+typedef struct
+{
+    unsigned long int m_alloc_count;
+    unsigned long int m_alloc_bytes;
+    unsigned long int m_system_alloc_count;
+    unsigned long int m_system_alloc_bytes;
+    unsigned long int m_huge_page_bytes;
+    unsigned long int m_node_local_bytes;
+    size_t m_peak_bytes;
+
+} image_arena_counters;
+
+/**
+ * @brief Bump allocator for all buffers of one image
+ *
+ * Memory is handed out linearly from m_blocks[0]. If it runs out, extra blocks
+ * are chained. Reset folds all blocks into one block of the high-water size,
+ * so the next image of the same dimensions needs no system allocation.
+ * Frees of single buffers are no-ops, memory is reclaimed by reset.
+ * Large blocks follow the page policy and, on NUMA systems, are bound to the
+ * node of the thread that allocates them; m_node is the node of the last one.
+ * m_huge_bytes is how much of the blocks currently held is on huge pages.
+ */
+typedef struct
+{
+    unsigned char *m_blocks[IMAGE_ARENA_MAX_BLOCKS];
+    size_t m_block_sizes[IMAGE_ARENA_MAX_BLOCKS];
+    bool m_block_mapped[IMAGE_ARENA_MAX_BLOCKS];
+    size_t m_block_count;
+    size_t m_used;
+    size_t m_used_total;
+    size_t m_huge_bytes;
+    int m_node;
+
+    image_arena_counters m_counters;
+
+} image_arena;
+
+/**
+ * @brief Set of idle arenas shared between jobs of a batch
+ *
+ * Acquire prefers an idle arena whose memory is on the node of the calling thread.
+ */
+typedef struct
+{
+    image_arena **m_idle;
+    size_t m_idle_count;
+    size_t m_capacity;
+    size_t m_created;
+
+    image_arena_counters m_counters;
+
+    pthread_mutex_t m_lock;
+
+} image_arena_pool;
+
+/**
+ * @brief Select backing of large blocks created from now on
+ *
+ * Must be called before worker threads start. Defaults to IMAGE_ARENA_PAGES_TRANSPARENT.
+ *
+ * @param name Policy name
+ * @return True if successful, false if the name is unknown
+ */
+bool image_arena_set_page_policy(const char *name);
+
+/**
+ * @brief Get name of current page policy
+ *
+ * @return Name
+ */
+const char *image_arena_page_policy_name();
+
+/**
+ * @brief Get NUMA node of the CPU the calling thread runs on
+ *
+ * @return Node, IMAGE_ARENA_NO_NODE if the system has only one
+ */
+int image_arena_current_node();
+
+/**
+ * @brief Create empty arena
+ *
+ * @return Pointer to arena, NULL if not successful
+ */
+image_arena *image_arena_create();
+
+/**
+ * @brief Free arena and all its memory
+ *
+ * @param arena Arena to destroy
+ */
+void image_arena_destroy(image_arena *arena);
+
+/**
+ * @brief Estimate bytes needed for all buffers of one image
+ *
+ * Covers compressed input, inflated data, pixels, row pointers,
+ * filtered data and compressed output, interlaced or not, and the
+ * pass rows of adam7.h.
+ *
+ * @param ihdr IHDR of the image
+ * @return Bytes
+ */
+size_t image_arena_size_for(const IHDR_chunk ihdr);
+
+/**
+ * @brief Make sure size bytes can be served without a system allocation
+ *
+ * Only grows while nothing is allocated, otherwise it is a no-op.
+ *
+ * @param arena Arena
+ * @param size Bytes
+ * @return True if successful, false if not
+ */
+bool image_arena_reserve(image_arena *arena, const size_t size);
+
+/**
+ * @brief Allocate aligned memory from arena
+ *
+ * @param arena Arena
+ * @param size Bytes
+ * @return Pointer to memory, NULL if not successful
+ */
+void *image_arena_alloc(image_arena *arena, const size_t size);
+
+/**
+ * @brief Check if pointer belongs to arena
+ *
+ * @param arena Arena
+ * @param ptr Pointer
+ * @return True if pointer is inside one of the arena blocks
+ */
+bool image_arena_owns(const image_arena *arena, const void *ptr);
+
+/**
+ * @brief Release every allocation at once, keeping the memory
+ *
+ * @param arena Arena
+ */
+void image_arena_reset(image_arena *arena);
+
+/**
+ * @brief Bind arena to calling thread
+ *
+ * image_alloc and image_free of this thread use the bound arena.
+ *
+ * @param arena Arena, NULL to unbind
+ */
+void image_arena_bind(image_arena *arena);
+
+/**
+ * @brief Get arena bound to calling thread
+ *
+ * @return Arena, NULL if none is bound
+ */
+image_arena *image_arena_bound();
+
+/**
+ * @brief Allocate image buffer from bound arena, or malloc if none is bound
+ *
+ * @param size Bytes
+ * @return Pointer to memory, NULL if not successful
+ */
+void *image_alloc(const size_t size);
+
+/**
+ * @brief Bytes requested through image_alloc by calling thread so far
+ *
+ * The difference over a section of code gives the buffer bytes it allocated.
+ *
+ * @return Bytes
+ */
+unsigned long int image_alloc_bytes();
+
+/**
+ * @brief Free image buffer. No-op for memory of the bound arena
+ *
+ * @param ptr Pointer from image_alloc
+ */
+void image_free(void *ptr);
+
+/**
+ * @brief Initialize arena pool
+ *
+ * @param pool Pool
+ * @return True if successful, false if not
+ */
+bool image_arena_pool_init(image_arena_pool *pool);
+
+/**
+ * @brief Take an idle arena, or create one if none is idle
+ *
+ * @param pool Pool
+ * @return Arena, NULL if not successful
+ */
+image_arena *image_arena_pool_acquire(image_arena_pool *pool);
+
+/**
+ * @brief Reset arena and return it to pool
+ *
+ * @param pool Pool
+ * @param arena Arena from image_arena_pool_acquire
+ */
+void image_arena_pool_release(image_arena_pool *pool, image_arena *arena);
+
+/**
+ * @brief Destroy all arenas of pool
+ *
+ * Counters of all arenas are summed into m_counters first.
+ *
+ * @param pool Pool
+ */
+void image_arena_pool_free(image_arena_pool *pool);
+
+#endif // ~IMAGE_ARENA_H
@@ -0,0 +1,62 @@
+#ifndef PAYLOAD_CIPHER_H
+#define PAYLOAD_CIPHER_H
+
+#include <stdbool.h>
+
+#include "stdint.h"
+
+// ChaCha20-Poly1305 (RFC 8439) sizes
+#define PAYLOAD_KEY_LENGTH 32
+#define PAYLOAD_NONCE_LENGTH 12
+#define PAYLOAD_TAG_LENGTH 16
+
+// Bytes an encrypted payload is longer than the plain one
+#define PAYLOAD_CIPHER_OVERHEAD (PAYLOAD_NONCE_LENGTH + PAYLOAD_TAG_LENGTH)
+
+// Shared library of the vectorized implementation, loaded on first use
+#define PAYLOAD_CIPHER_SODIUM_LIBRARY "libsodium.so.23"
+
+/**
+ * @brief Read key from file
+ *
+ * The file holds exactly PAYLOAD_KEY_LENGTH bytes, such as the first bytes of /dev/urandom.
+ *
+ * @param file_name Path to key file
+ * @param key Outputs the key, PAYLOAD_KEY_LENGTH bytes
+ * @return True if successful, false if the file cannot be read or has another length
+ */
+bool payload_read_key(const char *file_name, unsigned char *const key);
+
+/**
+ * @brief Encrypt and authenticate payload before it is embedded
+ *
+ * Result is a random nonce, the ciphertext, and the tag. flags are
+ * authenticated with it, so a decoder refuses a length header whose flags
+ * were changed. libsodium does the work when it is installed, with the
+ * ChaCha20 of the widest vector unit it finds; a portable implementation
+ * gives the same bytes otherwise. Safe to call concurrently.
+ *
+ * @param data Payload
+ * @param data_length Payload length
+ * @param key Key, PAYLOAD_KEY_LENGTH bytes
+ * @param flags PAYLOAD_FLAG_ bits the payload is embedded with, PAYLOAD_FLAG_ENCRYPTED included
+ * @param encrypted_length Outputs length of the result
+ * @return Encrypted payload, free with image_free, NULL on failure
+ */
+unsigned char *payload_encrypt(const unsigned char *const data, const uint32_t data_length,
+                               const unsigned char *const key, const uint32_t flags, uint32_t *encrypted_length);
+
+/**
+ * @brief Check and decrypt payload encrypted by payload_encrypt
+ *
+ * @param data Encrypted payload, as extracted from the image
+ * @param data_length Encrypted length
+ * @param key Key, PAYLOAD_KEY_LENGTH bytes
+ * @param flags PAYLOAD_FLAG_ bits read with the length
+ * @param decrypted_length Outputs length of the result, the '\0' appended included, as decode_data_rgba does
+ * @return Payload with '\0' appended, free with image_free, NULL if the key is wrong or the data changed
+ */
+unsigned char *payload_decrypt(const unsigned char *const data, const uint32_t data_length,
+                               const unsigned char *const key, const uint32_t flags, uint32_t *decrypted_length);
+
+#endif // ~PAYLOAD_CIPHER_H
@@ -0,0 +1,38 @@
+#ifndef PAYLOAD_COMPRESSION_H
+#define PAYLOAD_COMPRESSION_H
+
+#include <stdbool.h>
+
+#include "stdint.h"
+
+// Deflate expands at most this much, longer uncompressed lengths mean a broken payload
+#define PAYLOAD_COMPRESSION_MAX_RATIO 1032
+
+/**
+ * @brief Compress payload before it is embedded
+ *
+ * Result is the uncompressed length, HEADER_DATA_LEN bytes lowest first,
+ * followed by a zlib stream from the current deflate backend. Text shrinks
+ * to about half, so the payload reaches half the rows. The caller marks the
+ * embedded length header with PAYLOAD_FLAG_COMPRESSED.
+ *
+ * @param data Payload
+ * @param data_length Payload length
+ * @param compressed_length Outputs length of the result
+ * @return Compressed payload, free with image_free, NULL if it would not be shorter or on failure
+ */
+unsigned char *payload_compress(const unsigned char *const data, const uint32_t data_length,
+                                uint32_t *compressed_length);
+
+/**
+ * @brief Uncompress payload compressed by payload_compress
+ *
+ * @param data Compressed payload, as extracted from the image
+ * @param data_length Compressed length
+ * @param uncompressed_length Outputs length of the result, the '\0' appended included, as decode_data_rgba does
+ * @return Payload with '\0' appended, free with image_free, NULL if broken
+ */
+unsigned char *payload_uncompress(const unsigned char *const data, const uint32_t data_length,
+                                  uint32_t *uncompressed_length);
+
+#endif // ~PAYLOAD_COMPRESSION_H
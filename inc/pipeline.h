@@ -0,0 +1,36 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../inc/codec.h"
+
+// Defaults
+#define PIPELINE_DEFAULT_QUEUE_DEPTH 2
+
+/**
+ * @brief Called once per job after its last stage, from the writer thread
+ */
+typedef void (*pipeline_done_callback)(codec_job *job, void *context);
+
+/**
+ * @brief Run jobs through a staged pipeline
+ *
+ * Stages are read -> inflate -> pixels (unfilter, embed/extract, filter) -> deflate -> write.
+ * Every stage runs on its own threads and hands jobs over through bounded queues,
+ * so I/O and compression of different images overlap.
+ * A full queue blocks the stage before it, which bounds the number of images in flight
+ * to (queue_depth + workers) per stage.
+ *
+ * @param jobs Initialized jobs
+ * @param job_count Number of jobs
+ * @param queue_depth Capacity of every queue between stages, 0 for default
+ * @param on_done Callback invoked for every finished or failed job, may be NULL
+ * @param context Passed to on_done
+ * @return True if pipeline ran, false if it could not be started and no job was touched
+ */
+bool run_pipeline(codec_job *const jobs, const size_t job_count, size_t queue_depth,
+                  pipeline_done_callback on_done, void *context);
+
+#endif // ~PIPELINE_H
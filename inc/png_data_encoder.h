@@ -4,17 +4,30 @@
 #include "../inc/png_filtration.h"
 #include "stdbool.h"
 
+// Top bits of the length header flag a payload compressed by payload_compress or
+// encrypted by payload_encrypt (compressed first), the rest is the length.
+// The reserved bit is 0 and marks a later header format when set
+#define PAYLOAD_FLAG_COMPRESSED 0x80000000u
+#define PAYLOAD_FLAG_ENCRYPTED 0x40000000u
+#define PAYLOAD_FLAG_RESERVED 0x20000000u
+#define PAYLOAD_LENGTH_MASK 0x1FFFFFFFu
+
 /**
  * @brief Encode data with length data_length in image
  *
+ * Data goes in the lowest bit of every 8 bit sample or the lowest two of
+ * every 16 bit sample, so the image carries one bit per byte of its rows.
+ *
  * @param image Image to encode data in
  * @param ihdr Header of the image that is being used for encoding
  * @param data Buffer with data that will be encoded
  * @param data_length Returns length of data buffer
- * @return True if successful, false if not
+ * @param flags PAYLOAD_FLAG_ bits stored with the length, 0 for a plain payload
+ * @return True if successful, false if not, also for the rare lengths whose
+ * header reads as one of the first format
  */
 bool encode_data_rgba(RGBA_pixel **image, const IHDR_chunk ihdr,
-                      unsigned char *const data, uint32_t data_length);
+                      unsigned char *const data, uint32_t data_length, const uint32_t flags);
 
 /**
  * @brief Decode data from image
@@ -23,9 +36,83 @@ bool encode_data_rgba(RGBA_pixel **image, const IHDR_chunk ihdr,
  * @param ihdr Header of the image that is being used
  * @param data Buffer with data that will be filled
  * @param data_length Returns length of data buffer
+ * @param flags Returns PAYLOAD_FLAG_ bits stored with the length
  * @return True if successful, false if not
  */
 bool decode_data_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr,
-                      unsigned char **data, uint32_t *data_length);
+                      unsigned char **data, uint32_t *data_length, uint32_t *flags);
+
+/**
+ * @brief Tell why decode_data_rgba did not read the length header of image
+ *
+ * Headers of the first format repeat the low byte of the length in all four
+ * bytes. They are recognized and refused, as are headers of a later format.
+ *
+ * @param image Image decoding failed on
+ * @param ihdr Header of the image
+ * @return Message, ending in a newline
+ */
+const char *decode_data_error_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr);
+
+/**
+ * @brief Read length of data encoded in image
+ *
+ * Only the rows holding the length header need to be present,
+ * the length is checked against the full image described by ihdr.
+ *
+ * @param image Image to read length from
+ * @param ihdr Header of the full image
+ * @param data_length Returns length of data, without the '\0' decode_data_rgba appends or the flags
+ * @return True if successful, false if the length does not fit the image
+ */
+bool decode_data_length_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr, uint32_t *data_length);
+
+/**
+ * @brief Bytes image can carry
+ *
+ * @param ihdr Header of the image
+ * @return Capacity in bytes, the length header of encode_data_rgba included
+ */
+unsigned long int capacity_rgba(const IHDR_chunk ihdr);
+
+/**
+ * @brief Embed bytes in image as they are, without length header
+ *
+ * Same bit layout as encode_data_rgba, starting first_byte bytes into the image.
+ * Images that carry parts of a longer payload, such as frames, use this.
+ *
+ * @param image Image to embed data in
+ * @param ihdr Header of the image
+ * @param first_byte Position of the first byte in the image
+ * @param data Bytes to embed
+ * @param data_length Count of bytes
+ * @return True if successful, false if they do not fit
+ */
+bool embed_bytes_rgba(RGBA_pixel **image, const IHDR_chunk ihdr, const unsigned long int first_byte,
+                      const unsigned char *const data, const unsigned long int data_length);
+
+/**
+ * @brief Extract bytes embedded by embed_bytes_rgba
+ *
+ * @param image Image to extract data from
+ * @param ihdr Header of the image
+ * @param first_byte Position of the first byte in the image
+ * @param data Outputs the bytes
+ * @param data_length Count of bytes
+ * @return True if successful, false if the image does not hold that many
+ */
+bool extract_bytes_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr, const unsigned long int first_byte,
+                        unsigned char *const data, const unsigned long int data_length);
+
+/**
+ * @brief Count rows from the top of image that hold data of given length
+ *
+ * Decoding these rows alone gives the same result as decoding the full image.
+ *
+ * @param ihdr Header of the full image
+ * @param data_length Length of data, 0 for the length header alone
+ * @return Row count, at most the image height
+ */
+uint32_t data_rows_rgba(const IHDR_chunk ihdr, const uint32_t data_length);
 
 #endif // ~PNG_DATA_ENCODER_H
@@ -5,8 +5,22 @@
 
 #include "../inc/png_parser.h"
 
+// Defines of filters for filter method(0)
+#define PNG_FILTER_NONE 0
+#define PNG_FILTER_SUB 1
+#define PNG_FILTER_UP 2
+#define PNG_FILTER_AVERAGE 3
+#define PNG_FILTER_PAETH 4
+#define PNG_FILTER_COUNT 5
+
 /**
  * @brief Single RGBA pixel struct.
+ *
+ * Image arrays are rows of RGBA_pixel pointers, but a row holds
+ * png_row_size bytes of samples in PNG order, 16 bit samples big endian.
+ * Only 8 bit RGBA rows are arrays of this struct; functions below take any
+ * format png_is_supported accepts. Filtered buffers hold rows top to bottom,
+ * interlaced images go through adam7.h instead.
  */
 typedef struct
 {
@@ -17,18 +31,67 @@ typedef struct
 
 } RGBA_pixel;
 
+/**
+ * @brief Allocate image matrix of uninitialized rows
+ *
+ * Same layout as unfilter_rgba_png, release with free_rgba_png.
+ *
+ * @param ihdr IHDR of the image
+ * @param row_count Rows to allocate
+ * @return RGBA_pixel** 2D Image array, NULL if not successful
+ */
+RGBA_pixel **alloc_rgba_png(const IHDR_chunk ihdr, const uint32_t row_count);
+
 /**
  * @brief Produce image matrix from filtered buffer
  *
+ * Rows are stored contiguously, release with free_rgba_png.
+ *
  * @param filtered_buffer Sequential input buffer with filtered image
  * @param ihdr IHDR of the filtered image
- * @return RGBA_pixel** 2D Image array
+ * @return RGBA_pixel** 2D Image array, NULL if not successful
  */
 RGBA_pixel **unfilter_rgba_png(const unsigned char *const filtered_buffer, const IHDR_chunk ihdr);
 
+/**
+ * @brief Choose filter type of every row by the minimum sum of absolute differences heuristic
+ *
+ * @param ihdr IHDR of the unfiltered image
+ * @param unfiltered_image 2D Image array
+ * @param filter_types Outputs one filter type per row, ihdr.m_height bytes
+ * @return True if successful, false if not
+ */
+bool select_rgba_png_filters(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image, unsigned char *const filter_types);
+
+/**
+ * @brief Produce filtered image buffer using given filter type per row
+ *
+ * @param ihdr IHDR of the unfiltered image
+ * @param unfiltered_image 2D Image array
+ * @param filter_types One filter type per row, from select_rgba_png_filters
+ * @param length Outputs the length of the filtered buffer
+ * @return Filtered image buffer, NULL if not successful
+ */
+unsigned char *apply_rgba_png_filters(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image,
+                                      const unsigned char *const filter_types, unsigned long int *const length);
+
+/**
+ * @brief Apply given filter type per row into caller owned buffer
+ *
+ * @param ihdr IHDR of the unfiltered image
+ * @param unfiltered_image 2D Image array
+ * @param filter_types One filter type per row
+ * @param filtered_buffer Outputs filtered image, height * (png_row_size + 1) bytes
+ * @return True if successful, false if a filter type is unknown
+ */
+bool apply_rgba_png_filters_to(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image,
+                               const unsigned char *const filter_types, unsigned char *const filtered_buffer);
+
 /**
  * @brief Produce filtered image buffer, ready to get compressed
  *
+ * Selects and applies filters in one call.
+ *
  * @param ihdr IHDR of the unfiltered image
  * @param unfiltered_image 2D Image array
  * @param length Outputs the length of the filtered buffer
@@ -36,4 +99,49 @@ RGBA_pixel **unfilter_rgba_png(const unsigned char *const filtered_buffer, const
  */
 unsigned char *filter_rgba_png(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image, unsigned long int *const length);
 
+/**
+ * @brief Reverse filter of one row
+ *
+ * @param filtered_row Filter type byte followed by the filtered row
+ * @param previous_row Unfiltered row above, zeros for the first row
+ * @param row Outputs the unfiltered row
+ * @param ihdr IHDR of a supported image
+ * @return True if successful, false if the filter type is unknown
+ */
+bool unfilter_rgba_row(const unsigned char *const filtered_row, const RGBA_pixel *const previous_row,
+                       RGBA_pixel *const row, const IHDR_chunk ihdr);
+
+/**
+ * @brief Select filter of one row by the same heuristic as select_rgba_png_filters and apply it
+ *
+ * @param row Unfiltered row
+ * @param previous_row Unfiltered row above, zeros for the first row
+ * @param scratch Storage for the heuristic, png_row_size + 1 bytes
+ * @param filtered_row Outputs filter type byte followed by the filtered row
+ * @param ihdr IHDR of a supported image
+ * @return True if successful, false if not
+ */
+bool filter_rgba_row(const RGBA_pixel *const row, const RGBA_pixel *const previous_row, unsigned char *const scratch,
+                     unsigned char *const filtered_row, const IHDR_chunk ihdr);
+
+/**
+ * @brief Apply given filter to one row
+ *
+ * @param row Unfiltered row
+ * @param previous_row Unfiltered row above, zeros for the first row
+ * @param filter_type Filter to apply
+ * @param filtered_row Outputs filter type byte followed by the filtered row
+ * @param ihdr IHDR of a supported image
+ * @return True if successful, false if the filter type is unknown
+ */
+bool apply_rgba_row_filter(const RGBA_pixel *const row, const RGBA_pixel *const previous_row,
+                           const unsigned char filter_type, unsigned char *const filtered_row, const IHDR_chunk ihdr);
+
+/**
+ * @brief Free image matrix produced by unfilter_rgba_png
+ *
+ * @param image 2D Image array
+ */
+void free_rgba_png(RGBA_pixel **image);
+
 #endif // ~PNG_FILTRATION_H
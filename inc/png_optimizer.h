@@ -0,0 +1,87 @@
+#ifndef PNG_OPTIMIZER_H
+#define PNG_OPTIMIZER_H
+
+#include <stdbool.h>
+
+#include "stdint.h"
+
+#include "../inc/png_parser.h"
+#include "../inc/png_filtration.h"
+
+// Mode names
+#define PNG_OPTIMIZE_NAME_SEARCH "search"
+#define PNG_OPTIMIZE_NAME_EXHAUSTIVE "exhaustive"
+
+// Filter strategy that keeps the per row choice of select_rgba_png_filters
+#define PNG_OPTIMIZE_FILTER_HEURISTIC PNG_FILTER_COUNT
+
+/**
+ * @brief How hard the output is compressed
+ *
+ * PNG_OPTIMIZE_SEARCH tries the heuristic and every fixed filter with every
+ * available backend at DEFLATE_LEVEL_MAX (and every strategy zlib offers).
+ * PNG_OPTIMIZE_EXHAUSTIVE does the same at the maximum level of each backend,
+ * which for libdeflate is its near-optimal parser.
+ */
+typedef enum
+{
+    PNG_OPTIMIZE_OFF,
+    PNG_OPTIMIZE_SEARCH,
+    PNG_OPTIMIZE_EXHAUSTIVE
+
+} png_optimize_mode;
+
+/**
+ * @brief Outcome of one optimization
+ *
+ * m_baseline_length is the size the default path (heuristic filters, current
+ * backend, default level) produces, m_best_length the size kept.
+ * m_filter is a PNG_FILTER_* value or PNG_OPTIMIZE_FILTER_HEURISTIC.
+ */
+typedef struct
+{
+    unsigned long int m_baseline_length;
+    unsigned long int m_best_length;
+    unsigned char m_filter;
+    const char *m_backend_name;
+    int m_level;
+    int m_strategy;
+    unsigned int m_candidates;
+
+} png_optimize_report;
+
+/**
+ * @brief Get printable name of mode
+ *
+ * @param mode Optimization mode
+ * @return Name
+ */
+const char *png_optimize_mode_name(const png_optimize_mode mode);
+
+/**
+ * @brief Get printable name of filter strategy
+ *
+ * @param filter PNG_FILTER_* value or PNG_OPTIMIZE_FILTER_HEURISTIC
+ * @return Name
+ */
+const char *png_optimize_filter_name(const unsigned char filter);
+
+/**
+ * @brief Filter and compress image, keeping the smallest stream found
+ *
+ * Replaces filter_rgba_png followed by compress_data. The default path is one
+ * of the candidates, so the result is never larger than it.
+ * Buffers are reused between candidates, memory stays at one filtered image
+ * and two compressed bounds whatever the number of candidates.
+ *
+ * @param ihdr IHDR of the unfiltered image
+ * @param unfiltered_image 2D Image array
+ * @param mode Search mode, not PNG_OPTIMIZE_OFF
+ * @param length Outputs the length of the compressed buffer
+ * @param report Outputs what was tried and kept
+ * @return Compressed buffer from image_alloc, NULL if not successful
+ */
+unsigned char *optimize_rgba_png(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image, const png_optimize_mode mode,
+                                 unsigned long int *const length, png_optimize_report *const report);
+
+#endif // ~PNG_OPTIMIZER_H
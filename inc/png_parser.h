@@ -2,6 +2,7 @@
 #define PNG_PARSER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "stdint.h"
 
@@ -9,6 +10,16 @@
 #define PNG_PARSER_RESET true
 #define PNG_PARSER_NEXT false
 
+// File name standing for standard input or output
+#define PNG_STANDARD_STREAM_NAME "-"
+
+// Bytes read at once from streams that cannot seek
+#define PNG_STREAM_READ_BLOCK_SIZE (1024 * 1024)
+
+// Whole image writing
+#define PNG_MAX_CHUNK_LENGTH 0x7fffffffUL // Largest chunk data the format allows
+#define PNG_OUTPUT_FILE_MODE 0644
+
 // Signature configurations
 #define HEADER_DATA_LEN 4
 #define HEADER_TYPE_LEN 4
@@ -24,16 +35,60 @@ static const unsigned char sRGB_SIGNATURE[TYPE_SIGNATURE_LENGTH] = {0x73, 0x52,
 static const unsigned char IEND_SIGNATURE[TYPE_SIGNATURE_LENGTH] = {0x49, 0x45, 0x4e, 0x44};
 static const unsigned char IEND_CRC_32[FOOTER_LENGTH] = {0xae, 0x42, 0x60, 0x82};
 
+#define IHDR_DATA_LENGTH 13
+
+// Animation chunks of APNG: control, frame control, frame data
+static const unsigned char acTL_SIGNATURE[TYPE_SIGNATURE_LENGTH] = {0x61, 0x63, 0x54, 0x4c};
+static const unsigned char fcTL_SIGNATURE[TYPE_SIGNATURE_LENGTH] = {0x66, 0x63, 0x54, 0x4c};
+static const unsigned char fdAT_SIGNATURE[TYPE_SIGNATURE_LENGTH] = {0x66, 0x64, 0x41, 0x54};
+
+#define acTL_DATA_LENGTH 8
+#define fcTL_DATA_LENGTH 26
+#define APNG_SEQUENCE_LENGTH 4 // Sequence number leading fcTL and fdAT data
+
+// Private seek index chunk: ancillary, private, not safe to copy since it describes IDAT
+static const unsigned char stIX_SIGNATURE[TYPE_SIGNATURE_LENGTH] = {0x73, 0x74, 0x49, 0x58};
+
+// Private payload chunk of the chunk channel: ancillary, private, not safe to copy
+static const unsigned char stPL_SIGNATURE[TYPE_SIGNATURE_LENGTH] = {0x73, 0x74, 0x50, 0x4c};
+
+// Seek index format
+#define SEEK_INDEX_VERSION 1
+#define SEEK_INDEX_WINDOW_EMPTY 0            // Full flush at every point, nothing to preload
+#define SEEK_INDEX_FLAG_INDEPENDENT_ROWS 0x01 // First row of every band uses None or Sub
+#define SEEK_INDEX_HEADER_LENGTH 12
+#define SEEK_INDEX_POINT_LENGTH 8
+
 // Default initialization values
 #define NULL_SIGNATURE "NULL"
 #define OUTSIDE_CHUNK_DEFAULT_INIT_ARGS 0, NULL_SIGNATURE, 0, 0
 
 // Constants
 #define RGBA_PIXEL_SIZE 4
+#define PNG_MAX_PIXEL_SIZE 8 // RGBA at 16 bits
 
 // Color types
+#define COLOR_TYPE_GRAY 0
+#define COLOR_TYPE_RGB 2
+#define COLOR_TYPE_GRAY_ALPHA 4
 #define COLOR_TYPE_RGBA 6
 
+// Supported bit depths
+#define BIT_DEPTH_8 8
+#define BIT_DEPTH_16 16
+
+// Interlace methods
+#define INTERLACE_METHOD_NONE 0
+#define INTERLACE_METHOD_ADAM7 1
+#define INTERLACE_METHOD_KEEP -1 // Never in files: output is interlaced the way its input was
+
+// Adam7 passes: first column and row of every pass, then the steps between its pixels
+#define ADAM7_PASS_COUNT 7
+static const unsigned char ADAM7_START_X[ADAM7_PASS_COUNT] = {0, 4, 0, 2, 0, 1, 0};
+static const unsigned char ADAM7_START_Y[ADAM7_PASS_COUNT] = {0, 0, 4, 0, 2, 0, 1};
+static const unsigned char ADAM7_STEP_X[ADAM7_PASS_COUNT] = {8, 8, 4, 4, 2, 2, 1};
+static const unsigned char ADAM7_STEP_Y[ADAM7_PASS_COUNT] = {8, 8, 8, 4, 4, 2, 2};
+
 /**
  * @brief Structure that hold ouside chunk data
  *
@@ -79,18 +134,144 @@ typedef struct
 
 } IDAT_chunk;
 
+/**
+ * @brief Entry point into the compressed stream
+ *
+ * m_offset is relative to the start of the IDAT data of all chunks joined,
+ * raw deflate data of the band starting at m_row begins there.
+ */
+typedef struct
+{
+    uint32_t m_row;
+    uint32_t m_offset;
+
+} seek_index_point;
+
+/**
+ * @brief Content of the stIX chunk
+ *
+ * m_point_count is 0 if the image has no index. Points are sorted, the first
+ * one is row 0 right after the zlib header. m_points comes from image_alloc.
+ */
+typedef struct
+{
+    unsigned char m_window;
+    unsigned char m_flags;
+    uint32_t m_band_rows;
+    uint32_t m_point_count;
+    seek_index_point *m_points;
+
+} seek_index;
+
+/**
+ * @brief Chunk of the input written again unchanged
+ *
+ * m_offset is where the whole chunk starts, length field first, in the input
+ * file or in m_data of its png_chunk_index. m_length counts header, data, and
+ * CRC.
+ */
+typedef struct
+{
+    long int m_offset;
+    uint32_t m_length;
+    bool m_is_after_data;
+} png_chunk_span;
+
+/**
+ * @brief Chunks an encoded image carries over from its input, in input order
+ *
+ * Chunks of an input file stay there: m_file_name is set and they are copied
+ * file to file by the kernel when the image is written. Inputs parsed from
+ * memory keep their chunks in m_data. m_spans and m_data come from
+ * image_alloc, m_count is 0 if there is nothing to carry over.
+ */
+typedef struct
+{
+    png_chunk_span *m_spans;
+    uint32_t m_count;
+    const char *m_file_name;
+    unsigned char *m_data;
+} png_chunk_index;
+
+/**
+ * @brief Check if image format can be worked on
+ *
+ * Gray, gray with alpha, RGB, and RGBA at 8 or 16 bits per sample, not
+ * interlaced or Adam7 interlaced.
+ *
+ * @param ihdr IHDR of the image
+ * @return True if supported, false if not
+ */
+bool png_is_supported(const IHDR_chunk ihdr);
+
+/**
+ * @brief Bytes of one pixel
+ *
+ * @param ihdr IHDR of a supported image
+ * @return Pixel size, 0 if the format is not supported
+ */
+uint32_t png_pixel_size(const IHDR_chunk ihdr);
+
+/**
+ * @brief Bytes of one unfiltered row, without the filter type byte
+ *
+ * @param ihdr IHDR of a supported image
+ * @return Row size, 0 if the format is not supported
+ */
+size_t png_row_size(const IHDR_chunk ihdr);
+
+/**
+ * @brief Describe one Adam7 pass as an image of its own
+ *
+ * @param ihdr IHDR of the interlaced image
+ * @param pass Pass index, 0 to ADAM7_PASS_COUNT - 1
+ * @return IHDR of the pass, not interlaced; width or height is 0 if the pass is empty
+ */
+IHDR_chunk png_pass_ihdr(const IHDR_chunk ihdr, const int pass);
+
+/**
+ * @brief Bytes of the inflated image: every row with its filter type byte, pass after pass if interlaced
+ *
+ * @param ihdr IHDR of a supported image
+ * @return Filtered length
+ */
+unsigned long int png_filtered_length(const IHDR_chunk ihdr);
+
+/**
+ * @brief Check if file name stands for standard input or output
+ *
+ * @param file_name File name
+ * @return True if it is PNG_STANDARD_STREAM_NAME
+ */
+bool png_is_standard_stream(const char *file_name);
+
 /**
  * @brief Open file (fopen)
  *
- * @param _FileName Path to png file
+ * PNG_STANDARD_STREAM_NAME opens stdin for reading and stdout for writing.
+ * Chunks are found by seeking, so input that cannot seek (pipes, sockets)
+ * is read whole in PNG_STREAM_READ_BLOCK_SIZE blocks and parsed from memory.
+ *
+ * @param _FileName Path to png file, kept by caller while a png_chunk_index read from it is used
  * @param _Mode fopen mode
  * @return True if successful, false if not
  */
 bool png_open(const char *_FileName, const char *_Mode);
 
+/**
+ * @brief Open whole png file already in memory for reading
+ *
+ * @param data File content, kept by caller until png_close
+ * @param length Content length
+ * @return True if successful, false if not
+ */
+bool png_open_memory(const unsigned char *data, const size_t length);
+
 /**
  * @brief Close file (fclose)
  *
+ * Standard streams are flushed, not closed.
+ *
  * @return True if successful, false if not
  */
 bool png_close();
@@ -112,6 +293,26 @@ IHDR_chunk read_png_IHDR();
  */
 IDAT_chunk read_png_IDAT(const bool is_reset);
 
+/**
+ * @brief Reads chunk of any or given type
+ *
+ * @param chunk_signature Type to look for, NULL for whichever chunk comes next
+ * @param is_reset If PNG_PARSER_RESET is given it starts from the first
+ * chunk, else if PNG_PARSER_NEXT is given from the chunk after the last read one
+ * @return outside_chunk, m_type is NULL_SIGNATURE if there is none
+ */
+outside_chunk read_png_chunk(const unsigned char *const chunk_signature, const bool is_reset);
+
+/**
+ * @brief Read data of chunk into buffer
+ *
+ * @param chunk Chunk from read_png_chunk
+ * @param skip Leading data bytes not to read
+ * @param dest Outputs m_data_length - skip bytes
+ * @return True if successful, false if not
+ */
+bool read_png_chunk_data(const outside_chunk chunk, const uint32_t skip, unsigned char *const dest);
+
 /**
  * @brief Extract raw data from IDAT chunk
  *
@@ -129,9 +330,45 @@ unsigned char *extract_IDAT_raw(const long int address, const uint32_t length);
  */
 unsigned char *extract_IDAT_raw_all(unsigned long int *total_compressed_data_length);
 
+/**
+ * @brief Reads stIX chunk
+ *
+ * Images without the chunk, or with one that does not match ihdr, give an
+ * empty index.
+ *
+ * @param ihdr IHDR of the image
+ * @param compressed_data_length Length of all IDAT data
+ * @return seek_index
+ */
+seek_index read_png_seek_index(const IHDR_chunk ihdr, const unsigned long int compressed_data_length);
+
+/**
+ * @brief Index the chunks an encoded image carries over
+ *
+ * Every chunk but IHDR, IDAT, IEND, and stIX, which the encoder writes itself,
+ * and the animation chunks, which the APNG encoder writes itself. Ancillary chunks
+ * that are not safe to copy are kept only if registered (sRGB, iCCP, gAMA, and
+ * the like), unknown ones may describe the old pixels and are dropped.
+ *
+ * @return png_chunk_index, empty if there are no such chunks or they cannot be read
+ */
+png_chunk_index read_png_chunk_index();
+
+/**
+ * @brief Index the same chunks as read_png_chunk_index, copied to memory
+ *
+ * For outputs written after the input is gone, or written over it.
+ *
+ * @return png_chunk_index with m_data set, empty if there are no such chunks or they cannot be read
+ */
+png_chunk_index read_png_chunk_copies();
+
 /**
  * @brief Uncompress data
  *
+ * Uses the backend chosen with deflate_backend_select. Fails if the
+ * stream ends before every row of the image.
+ *
  * @param ihdr IHDR data
  * @param compressed_data_buffer Pointer to source of compressed data
  * @param compressed_data_length Length of compressed data
@@ -141,9 +378,29 @@ unsigned char *extract_IDAT_raw_all(unsigned long int *total_compressed_data_len
 unsigned char *uncompress_data(const IHDR_chunk ihdr, const unsigned char *const compressed_data_buffer,
                                const unsigned long int compressed_data_length, unsigned long int *uncompressed_data_length);
 
+/**
+ * @brief Uncompress only the bands holding the first rows
+ *
+ * Bands are entered through the seek index and inflated on their own.
+ * The zlib checksum covers the whole stream and is not verified.
+ *
+ * @param ihdr IHDR data
+ * @param compressed_data_buffer Pointer to source of compressed data
+ * @param compressed_data_length Length of compressed data
+ * @param index Seek index of the image, not empty
+ * @param row_count Rows needed from the top of the image
+ * @param uncompressed_data_length Gives length of uncompressed data, whole bands so at least row_count rows
+ * @return Pointer to uncompressed data buffer
+ */
+unsigned char *uncompress_data_rows(const IHDR_chunk ihdr, const unsigned char *const compressed_data_buffer,
+                                    const unsigned long int compressed_data_length, const seek_index *const index,
+                                    const uint32_t row_count, unsigned long int *uncompressed_data_length);
+
 /**
  * @brief Compresses data
  *
+ * Uses the backend chosen with deflate_backend_select, at its default level.
+ *
  * @param compressed_data_length Gives length of compressed data
  * @param uncompressed_data_buffer Pointer to source of uncompressed data
  * @param uncompressed_data_length Length of uncompressed data
@@ -152,6 +409,21 @@ unsigned char *uncompress_data(const IHDR_chunk ihdr, const unsigned char *const
 unsigned char *compress_data(unsigned long int *compressed_data_length, const unsigned char *const uncompressed_data_buffer,
                              const unsigned long int uncompressed_data_length);
 
+/**
+ * @brief Compresses data with a flush point every band_rows rows
+ *
+ * Always uses zlib, see deflate_backend_deflate_flushed.
+ *
+ * @param compressed_data_length Gives length of compressed data
+ * @param uncompressed_data_buffer Filtered image
+ * @param ihdr IHDR of the image
+ * @param band_rows Rows between flush points
+ * @param index Outputs the flush points, m_flags is left to the caller
+ * @return Pointer to compressed data buffer
+ */
+unsigned char *compress_data_indexed(unsigned long int *compressed_data_length, const unsigned char *const uncompressed_data_buffer,
+                                     const IHDR_chunk ihdr, const uint32_t band_rows, seek_index *const index);
+
 /**
  * @brief Write PNG IHDR chunk at current file pointer state
  *
@@ -169,6 +441,14 @@ bool write_png_IHDR(IHDR_chunk ihdr);
  */
 bool write_png_IDAT(const unsigned char *const buffer, const unsigned long int buf_length);
 
+/**
+ * @brief Write stIX chunk at current file pointer state
+ *
+ * @param index Seek index, not empty
+ * @return True if successful, false if not
+ */
+bool write_png_seek_index(const seek_index *const index);
+
 /**
  * @brief Write PNG IEND chunk at current file pointer state
  *
@@ -176,4 +456,129 @@ bool write_png_IDAT(const unsigned char *const buffer, const unsigned long int b
  */
 bool write_png_IEND();
 
+/**
+ * @brief Write whole image with one vectored write
+ *
+ * Signature, IHDR, seek index, and IDAT header are serialized into small
+ * buffers, the compressed data is written from where it is, and the file is
+ * preallocated to its final size first. Carried chunks go before and after
+ * the IDAT as they were in the input; chunks still in the input file are
+ * copied by the kernel (copy_file_range, or sendfile to pipes) between the
+ * vectored writes. Does not use the open image.
+ *
+ * @param file_name Path to png file or PNG_STANDARD_STREAM_NAME for stdout
+ * @param ihdr IHDR of image
+ * @param index Seek index, NULL or empty writes none
+ * @param chunks Chunks carried over, NULL or empty writes none
+ * @param data Compressed data, written as one IDAT
+ * @param data_length Compressed data length, up to PNG_MAX_CHUNK_LENGTH
+ * @return True if successful, false if not
+ */
+bool png_write_image(const char *file_name, const IHDR_chunk ihdr, const seek_index *const index,
+                     const png_chunk_index *const chunks, const unsigned char *const data,
+                     const unsigned long int data_length);
+
+/**
+ * @brief Copy the open image with one chunk added before IEND
+ *
+ * Chunks of the type added are left out, every other chunk is copied as it
+ * is, by the kernel if the image is read from a file; no pixel data is
+ * inflated. Output is written the way png_write_image writes it.
+ *
+ * @param file_name Path to png file or PNG_STANDARD_STREAM_NAME for stdout
+ * @param chunk_signature Type of the chunk added
+ * @param data Chunk data
+ * @param data_length Chunk data length, up to PNG_MAX_CHUNK_LENGTH
+ * @return True if successful, false if not
+ */
+bool png_splice_chunk(const char *file_name, const unsigned char *const chunk_signature,
+                      const unsigned char *const data, const unsigned long int data_length);
+
+/**
+ * @brief Serialize whole image into memory
+ *
+ * Same layout as png_write_image, carried chunks still in the input file are
+ * read into the image.
+ *
+ * @param ihdr IHDR of image
+ * @param index Seek index, NULL or empty writes none
+ * @param chunks Chunks carried over, NULL or empty writes none
+ * @param data Compressed data, written as one IDAT
+ * @param data_length Compressed data length, up to PNG_MAX_CHUNK_LENGTH
+ * @param length Outputs image length
+ * @return Image from malloc, to free by caller, NULL if not successful
+ */
+unsigned char *png_build_image(const IHDR_chunk ihdr, const seek_index *const index,
+                               const png_chunk_index *const chunks, const unsigned char *const data,
+                               const unsigned long int data_length, size_t *length);
+
+/**
+ * @brief Start writing image whose compressed data comes in pieces
+ *
+ * Signature and IHDR are written at once, IDAT chunks follow with
+ * png_stream_write_IDAT and png_stream_finish ends the image. Does not use
+ * the open image, so one image can be read while another is written.
+ *
+ * @param file_name Path to png file or PNG_STANDARD_STREAM_NAME for stdout
+ * @param ihdr IHDR of image
+ * @return File descriptor, -1 if not successful
+ */
+int png_stream_start(const char *file_name, const IHDR_chunk ihdr);
+
+/**
+ * @brief Write one IDAT chunk of image started with png_stream_start
+ *
+ * @param fd File descriptor from png_stream_start
+ * @param data Compressed data
+ * @param data_length Compressed data length, up to PNG_MAX_CHUNK_LENGTH
+ * @return True if successful, false if not
+ */
+bool png_stream_write_IDAT(const int fd, const unsigned char *const data, const unsigned long int data_length);
+
+/**
+ * @brief Write one chunk of any type of image started with png_stream_start
+ *
+ * @param fd File descriptor from png_stream_start
+ * @param chunk_signature Chunk type
+ * @param data Chunk data
+ * @param data_length Chunk data length, up to PNG_MAX_CHUNK_LENGTH
+ * @return True if successful, false if not
+ */
+bool png_stream_write_chunk(const int fd, const unsigned char *const chunk_signature, const unsigned char *const data,
+                            const unsigned long int data_length);
+
+/**
+ * @brief Write the carried chunks of one side of the data, of image started with png_stream_start
+ *
+ * @param fd File descriptor from png_stream_start
+ * @param chunks Chunks carried over, NULL or empty writes none
+ * @param is_after_data False for the chunks before the first IDAT, true for the ones after
+ * @return True if successful, false if not
+ */
+bool png_stream_write_chunks(const int fd, const png_chunk_index *const chunks, const bool is_after_data);
+
+/**
+ * @brief Write one fdAT chunk of image started with png_stream_start
+ *
+ * @param fd File descriptor from png_stream_start
+ * @param sequence Sequence number of the chunk
+ * @param data Compressed frame data, without sequence number
+ * @param data_length Compressed data length, up to PNG_MAX_CHUNK_LENGTH - APNG_SEQUENCE_LENGTH
+ * @return True if successful, false if not
+ */
+bool png_stream_write_fdAT(const int fd, const uint32_t sequence, const unsigned char *const data,
+                           const unsigned long int data_length);
+
+/**
+ * @brief End image started with png_stream_start
+ *
+ * IEND is written only if the image is complete; the file is closed unless
+ * it is stdout.
+ *
+ * @param fd File descriptor from png_stream_start
+ * @param is_complete False if writing gave up, the file is left without IEND
+ * @return True if the image is complete and written, false if not
+ */
+bool png_stream_finish(const int fd, const bool is_complete);
+
 #endif // ~PNG_PARSER_H
@@ -4,6 +4,10 @@
 
 // Boundaries
 #define PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH 255
+#define PROGRAM_INPUT_PARSER_MAX_INDEX_BAND_ROWS 65536
+#define PROGRAM_INPUT_PARSER_MAX_CACHE_MB (1024UL * 1024UL)
+#define PROGRAM_INPUT_PARSER_MAX_IMAGE_THREADS 2
+#define PROGRAM_INPUT_PARSER_MAX_BAND_ROWS 65536
 
 // Error codes
 #define PROGRAM_INPUT_PARSER_OK 0
@@ -16,6 +20,52 @@
  * m_encode is true for encode operation,
  * false for decode operation.
  * Defaults to decode
+ *
+ * m_batch_manifest is empty unless batch mode is requested,
+ * m_batch_pipeline selects the staged pipeline instead of the job pool
+ *
+ * m_daemon_socket is set when serving requests, m_client_socket when
+ * forwarding the request to a daemon; both are empty otherwise
+ *
+ * m_stats_name is the file per image statistics are appended to, empty if not requested
+ *
+ * m_backend_name selects the deflate backend, empty picks the fastest available
+ *
+ * m_optimize is a png_optimize_mode, PNG_OPTIMIZE_OFF (0) unless requested
+ *
+ * m_index_band_rows is the number of rows between seek index points written
+ * when encoding, 0 writes no index
+ *
+ * m_cache_directory holds the decoded carrier cache, empty if not requested;
+ * m_cache_max_mb caps its size
+ *
+ * m_fanout_manifest lists payload/output pairs encoded into m_input_name,
+ * empty unless fan-out is requested
+ *
+ * m_page_policy backs large image buffers, empty keeps the default
+ *
+ * m_prefetch_depth is the number of batch inputs read ahead and outputs written
+ * in the background, 0 if not requested; m_io_backend does that I/O, empty
+ * picks io_uring when available
+ *
+ * m_image_threads is the number of threads working on one single image, 1 unless requested
+ *
+ * m_band_rows is the number of rows an encoded image is streamed through at
+ * once, 0 works on the whole image
+ *
+ * m_interlace is the interlace method of encoded images, INTERLACE_METHOD_KEEP
+ * (-1) unless requested
+ *
+ * m_chunk_channel is true when the payload is encoded in a private chunk
+ * instead of the pixels
+ *
+ * m_compress is true when the payload is compressed before it is encoded in the pixels
+ *
+ * m_key_name is the file holding the key payloads are encrypted and decrypted
+ * with, empty if they are not
+ *
+ * m_scatter_name is the file holding the key the rows payloads are encoded in
+ * are ordered by, empty if they go in top to bottom
  */
 typedef struct
 {
@@ -23,6 +73,27 @@ typedef struct
     const char *m_output_name;
     bool m_encode;
     const char *m_operation_argument;
+    const char *m_batch_manifest;
+    bool m_batch_pipeline;
+    const char *m_daemon_socket;
+    const char *m_client_socket;
+    const char *m_stats_name;
+    const char *m_backend_name;
+    int m_optimize;
+    unsigned int m_index_band_rows;
+    const char *m_cache_directory;
+    unsigned long int m_cache_max_mb;
+    const char *m_fanout_manifest;
+    const char *m_page_policy;
+    unsigned int m_prefetch_depth;
+    const char *m_io_backend;
+    unsigned int m_image_threads;
+    unsigned int m_band_rows;
+    int m_interlace;
+    bool m_chunk_channel;
+    bool m_compress;
+    const char *m_key_name;
+    const char *m_scatter_name;
     int m_error_code;
 } program_inp;
 
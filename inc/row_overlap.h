@@ -0,0 +1,53 @@
+#ifndef ROW_OVERLAP_H
+#define ROW_OVERLAP_H
+
+#include <stdbool.h>
+
+#include "stdint.h"
+
+#include "../inc/png_parser.h"
+#include "../inc/png_filtration.h"
+
+// Bytes of rows in flight between the two threads of one image
+#define ROW_OVERLAP_RING_BYTES (4 * 1024 * 1024)
+
+// Rows handed over at once, small enough for the consumer to start early
+#define ROW_OVERLAP_STEP_ROWS 8
+
+// Checks of the other thread's progress before yielding the core
+#define ROW_OVERLAP_SPIN_COUNT 256
+
+/**
+ * @brief Inflate and unfilter a whole image on two threads
+ *
+ * A helper thread inflates the stream with zlib, a few rows at a time, into a
+ * ring of ROW_OVERLAP_RING_BYTES; the calling thread unfilters every row as
+ * soon as it arrives. Neither waits for the whole image and the uncompressed
+ * image is never held in full. Same result as uncompress_data followed by
+ * unfilter_rgba_png.
+ *
+ * @param ihdr IHDR of the image
+ * @param compressed_data Whole zlib stream of IDAT
+ * @param compressed_data_length Stream length
+ * @param filter_types Outputs the filter type of every row, ihdr.m_height bytes, may be NULL
+ * @return RGBA_pixel** 2D Image array, release with free_rgba_png, NULL if not successful
+ */
+RGBA_pixel **row_overlap_unfilter(const IHDR_chunk ihdr, const unsigned char *const compressed_data,
+                                  const unsigned long int compressed_data_length, unsigned char *const filter_types);
+
+/**
+ * @brief Filter and deflate a whole image on two threads
+ *
+ * A helper thread selects and applies filters row by row into a ring of
+ * ROW_OVERLAP_RING_BYTES; the calling thread deflates rows with zlib as soon
+ * as they arrive. Same result as select_rgba_png_filters, apply_rgba_png_filters
+ * and a zlib deflate at the default level.
+ *
+ * @param ihdr IHDR of the image
+ * @param image 2D Image array
+ * @param compressed_data_length Outputs the compressed length
+ * @return Compressed data, NULL if not successful
+ */
+unsigned char *row_overlap_filter(const IHDR_chunk ihdr, RGBA_pixel **image, unsigned long int *compressed_data_length);
+
+#endif // ~ROW_OVERLAP_H
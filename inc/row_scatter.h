@@ -0,0 +1,63 @@
+#ifndef ROW_SCATTER_H
+#define ROW_SCATTER_H
+
+#include <stdbool.h>
+
+#include "stdint.h"
+
+#include "../inc/png_filtration.h"
+
+// Feistel rounds of the row permutation
+#define ROW_SCATTER_ROUNDS 4
+
+/**
+ * @brief Keyed order of image rows the payload is embedded in
+ *
+ * Rows are shuffled, bits inside a row stay in PNG sample order, so
+ * embedding still walks whole rows. The permutation is a Feistel network
+ * over the row numbers, so the row at any position is computed on its own
+ * and no table of the image height is built.
+ */
+typedef struct
+{
+    uint64_t m_round_keys[ROW_SCATTER_ROUNDS];
+
+} row_scatter;
+
+/**
+ * @brief Derive scatter order from key
+ *
+ * @param scatter Scatter to initialize
+ * @param key Key, PAYLOAD_KEY_LENGTH bytes, as read by payload_read_key
+ */
+void row_scatter_init(row_scatter *scatter, const unsigned char *const key);
+
+/**
+ * @brief Row at position index of the scatter order
+ *
+ * Positions 0 to height - 1 give every row of the image once.
+ *
+ * @param scatter Scatter order
+ * @param height Image height
+ * @param index Position, less than height
+ * @return Row number
+ */
+uint32_t row_scatter_row(const row_scatter *scatter, const uint32_t height, const uint32_t index);
+
+/**
+ * @brief Image view of the first rows in scatter order
+ *
+ * Row i of the view points to row row_scatter_row(i) of image, so
+ * encode_data_rgba and decode_data_rgba work on it as on the image itself
+ * as long as the payload stays within row_count rows (see data_rows_rgba).
+ *
+ * @param scatter Scatter order
+ * @param image Image the view points into
+ * @param height Image height
+ * @param row_count Rows of the view
+ * @return View, free with image_free only, NULL on failure
+ */
+RGBA_pixel **row_scatter_view(const row_scatter *scatter, RGBA_pixel **const image, const uint32_t height,
+                              const uint32_t row_count);
+
+#endif // ~ROW_SCATTER_H
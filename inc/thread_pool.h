@@ -0,0 +1,91 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Boundaries
+#define THREAD_POOL_MAX_WORKERS 256
+#define THREAD_POOL_DEQUE_INITIAL_CAPACITY 64
+
+/**
+ * @brief Task executed by a pool worker
+ */
+typedef void (*thread_pool_task)(void *argument);
+
+/**
+ * @brief Opaque work-stealing thread pool
+ *
+ * Every worker owns a deque. Owners pop from the bottom (LIFO),
+ * idle workers steal from the top (FIFO) of other deques.
+ */
+typedef struct thread_pool thread_pool;
+
+/**
+ * @brief Counter used for waiting on a set of submitted tasks
+ *
+ * Must be zero initialized before first use.
+ */
+typedef struct
+{
+    atomic_long m_pending;
+
+} thread_pool_group;
+
+/**
+ * @brief Create thread pool
+ *
+ * @param worker_count Number of workers, 0 sizes the pool to the online cores
+ * @return Pointer to pool, NULL if not successful
+ */
+thread_pool *thread_pool_create(size_t worker_count);
+
+/**
+ * @brief Submit task to pool
+ *
+ * Tasks submitted from a worker go to its own deque,
+ * tasks submitted from other threads are spread round-robin.
+ *
+ * @param pool Thread pool
+ * @param group Group the task is accounted in, may be NULL
+ * @param task Function to execute
+ * @param argument Argument passed to task
+ * @return True if successful, false if not
+ */
+bool thread_pool_submit(thread_pool *pool, thread_pool_group *group, thread_pool_task task, void *argument);
+
+/**
+ * @brief Wait until all tasks of group are finished
+ *
+ * The calling thread executes pending tasks while waiting,
+ * so it is safe to call from inside a task.
+ *
+ * @param pool Thread pool
+ * @param group Group to wait for
+ */
+void thread_pool_wait(thread_pool *pool, thread_pool_group *group);
+
+/**
+ * @brief Get number of workers in pool
+ *
+ * @param pool Thread pool
+ * @return Worker count
+ */
+size_t thread_pool_size(const thread_pool *pool);
+
+/**
+ * @brief Get index of the calling worker
+ *
+ * @return Worker index, or -1 if caller is not a pool worker
+ */
+int thread_pool_worker_index();
+
+/**
+ * @brief Stop workers and free pool. Pending tasks are executed first
+ *
+ * @param pool Thread pool
+ */
+void thread_pool_destroy(thread_pool *pool);
+
+#endif // ~THREAD_POOL_H
@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "../inc/adam7.h"
+#include "../inc/image_arena.h"
+
+/**
+ * @brief Copies pixels between a row of the image and a row of one pass
+ *
+ * Pass pixel x is image pixel start + x * step.
+ */
+typedef void (*pass_kernel)(unsigned char *const image_row, unsigned char *const pass_row, const uint32_t width,
+                            const uint32_t start, const uint32_t step);
+
+typedef struct
+{
+    pass_kernel m_scatter;
+    pass_kernel m_gather;
+
+} pass_kernels;
+
+/**
+ * @brief Work of one pass
+ *
+ * m_filtered points at the pass in the filtered buffer, m_rows holds two
+ * pass rows and the scratch of filter_rgba_row. Everything is taken by the
+ * caller, tasks do not allocate.
+ */
+typedef struct
+{
+    IHDR_chunk m_ihdr;
+    int m_pass;
+    const pass_kernels *m_kernels;
+
+    unsigned char *m_filtered;
+    RGBA_pixel **m_image;
+    unsigned char *m_rows;
+    const RGBA_pixel *m_zero_row;
+
+    bool m_is_ok;
+
+} pass_task;
+
+// Kernels with constant pixel size, so memcpy is a plain move
+
+#define DEFINE_PASS_KERNELS(BPP)                                                                                       \
+    static void scatter_pass_##BPP(unsigned char *const image_row, unsigned char *const pass_row,                      \
+                                   const uint32_t width, const uint32_t start, const uint32_t step)                    \
+    {                                                                                                                  \
+        for (uint32_t x = 0; x < width; x++)                                                                           \
+        {                                                                                                              \
+            memcpy(&image_row[(size_t)(start + x * step) * BPP], &pass_row[(size_t)x * BPP], BPP);                     \
+        }                                                                                                              \
+    }                                                                                                                  \
+                                                                                                                       \
+    static void gather_pass_##BPP(unsigned char *const image_row, unsigned char *const pass_row,                       \
+                                  const uint32_t width, const uint32_t start, const uint32_t step)                     \
+    {                                                                                                                  \
+        for (uint32_t x = 0; x < width; x++)                                                                           \
+        {                                                                                                              \
+            memcpy(&pass_row[(size_t)x * BPP], &image_row[(size_t)(start + x * step) * BPP], BPP);                     \
+        }                                                                                                              \
+    }
+
+#define PASS_KERNELS(BPP) {scatter_pass_##BPP, gather_pass_##BPP}
+
+DEFINE_PASS_KERNELS(1)
+DEFINE_PASS_KERNELS(2)
+DEFINE_PASS_KERNELS(3)
+DEFINE_PASS_KERNELS(4)
+DEFINE_PASS_KERNELS(6)
+DEFINE_PASS_KERNELS(8)
+
+// Indexed by pixel size
+static const pass_kernels g_pass_kernels[PNG_MAX_PIXEL_SIZE + 1] = {
+    [1] = PASS_KERNELS(1), [2] = PASS_KERNELS(2), [3] = PASS_KERNELS(3),
+    [4] = PASS_KERNELS(4), [6] = PASS_KERNELS(6), [8] = PASS_KERNELS(8),
+};
+
+// Tasks
+
+static void unfilter_pass(void *argument)
+{
+    pass_task *task = (pass_task *)argument;
+    size_t row_size = png_row_size(task->m_ihdr);
+    uint32_t start_y = ADAM7_START_Y[task->m_pass];
+    uint32_t step_y = ADAM7_STEP_Y[task->m_pass];
+
+    for (uint32_t y = 0; y < task->m_ihdr.m_height; y++)
+    {
+        RGBA_pixel *row = (RGBA_pixel *)&task->m_rows[(y % 2) * row_size];
+        const RGBA_pixel *previous = y == 0 ? task->m_zero_row : (RGBA_pixel *)&task->m_rows[((y + 1) % 2) * row_size];
+
+        if (unfilter_rgba_row(&task->m_filtered[y * (row_size + 1)], previous, row, task->m_ihdr) == false)
+        {
+            task->m_is_ok = false;
+            return;
+        }
+
+        task->m_kernels->m_scatter((unsigned char *)task->m_image[start_y + y * step_y], (unsigned char *)row,
+                                   task->m_ihdr.m_width, ADAM7_START_X[task->m_pass], ADAM7_STEP_X[task->m_pass]);
+    }
+
+    task->m_is_ok = true;
+}
+
+static void filter_pass(void *argument)
+{
+    pass_task *task = (pass_task *)argument;
+    size_t row_size = png_row_size(task->m_ihdr);
+    unsigned char *scratch = &task->m_rows[2 * row_size];
+    uint32_t start_y = ADAM7_START_Y[task->m_pass];
+    uint32_t step_y = ADAM7_STEP_Y[task->m_pass];
+
+    for (uint32_t y = 0; y < task->m_ihdr.m_height; y++)
+    {
+        RGBA_pixel *row = (RGBA_pixel *)&task->m_rows[(y % 2) * row_size];
+        const RGBA_pixel *previous = y == 0 ? task->m_zero_row : (RGBA_pixel *)&task->m_rows[((y + 1) % 2) * row_size];
+
+        task->m_kernels->m_gather((unsigned char *)task->m_image[start_y + y * step_y], (unsigned char *)row,
+                                  task->m_ihdr.m_width, ADAM7_START_X[task->m_pass], ADAM7_STEP_X[task->m_pass]);
+
+        if (filter_rgba_row(row, previous, scratch, &task->m_filtered[y * (row_size + 1)], task->m_ihdr) == false)
+        {
+            task->m_is_ok = false;
+            return;
+        }
+    }
+
+    task->m_is_ok = true;
+}
+
+// Pass set up and execution
+
+/**
+ * @brief Describe every non-empty pass and take its rows
+ *
+ * @return Number of tasks, -1 if allocation failed
+ */
+static int prepare_passes(const IHDR_chunk ihdr, unsigned char *const filtered, RGBA_pixel **image,
+                          const RGBA_pixel *const zero_row, pass_task *const tasks)
+{
+    unsigned long int offset = 0;
+    int count = 0;
+
+    for (int pass = 0; pass < ADAM7_PASS_COUNT; pass++)
+    {
+        IHDR_chunk pass_ihdr = png_pass_ihdr(ihdr, pass);
+        size_t row_size = png_row_size(pass_ihdr);
+
+        if (pass_ihdr.m_width == 0 || pass_ihdr.m_height == 0)
+        {
+            continue;
+        }
+
+        tasks[count].m_ihdr = pass_ihdr;
+        tasks[count].m_pass = pass;
+        tasks[count].m_kernels = &g_pass_kernels[png_pixel_size(ihdr)];
+        tasks[count].m_filtered = &filtered[offset];
+        tasks[count].m_image = image;
+        tasks[count].m_zero_row = zero_row;
+        tasks[count].m_is_ok = false;
+
+        // Two rows and scratch
+        tasks[count].m_rows = (unsigned char *)image_alloc(3 * row_size + 1);
+
+        if (tasks[count].m_rows == NULL)
+        {
+            return -1;
+        }
+
+        offset += (row_size + 1) * pass_ihdr.m_height;
+        count++;
+    }
+
+    return count;
+}
+
+static bool run_passes(pass_task *const tasks, const int count, thread_pool_task function, thread_pool *pool)
+{
+    thread_pool_group group = {0};
+    bool result = true;
+
+    // Last passes are the largest, they go first so the small ones fill the gaps
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (pool == NULL || thread_pool_submit(pool, &group, function, &tasks[i]) == false)
+        {
+            function(&tasks[i]);
+        }
+    }
+
+    if (pool != NULL)
+    {
+        thread_pool_wait(pool, &group);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        result = result && tasks[i].m_is_ok;
+    }
+
+    return result;
+}
+
+static void release_passes(pass_task *const tasks, const int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        image_free(tasks[i].m_rows);
+    }
+}
+
+// Header defined functions
+
+RGBA_pixel **adam7_unfilter(const unsigned char *const filtered_buffer, const IHDR_chunk ihdr, thread_pool *pool)
+{
+    pass_task tasks[ADAM7_PASS_COUNT];
+    RGBA_pixel **result = NULL;
+    RGBA_pixel *zero_row = NULL;
+    int count = 0;
+    bool is_ok = false;
+
+    if (png_is_supported(ihdr) == false || ihdr.m_interlace_method != INTERLACE_METHOD_ADAM7)
+    {
+        return NULL;
+    }
+
+    memset(tasks, 0, sizeof(tasks));
+
+    result = alloc_rgba_png(ihdr, ihdr.m_height);
+    zero_row = (RGBA_pixel *)image_alloc(png_row_size(ihdr));
+
+    if (result != NULL && zero_row != NULL)
+    {
+        // The row before first is 0 by specifiaction
+        memset(zero_row, 0, png_row_size(ihdr));
+
+        count = prepare_passes(ihdr, (unsigned char *)filtered_buffer, result, zero_row, tasks);
+        is_ok = count >= 0 && run_passes(tasks, count, unfilter_pass, pool);
+    }
+
+    release_passes(tasks, ADAM7_PASS_COUNT);
+    image_free(zero_row);
+
+    if (is_ok == false)
+    {
+        free_rgba_png(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+unsigned char *adam7_filter(const IHDR_chunk ihdr, RGBA_pixel **image, thread_pool *pool,
+                            unsigned long int *const length)
+{
+    pass_task tasks[ADAM7_PASS_COUNT];
+    unsigned char *result = NULL;
+    RGBA_pixel *zero_row = NULL;
+    int count = 0;
+    bool is_ok = false;
+
+    *length = 0;
+
+    if (png_is_supported(ihdr) == false || ihdr.m_interlace_method != INTERLACE_METHOD_ADAM7 || image == NULL)
+    {
+        return NULL;
+    }
+
+    memset(tasks, 0, sizeof(tasks));
+
+    result = (unsigned char *)image_alloc(png_filtered_length(ihdr));
+    zero_row = (RGBA_pixel *)image_alloc(png_row_size(ihdr));
+
+    if (result != NULL && zero_row != NULL)
+    {
+        // The row before first is 0 by specifiaction
+        memset(zero_row, 0, png_row_size(ihdr));
+
+        count = prepare_passes(ihdr, result, image, zero_row, tasks);
+        is_ok = count >= 0 && run_passes(tasks, count, filter_pass, pool);
+    }
+
+    release_passes(tasks, ADAM7_PASS_COUNT);
+    image_free(zero_row);
+
+    if (is_ok == false)
+    {
+        image_free(result);
+        return NULL;
+    }
+
+    *length = png_filtered_length(ihdr);
+
+    return result;
+}
@@ -0,0 +1,636 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "../inc/apng.h"
+#include "../inc/png_filtration.h"
+#include "../inc/png_data_encoder.h"
+#include "../inc/adam7.h"
+#include "../inc/thread_pool.h"
+#include "../inc/image_arena.h"
+
+/**
+ * @brief One frame and its share of the payload stream
+ *
+ * The default image is a frame too, with or without frame control. m_data is
+ * the compressed frame, every chunk of it joined without sequence numbers.
+ * The frame carries stream bytes m_first_byte to m_first_byte + m_byte_count,
+ * none if m_byte_count is 0; m_stream is read when encoding and written when
+ * decoding.
+ */
+typedef struct
+{
+    IHDR_chunk m_ihdr;
+    bool m_is_default;
+    bool m_has_control;
+    unsigned char m_control[fcTL_DATA_LENGTH];
+
+    unsigned char *m_data;
+    unsigned long int m_data_length;
+
+    unsigned long int m_first_byte;
+    unsigned long int m_byte_count;
+    unsigned char *m_stream;
+
+    bool m_is_ok;
+
+} apng_frame;
+
+typedef struct
+{
+    IHDR_chunk m_ihdr;
+    unsigned char m_control[acTL_DATA_LENGTH];
+
+    apng_frame *m_frames;
+    uint32_t m_frame_count;
+
+    png_chunk_index m_chunks;
+
+} apng_image;
+
+// Helper functions
+
+static inline uint32_t load_be32(const unsigned char *src)
+{
+    return (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 8 | (uint32_t)src[3];
+}
+
+static inline void store_be32(unsigned char *dest, const uint32_t value)
+{
+    dest[0] = value >> 24;
+    dest[1] = value >> 16;
+    dest[2] = value >> 8;
+    dest[3] = value;
+}
+
+static inline bool is_chunk(const outside_chunk *const chunk, const unsigned char *const signature)
+{
+    return memcmp(chunk->m_type, signature, TYPE_SIGNATURE_LENGTH) == 0;
+}
+
+static void free_animation(apng_image *image)
+{
+    for (uint32_t i = 0; image->m_frames != NULL && i < image->m_frame_count; i++)
+    {
+        image_free(image->m_frames[i].m_data);
+    }
+
+    free(image->m_frames);
+    image->m_frames = NULL;
+    image->m_frame_count = 0;
+
+    image_free(image->m_chunks.m_spans);
+    image_free(image->m_chunks.m_data);
+    memset(&image->m_chunks, 0, sizeof(png_chunk_index));
+}
+
+// Reading
+
+// First pass: frame table from the chunk headers and fcTL, data lengths summed per frame
+static bool read_frame_table(apng_image *image, const uint32_t frame_limit)
+{
+    apng_frame *frame = NULL;
+
+    for (outside_chunk chunk = read_png_chunk(NULL, PNG_PARSER_RESET);
+         is_chunk(&chunk, IEND_SIGNATURE) == false && is_chunk(&chunk, (const unsigned char *)NULL_SIGNATURE) == false;
+         chunk = read_png_chunk(NULL, PNG_PARSER_NEXT))
+    {
+        if (is_chunk(&chunk, fcTL_SIGNATURE) == true)
+        {
+            if (image->m_frame_count == frame_limit || chunk.m_data_length != fcTL_DATA_LENGTH)
+            {
+                return false;
+            }
+
+            frame = &image->m_frames[image->m_frame_count++];
+            frame->m_ihdr = image->m_ihdr;
+            frame->m_has_control = true;
+
+            if (read_png_chunk_data(chunk, 0, frame->m_control) == false)
+            {
+                return false;
+            }
+
+            // Sequence number, then width and height of the frame
+            frame->m_ihdr.m_width = load_be32(&frame->m_control[APNG_SEQUENCE_LENGTH]);
+            frame->m_ihdr.m_height = load_be32(&frame->m_control[APNG_SEQUENCE_LENGTH + 4]);
+
+            if (png_is_supported(frame->m_ihdr) == false)
+            {
+                return false;
+            }
+        }
+        else if (is_chunk(&chunk, IDAT_SIGNATURE) == true)
+        {
+            // Default image is the first frame, or comes before the animation without frame control
+            if (frame == NULL)
+            {
+                frame = &image->m_frames[image->m_frame_count++];
+                frame->m_ihdr = image->m_ihdr;
+            }
+
+            if (frame != &image->m_frames[0])
+            {
+                return false;
+            }
+
+            frame->m_is_default = true;
+            frame->m_data_length += chunk.m_data_length;
+        }
+        else if (is_chunk(&chunk, fdAT_SIGNATURE) == true)
+        {
+            if (frame == NULL || frame->m_is_default == true || chunk.m_data_length < APNG_SEQUENCE_LENGTH)
+            {
+                return false;
+            }
+
+            frame->m_data_length += chunk.m_data_length - APNG_SEQUENCE_LENGTH;
+        }
+    }
+
+    if (image->m_frame_count == 0 || image->m_frames[0].m_is_default == false)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < image->m_frame_count; i++)
+    {
+        if (image->m_frames[i].m_data_length == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Second pass: data of every frame joined into one buffer
+static bool read_frame_data(apng_image *image)
+{
+    int index = -1;
+    unsigned long int filled = 0;
+
+    for (uint32_t i = 0; i < image->m_frame_count; i++)
+    {
+        image->m_frames[i].m_data = (unsigned char *)image_alloc(image->m_frames[i].m_data_length);
+
+        if (image->m_frames[i].m_data == NULL)
+        {
+            return false;
+        }
+    }
+
+    for (outside_chunk chunk = read_png_chunk(NULL, PNG_PARSER_RESET);
+         is_chunk(&chunk, IEND_SIGNATURE) == false && is_chunk(&chunk, (const unsigned char *)NULL_SIGNATURE) == false;
+         chunk = read_png_chunk(NULL, PNG_PARSER_NEXT))
+    {
+        uint32_t skip = is_chunk(&chunk, fdAT_SIGNATURE) ? APNG_SEQUENCE_LENGTH : 0;
+
+        // Same walk as the table, so every chunk lands in the frame counted for it
+        if (is_chunk(&chunk, fcTL_SIGNATURE) == true || (is_chunk(&chunk, IDAT_SIGNATURE) == true && index < 0))
+        {
+            index++;
+            filled = 0;
+        }
+
+        if (is_chunk(&chunk, IDAT_SIGNATURE) == false && is_chunk(&chunk, fdAT_SIGNATURE) == false)
+        {
+            continue;
+        }
+
+        if (read_png_chunk_data(chunk, skip, &image->m_frames[index].m_data[filled]) == false)
+        {
+            return false;
+        }
+
+        filled += chunk.m_data_length - skip;
+    }
+
+    return true;
+}
+
+static bool read_animation(const char *input_name, apng_image *image, const char **error)
+{
+    outside_chunk control;
+    uint32_t frame_limit = 0;
+    bool result = false;
+
+    memset(image, 0, sizeof(apng_image));
+
+    if (png_open(input_name, "rb") == false)
+    {
+        *error = "File is not found!\n";
+        return false;
+    }
+
+    image->m_ihdr = read_png_IHDR();
+    control = read_png_chunk(acTL_SIGNATURE, PNG_PARSER_RESET);
+
+    if (png_is_supported(image->m_ihdr) == false || control.m_data_length != acTL_DATA_LENGTH ||
+        read_png_chunk_data(control, 0, image->m_control) == false)
+    {
+        png_close();
+        *error = "Animated image is not supported!\n";
+        return false;
+    }
+
+    // Frames with control, and the default image if it has none
+    frame_limit = load_be32(image->m_control) + 1;
+
+    if (frame_limit > 1 && frame_limit <= APNG_MAX_FRAMES + 1)
+    {
+        image->m_frames = (apng_frame *)calloc(frame_limit, sizeof(apng_frame));
+    }
+
+    if (image->m_frames == NULL || read_frame_table(image, frame_limit) == false)
+    {
+        *error = "Animation frames are not valid!\n";
+    }
+    else if (read_frame_data(image) == false)
+    {
+        *error = "Extraction of IDAT raw data failed!\n";
+    }
+    else
+    {
+        // Output may replace the input, the frames are in memory already and the chunks join them
+        image->m_chunks = read_png_chunk_copies();
+        result = true;
+    }
+
+    png_close();
+
+    if (result == false)
+    {
+        free_animation(image);
+    }
+
+    return result;
+}
+
+// Frame work
+
+static RGBA_pixel **unfilter_frame(apng_frame *frame)
+{
+    unsigned long int filtered_length = 0;
+    unsigned char *filtered = uncompress_data(frame->m_ihdr, frame->m_data, frame->m_data_length, &filtered_length);
+    RGBA_pixel **result = NULL;
+
+    if (filtered == NULL)
+    {
+        return NULL;
+    }
+
+    // Passes of an interlaced frame run on this task's thread
+    if (frame->m_ihdr.m_interlace_method == INTERLACE_METHOD_ADAM7)
+    {
+        result = adam7_unfilter(filtered, frame->m_ihdr, NULL);
+    }
+    else
+    {
+        result = unfilter_rgba_png(filtered, frame->m_ihdr);
+    }
+
+    image_free(filtered);
+
+    return result;
+}
+
+static void encode_frame(void *argument)
+{
+    apng_frame *frame = (apng_frame *)argument;
+    RGBA_pixel **image = unfilter_frame(frame);
+    unsigned char *filtered = NULL;
+    unsigned long int filtered_length = 0;
+    unsigned char *compressed = NULL;
+    unsigned long int compressed_length = 0;
+
+    frame->m_is_ok = false;
+
+    if (image == NULL ||
+        embed_bytes_rgba(image, frame->m_ihdr, 0, &frame->m_stream[frame->m_first_byte], frame->m_byte_count) == false)
+    {
+        free_rgba_png(image);
+        return;
+    }
+
+    if (frame->m_ihdr.m_interlace_method == INTERLACE_METHOD_ADAM7)
+    {
+        filtered = adam7_filter(frame->m_ihdr, image, NULL, &filtered_length);
+    }
+    else
+    {
+        filtered = filter_rgba_png(frame->m_ihdr, image, &filtered_length);
+    }
+
+    free_rgba_png(image);
+
+    if (filtered == NULL)
+    {
+        return;
+    }
+
+    compressed = compress_data(&compressed_length, filtered, filtered_length);
+    image_free(filtered);
+
+    if (compressed == NULL)
+    {
+        return;
+    }
+
+    image_free(frame->m_data);
+    frame->m_data = compressed;
+    frame->m_data_length = compressed_length;
+    frame->m_is_ok = true;
+}
+
+static void decode_frame(void *argument)
+{
+    apng_frame *frame = (apng_frame *)argument;
+    RGBA_pixel **image = unfilter_frame(frame);
+
+    frame->m_is_ok = image != NULL && extract_bytes_rgba(image, frame->m_ihdr, 0, &frame->m_stream[frame->m_first_byte],
+                                                         frame->m_byte_count) == true;
+
+    free_rgba_png(image);
+}
+
+// Runs task on every frame carrying a part of the stream, from first on
+static bool run_frames(apng_image *image, const uint32_t first, thread_pool_task task)
+{
+    thread_pool_group group = {0};
+    thread_pool *pool = NULL;
+    uint32_t count = 0;
+    bool result = true;
+
+    for (uint32_t i = first; i < image->m_frame_count; i++)
+    {
+        count += image->m_frames[i].m_byte_count > 0;
+    }
+
+    // One frame gains nothing from a pool
+    if (count > 1)
+    {
+        pool = thread_pool_create(0);
+    }
+
+    for (uint32_t i = first; i < image->m_frame_count; i++)
+    {
+        apng_frame *frame = &image->m_frames[i];
+
+        if (frame->m_byte_count == 0)
+        {
+            continue;
+        }
+
+        if (pool == NULL || thread_pool_submit(pool, &group, task, frame) == false)
+        {
+            task(frame);
+        }
+    }
+
+    if (pool != NULL)
+    {
+        thread_pool_wait(pool, &group);
+        thread_pool_destroy(pool);
+    }
+
+    for (uint32_t i = first; i < image->m_frame_count; i++)
+    {
+        result = result && (image->m_frames[i].m_byte_count == 0 || image->m_frames[i].m_is_ok == true);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Hand out the stream to the frames in file order
+ *
+ * @return False if the stream does not fit, or the length header does not fit the default image
+ */
+static bool assign_stream(apng_image *image, unsigned char *const stream, const unsigned long int stream_length)
+{
+    unsigned long int position = 0;
+
+    if (capacity_rgba(image->m_frames[0].m_ihdr) < HEADER_DATA_LEN)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < image->m_frame_count; i++)
+    {
+        apng_frame *frame = &image->m_frames[i];
+        unsigned long int capacity = capacity_rgba(frame->m_ihdr);
+
+        frame->m_stream = stream;
+        frame->m_first_byte = position;
+        frame->m_byte_count = position < stream_length
+                                  ? (stream_length - position < capacity ? stream_length - position : capacity)
+                                  : 0;
+
+        position += capacity;
+    }
+
+    return position >= stream_length;
+}
+
+// Writing
+
+static bool write_animation(const char *output_name, apng_image *image)
+{
+    uint32_t sequence = 0;
+    bool is_ok = true;
+    int fd = png_stream_start(output_name, image->m_ihdr);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    is_ok = png_stream_write_chunk(fd, acTL_SIGNATURE, image->m_control, acTL_DATA_LENGTH) &&
+            png_stream_write_chunks(fd, &image->m_chunks, false);
+
+    // Each frame is one chunk now, so sequence numbers are counted again
+    for (uint32_t i = 0; is_ok == true && i < image->m_frame_count; i++)
+    {
+        apng_frame *frame = &image->m_frames[i];
+
+        if (frame->m_has_control == true)
+        {
+            store_be32(frame->m_control, sequence++);
+            is_ok = png_stream_write_chunk(fd, fcTL_SIGNATURE, frame->m_control, fcTL_DATA_LENGTH);
+        }
+
+        if (is_ok == true && frame->m_is_default == true)
+        {
+            is_ok = png_stream_write_IDAT(fd, frame->m_data, frame->m_data_length);
+        }
+        else if (is_ok == true)
+        {
+            is_ok = png_stream_write_fdAT(fd, sequence++, frame->m_data, frame->m_data_length);
+        }
+    }
+
+    is_ok = is_ok && png_stream_write_chunks(fd, &image->m_chunks, true);
+
+    return png_stream_finish(fd, is_ok);
+}
+
+// Header defined functions
+
+bool apng_is_animated(const char *file_name)
+{
+    outside_chunk control;
+
+    if (png_is_standard_stream(file_name) == true || png_open(file_name, "rb") == false)
+    {
+        return false;
+    }
+
+    control = read_png_chunk(acTL_SIGNATURE, PNG_PARSER_RESET);
+
+    png_close();
+
+    return is_chunk(&control, acTL_SIGNATURE);
+}
+
+bool apng_encode(const char *input_name, const char *output_name, const unsigned char *const data,
+                 const uint32_t data_length, const uint32_t flags, const char **error)
+{
+    apng_image image;
+    unsigned long int stream_length = (unsigned long int)data_length + HEADER_DATA_LEN;
+    uint32_t flagged_length = data_length | flags;
+    unsigned char *stream = NULL;
+    bool result = false;
+
+    if (data_length > PAYLOAD_LENGTH_MASK)
+    {
+        *error = "Data is too long for the animation frames!\n";
+        return false;
+    }
+
+    if (read_animation(input_name, &image, error) == false)
+    {
+        return false;
+    }
+
+    stream = (unsigned char *)malloc(stream_length);
+
+    if (stream == NULL)
+    {
+        *error = "Could not allocate payload stream!\n";
+    }
+    else
+    {
+        // Length header and flags lowest byte first, as encode_data_rgba writes them
+        for (int i = 0; i < HEADER_DATA_LEN; i++)
+        {
+            stream[i] = (flagged_length >> (i * 8)) & 0xFF;
+        }
+
+        memcpy(&stream[HEADER_DATA_LEN], data, data_length);
+
+        if (assign_stream(&image, stream, stream_length) == false)
+        {
+            *error = "Data is too long for the animation frames!\n";
+        }
+        else if (run_frames(&image, 0, encode_frame) == false)
+        {
+            *error = "Could not encode animation frames!\n";
+        }
+        else if (write_animation(output_name, &image) == false)
+        {
+            *error = "Could not write image to file!\n";
+        }
+        else
+        {
+            result = true;
+        }
+    }
+
+    free(stream);
+    free_animation(&image);
+
+    return result;
+}
+
+bool apng_decode(const char *input_name, unsigned char **data, uint32_t *data_length, uint32_t *flags,
+                 const char **error)
+{
+    apng_image image;
+    unsigned char header[HEADER_DATA_LEN];
+    unsigned char *stream = NULL;
+    unsigned long int stream_length = 0;
+    RGBA_pixel **first_image = NULL;
+    uint32_t length = 0;
+    bool result = false;
+
+    *data = NULL;
+    *data_length = 0;
+    *flags = 0;
+
+    if (read_animation(input_name, &image, error) == false)
+    {
+        return false;
+    }
+
+    // Default image first, it holds the length header
+    first_image = unfilter_frame(&image.m_frames[0]);
+
+    if (first_image == NULL ||
+        extract_bytes_rgba(first_image, image.m_frames[0].m_ihdr, 0, header, HEADER_DATA_LEN) == false)
+    {
+        *error = "Decoding failed!\n";
+        free_rgba_png(first_image);
+        free_animation(&image);
+        return false;
+    }
+
+    for (int i = HEADER_DATA_LEN - 1; i >= 0; i--)
+    {
+        length = (length << 8) | header[i];
+    }
+
+    if ((length & PAYLOAD_FLAG_RESERVED) != 0)
+    {
+        *error = "Payload has a length header of a later format!\n";
+        free_rgba_png(first_image);
+        free_animation(&image);
+        return false;
+    }
+
+    *flags = length & ~PAYLOAD_LENGTH_MASK;
+    length &= PAYLOAD_LENGTH_MASK;
+
+    stream_length = (unsigned long int)length + HEADER_DATA_LEN;
+
+    // + 1 for the '\0' appended
+    stream = (unsigned char *)malloc(stream_length + 1);
+
+    if (stream == NULL || assign_stream(&image, stream, stream_length) == false)
+    {
+        *error = "Decoding failed!\n";
+    }
+    // Rest of the default image here, the frames after it in parallel
+    else if (extract_bytes_rgba(first_image, image.m_frames[0].m_ihdr, 0, stream,
+                                image.m_frames[0].m_byte_count) == false ||
+             run_frames(&image, 1, decode_frame) == false)
+    {
+        *error = "Could not decode animation frames!\n";
+    }
+    else
+    {
+        memmove(stream, &stream[HEADER_DATA_LEN], length);
+        stream[length] = '\0';
+
+        *data = stream;
+        *data_length = length + 1;
+        stream = NULL;
+        result = true;
+    }
+
+    free(stream);
+    free_rgba_png(first_image);
+    free_animation(&image);
+
+    return result;
+}
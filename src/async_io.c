@@ -0,0 +1,761 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "../inc/async_io.h"
+#include "../inc/thread_pool.h"
+
+// Largest single read or write, the length field of a submission is 32 bits
+#define MAX_TRANSFER_LENGTH (1U << 30)
+
+// Completion without request, tells the reaper to stop
+#define STOP_USER_DATA 0
+
+#define OUTPUT_FILE_MODE 0644
+
+/**
+ * @brief Progress of one file
+ *
+ * Reads and writes both open first, then transfer until m_done reaches m_length.
+ */
+typedef enum
+{
+    REQUEST_IDLE,
+    REQUEST_OPENING,
+    REQUEST_TRANSFERRING,
+    REQUEST_DONE,
+    REQUEST_FAILED,
+    REQUEST_RELEASED
+
+} request_state;
+
+typedef struct io_request
+{
+    struct async_io *m_io;
+    const char *m_name;
+    bool m_is_write;
+    int m_fd;
+    struct io_request *m_next_write;
+
+    unsigned char *m_data;
+    size_t m_length;
+    size_t m_done;
+
+    request_state m_state;
+
+} io_request;
+
+/**
+ * @brief Mapped io_uring, rings are used without liburing
+ */
+typedef struct
+{
+    int m_fd;
+
+    unsigned int *m_sq_head;
+    unsigned int *m_sq_tail;
+    unsigned int *m_sq_mask;
+    unsigned int *m_sq_array;
+    struct io_uring_sqe *m_sqes;
+
+    unsigned int *m_cq_head;
+    unsigned int *m_cq_tail;
+    unsigned int *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    void *m_sq_ring;
+    size_t m_sq_ring_size;
+    void *m_cq_ring;
+    size_t m_cq_ring_size;
+    size_t m_sqes_size;
+
+} uring;
+
+struct async_io
+{
+    async_io_backend m_backend;
+    size_t m_depth;
+
+    io_request *m_reads;
+    size_t m_read_count;
+    size_t m_next_read;
+
+    size_t m_in_flight;
+    size_t m_writes_in_flight;
+    io_request *m_writes;
+    bool m_is_broken;
+
+    async_io_stats m_stats;
+
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_cond;
+
+    uring m_ring;
+    pthread_t m_reaper;
+
+    thread_pool *m_pool;
+    thread_pool_group m_group;
+};
+
+// io_uring functions
+
+static bool uring_supports(const int fd, const int *const opcodes, const size_t opcode_count)
+{
+    size_t probe_size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probe_size);
+    bool result = probe != NULL && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0;
+
+    for (size_t i = 0; result == true && i < opcode_count; i++)
+    {
+        result = opcodes[i] <= probe->last_op && (probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    free(probe);
+
+    return result;
+}
+
+static bool uring_init(uring *ring, const unsigned int entries)
+{
+    static const int needed_opcodes[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_NOP};
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(uring));
+    memset(&params, 0, sizeof(params));
+
+    ring->m_fd = syscall(__NR_io_uring_setup, entries, &params);
+
+    if (ring->m_fd < 0)
+    {
+        return false;
+    }
+
+    // Open and read by offset need 5.6, older kernels use the thread backend
+    if (uring_supports(ring->m_fd, needed_opcodes, sizeof(needed_opcodes) / sizeof(needed_opcodes[0])) == false)
+    {
+        close(ring->m_fd);
+        return false;
+    }
+
+    ring->m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0 && ring->m_cq_ring_size > ring->m_sq_ring_size)
+    {
+        ring->m_sq_ring_size = ring->m_cq_ring_size;
+    }
+
+    ring->m_sq_ring = mmap(NULL, ring->m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring->m_fd, IORING_OFF_SQ_RING);
+    ring->m_cq_ring = ring->m_sq_ring;
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 && ring->m_sq_ring != MAP_FAILED)
+    {
+        ring->m_cq_ring = mmap(NULL, ring->m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               ring->m_fd, IORING_OFF_CQ_RING);
+    }
+
+    ring->m_sqes = (struct io_uring_sqe *)mmap(NULL, ring->m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                               ring->m_fd, IORING_OFF_SQES);
+
+    if (ring->m_sq_ring == MAP_FAILED || ring->m_cq_ring == MAP_FAILED || ring->m_sqes == MAP_FAILED)
+    {
+        if (ring->m_sqes != MAP_FAILED)
+        {
+            munmap(ring->m_sqes, ring->m_sqes_size);
+        }
+
+        if (ring->m_cq_ring != MAP_FAILED && ring->m_cq_ring != ring->m_sq_ring)
+        {
+            munmap(ring->m_cq_ring, ring->m_cq_ring_size);
+        }
+
+        if (ring->m_sq_ring != MAP_FAILED)
+        {
+            munmap(ring->m_sq_ring, ring->m_sq_ring_size);
+        }
+
+        close(ring->m_fd);
+        return false;
+    }
+
+    ring->m_sq_head = (unsigned int *)((unsigned char *)ring->m_sq_ring + params.sq_off.head);
+    ring->m_sq_tail = (unsigned int *)((unsigned char *)ring->m_sq_ring + params.sq_off.tail);
+    ring->m_sq_mask = (unsigned int *)((unsigned char *)ring->m_sq_ring + params.sq_off.ring_mask);
+    ring->m_sq_array = (unsigned int *)((unsigned char *)ring->m_sq_ring + params.sq_off.array);
+
+    ring->m_cq_head = (unsigned int *)((unsigned char *)ring->m_cq_ring + params.cq_off.head);
+    ring->m_cq_tail = (unsigned int *)((unsigned char *)ring->m_cq_ring + params.cq_off.tail);
+    ring->m_cq_mask = (unsigned int *)((unsigned char *)ring->m_cq_ring + params.cq_off.ring_mask);
+    ring->m_cqes = (struct io_uring_cqe *)((unsigned char *)ring->m_cq_ring + params.cq_off.cqes);
+
+    return true;
+}
+
+static void uring_free(uring *ring)
+{
+    munmap(ring->m_sqes, ring->m_sqes_size);
+
+    if (ring->m_cq_ring != ring->m_sq_ring)
+    {
+        munmap(ring->m_cq_ring, ring->m_cq_ring_size);
+    }
+
+    munmap(ring->m_sq_ring, ring->m_sq_ring_size);
+    close(ring->m_fd);
+}
+
+// Caller holds the lock, every entry is handed to the kernel right away so the queue never fills
+static bool uring_submit(uring *ring, const struct io_uring_sqe *const entry)
+{
+    unsigned int tail = *ring->m_sq_tail;
+    unsigned int index = tail & *ring->m_sq_mask;
+    int count = 0;
+
+    ring->m_sqes[index] = *entry;
+    ring->m_sq_array[index] = index;
+
+    atomic_store_explicit((_Atomic unsigned int *)ring->m_sq_tail, tail + 1, memory_order_release);
+
+    do
+    {
+        count = syscall(__NR_io_uring_enter, ring->m_fd, 1, 0, 0, NULL, 0);
+    } while (count < 0 && errno == EINTR);
+
+    return count == 1;
+}
+
+// Request functions
+
+static void finish_request(io_request *request, const bool is_ok)
+{
+    async_io *io = request->m_io;
+
+    if (request->m_fd >= 0)
+    {
+        // Data of a write is only safe once the close succeeded
+        if (close(request->m_fd) != 0 && request->m_is_write == true)
+        {
+            request->m_state = REQUEST_FAILED;
+        }
+
+        request->m_fd = -1;
+    }
+
+    io->m_in_flight--;
+
+    if (request->m_is_write == false)
+    {
+        request->m_state = is_ok ? REQUEST_DONE : REQUEST_FAILED;
+
+        if (is_ok == true)
+        {
+            io->m_stats.m_reads++;
+            io->m_stats.m_read_bytes += request->m_length;
+        }
+        else
+        {
+            free(request->m_data);
+            request->m_data = NULL;
+        }
+
+        pthread_cond_broadcast(&io->m_cond);
+        return;
+    }
+
+    io->m_writes_in_flight--;
+
+    for (io_request **link = &io->m_writes; *link != NULL; link = &(*link)->m_next_write)
+    {
+        if (*link == request)
+        {
+            *link = request->m_next_write;
+            break;
+        }
+    }
+
+    if (is_ok == true && request->m_state != REQUEST_FAILED)
+    {
+        io->m_stats.m_writes++;
+        io->m_stats.m_write_bytes += request->m_length;
+    }
+    else
+    {
+        io->m_stats.m_failed_writes++;
+        fprintf(stderr, "[Error] Could not write %s\n", request->m_name);
+    }
+
+    free(request->m_data);
+    free((char *)request->m_name);
+    free(request);
+
+    pthread_cond_broadcast(&io->m_cond);
+}
+
+static bool submit_step(io_request *request)
+{
+    struct io_uring_sqe entry;
+    size_t remaining = request->m_length - request->m_done;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.user_data = (uint64_t)(uintptr_t)request;
+
+    if (request->m_state == REQUEST_OPENING)
+    {
+        entry.opcode = IORING_OP_OPENAT;
+        entry.fd = AT_FDCWD;
+        entry.addr = (uint64_t)(uintptr_t)request->m_name;
+        entry.len = request->m_is_write ? OUTPUT_FILE_MODE : 0;
+        entry.open_flags = request->m_is_write ? O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC : O_RDONLY | O_CLOEXEC;
+    }
+    else
+    {
+        entry.opcode = request->m_is_write ? IORING_OP_WRITE : IORING_OP_READ;
+        entry.fd = request->m_fd;
+        entry.addr = (uint64_t)(uintptr_t)&request->m_data[request->m_done];
+        entry.len = remaining < MAX_TRANSFER_LENGTH ? remaining : MAX_TRANSFER_LENGTH;
+        entry.off = request->m_done;
+    }
+
+    return uring_submit(&request->m_io->m_ring, &entry);
+}
+
+// Reads learn their length once the file is open
+static bool prepare_transfer(io_request *request)
+{
+    struct stat status;
+
+    request->m_state = REQUEST_TRANSFERRING;
+
+    if (request->m_is_write == true)
+    {
+        return true;
+    }
+
+    if (fstat(request->m_fd, &status) != 0 || status.st_size <= 0)
+    {
+        return false;
+    }
+
+    request->m_length = status.st_size;
+    request->m_data = (unsigned char *)malloc(request->m_length);
+
+    return request->m_data != NULL;
+}
+
+// Caller holds the lock
+static void advance_request(io_request *request, const int result)
+{
+    bool is_ok = true;
+
+    if (result == -EINTR || result == -EAGAIN)
+    {
+        is_ok = submit_step(request);
+    }
+    else if (result < 0 || (result == 0 && request->m_state == REQUEST_TRANSFERRING))
+    {
+        is_ok = false;
+    }
+    else if (request->m_state == REQUEST_OPENING)
+    {
+        request->m_fd = result;
+        is_ok = prepare_transfer(request);
+
+        if (is_ok == true && request->m_done < request->m_length)
+        {
+            is_ok = submit_step(request);
+        }
+        else if (is_ok == true)
+        {
+            finish_request(request, true);
+            return;
+        }
+    }
+    else
+    {
+        // Short transfers continue where they stopped
+        request->m_done += result;
+
+        if (request->m_done < request->m_length)
+        {
+            is_ok = submit_step(request);
+        }
+        else
+        {
+            finish_request(request, true);
+            return;
+        }
+    }
+
+    if (is_ok == false)
+    {
+        finish_request(request, false);
+    }
+}
+
+// Caller holds the lock. Ring is dead, nothing in flight completes any more
+static void fail_in_flight(async_io *io)
+{
+    io->m_is_broken = true;
+
+    for (size_t i = 0; i < io->m_next_read; i++)
+    {
+        if (io->m_reads[i].m_state == REQUEST_OPENING || io->m_reads[i].m_state == REQUEST_TRANSFERRING)
+        {
+            finish_request(&io->m_reads[i], false);
+        }
+    }
+
+    while (io->m_writes != NULL)
+    {
+        finish_request(io->m_writes, false);
+    }
+}
+
+static void *reaper_main(void *argument)
+{
+    async_io *io = (async_io *)argument;
+    uring *ring = &io->m_ring;
+    bool is_stopping = false;
+
+    while (is_stopping == false)
+    {
+        // Waiters of requests in flight would wait forever otherwise
+        if (syscall(__NR_io_uring_enter, ring->m_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+        {
+            pthread_mutex_lock(&io->m_lock);
+            fail_in_flight(io);
+            pthread_mutex_unlock(&io->m_lock);
+            break;
+        }
+
+        pthread_mutex_lock(&io->m_lock);
+
+        unsigned int head = *ring->m_cq_head;
+        unsigned int tail = atomic_load_explicit((_Atomic unsigned int *)ring->m_cq_tail, memory_order_acquire);
+
+        for (; head != tail; head++)
+        {
+            const struct io_uring_cqe *completion = &ring->m_cqes[head & *ring->m_cq_mask];
+
+            if (completion->user_data == STOP_USER_DATA)
+            {
+                is_stopping = true;
+                continue;
+            }
+
+            advance_request((io_request *)(uintptr_t)completion->user_data, completion->res);
+        }
+
+        atomic_store_explicit((_Atomic unsigned int *)ring->m_cq_head, head, memory_order_release);
+
+        pthread_mutex_unlock(&io->m_lock);
+    }
+
+    return NULL;
+}
+
+// Thread backend, the whole request is one blocking task
+static void run_blocking_request(void *argument)
+{
+    io_request *request = (io_request *)argument;
+    async_io *io = request->m_io;
+    bool is_ok = true;
+
+    request->m_fd = request->m_is_write ? open(request->m_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, OUTPUT_FILE_MODE)
+                                        : open(request->m_name, O_RDONLY | O_CLOEXEC);
+
+    is_ok = request->m_fd >= 0 && prepare_transfer(request) == true;
+
+    while (is_ok == true && request->m_done < request->m_length)
+    {
+        ssize_t count = request->m_is_write
+                            ? pwrite(request->m_fd, &request->m_data[request->m_done], request->m_length - request->m_done, request->m_done)
+                            : pread(request->m_fd, &request->m_data[request->m_done], request->m_length - request->m_done, request->m_done);
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        is_ok = count > 0;
+        request->m_done += is_ok ? count : 0;
+    }
+
+    // Finished writes free the request, unlock through a copy
+    pthread_mutex_lock(&io->m_lock);
+    finish_request(request, is_ok);
+    pthread_mutex_unlock(&io->m_lock);
+}
+
+// Caller holds the lock
+static void start_request(async_io *io, io_request *request)
+{
+    io->m_in_flight++;
+
+    if (io->m_backend == ASYNC_IO_BACKEND_THREADS)
+    {
+        request->m_state = REQUEST_TRANSFERRING;
+
+        if (thread_pool_submit(io->m_pool, &io->m_group, run_blocking_request, request) == false)
+        {
+            finish_request(request, false);
+        }
+
+        return;
+    }
+
+    request->m_state = REQUEST_OPENING;
+
+    if (io->m_is_broken == true || submit_step(request) == false)
+    {
+        finish_request(request, false);
+    }
+}
+
+// Header defined functions
+
+async_io *async_io_create(const char *const *input_names, const size_t input_count, const size_t depth,
+                          const async_io_backend backend)
+{
+    async_io *result = NULL;
+
+    if (depth == 0 || depth > ASYNC_IO_MAX_DEPTH)
+    {
+        return NULL;
+    }
+
+    result = (async_io *)calloc(1, sizeof(async_io));
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    result->m_reads = (io_request *)calloc(input_count + 1, sizeof(io_request));
+
+    if (result->m_reads == NULL)
+    {
+        free(result);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < input_count; i++)
+    {
+        result->m_reads[i].m_io = result;
+        result->m_reads[i].m_name = input_names[i];
+        result->m_reads[i].m_fd = -1;
+    }
+
+    result->m_read_count = input_count;
+    result->m_depth = depth;
+
+    pthread_mutex_init(&result->m_lock, NULL);
+    pthread_cond_init(&result->m_cond, NULL);
+
+    // Room for every read ahead and every write in flight, plus resubmissions
+    result->m_backend = ASYNC_IO_BACKEND_THREADS;
+
+    if (backend != ASYNC_IO_BACKEND_THREADS && uring_init(&result->m_ring, 4 * depth) == true)
+    {
+        if (pthread_create(&result->m_reaper, NULL, reaper_main, result) == 0)
+        {
+            result->m_backend = ASYNC_IO_BACKEND_IO_URING;
+        }
+        else
+        {
+            uring_free(&result->m_ring);
+        }
+    }
+
+    // Asked for io_uring by name, the caller decides about falling back
+    if (backend == ASYNC_IO_BACKEND_IO_URING && result->m_backend != ASYNC_IO_BACKEND_IO_URING)
+    {
+        pthread_mutex_destroy(&result->m_lock);
+        pthread_cond_destroy(&result->m_cond);
+        free(result->m_reads);
+        free(result);
+        return NULL;
+    }
+
+    // Blocking calls of network volumes overlap only with as many threads as requests
+    if (result->m_backend == ASYNC_IO_BACKEND_THREADS)
+    {
+        result->m_pool = thread_pool_create(depth);
+
+        if (result->m_pool == NULL)
+        {
+            pthread_mutex_destroy(&result->m_lock);
+            pthread_cond_destroy(&result->m_cond);
+            free(result->m_reads);
+            free(result);
+            return NULL;
+        }
+    }
+
+    return result;
+}
+
+const unsigned char *async_io_read(async_io *io, const size_t index, size_t *length)
+{
+    const unsigned char *result = NULL;
+
+    *length = 0;
+
+    if (index >= io->m_read_count)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&io->m_lock);
+
+    // Keep depth inputs on the way past the one asked for
+    while (io->m_next_read < io->m_read_count && io->m_next_read <= index + io->m_depth)
+    {
+        start_request(io, &io->m_reads[io->m_next_read++]);
+    }
+
+    while (io->m_reads[index].m_state == REQUEST_OPENING || io->m_reads[index].m_state == REQUEST_TRANSFERRING)
+    {
+        pthread_cond_wait(&io->m_cond, &io->m_lock);
+    }
+
+    if (io->m_reads[index].m_state == REQUEST_DONE)
+    {
+        result = io->m_reads[index].m_data;
+        *length = io->m_reads[index].m_length;
+    }
+
+    pthread_mutex_unlock(&io->m_lock);
+
+    return result;
+}
+
+void async_io_release(async_io *io, const size_t index)
+{
+    if (index >= io->m_read_count)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&io->m_lock);
+
+    if (io->m_reads[index].m_state == REQUEST_DONE)
+    {
+        free(io->m_reads[index].m_data);
+        io->m_reads[index].m_data = NULL;
+        io->m_reads[index].m_state = REQUEST_RELEASED;
+    }
+
+    pthread_mutex_unlock(&io->m_lock);
+}
+
+bool async_io_write(async_io *io, const char *output_name, unsigned char *data, const size_t length)
+{
+    io_request *request = (io_request *)calloc(1, sizeof(io_request));
+    char *name = (char *)malloc(strlen(output_name) + 1);
+
+    if (request == NULL || name == NULL)
+    {
+        free(request);
+        free(name);
+        free(data);
+        return false;
+    }
+
+    strcpy(name, output_name);
+
+    request->m_io = io;
+    request->m_name = name;
+    request->m_is_write = true;
+    request->m_fd = -1;
+    request->m_data = data;
+    request->m_length = length;
+
+    pthread_mutex_lock(&io->m_lock);
+
+    // Backpressure, finished images wait here instead of piling up in memory
+    while (io->m_writes_in_flight >= io->m_depth)
+    {
+        pthread_cond_wait(&io->m_cond, &io->m_lock);
+    }
+
+    io->m_writes_in_flight++;
+    request->m_next_write = io->m_writes;
+    io->m_writes = request;
+    start_request(io, request);
+
+    pthread_mutex_unlock(&io->m_lock);
+
+    return true;
+}
+
+const char *async_io_backend_name(const async_io *io)
+{
+    return io->m_backend == ASYNC_IO_BACKEND_IO_URING ? ASYNC_IO_BACKEND_NAME_IO_URING : ASYNC_IO_BACKEND_NAME_THREADS;
+}
+
+void async_io_destroy(async_io *io, async_io_stats *stats)
+{
+    pthread_mutex_lock(&io->m_lock);
+
+    while (io->m_in_flight > 0)
+    {
+        pthread_cond_wait(&io->m_cond, &io->m_lock);
+    }
+
+    // Reaper of a dead ring is gone already
+    if (io->m_backend == ASYNC_IO_BACKEND_IO_URING && io->m_is_broken == false)
+    {
+        struct io_uring_sqe stop;
+
+        memset(&stop, 0, sizeof(stop));
+        stop.opcode = IORING_OP_NOP;
+        stop.user_data = STOP_USER_DATA;
+
+        // Reaper is idle, nothing is in flight, so a failed stop can only mean a dead ring
+        if (uring_submit(&io->m_ring, &stop) == false)
+        {
+            pthread_cancel(io->m_reaper);
+        }
+    }
+
+    pthread_mutex_unlock(&io->m_lock);
+
+    if (io->m_backend == ASYNC_IO_BACKEND_IO_URING)
+    {
+        pthread_join(io->m_reaper, NULL);
+        uring_free(&io->m_ring);
+    }
+    else
+    {
+        thread_pool_wait(io->m_pool, &io->m_group);
+        thread_pool_destroy(io->m_pool);
+    }
+
+    for (size_t i = 0; i < io->m_read_count; i++)
+    {
+        free(io->m_reads[i].m_data);
+    }
+
+    if (stats != NULL)
+    {
+        *stats = io->m_stats;
+    }
+
+    pthread_mutex_destroy(&io->m_lock);
+    pthread_cond_destroy(&io->m_cond);
+    free(io->m_reads);
+    free(io);
+}
@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "../inc/band_codec.h"
+#include "../inc/png_parser.h"
+#include "../inc/png_filtration.h"
+#include "../inc/png_data_encoder.h"
+#include "../inc/deflate_backend.h"
+#include "../inc/image_arena.h"
+
+/**
+ * @brief Buffers of one banded encode
+ *
+ * m_filtered holds the band as inflated, then the same band filtered again.
+ * The previous rows are the last row of the band before: unfiltering needs it
+ * as read, filtering as written, which differ where the payload ends.
+ */
+typedef struct
+{
+    IHDR_chunk m_ihdr;
+    size_t m_row_length;
+
+    unsigned char *m_idat_data;
+    int m_fd;
+
+    unsigned char *m_filtered;
+    RGBA_pixel **m_rows;
+    RGBA_pixel *m_unfilter_previous;
+    RGBA_pixel *m_filter_previous;
+    unsigned char *m_scratch;
+    unsigned char *m_output;
+
+} band_state;
+
+static inline uint32_t min_rows(const uint32_t a, const uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+// Input side
+
+// Data of the next IDAT chunk goes to the inflate stream, empty chunks are skipped
+static bool next_idat(band_state *state, const bool is_reset)
+{
+    IDAT_chunk idat = read_png_IDAT(is_reset);
+
+    while (memcmp(idat.m_outside_chunk.m_type, IDAT_SIGNATURE, TYPE_SIGNATURE_LENGTH) == 0 &&
+           idat.m_outside_chunk.m_data_length == 0)
+    {
+        idat = read_png_IDAT(PNG_PARSER_NEXT);
+    }
+
+    image_free(state->m_idat_data);
+    state->m_idat_data = NULL;
+
+    if (memcmp(idat.m_outside_chunk.m_type, IDAT_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0)
+    {
+        return false;
+    }
+
+    state->m_idat_data = extract_IDAT_raw(idat.m_raw_inside_chunk_data_offset, idat.m_outside_chunk.m_data_length);
+
+    if (state->m_idat_data == NULL)
+    {
+        return false;
+    }
+
+    return is_reset == PNG_PARSER_RESET
+               ? deflate_backend_inflate_start(state->m_idat_data, idat.m_outside_chunk.m_data_length)
+               : deflate_backend_inflate_feed(state->m_idat_data, idat.m_outside_chunk.m_data_length);
+}
+
+static bool inflate_band(band_state *state, unsigned char *dest, unsigned long int length)
+{
+    unsigned long int produced = 0;
+    bool is_end = false;
+
+    while (length > 0)
+    {
+        if (deflate_backend_inflate_next(dest, length, &produced, &is_end) == false)
+        {
+            return false;
+        }
+
+        dest += produced;
+        length -= produced;
+
+        // Short of the band, the stream goes on in the next chunk or is cut off
+        if (length > 0 && (is_end == true || next_idat(state, PNG_PARSER_NEXT) == false))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Stream has to end right after the last row, which also checks its checksum
+static bool finish_inflate(band_state *state)
+{
+    unsigned char extra = 0;
+    unsigned long int produced = 0;
+    bool is_end = false;
+
+    do
+    {
+        if (deflate_backend_inflate_next(&extra, sizeof(extra), &produced, &is_end) == false || produced != 0)
+        {
+            return false;
+        }
+
+        if (is_end == true)
+        {
+            return true;
+        }
+
+    } while (next_idat(state, PNG_PARSER_NEXT) == true);
+
+    return false;
+}
+
+// Output side
+
+static bool write_idat(void *context, const unsigned char *const data, const unsigned long int length)
+{
+    band_state *state = (band_state *)context;
+
+    return length == 0 || png_stream_write_IDAT(state->m_fd, data, length);
+}
+
+// Bands
+
+static bool alloc_buffers(band_state *state, const uint32_t max_rows)
+{
+    size_t pixel_row_length = state->m_row_length - 1;
+
+    state->m_filtered = (unsigned char *)image_alloc(max_rows * state->m_row_length);
+    state->m_rows = alloc_rgba_png(state->m_ihdr, max_rows);
+    state->m_unfilter_previous = (RGBA_pixel *)image_alloc(pixel_row_length);
+    state->m_filter_previous = (RGBA_pixel *)image_alloc(pixel_row_length);
+    state->m_scratch = (unsigned char *)image_alloc(state->m_row_length);
+    state->m_output = (unsigned char *)image_alloc(BAND_CODEC_IDAT_BYTES);
+
+    if (state->m_filtered == NULL || state->m_rows == NULL || state->m_unfilter_previous == NULL || state->m_filter_previous == NULL || state->m_scratch == NULL ||
+        state->m_output == NULL)
+    {
+        return false;
+    }
+
+    // The row before first is 0 by specifiaction
+    memset(state->m_unfilter_previous, 0, pixel_row_length);
+    memset(state->m_filter_previous, 0, pixel_row_length);
+
+    return true;
+}
+
+static void free_buffers(band_state *state)
+{
+    image_free(state->m_idat_data);
+    image_free(state->m_filtered);
+    free_rgba_png(state->m_rows);
+    image_free(state->m_unfilter_previous);
+    image_free(state->m_filter_previous);
+    image_free(state->m_scratch);
+    image_free(state->m_output);
+}
+
+static bool unfilter_band(band_state *state, const uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (unfilter_rgba_row(&state->m_filtered[i * state->m_row_length],
+                              i == 0 ? state->m_unfilter_previous : state->m_rows[i - 1], state->m_rows[i],
+                              state->m_ihdr) == false)
+        {
+            return false;
+        }
+    }
+
+    memcpy(state->m_unfilter_previous, state->m_rows[count - 1], state->m_row_length - 1);
+
+    return true;
+}
+
+static bool filter_band(band_state *state, const uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (filter_rgba_row(state->m_rows[i], i == 0 ? state->m_filter_previous : state->m_rows[i - 1],
+                            state->m_scratch, &state->m_filtered[i * state->m_row_length], state->m_ihdr) == false)
+        {
+            return false;
+        }
+    }
+
+    memcpy(state->m_filter_previous, state->m_rows[count - 1], state->m_row_length - 1);
+
+    return true;
+}
+
+static bool encode_bands(band_state *state, const unsigned char *const data, const uint32_t data_length,
+                         const uint32_t flags, const uint32_t band_rows, const char **error)
+{
+    uint32_t height = state->m_ihdr.m_height;
+    uint32_t data_rows = data_rows_rgba(state->m_ihdr, data_length);
+    uint32_t first_rows = min_rows(height, data_rows > band_rows ? data_rows : band_rows);
+    uint32_t count = 0;
+
+    if (alloc_buffers(state, first_rows) == false)
+    {
+        *error = "Could not allocate band buffers!\n";
+        return false;
+    }
+
+    if (next_idat(state, PNG_PARSER_RESET) == false ||
+        deflate_backend_deflate_start(state->m_output, BAND_CODEC_IDAT_BYTES, DEFLATE_LEVEL_DEFAULT) == false)
+    {
+        *error = "Extraction of IDAT raw data failed!\n";
+        return false;
+    }
+
+    for (uint32_t row = 0; row < height; row += count)
+    {
+        count = row == 0 ? first_rows : min_rows(band_rows, height - row);
+
+        if (inflate_band(state, state->m_filtered, count * state->m_row_length) == false ||
+            unfilter_band(state, count) == false)
+        {
+            *error = "Uncompression of IDAT raw data failed!\n";
+            return false;
+        }
+
+        // Payload rows all sit in the first band, the size check is against the whole image
+        if (row == 0 &&
+            encode_data_rgba(state->m_rows, state->m_ihdr, (unsigned char *)data, data_length, flags) == false)
+        {
+            *error = "Encoding failed!\n";
+            return false;
+        }
+
+        if (filter_band(state, count) == false)
+        {
+            *error = "Could not filter output image!\n";
+            return false;
+        }
+
+        if (deflate_backend_deflate_drain(state->m_filtered, count * state->m_row_length, row + count == height,
+                                          write_idat, state) == false)
+        {
+            *error = "Could not write image to file!\n";
+            return false;
+        }
+    }
+
+    if (finish_inflate(state) == false)
+    {
+        *error = "Uncompression of IDAT raw data failed!\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Header defined functions
+
+bool band_encode(const char *input_name, const char *output_name, const unsigned char *const data,
+                 const uint32_t data_length, const uint32_t flags, const uint32_t band_rows, const char **error)
+{
+    band_state state;
+    png_chunk_index chunks;
+    bool result = false;
+
+    memset(&state, 0, sizeof(band_state));
+
+    if (band_rows == 0 || png_open(input_name, "rb") == false)
+    {
+        *error = "File is not found!\n";
+        return false;
+    }
+
+    state.m_ihdr = read_png_IHDR();
+    state.m_row_length = png_row_size(state.m_ihdr) + 1;
+
+    if (png_is_supported(state.m_ihdr) == false)
+    {
+        png_close();
+        *error = "Uncompression of IDAT raw data failed!\n";
+        return false;
+    }
+
+    if (state.m_ihdr.m_interlace_method != INTERLACE_METHOD_NONE)
+    {
+        png_close();
+        *error = "Banded encoding needs a non-interlaced image!\n";
+        return false;
+    }
+
+    chunks = read_png_chunk_index();
+    state.m_fd = png_stream_start(output_name, state.m_ihdr);
+
+    if (state.m_fd < 0 || png_stream_write_chunks(state.m_fd, &chunks, false) == false)
+    {
+        if (state.m_fd >= 0)
+        {
+            png_stream_finish(state.m_fd, false);
+        }
+
+        png_close();
+        image_free(chunks.m_spans);
+        image_free(chunks.m_data);
+        *error = "Could not write image to file!\n";
+        return false;
+    }
+
+    result = encode_bands(&state, data, data_length, flags, band_rows, error);
+
+    if (result == true && png_stream_write_chunks(state.m_fd, &chunks, true) == false)
+    {
+        *error = "Could not write image to file!\n";
+        result = false;
+    }
+
+    if (png_stream_finish(state.m_fd, result) == false && result == true)
+    {
+        *error = "Could not write image to file!\n";
+        result = false;
+    }
+
+    png_close();
+    free_buffers(&state);
+    image_free(chunks.m_spans);
+    image_free(chunks.m_data);
+
+    return result;
+}
@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../inc/global_config.h"
+#include "../inc/batch.h"
+#include "../inc/codec.h"
+#include "../inc/thread_pool.h"
+#include "../inc/pipeline.h"
+
+#define BYTES_IN_MEGABYTE (1024.0 * 1024.0)
+
+// Helper functions
+
+static inline double seconds_now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static char *copy_string(const char *src)
+{
+    char *result = (char *)malloc(strlen(src) + 1);
+
+    if (result != NULL)
+    {
+        strcpy(result, src);
+    }
+
+    return result;
+}
+
+// Manifest parsing
+
+// Skip the rest of a line fgets stopped in, true if there was any
+static bool skip_line_rest(FILE *fp)
+{
+    int character = getc(fp);
+    bool result = character != EOF && character != '\n';
+
+    while (character != EOF && character != '\n')
+    {
+        character = getc(fp);
+    }
+
+    return result;
+}
+
+// Fan-out manifests name no input, every job takes carrier_name instead. Malformed lines are counted, not run
+static bool parse_manifest(const char *manifest_name, const char *carrier_name, batch_job **jobs_out, size_t *job_count,
+                           size_t *bad_line_count)
+{
+    const size_t expected_fields = carrier_name != NULL ? 2 : 3;
+    FILE *fp = fopen(manifest_name, "r");
+    char line[BATCH_MAX_LINE_LENGTH];
+    size_t line_number = 0;
+    size_t capacity = 0;
+    batch_job *jobs = NULL;
+
+    *jobs_out = NULL;
+    *job_count = 0;
+    *bad_line_count = 0;
+
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char *fields[3] = {NULL};
+        char *token = NULL;
+        size_t field_count = 0;
+        size_t length = strlen(line);
+
+        line_number++;
+
+        // Rest of a longer line would be read as a line of its own, maybe a job writing somewhere unintended
+        if (length > 0 && line[length - 1] != '\n' && skip_line_rest(fp) == true)
+        {
+            fprintf(stderr, "[Error] %s:%zu: line is longer than %d characters\n", manifest_name, line_number,
+                    BATCH_MAX_LINE_LENGTH - 1);
+            (*bad_line_count)++;
+            continue;
+        }
+
+        for (token = strtok(line, BATCH_FIELD_SEPARATORS); token != NULL; token = strtok(NULL, BATCH_FIELD_SEPARATORS))
+        {
+            if (field_count == 0 && token[0] == BATCH_COMMENT_CHARACTER)
+            {
+                break;
+            }
+
+            if (field_count < 3)
+            {
+                fields[field_count] = token;
+            }
+
+            field_count++;
+        }
+
+        // Skip empty and comment lines
+        if (field_count == 0)
+        {
+            continue;
+        }
+
+        if (field_count != expected_fields)
+        {
+            fprintf(stderr, "[Error] %s:%zu: expected %s<payload_file> <output_image>\n", manifest_name, line_number,
+                    carrier_name != NULL ? "" : "<input_image> ");
+            (*bad_line_count)++;
+            continue;
+        }
+
+        // Grow job storage
+        if (*job_count == capacity)
+        {
+            batch_job *grown = NULL;
+
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            grown = (batch_job *)realloc(jobs, capacity * sizeof(batch_job));
+
+            if (grown == NULL)
+            {
+                fclose(fp);
+                *jobs_out = jobs;
+                return false;
+            }
+
+            jobs = grown;
+        }
+
+        jobs[*job_count].m_input_name = copy_string(carrier_name != NULL ? carrier_name : fields[0]);
+        jobs[*job_count].m_payload_name = copy_string(fields[expected_fields - 2]);
+        jobs[*job_count].m_output_name = copy_string(fields[expected_fields - 1]);
+        jobs[*job_count].m_line = line_number;
+
+        (*job_count)++;
+
+        // Counted already, so the names copied are freed with the others
+        if (jobs[*job_count - 1].m_input_name == NULL || jobs[*job_count - 1].m_payload_name == NULL ||
+            jobs[*job_count - 1].m_output_name == NULL)
+        {
+            fclose(fp);
+            *jobs_out = jobs;
+            return false;
+        }
+    }
+
+    fclose(fp);
+
+    *jobs_out = jobs;
+
+    return true;
+}
+
+// Job execution
+
+/**
+ * @brief Shared state of a running batch
+ */
+typedef struct
+{
+    size_t m_failed_count;
+    unsigned long int m_total_bytes;
+    unsigned long int m_saved_bytes;
+    image_arena_pool m_arenas;
+    carrier_cache m_cache_storage;
+    carrier_cache *m_cache;
+    FILE *m_stats;
+    pthread_mutex_t m_lock;
+
+} batch_context;
+
+static void report_batch_job(codec_job *job, void *context)
+{
+    batch_context *batch = (batch_context *)context;
+
+    pthread_mutex_lock(&batch->m_lock);
+
+    if (job->m_error != NULL)
+    {
+        batch->m_failed_count++;
+    }
+    else
+    {
+        batch->m_total_bytes += job->m_bytes_in + job->m_bytes_out;
+        batch->m_saved_bytes += job->m_optimize_report.m_baseline_length - job->m_optimize_report.m_best_length;
+    }
+
+    pthread_mutex_unlock(&batch->m_lock);
+
+    // Single call, so lines of different workers do not interleave
+    if (job->m_error != NULL)
+    {
+        printf("[Error] %s -> %s: %s", job->m_input_name, job->m_output_name, job->m_error);
+    }
+    else if (job->m_optimize != PNG_OPTIMIZE_OFF)
+    {
+        printf("[OK] %s -> %s (%.3f ms, optimized %lu -> %lu bytes)\n", job->m_input_name, job->m_output_name,
+               job->m_seconds * 1000.0, job->m_optimize_report.m_baseline_length, job->m_optimize_report.m_best_length);
+    }
+    else
+    {
+        printf("[OK] %s -> %s (%.3f ms)\n", job->m_input_name, job->m_output_name, job->m_seconds * 1000.0);
+    }
+
+    if (batch->m_stats != NULL)
+    {
+        codec_write_stats(batch->m_stats, job);
+    }
+}
+
+/**
+ * @brief Pool task argument
+ */
+typedef struct
+{
+    codec_job *m_job;
+    batch_context *m_batch;
+
+} batch_task;
+
+static void run_batch_job(void *argument)
+{
+    batch_task *task = (batch_task *)argument;
+
+    codec_run(task->m_job);
+    report_batch_job(task->m_job, task->m_batch);
+    codec_job_release(task->m_job);
+}
+
+static void run_on_pool(codec_job *const codec_jobs, const size_t job_count, size_t worker_count, batch_context *batch)
+{
+    thread_pool_group group = {0};
+    thread_pool *pool = thread_pool_create(worker_count);
+    batch_task *tasks = (batch_task *)malloc(job_count * sizeof(batch_task) + 1);
+
+    for (size_t i = 0; i < job_count; i++)
+    {
+        if (tasks == NULL)
+        {
+            batch_task task = {&codec_jobs[i], batch};
+            run_batch_job(&task);
+            continue;
+        }
+
+        tasks[i].m_job = &codec_jobs[i];
+        tasks[i].m_batch = batch;
+
+        // Run inline if there is no pool or it cannot take the job
+        if (pool == NULL || thread_pool_submit(pool, &group, run_batch_job, &tasks[i]) == false)
+        {
+            run_batch_job(&tasks[i]);
+        }
+    }
+
+    if (pool != NULL)
+    {
+        thread_pool_wait(pool, &group);
+        thread_pool_destroy(pool);
+    }
+
+    free(tasks);
+}
+
+static void free_manifest(batch_job *jobs, const size_t job_count)
+{
+    for (size_t i = 0; i < job_count; i++)
+    {
+        free(jobs[i].m_input_name);
+        free(jobs[i].m_payload_name);
+        free(jobs[i].m_output_name);
+    }
+
+    free(jobs);
+}
+
+// Runs every parsed job, encoding into the shared carrier if carrier_name is set; bad lines count as failed jobs
+static int run_jobs(batch_job *jobs, const size_t job_count, const size_t bad_line_count, const char *carrier_name,
+                    const batch_options *const options)
+{
+    double start = 0;
+    double elapsed = 0;
+    codec_job *codec_jobs = NULL;
+    codec_carrier carrier;
+    bool is_carrier_loaded = false;
+    batch_context batch = {0};
+    async_io *io = NULL;
+    async_io_stats io_stats = {0};
+    const char *io_backend_name = NULL;
+
+    codec_jobs = (codec_job *)malloc(job_count * sizeof(codec_job) + 1);
+
+    if (codec_jobs == NULL)
+    {
+        perror("Could not allocate batch jobs!\n");
+        return PROGRAM_ERROR;
+    }
+
+    if (image_arena_pool_init(&batch.m_arenas) == false)
+    {
+        perror("Could not allocate batch arenas!\n");
+        free(codec_jobs);
+        return PROGRAM_ERROR;
+    }
+
+    if (options->m_stats_name != NULL && strlen(options->m_stats_name) > 0)
+    {
+        batch.m_stats = fopen(options->m_stats_name, "ab");
+
+        if (batch.m_stats == NULL)
+        {
+            perror("Could not open stats file!\n");
+        }
+    }
+
+    if (options->m_cache_directory != NULL && strlen(options->m_cache_directory) > 0)
+    {
+        if (carrier_cache_open(&batch.m_cache_storage, options->m_cache_directory, options->m_cache_max_bytes) == true)
+        {
+            batch.m_cache = &batch.m_cache_storage;
+        }
+        else
+        {
+            perror("Could not open carrier cache!\n");
+        }
+    }
+
+    // Carrier is decoded once, before any job starts
+    if (carrier_name != NULL)
+    {
+        start = seconds_now();
+        is_carrier_loaded = codec_carrier_load(&carrier, carrier_name, batch.m_cache, options->m_index_band_rows);
+        elapsed = seconds_now() - start;
+
+        if (is_carrier_loaded == false)
+        {
+            printf("[Error] %s: %s", carrier_name, carrier.m_job.m_error);
+        }
+        else
+        {
+            printf("Carrier: %s decoded once in %.3f ms for %zu outputs\n", carrier_name, elapsed * 1000.0, job_count);
+        }
+    }
+
+    // Fan-out reads nothing but its carrier, only writes go through async I/O then
+    if (options->m_prefetch_depth > 0)
+    {
+        const char **input_names = (const char **)malloc(job_count * sizeof(const char *) + 1);
+
+        for (size_t i = 0; input_names != NULL && i < job_count; i++)
+        {
+            input_names[i] = jobs[i].m_input_name;
+        }
+
+        if (input_names != NULL)
+        {
+            io = async_io_create(input_names, carrier_name == NULL ? job_count : 0, options->m_prefetch_depth,
+                                 options->m_io_backend);
+
+            // Fallback of an explicit io_uring is told, not taken silently
+            if (io == NULL && options->m_io_backend == ASYNC_IO_BACKEND_IO_URING)
+            {
+                fprintf(stderr, "[Warning] io_uring is not available, falling back to %s!\n",
+                        ASYNC_IO_BACKEND_NAME_THREADS);
+                io = async_io_create(input_names, carrier_name == NULL ? job_count : 0, options->m_prefetch_depth,
+                                     ASYNC_IO_BACKEND_THREADS);
+            }
+        }
+
+        if (io == NULL)
+        {
+            perror("Could not start asynchronous I/O!\n");
+        }
+        else
+        {
+            io_backend_name = async_io_backend_name(io);
+        }
+
+        // Async I/O keeps the names, not the array
+        free(input_names);
+    }
+
+    for (size_t i = 0; i < job_count; i++)
+    {
+        codec_job_init(&codec_jobs[i], jobs[i].m_input_name, jobs[i].m_output_name, true);
+        codec_jobs[i].m_io = io;
+        codec_jobs[i].m_io_index = i;
+        codec_jobs[i].m_carrier = is_carrier_loaded ? &carrier : NULL;
+        codec_jobs[i].m_payload_name = jobs[i].m_payload_name;
+        codec_jobs[i].m_arena_pool = &batch.m_arenas;
+        codec_jobs[i].m_optimize = options->m_optimize;
+        codec_jobs[i].m_index_band_rows = options->m_index_band_rows;
+        codec_jobs[i].m_interlace = options->m_interlace;
+        codec_jobs[i].m_compress = options->m_compress;
+        codec_jobs[i].m_key = options->m_key;
+        codec_jobs[i].m_scatter = options->m_scatter;
+        codec_jobs[i].m_cache = batch.m_cache;
+    }
+
+    pthread_mutex_init(&batch.m_lock, NULL);
+
+    start = seconds_now();
+
+    // Without its carrier no job can run
+    if (carrier_name != NULL && is_carrier_loaded == false)
+    {
+        batch.m_failed_count += job_count;
+    }
+    // Pool is also the fallback when the pipeline cannot start
+    else if (options->m_scheduler != BATCH_SCHEDULER_PIPELINE ||
+             run_pipeline(codec_jobs, job_count, 0, report_batch_job, &batch) == false)
+    {
+        run_on_pool(codec_jobs, job_count, options->m_worker_count, &batch);
+    }
+
+    // Batch is done once its last output is on disk
+    if (io != NULL)
+    {
+        async_io_destroy(io, &io_stats);
+        batch.m_failed_count += io_stats.m_failed_writes;
+    }
+
+    elapsed = seconds_now() - start;
+
+    batch.m_failed_count += bad_line_count;
+
+    printf("Batch: %zu images, %zu failed, %s, %.3f s, %.2f images/s, %.2f MB/s\n",
+           job_count + bad_line_count, batch.m_failed_count,
+           options->m_scheduler == BATCH_SCHEDULER_PIPELINE ? "pipeline" : "pool", elapsed,
+           elapsed > 0 ? (job_count + bad_line_count - batch.m_failed_count) / elapsed : 0.0,
+           elapsed > 0 ? batch.m_total_bytes / BYTES_IN_MEGABYTE / elapsed : 0.0);
+
+    if (options->m_optimize != PNG_OPTIMIZE_OFF)
+    {
+        printf("Optimized: %.2f MB saved over default compression\n", batch.m_saved_bytes / BYTES_IN_MEGABYTE);
+    }
+
+    if (io_backend_name != NULL)
+    {
+        printf("I/O: %s, depth %zu, %lu reads (%.2f MB), %lu writes (%.2f MB), %lu failed writes\n",
+               io_backend_name, options->m_prefetch_depth, io_stats.m_reads, io_stats.m_read_bytes / BYTES_IN_MEGABYTE,
+               io_stats.m_writes, io_stats.m_write_bytes / BYTES_IN_MEGABYTE, io_stats.m_failed_writes);
+    }
+
+    // Carrier may be mapped from the cache
+    if (carrier_name != NULL)
+    {
+        codec_carrier_release(&carrier);
+    }
+
+    if (batch.m_cache != NULL)
+    {
+        printf("Cache: %lu hits, %lu misses, %lu evictions\n", atomic_load(&batch.m_cache->m_hits),
+               atomic_load(&batch.m_cache->m_misses), atomic_load(&batch.m_cache->m_evictions));
+        carrier_cache_close(batch.m_cache);
+    }
+
+    image_arena_pool_free(&batch.m_arenas);
+
+    printf("Arenas: %zu, %lu allocations (%.2f MB) served, %lu system allocations (%.2f MB), peak %.2f MB per image\n",
+           batch.m_arenas.m_created, batch.m_arenas.m_counters.m_alloc_count,
+           batch.m_arenas.m_counters.m_alloc_bytes / BYTES_IN_MEGABYTE,
+           batch.m_arenas.m_counters.m_system_alloc_count,
+           batch.m_arenas.m_counters.m_system_alloc_bytes / BYTES_IN_MEGABYTE,
+           batch.m_arenas.m_counters.m_peak_bytes / BYTES_IN_MEGABYTE);
+
+    printf("Pages: %s, %.2f MB on huge pages, %.2f MB bound to the local NUMA node\n", image_arena_page_policy_name(),
+           batch.m_arenas.m_counters.m_huge_page_bytes / BYTES_IN_MEGABYTE,
+           batch.m_arenas.m_counters.m_node_local_bytes / BYTES_IN_MEGABYTE);
+
+    if (batch.m_stats != NULL)
+    {
+        fclose(batch.m_stats);
+    }
+
+    pthread_mutex_destroy(&batch.m_lock);
+    free(codec_jobs);
+
+    return batch.m_failed_count == 0 ? PROGRAM_OK : PROGRAM_ERROR;
+}
+
+// Header defined functions
+
+int run_batch(const char *manifest_name, const batch_options *const options)
+{
+    size_t job_count = 0;
+    size_t bad_line_count = 0;
+    batch_job *jobs = NULL;
+    int result = PROGRAM_OK;
+
+    if (parse_manifest(manifest_name, NULL, &jobs, &job_count, &bad_line_count) == false)
+    {
+        perror("Could not read batch manifest!\n");
+        free_manifest(jobs, job_count);
+        return PROGRAM_ERROR;
+    }
+
+    result = run_jobs(jobs, job_count, bad_line_count, NULL, options);
+
+    free_manifest(jobs, job_count);
+
+    return result;
+}
+
+int run_fanout(const char *carrier_name, const char *manifest_name, const batch_options *const options)
+{
+    size_t job_count = 0;
+    size_t bad_line_count = 0;
+    batch_job *jobs = NULL;
+    int result = PROGRAM_OK;
+
+    if (parse_manifest(manifest_name, carrier_name, &jobs, &job_count, &bad_line_count) == false)
+    {
+        perror("Could not read fan-out manifest!\n");
+        free_manifest(jobs, job_count);
+        return PROGRAM_ERROR;
+    }
+
+    result = run_jobs(jobs, job_count, bad_line_count, carrier_name, options);
+
+    free_manifest(jobs, job_count);
+
+    return result;
+}
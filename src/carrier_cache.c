@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zlib.h"
+
+#include "../inc/carrier_cache.h"
+#include "../inc/image_arena.h"
+
+// Trailer of a zlib stream is the Adler-32 of the uncompressed data
+#define ZLIB_TRAILER_LENGTH 4
+
+#define CARRIER_CACHE_TEMP_PREFIX ".tmp"
+#define CARRIER_CACHE_DIRECTORY_MODE 0755
+#define CARRIER_CACHE_FILE_MODE 0644
+
+/**
+ * @brief Start of every entry file
+ *
+ * Filter types follow the header, pixels start at m_pixel_offset, page aligned.
+ * Native byte order, entries are not meant to move between machines.
+ */
+typedef struct
+{
+    char m_magic[CARRIER_CACHE_MAGIC_LENGTH];
+    uint32_t m_width;
+    uint32_t m_height;
+    unsigned char m_bit_depth;
+    unsigned char m_color_type;
+    unsigned char m_compression_method;
+    unsigned char m_filter_method;
+    unsigned char m_interlace_method;
+    uint32_t m_pixel_size;
+    uint64_t m_idat_length;
+    uint32_t m_idat_crc;
+    uint32_t m_idat_adler;
+    uint64_t m_pixel_offset;
+
+} entry_header;
+
+/**
+ * @brief Entry seen while scanning for eviction
+ */
+typedef struct
+{
+    char m_name[NAME_MAX + 1];
+    off_t m_size;
+    struct timespec m_mtime;
+
+} entry_info;
+
+static atomic_ulong g_temp_counter = 0;
+
+// Helper functions
+
+static inline size_t pixel_offset(const uint32_t height)
+{
+    size_t length = sizeof(entry_header) + height;
+
+    return (length + CARRIER_CACHE_PAGE_SIZE - 1) / CARRIER_CACHE_PAGE_SIZE * CARRIER_CACHE_PAGE_SIZE;
+}
+
+static inline size_t row_size(const carrier_cache_key *const key)
+{
+    return (size_t)key->m_width * key->m_pixel_size;
+}
+
+static inline size_t entry_size(const carrier_cache_key *const key)
+{
+    return pixel_offset(key->m_height) + row_size(key) * key->m_height;
+}
+
+static inline bool entry_path(const carrier_cache *cache, const carrier_cache_key *const key, char *dest)
+{
+    int length = snprintf(dest, CARRIER_CACHE_MAX_PATH_LENGTH, "%s/%08x%08x_%ux%u_%02x%02x%02x%02x%02x_%lx" CARRIER_CACHE_EXTENSION,
+                          cache->m_directory, key->m_idat_crc, key->m_idat_adler, key->m_width, key->m_height,
+                          key->m_bit_depth, key->m_color_type, key->m_compression_method, key->m_filter_method,
+                          key->m_interlace_method, key->m_idat_length);
+
+    return length > 0 && length < CARRIER_CACHE_MAX_PATH_LENGTH;
+}
+
+static bool write_all(const int fd, const void *buffer, size_t length)
+{
+    const unsigned char *position = (const unsigned char *)buffer;
+
+    while (length > 0)
+    {
+        ssize_t written = write(fd, position, length);
+
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (written <= 0)
+        {
+            return false;
+        }
+
+        position += written;
+        length -= written;
+    }
+
+    return true;
+}
+
+static bool is_entry_name(const char *name)
+{
+    size_t length = strlen(name);
+    size_t extension_length = strlen(CARRIER_CACHE_EXTENSION);
+
+    return name[0] != '.' && length > extension_length &&
+           strcmp(&name[length - extension_length], CARRIER_CACHE_EXTENSION) == 0;
+}
+
+static int compare_entry_age(const void *a, const void *b)
+{
+    const struct timespec *left = &((const entry_info *)a)->m_mtime;
+    const struct timespec *right = &((const entry_info *)b)->m_mtime;
+
+    if (left->tv_sec != right->tv_sec)
+    {
+        return left->tv_sec < right->tv_sec ? -1 : 1;
+    }
+
+    return left->tv_nsec < right->tv_nsec ? -1 : left->tv_nsec > right->tv_nsec;
+}
+
+static void evict(carrier_cache *cache)
+{
+    DIR *directory = NULL;
+    struct dirent *dirent = NULL;
+    entry_info *entries = NULL;
+    size_t entry_count = 0;
+    size_t capacity = 0;
+    unsigned long int total = 0;
+
+    // One scan at a time, other processes may still evict concurrently and unlink just fails for them
+    pthread_mutex_lock(&cache->m_evict_lock);
+
+    directory = opendir(cache->m_directory);
+
+    if (directory == NULL)
+    {
+        pthread_mutex_unlock(&cache->m_evict_lock);
+        return;
+    }
+
+    while ((dirent = readdir(directory)) != NULL)
+    {
+        struct stat info;
+
+        if (is_entry_name(dirent->d_name) == false ||
+            fstatat(dirfd(directory), dirent->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            continue;
+        }
+
+        if (entry_count == capacity)
+        {
+            entry_info *grown = NULL;
+
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            grown = (entry_info *)realloc(entries, capacity * sizeof(entry_info));
+
+            if (grown == NULL)
+            {
+                break;
+            }
+
+            entries = grown;
+        }
+
+        strcpy(entries[entry_count].m_name, dirent->d_name);
+        entries[entry_count].m_size = info.st_size;
+        entries[entry_count].m_mtime = info.st_mtim;
+        entry_count++;
+
+        total += info.st_size;
+    }
+
+    // Least recently used first
+    if (total > cache->m_max_bytes)
+    {
+        qsort(entries, entry_count, sizeof(entry_info), compare_entry_age);
+    }
+
+    for (size_t i = 0; i < entry_count && total > cache->m_max_bytes; i++)
+    {
+        // Images mapped from the entry keep their pages until unmapped
+        if (unlinkat(dirfd(directory), entries[i].m_name, 0) == 0)
+        {
+            atomic_fetch_add(&cache->m_evictions, 1);
+        }
+
+        total -= entries[i].m_size;
+    }
+
+    closedir(directory);
+    free(entries);
+
+    pthread_mutex_unlock(&cache->m_evict_lock);
+}
+
+// Header defined functions
+
+bool carrier_cache_open(carrier_cache *cache, const char *directory, const unsigned long int max_bytes)
+{
+    memset(cache, 0, sizeof(carrier_cache));
+
+    if (strlen(directory) >= CARRIER_CACHE_MAX_PATH_LENGTH)
+    {
+        return false;
+    }
+
+    if (mkdir(directory, CARRIER_CACHE_DIRECTORY_MODE) != 0 && errno != EEXIST)
+    {
+        return false;
+    }
+
+    strcpy(cache->m_directory, directory);
+    cache->m_max_bytes = max_bytes;
+
+    atomic_init(&cache->m_hits, 0);
+    atomic_init(&cache->m_misses, 0);
+    atomic_init(&cache->m_evictions, 0);
+
+    return pthread_mutex_init(&cache->m_evict_lock, NULL) == 0;
+}
+
+void carrier_cache_close(carrier_cache *cache)
+{
+    pthread_mutex_destroy(&cache->m_evict_lock);
+}
+
+carrier_cache_key carrier_cache_key_of(const IHDR_chunk ihdr, const unsigned char *const compressed_data,
+                                       const unsigned long int compressed_data_length)
+{
+    carrier_cache_key result;
+
+    memset(&result, 0, sizeof(carrier_cache_key));
+
+    result.m_width = ihdr.m_width;
+    result.m_height = ihdr.m_height;
+    result.m_bit_depth = ihdr.m_bit_depth;
+    result.m_color_type = ihdr.m_color_type;
+    result.m_compression_method = ihdr.m_compression_method;
+    result.m_filter_method = ihdr.m_filter_method;
+    result.m_interlace_method = ihdr.m_interlace_method;
+    result.m_pixel_size = png_pixel_size(ihdr);
+    result.m_idat_length = compressed_data_length;
+    result.m_idat_crc = crc32_z(crc32(0L, Z_NULL, 0), compressed_data, compressed_data_length);
+
+    if (compressed_data_length >= ZLIB_TRAILER_LENGTH)
+    {
+        const unsigned char *trailer = &compressed_data[compressed_data_length - ZLIB_TRAILER_LENGTH];
+
+        result.m_idat_adler = (uint32_t)trailer[0] << 24 | (uint32_t)trailer[1] << 16 |
+                              (uint32_t)trailer[2] << 8 | (uint32_t)trailer[3];
+    }
+
+    return result;
+}
+
+RGBA_pixel **carrier_cache_map(carrier_cache *cache, const carrier_cache_key *const key,
+                               carrier_cache_mapping *const mapping, const unsigned char **filter_types)
+{
+    char path[CARRIER_CACHE_MAX_PATH_LENGTH];
+    const entry_header *header = NULL;
+    RGBA_pixel **result = NULL;
+    unsigned char *address = NULL;
+    size_t length = entry_size(key);
+    struct stat info;
+    int fd = -1;
+
+    memset(mapping, 0, sizeof(carrier_cache_mapping));
+    *filter_types = NULL;
+
+    fd = entry_path(cache, key, path) ? open(path, O_RDONLY) : -1;
+
+    if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size != length)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        atomic_fetch_add(&cache->m_misses, 1);
+        return NULL;
+    }
+
+    // Private mapping: embedding writes only copy the pages it touches
+    address = (unsigned char *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    // Touch entry for LRU eviction
+    if (address != MAP_FAILED)
+    {
+        futimens(fd, NULL);
+    }
+
+    close(fd);
+
+    if (address == MAP_FAILED)
+    {
+        atomic_fetch_add(&cache->m_misses, 1);
+        return NULL;
+    }
+
+    header = (const entry_header *)address;
+    result = (RGBA_pixel **)image_alloc(key->m_height * sizeof(RGBA_pixel *));
+
+    if (result == NULL || memcmp(header->m_magic, CARRIER_CACHE_MAGIC, CARRIER_CACHE_MAGIC_LENGTH) != 0 ||
+        header->m_width != key->m_width || header->m_height != key->m_height ||
+        header->m_bit_depth != key->m_bit_depth || header->m_color_type != key->m_color_type ||
+        header->m_compression_method != key->m_compression_method ||
+        header->m_filter_method != key->m_filter_method || header->m_interlace_method != key->m_interlace_method ||
+        header->m_pixel_size != key->m_pixel_size || header->m_idat_length != key->m_idat_length ||
+        header->m_idat_crc != key->m_idat_crc || header->m_idat_adler != key->m_idat_adler ||
+        header->m_pixel_offset != pixel_offset(key->m_height))
+    {
+        image_free(result);
+        munmap(address, length);
+        atomic_fetch_add(&cache->m_misses, 1);
+        return NULL;
+    }
+
+    for (uint32_t row = 0; row < key->m_height; row++)
+    {
+        result[row] = (RGBA_pixel *)&address[header->m_pixel_offset + row * row_size(key)];
+    }
+
+    mapping->m_address = address;
+    mapping->m_length = length;
+    *filter_types = &address[sizeof(entry_header)];
+
+    atomic_fetch_add(&cache->m_hits, 1);
+
+    return result;
+}
+
+void carrier_cache_unmap(carrier_cache_mapping *const mapping, RGBA_pixel **image)
+{
+    image_free(image);
+
+    if (mapping->m_address != NULL)
+    {
+        munmap(mapping->m_address, mapping->m_length);
+    }
+
+    memset(mapping, 0, sizeof(carrier_cache_mapping));
+}
+
+bool carrier_cache_store(carrier_cache *cache, const carrier_cache_key *const key, RGBA_pixel **image,
+                         const unsigned char *const filter_types)
+{
+    char path[CARRIER_CACHE_MAX_PATH_LENGTH];
+    char temp_path[CARRIER_CACHE_MAX_PATH_LENGTH];
+    size_t offset = pixel_offset(key->m_height);
+    unsigned char *head = NULL;
+    entry_header header;
+    bool result = false;
+    int fd = -1;
+
+    if (entry_path(cache, key, path) == false ||
+        snprintf(temp_path, sizeof(temp_path), "%s/" CARRIER_CACHE_TEMP_PREFIX ".%d.%lu", cache->m_directory,
+                 (int)getpid(), atomic_fetch_add(&g_temp_counter, 1)) >= (int)sizeof(temp_path))
+    {
+        return false;
+    }
+
+    // Header, filter types and padding up to the pixels in one write
+    head = (unsigned char *)calloc(1, offset);
+
+    if (head == NULL)
+    {
+        return false;
+    }
+
+    memset(&header, 0, sizeof(entry_header));
+    memcpy(header.m_magic, CARRIER_CACHE_MAGIC, CARRIER_CACHE_MAGIC_LENGTH);
+    header.m_width = key->m_width;
+    header.m_height = key->m_height;
+    header.m_bit_depth = key->m_bit_depth;
+    header.m_color_type = key->m_color_type;
+    header.m_compression_method = key->m_compression_method;
+    header.m_filter_method = key->m_filter_method;
+    header.m_interlace_method = key->m_interlace_method;
+    header.m_pixel_size = key->m_pixel_size;
+    header.m_idat_length = key->m_idat_length;
+    header.m_idat_crc = key->m_idat_crc;
+    header.m_idat_adler = key->m_idat_adler;
+    header.m_pixel_offset = offset;
+
+    memcpy(head, &header, sizeof(entry_header));
+    memcpy(&head[sizeof(entry_header)], filter_types, key->m_height);
+
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL, CARRIER_CACHE_FILE_MODE);
+
+    // Written under a temporary name, so readers never map a partial entry
+    if (fd >= 0)
+    {
+        result = write_all(fd, head, offset) &&
+                 write_all(fd, image[0], row_size(key) * key->m_height);
+        result = close(fd) == 0 && result;
+        result = result && rename(temp_path, path) == 0;
+
+        if (result == false)
+        {
+            unlink(temp_path);
+        }
+    }
+
+    free(head);
+
+    if (result == true)
+    {
+        evict(cache);
+    }
+
+    return result;
+}
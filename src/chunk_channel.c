@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "zlib.h"
+
+#include "../inc/chunk_channel.h"
+#include "../inc/png_parser.h"
+
+static inline bool is_chunk(const outside_chunk *const chunk, const unsigned char *const signature)
+{
+    return memcmp(chunk->m_type, signature, TYPE_SIGNATURE_LENGTH) == 0;
+}
+
+// Header defined functions
+
+bool chunk_channel_encode(const char *input_name, const char *output_name, const unsigned char *const data,
+                          const uint32_t data_length, const char **error)
+{
+    IHDR_chunk ihdr;
+    bool result = false;
+
+    if (png_open(input_name, "rb") == false)
+    {
+        *error = "File is not found!\n";
+        return false;
+    }
+
+    // Pixels are never looked at, any image with a header goes
+    ihdr = read_png_IHDR();
+
+    if (is_chunk(&ihdr.m_outside_chunk, IHDR_SIGNATURE) == false)
+    {
+        *error = "Image header is not found!\n";
+    }
+    else if (data_length > PNG_MAX_CHUNK_LENGTH)
+    {
+        *error = "Data is too long for one chunk!\n";
+    }
+    else if (png_splice_chunk(output_name, stPL_SIGNATURE, data, data_length) == false)
+    {
+        *error = "Could not write image to file!\n";
+    }
+    else
+    {
+        result = true;
+    }
+
+    png_close();
+
+    return result;
+}
+
+bool chunk_channel_is_used(const char *file_name)
+{
+    outside_chunk chunk;
+
+    if (png_is_standard_stream(file_name) == true || png_open(file_name, "rb") == false)
+    {
+        return false;
+    }
+
+    chunk = read_png_chunk(stPL_SIGNATURE, PNG_PARSER_RESET);
+
+    png_close();
+
+    return is_chunk(&chunk, stPL_SIGNATURE);
+}
+
+bool chunk_channel_decode(const char *input_name, unsigned char **data, uint32_t *data_length, const char **error)
+{
+    outside_chunk chunk;
+    unsigned char *result = NULL;
+
+    *data = NULL;
+    *data_length = 0;
+
+    if (png_open(input_name, "rb") == false)
+    {
+        *error = "File is not found!\n";
+        return false;
+    }
+
+    chunk = read_png_chunk(stPL_SIGNATURE, PNG_PARSER_RESET);
+
+    if (is_chunk(&chunk, stPL_SIGNATURE) == false || chunk.m_data_length > PNG_MAX_CHUNK_LENGTH)
+    {
+        png_close();
+        *error = "Payload chunk is not found!\n";
+        return false;
+    }
+
+    // + 1 for the '\0' appended
+    result = (unsigned char *)malloc((size_t)chunk.m_data_length + 1);
+
+    if (result == NULL || read_png_chunk_data(chunk, 0, result) == false ||
+        crc32(crc32(0L, stPL_SIGNATURE, TYPE_SIGNATURE_LENGTH), result, chunk.m_data_length) != chunk.m_CRC_32)
+    {
+        png_close();
+        free(result);
+        *error = "Payload chunk is damaged!\n";
+        return false;
+    }
+
+    png_close();
+
+    result[chunk.m_data_length] = '\0';
+
+    *data = result;
+    *data_length = chunk.m_data_length + 1;
+
+    return true;
+}
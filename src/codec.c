@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "zlib.h"
 
@@ -11,228 +12,1646 @@
 #include "../inc/png_parser.h"
 #include "../inc/png_filtration.h"
 #include "../inc/png_data_encoder.h"
+#include "../inc/png_optimizer.h"
+#include "../inc/image_arena.h"
+#include "../inc/row_overlap.h"
+#include "../inc/band_codec.h"
+#include "../inc/adam7.h"
+#include "../inc/apng.h"
+#include "../inc/chunk_channel.h"
+#include "../inc/payload_compression.h"
+#include "../inc/payload_cipher.h"
 
-int encoding(program_inp input)
+// Helper functions
+
+static inline double seconds_now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static inline bool job_fail(codec_job *job, const char *error)
+{
+    job->m_error = error;
+    return false;
+}
+
+// Image row at position index of the order the payload goes in
+static inline uint32_t job_payload_row(const codec_job *job, const uint32_t index)
+{
+    return job->m_scatter != NULL ? row_scatter_row(job->m_scatter, job->m_ihdr.m_height, index) : index;
+}
+
+static void free_image(codec_job *job)
+{
+    if (job->m_cache_mapping.m_address != NULL)
+    {
+        carrier_cache_unmap(&job->m_cache_mapping, job->m_image);
+        job->m_carrier_filter_types = NULL;
+    }
+    // Private rows of a shared carrier are one block starting at the first payload row
+    else if (job->m_carrier != NULL && job->m_image != NULL)
+    {
+        image_free(job->m_image[job_payload_row(job, 0)]);
+        image_free(job->m_image);
+    }
+    else
+    {
+        free_rgba_png(job->m_image);
+    }
+
+    job->m_image = NULL;
+}
+
+// Rows of the image the job works on, fewer than the image has when only the payload rows are decoded
+static inline IHDR_chunk job_rows_ihdr(const codec_job *job)
+{
+    IHDR_chunk result = job->m_ihdr;
+
+    if (job->m_decoded_rows != 0)
+    {
+        result.m_height = job->m_decoded_rows;
+    }
+
+    return result;
+}
+
+// Image the job encodes: same as the input, interlaced as requested
+static inline IHDR_chunk job_output_ihdr(const codec_job *job)
+{
+    IHDR_chunk result = job->m_ihdr;
+
+    if (job->m_interlace != INTERLACE_METHOD_KEEP)
+    {
+        result.m_interlace_method = job->m_interlace;
+    }
+
+    return result;
+}
+
+static inline bool job_is_input_interlaced(const codec_job *job)
+{
+    return job->m_ihdr.m_interlace_method != INTERLACE_METHOD_NONE;
+}
+
+static inline bool job_is_output_interlaced(const codec_job *job)
+{
+    return job_output_ihdr(job).m_interlace_method != INTERLACE_METHOD_NONE;
+}
+
+// Jobs on a shared carrier carry the chunks of the carrier
+static inline const png_chunk_index *job_chunks(const codec_job *job)
+{
+    return job->m_carrier != NULL ? &job->m_carrier->m_job.m_chunks : &job->m_chunks;
+}
+
+static inline bool job_has_index(const codec_job *job)
+{
+    return job->m_index_band_rows != 0 && job->m_optimize == PNG_OPTIMIZE_OFF && job_is_output_interlaced(job) == false;
+}
+
+// Encoding whose select, filter, and deflate run as one overlapped step
+static inline bool job_overlaps_filter(const codec_job *job)
+{
+    return job->m_overlap_rows == true && job->m_encode == true && job->m_optimize == PNG_OPTIMIZE_OFF &&
+           job->m_carrier == NULL && job->m_carrier_filter_types == NULL && job_has_index(job) == false &&
+           job_is_output_interlaced(job) == false;
+}
+
+// Rows a job sharing a carrier selects and filters itself: the payload rows and the row after them
+static inline uint32_t job_refiltered_rows(const codec_job *job)
+{
+    return job->m_private_rows < job->m_ihdr.m_height ? job->m_private_rows + 1 : job->m_ihdr.m_height;
+}
+
+// First row of a band must not look at the row above, so every band unfilters on its own
+static void restrict_band_start_filters(unsigned char *const filter_types, const uint32_t height, const uint32_t band_rows)
+{
+    for (uint32_t row = band_rows; row < height; row += band_rows)
+    {
+        if (filter_types[row] != PNG_FILTER_NONE && filter_types[row] != PNG_FILTER_SUB)
+        {
+            filter_types[row] = PNG_FILTER_SUB;
+        }
+    }
+}
+
+static unsigned long int held_bytes(const codec_job *job)
+{
+    unsigned long int result = 0;
+
+    if (job->m_compressed_data != NULL)
+    {
+        result += job->m_compressed_data_len;
+    }
+
+    if (job->m_uncompressed_data != NULL)
+    {
+        result += job->m_uncompressed_data_len;
+    }
+
+    if (job->m_image != NULL)
+    {
+        uint32_t rows = job->m_carrier != NULL ? job->m_private_rows : job_rows_ihdr(job).m_height;
+
+        result += png_row_size(job->m_ihdr) * rows;
+    }
+
+    if (job->m_filter_types != NULL)
+    {
+        result += job->m_ihdr.m_height;
+    }
+
+    if (job->m_filtered_data != NULL)
+    {
+        result += job->m_filtered_data_len;
+    }
+
+    if (job->m_decoded_data != NULL)
+    {
+        result += job->m_decoded_data_len;
+    }
+
+    return result;
+}
+
+static void write_json_string(FILE *fp, const char *text)
+{
+    fputc('"', fp);
+
+    for (; *text != '\0'; text++)
+    {
+        unsigned char character = (unsigned char)*text;
+
+        if (character == '"' || character == '\\')
+        {
+            fputc('\\', fp);
+            fputc(character, fp);
+        }
+        else if (character < 0x20)
+        {
+            fprintf(fp, "\\u%04x", character);
+        }
+        else
+        {
+            fputc(character, fp);
+        }
+    }
+
+    fputc('"', fp);
+}
+
+static unsigned char *read_payload_file(const char *file_name, uint32_t *length)
+{
+    unsigned char *result = NULL;
+    FILE *fp = fopen(file_name, "rb");
+    long int size = 0;
+
+    *length = 0;
+
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+
+    // + 1 so empty payloads still get a valid buffer
+    result = size < 0 ? NULL : (unsigned char *)image_alloc(size + 1);
+
+    if (result == NULL || fread(result, 1, size, fp) != (size_t)size)
+    {
+        image_free(result);
+        fclose(fp);
+        return NULL;
+    }
+
+    fclose(fp);
+
+    *length = size;
+
+    return result;
+}
+
+/**
+ * @brief Compress and encrypt payload as asked, in that order, ciphertext does not shrink
+ *
+ * @return False only if encryption fails, packed stays NULL if the payload goes in as it is
+ */
+static bool pack_payload(const unsigned char *const data, const uint32_t length, const bool compress,
+                         const unsigned char *const key, unsigned char **packed, uint32_t *packed_length,
+                         uint32_t *flags)
+{
+    unsigned char *compressed = NULL;
+    uint32_t compressed_length = 0;
+
+    *packed = NULL;
+    *packed_length = length;
+    *flags = 0;
+
+    // Not shrinking or failing to compress only costs rows, the payload goes in as it is
+    if (compress == true && (compressed = payload_compress(data, length, &compressed_length)) != NULL)
+    {
+        *packed = compressed;
+        *packed_length = compressed_length;
+        *flags = PAYLOAD_FLAG_COMPRESSED;
+    }
+
+    if (key == NULL)
+    {
+        return true;
+    }
+
+    // Flags are final before encryption, they are authenticated with the payload
+    *flags |= PAYLOAD_FLAG_ENCRYPTED;
+    *packed = payload_encrypt(compressed != NULL ? compressed : data, *packed_length, key, *flags, packed_length);
+
+    image_free(compressed);
+
+    return *packed != NULL;
+}
+
+static void replace_payload(unsigned char **data, uint32_t *length, unsigned char *const result,
+                            const uint32_t result_length)
+{
+    image_free(*data);
+
+    *data = result;
+    *length = result_length;
+}
+
+/**
+ * @brief Reverse pack_payload on data as decode_data_rgba returns it, '\0' appended and counted
+ *
+ * data is replaced by the plain payload, in the same form.
+ */
+static bool unpack_payload(unsigned char **data, uint32_t *length, const uint32_t flags,
+                           const unsigned char *const key, const char **error)
+{
+    unsigned char *result = NULL;
+    uint32_t result_length = 0;
+
+    if ((flags & PAYLOAD_FLAG_ENCRYPTED) != 0)
+    {
+        if (key == NULL)
+        {
+            *error = "Payload is encrypted, a key is needed!\n";
+            return false;
+        }
+
+        if ((result = payload_decrypt(*data, *length - 1, key, flags, &result_length)) == NULL)
+        {
+            *error = "Could not decrypt payload, the key is wrong or the image was changed!\n";
+            return false;
+        }
+
+        replace_payload(data, length, result, result_length);
+    }
+
+    if ((flags & PAYLOAD_FLAG_COMPRESSED) != 0)
+    {
+        if ((result = payload_uncompress(*data, *length - 1, &result_length)) == NULL)
+        {
+            *error = "Could not uncompress payload!\n";
+            return false;
+        }
+
+        replace_payload(data, length, result, result_length);
+    }
+
+    return true;
+}
+
+static bool load_payload(codec_job *job)
+{
+    // Load payload from file if it is not given in memory
+    if (job->m_encode == true && job->m_payload_name != NULL)
+    {
+        job->m_owned_hidden_data = read_payload_file(job->m_payload_name, &job->m_hidden_data_len);
+        job->m_hidden_data = job->m_owned_hidden_data;
+
+        if (job->m_owned_hidden_data == NULL)
+        {
+            return job_fail(job, "Could not read payload file!\n");
+        }
+    }
+
+    if (job->m_encode == true && (job->m_compress == true || job->m_key != NULL) && job->m_payload_flags == 0)
+    {
+        unsigned char *packed = NULL;
+        uint32_t packed_length = 0;
+
+        if (pack_payload(job->m_hidden_data, job->m_hidden_data_len, job->m_compress, job->m_key, &packed,
+                         &packed_length, &job->m_payload_flags) == false)
+        {
+            return job_fail(job, "Could not encrypt payload!\n");
+        }
+
+        if (packed != NULL)
+        {
+            image_free(job->m_owned_hidden_data);
+
+            job->m_owned_hidden_data = packed;
+            job->m_hidden_data = packed;
+            job->m_hidden_data_len = packed_length;
+        }
+    }
+
+    return true;
+}
+
+// Prefetched input is parsed from memory
+static bool open_input(codec_job *job)
+{
+    const unsigned char *data = NULL;
+    size_t length = 0;
+
+    if (job->m_io == NULL)
+    {
+        return png_open(job->m_input_name, "rb");
+    }
+
+    data = async_io_read(job->m_io, job->m_io_index, &length);
+
+    if (data == NULL || png_open_memory(data, length) == false)
+    {
+        async_io_release(job->m_io, job->m_io_index);
+        return false;
+    }
+
+    return true;
+}
+
+static inline bool has_input_chunk(const unsigned char *const signature)
+{
+    outside_chunk chunk = read_png_chunk(signature, PNG_PARSER_RESET);
+
+    return memcmp(chunk.m_type, signature, TYPE_SIGNATURE_LENGTH) == 0;
+}
+
+static void close_input(codec_job *job)
+{
+    png_close();
+
+    if (job->m_io != NULL)
+    {
+        async_io_release(job->m_io, job->m_io_index);
+    }
+}
+
+// Stages
+
+static bool stage_read(codec_job *job)
+{
+    // Shared carrier is decoded already, only the payload is left to read
+    if (job->m_carrier != NULL)
+    {
+        job->m_ihdr = job->m_carrier->m_job.m_ihdr;
+
+        if (job->m_arena != NULL)
+        {
+            image_arena_reserve(job->m_arena, image_arena_size_for(job->m_ihdr));
+        }
+
+        return load_payload(job);
+    }
+
+    if (open_input(job) == false)
+    {
+        return job_fail(job, "File is not found!\n");
+    }
+
+    // Frames take apng_encode and apng_decode, the stages would only see the default image
+    if (has_input_chunk(acTL_SIGNATURE) == true)
+    {
+        close_input(job);
+        return job_fail(job, "Animated images are only encoded and decoded one at a time!\n");
+    }
+
+    // Payload of the chunk channel is not in the pixels, chunk_channel_decode reads it
+    if (job->m_encode == false && has_input_chunk(stPL_SIGNATURE) == true)
+    {
+        close_input(job);
+        return job_fail(job, "Chunk channel payloads are only decoded one at a time!\n");
+    }
+
+    // Extract IHDR
+    job->m_ihdr = read_png_IHDR();
+
+    // Size arena for every buffer of this image before the first one is taken
+    if (job->m_arena != NULL)
+    {
+        image_arena_reserve(job->m_arena, image_arena_size_for(job->m_ihdr));
+    }
+
+    // Extract compressed data
+    job->m_compressed_data = extract_IDAT_raw_all(&job->m_compressed_data_len);
+
+    // Decoding can skip to the payload rows of indexed images
+    if (job->m_compressed_data != NULL && job->m_encode == false)
+    {
+        job->m_seek_index = read_png_seek_index(job->m_ihdr, job->m_compressed_data_len);
+    }
+
+    // Only located here, chunks of an input file are copied by the kernel when the image is written
+    if (job->m_compressed_data != NULL && job->m_encode == true)
+    {
+        job->m_chunks = read_png_chunk_index();
+    }
+
+    // Close image
+    close_input(job);
+
+    if (job->m_compressed_data == NULL)
+    {
+        return job_fail(job, "Extraction of IDAT raw data failed!\n");
+    }
+
+    // Cached carrier needs neither inflate nor unfilter; interlaced carriers have no filter types to cache
+    if (job->m_cache != NULL && job->m_encode == true && job_is_input_interlaced(job) == false)
+    {
+        job->m_cache_key = carrier_cache_key_of(job->m_ihdr, job->m_compressed_data, job->m_compressed_data_len);
+        job->m_image = carrier_cache_map(job->m_cache, &job->m_cache_key, &job->m_cache_mapping,
+                                         &job->m_carrier_filter_types);
+        job->m_cache_hit = job->m_image != NULL;
+    }
+
+    if (load_payload(job) == false)
+    {
+        return false;
+    }
+
+    job->m_bytes_in = job->m_compressed_data_len;
+
+    return true;
+}
+
+static bool inflate_payload_rows(codec_job *job)
+{
+    unsigned long int row_length = png_row_size(job->m_ihdr) + 1;
+    IHDR_chunk rows_ihdr = job->m_ihdr;
+    RGBA_pixel **header_image = NULL;
+    uint32_t data_length = 0;
+    bool is_ok = false;
+
+    // Bands holding the length header first
+    job->m_uncompressed_data = uncompress_data_rows(job->m_ihdr, job->m_compressed_data, job->m_compressed_data_len,
+                                                    &job->m_seek_index, data_rows_rgba(job->m_ihdr, 0),
+                                                    &job->m_uncompressed_data_len);
+
+    if (job->m_uncompressed_data == NULL)
+    {
+        return false;
+    }
+
+    rows_ihdr.m_height = job->m_uncompressed_data_len / row_length;
+    header_image = unfilter_rgba_png(job->m_uncompressed_data, rows_ihdr);
+    is_ok = header_image != NULL && decode_data_length_rgba(header_image, job->m_ihdr, &data_length) == true;
+    free_rgba_png(header_image);
+
+    if (is_ok == false)
+    {
+        return false;
+    }
+
+    // Then every band up to the last payload row, if the header bands do not hold it already
+    if (data_rows_rgba(job->m_ihdr, data_length) > rows_ihdr.m_height)
+    {
+        image_free(job->m_uncompressed_data);
+
+        job->m_uncompressed_data = uncompress_data_rows(job->m_ihdr, job->m_compressed_data, job->m_compressed_data_len,
+                                                        &job->m_seek_index, data_rows_rgba(job->m_ihdr, data_length),
+                                                        &job->m_uncompressed_data_len);
+
+        if (job->m_uncompressed_data == NULL)
+        {
+            return false;
+        }
+    }
+
+    job->m_decoded_rows = job->m_uncompressed_data_len / row_length;
+
+    return true;
+}
+
+static bool stage_inflate(codec_job *job)
+{
+    // Pixels came from the carrier cache or are shared with a decoded carrier
+    if (job->m_image != NULL || job->m_carrier != NULL)
+    {
+        image_free(job->m_compressed_data);
+        job->m_compressed_data = NULL;
+
+        return true;
+    }
+
+    // Indexed images decode only the rows holding the payload, others fall back to the whole stream.
+    // Scattered payload rows are spread over every band
+    if (job->m_encode == false && job->m_seek_index.m_point_count != 0 && job->m_scatter == NULL &&
+        inflate_payload_rows(job) == true)
+    {
+        image_free(job->m_compressed_data);
+        job->m_compressed_data = NULL;
+
+        return true;
+    }
+
+    image_free(job->m_uncompressed_data);
+    job->m_uncompressed_data = NULL;
+    job->m_decoded_rows = 0;
+
+    // Unfilter stage inflates while it goes
+    if (job->m_overlap_rows == true && job_is_input_interlaced(job) == false)
+    {
+        return true;
+    }
+
+    job->m_uncompressed_data = uncompress_data(job->m_ihdr, job->m_compressed_data, job->m_compressed_data_len,
+                                               &job->m_uncompressed_data_len);
+
+    image_free(job->m_compressed_data);
+    job->m_compressed_data = NULL;
+
+    if (job->m_uncompressed_data == NULL)
+    {
+        return job_fail(job, "Uncompression of IDAT raw data failed!\n");
+    }
+
+    return true;
+}
+
+static void store_in_cache(codec_job *job, unsigned char *const filter_types)
+{
+    unsigned long int row_length = png_row_size(job->m_ihdr) + 1;
+
+    // Filter types of the carrier are the first byte of every filtered row, overlapped unfilter collected them already
+    for (uint32_t row = 0; job->m_uncompressed_data != NULL && row < job->m_ihdr.m_height; row++)
+    {
+        filter_types[row] = job->m_uncompressed_data[row * row_length];
+    }
+
+    // Failing to cache only costs the next job the decode
+    if (job->m_image != NULL)
+    {
+        carrier_cache_store(job->m_cache, &job->m_cache_key, job->m_image, filter_types);
+    }
+}
+
+static bool share_carrier_rows(codec_job *job)
+{
+    const codec_job *carrier = &job->m_carrier->m_job;
+    size_t row_size = png_row_size(job->m_ihdr);
+    unsigned char *private_rows = NULL;
+
+    job->m_private_rows = data_rows_rgba(job->m_ihdr, job->m_hidden_data_len);
+
+    // Payload rows are one private block, in the order the payload goes in
+    job->m_image = (RGBA_pixel **)image_alloc(job->m_ihdr.m_height * sizeof(RGBA_pixel *));
+    private_rows = (unsigned char *)image_alloc(row_size * job->m_private_rows);
+
+    if (job->m_image == NULL || private_rows == NULL)
+    {
+        image_free(job->m_image);
+        image_free(private_rows);
+        job->m_image = NULL;
+
+        return job_fail(job, "Could not copy carrier rows!\n");
+    }
+
+    // Copy on write: embedding only touches the payload rows, every other row points into the carrier
+    memcpy(job->m_image, carrier->m_image, job->m_ihdr.m_height * sizeof(RGBA_pixel *));
+
+    for (uint32_t i = 0; i < job->m_private_rows; i++)
+    {
+        uint32_t row = job_payload_row(job, i);
+
+        job->m_image[row] = (RGBA_pixel *)&private_rows[i * row_size];
+        memcpy(job->m_image[row], carrier->m_image[row], row_size);
+    }
+
+    return true;
+}
+
+static bool stage_unfilter(codec_job *job)
+{
+    unsigned char *filter_types = NULL;
+
+    if (job->m_carrier != NULL)
+    {
+        return share_carrier_rows(job);
+    }
+
+    // Pixels came from the carrier cache
+    if (job->m_image != NULL)
+    {
+        return true;
+    }
+
+    if (job->m_cache != NULL && job->m_encode == true && job_is_input_interlaced(job) == false)
+    {
+        filter_types = (unsigned char *)image_alloc(job->m_ihdr.m_height);
+    }
+
+    // Inflate was left for this stage when rows overlap
+    if (job->m_uncompressed_data == NULL && job->m_compressed_data != NULL)
+    {
+        job->m_image = row_overlap_unfilter(job->m_ihdr, job->m_compressed_data, job->m_compressed_data_len, filter_types);
+
+        image_free(job->m_compressed_data);
+        job->m_compressed_data = NULL;
+    }
+    else if (job_is_input_interlaced(job) == true)
+    {
+        job->m_image = adam7_unfilter(job->m_uncompressed_data, job->m_ihdr, job->m_pass_pool);
+    }
+    else
+    {
+        job->m_image = unfilter_rgba_png(job->m_uncompressed_data, job_rows_ihdr(job));
+    }
+
+    if (filter_types != NULL)
+    {
+        store_in_cache(job, filter_types);
+    }
+
+    image_free(filter_types);
+
+    image_free(job->m_uncompressed_data);
+    job->m_uncompressed_data = NULL;
+
+    if (job->m_image == NULL)
+    {
+        return job_fail(job, "Could not unfilter image!\n");
+    }
+
+    return true;
+}
+
+// Rows holding data of given length, in the order it goes in; the image itself unless scattered
+static RGBA_pixel **payload_rows(const codec_job *job, const uint32_t data_length)
+{
+    if (job->m_scatter == NULL)
+    {
+        return job->m_image;
+    }
+
+    return row_scatter_view(job->m_scatter, job->m_image, job->m_ihdr.m_height, data_rows_rgba(job->m_ihdr, data_length));
+}
+
+static void release_payload_rows(const codec_job *job, RGBA_pixel **rows)
+{
+    if (rows != job->m_image)
+    {
+        image_free(rows);
+    }
+}
+
+// Scattered rows are looked up for the length header first, then for the data it announces
+static RGBA_pixel **decoded_payload_rows(const codec_job *job)
+{
+    RGBA_pixel **rows = payload_rows(job, 0);
+    uint32_t data_length = 0;
+    bool is_ok = false;
+
+    if (job->m_scatter == NULL || rows == NULL)
+    {
+        return rows;
+    }
+
+    is_ok = decode_data_length_rgba(rows, job->m_ihdr, &data_length);
+    release_payload_rows(job, rows);
+
+    return is_ok == true ? payload_rows(job, data_length) : NULL;
+}
+
+static bool stage_embed(codec_job *job)
+{
+    RGBA_pixel **rows = NULL;
+    bool is_ok = false;
+
+    if (job->m_encode == true)
+    {
+        // Encode data in file
+        rows = payload_rows(job, job->m_hidden_data_len);
+        is_ok = rows != NULL && encode_data_rgba(rows, job->m_ihdr, (unsigned char *)job->m_hidden_data,
+                                                 job->m_hidden_data_len, job->m_payload_flags) == true;
+        release_payload_rows(job, rows);
+
+        if (is_ok == false)
+        {
+            return job_fail(job, "Encoding failed!\n");
+        }
+
+        return true;
+    }
+
+    // Decode data from file
+    rows = decoded_payload_rows(job);
+    is_ok = rows != NULL && decode_data_rgba(rows, job_rows_ihdr(job), &job->m_decoded_data, &job->m_decoded_data_len,
+                                             &job->m_payload_flags) == true;
+
+    if (is_ok == false)
+    {
+        job_fail(job, rows != NULL ? decode_data_error_rgba(rows, job_rows_ihdr(job)) : "Decoding failed!\n");
+        release_payload_rows(job, rows);
+        return false;
+    }
+
+    release_payload_rows(job, rows);
+
+    if (unpack_payload(&job->m_decoded_data, &job->m_decoded_data_len, job->m_payload_flags, job->m_key,
+                       &job->m_error) == false)
+    {
+        return false;
+    }
+
+    // Pixels are not needed anymore in decoding mode
+    free_image(job);
+
+    return true;
+}
+
+static bool stage_select(codec_job *job)
+{
+    IHDR_chunk ihdr = job_output_ihdr(job);
+
+    // Nothing to filter in decoding mode, optimizer and overlapped deflate filter on their own; passes pick filters as they go
+    if (job->m_encode == false || job->m_optimize != PNG_OPTIMIZE_OFF || job_overlaps_filter(job) == true ||
+        job_is_output_interlaced(job) == true)
+    {
+        return true;
+    }
+
+    job->m_filter_types = (unsigned char *)image_alloc(job->m_ihdr.m_height);
+
+    if (job->m_filter_types == NULL)
+    {
+        return job_fail(job, "Could not select filters of output image!\n");
+    }
+
+    // Shared carrier rows keep the filter choice made for the carrier, so do scattered payload rows:
+    // embedding only changes low bits
+    if (job->m_carrier != NULL && job->m_scatter != NULL)
+    {
+        memcpy(job->m_filter_types, job->m_carrier->m_job.m_filter_types, job->m_ihdr.m_height);
+    }
+    else if (job->m_carrier != NULL)
+    {
+        IHDR_chunk refiltered_ihdr = ihdr;
+
+        refiltered_ihdr.m_height = job_refiltered_rows(job);
+
+        if (select_rgba_png_filters(refiltered_ihdr, job->m_image, job->m_filter_types) == false)
+        {
+            return job_fail(job, "Could not select filters of output image!\n");
+        }
+
+        memcpy(&job->m_filter_types[refiltered_ihdr.m_height], &job->m_carrier->m_job.m_filter_types[refiltered_ihdr.m_height],
+               job->m_ihdr.m_height - refiltered_ihdr.m_height);
+    }
+    // Carrier from the cache keeps its own filter choice, embedding only changes low bits
+    else if (job->m_carrier_filter_types != NULL)
+    {
+        memcpy(job->m_filter_types, job->m_carrier_filter_types, job->m_ihdr.m_height);
+    }
+    else if (select_rgba_png_filters(ihdr, job->m_image, job->m_filter_types) == false)
+    {
+        return job_fail(job, "Could not select filters of output image!\n");
+    }
+
+    if (job_has_index(job) == true)
+    {
+        restrict_band_start_filters(job->m_filter_types, job->m_ihdr.m_height, job->m_index_band_rows);
+    }
+
+    return true;
+}
+
+// Scattered payload rows are spread over the carrier, each one and the row after it are filtered again
+static bool filter_scattered_rows(codec_job *job, unsigned char *const result)
 {
-    IHDR_chunk ihdr;
+    IHDR_chunk ihdr = job_output_ihdr(job);
+    unsigned long int row_length = png_row_size(ihdr) + 1;
+    RGBA_pixel *zero_row = (RGBA_pixel *)image_alloc(row_length);
+    bool is_ok = zero_row != NULL;
+
+    if (zero_row != NULL)
+    {
+        memset(zero_row, 0, row_length);
+    }
 
-    unsigned char *compressed_data = NULL;
-    unsigned long int compressed_data_len = 0;
+    for (uint32_t i = 0; is_ok == true && i < job->m_private_rows; i++)
+    {
+        uint32_t first = job_payload_row(job, i);
+        uint32_t last = first + 1 < ihdr.m_height ? first + 1 : first;
 
-    unsigned char *uncompressed_data = NULL;
-    unsigned long uncompressed_data_length = 0;
+        for (uint32_t row = first; is_ok == true && row <= last; row++)
+        {
+            is_ok = apply_rgba_row_filter(job->m_image[row], row > 0 ? job->m_image[row - 1] : zero_row,
+                                          job->m_filter_types[row], &result[row * row_length], ihdr);
+        }
+    }
 
-    RGBA_pixel **unfiltered_data = NULL;
+    image_free(zero_row);
 
-    const char *hidden_data = input.m_operation_argument;
+    return is_ok;
+}
 
-    unsigned long int out_filtered_len = 0;
-    unsigned char *out_filtered = NULL;
+static unsigned char *filter_shared_rows(codec_job *job, unsigned long int *const length)
+{
+    const codec_carrier *carrier = job->m_carrier;
+    unsigned long int row_length = png_row_size(job->m_ihdr) + 1;
+    unsigned long int refiltered_length = 0;
+    IHDR_chunk refiltered_ihdr = job_output_ihdr(job);
+    unsigned char *result = NULL;
+    bool is_ok = false;
 
-    unsigned long int out_compressed_len = 0;
-    unsigned char *out_compressed_data = NULL;
+    result = (unsigned char *)image_alloc(carrier->m_filtered_data_len);
 
-    if (png_open(input.m_input_name, "rb") == false)
+    if (result == NULL)
     {
-        perror("File is not found!\n");
-        return PROGRAM_ERROR;
+        return NULL;
     }
 
-    // Extract IHDR
-    ihdr = read_png_IHDR();
+    if (job->m_scatter != NULL)
+    {
+        memcpy(result, carrier->m_filtered_data, carrier->m_filtered_data_len);
+        is_ok = filter_scattered_rows(job, result);
+    }
+    else
+    {
+        refiltered_ihdr.m_height = job_refiltered_rows(job);
+        refiltered_length = refiltered_ihdr.m_height * row_length;
 
-    // Extract compressed data
-    compressed_data = (unsigned char *)extract_IDAT_raw_all(&compressed_data_len);
+        is_ok = apply_rgba_png_filters_to(refiltered_ihdr, job->m_image, job->m_filter_types, result);
+
+        // Rows below see the same pixels above them as in the carrier, so they filter to the same bytes
+        memcpy(&result[refiltered_length], &carrier->m_filtered_data[refiltered_length],
+               carrier->m_filtered_data_len - refiltered_length);
+    }
 
-    if (compressed_data == NULL)
+    if (is_ok == false)
     {
-        perror("Extraction of IDAT raw data failed!\n");
-        return PROGRAM_ERROR;
+        image_free(result);
+        return NULL;
     }
 
-    // Close image
-    png_close();
+    *length = carrier->m_filtered_data_len;
+
+    return result;
+}
 
-    // Uncompress data
-    uncompressed_data = uncompress_data(ihdr, compressed_data, compressed_data_len, &uncompressed_data_length);
+static bool stage_filter(codec_job *job)
+{
+    // Nothing to filter in decoding mode, optimizer and overlapped deflate filter on their own
+    if (job->m_encode == false || job->m_optimize != PNG_OPTIMIZE_OFF || job_overlaps_filter(job) == true)
+    {
+        return true;
+    }
 
-    if (uncompressed_data == NULL)
+    // Passes gather their pixels from the whole image, shared carrier rows included
+    if (job_is_output_interlaced(job) == true)
     {
-        perror("Uncompression of IDAT raw data failed!\n");
-        return PROGRAM_ERROR;
+        job->m_filtered_data = adam7_filter(job_output_ihdr(job), job->m_image, job->m_pass_pool,
+                                            &job->m_filtered_data_len);
+    }
+    else if (job->m_carrier != NULL)
+    {
+        job->m_filtered_data = filter_shared_rows(job, &job->m_filtered_data_len);
+    }
+    else
+    {
+        job->m_filtered_data = apply_rgba_png_filters(job_output_ihdr(job), job->m_image, job->m_filter_types,
+                                                      &job->m_filtered_data_len);
     }
 
-    free(compressed_data);
+    free_image(job);
 
-    // Unfilter data
-    unfiltered_data = unfilter_rgba_png(uncompressed_data, ihdr);
+    image_free(job->m_filter_types);
+    job->m_filter_types = NULL;
 
-    if (unfiltered_data == NULL)
+    if (job->m_filtered_data == NULL)
     {
-        perror("Could not unfilter image!\n");
-        return PROGRAM_ERROR;
+        return job_fail(job, "Could not filter output image!");
     }
 
-    free(uncompressed_data);
+    return true;
+}
+
+static bool stage_deflate(codec_job *job)
+{
+    // Nothing to compress in decoding mode
+    if (job->m_encode == false)
+    {
+        return true;
+    }
 
-    // Encode data in file
-    if (encode_data_rgba(unfiltered_data, ihdr, (unsigned char *)hidden_data, strlen(hidden_data)) == false)
+    // Every filter and compression candidate needs the pixels
+    if (job->m_optimize != PNG_OPTIMIZE_OFF)
     {
-        perror("Encoding failed!\n");
-        return PROGRAM_ERROR;
+        // Candidates are filtered top to bottom
+        if (job_is_output_interlaced(job) == true)
+        {
+            return job_fail(job, "Optimizer needs non-interlaced output!\n");
+        }
+
+        job->m_compressed_data = optimize_rgba_png(job_output_ihdr(job), job->m_image, job->m_optimize,
+                                                   &job->m_compressed_data_len, &job->m_optimize_report);
+
+        free_image(job);
+
+        if (job->m_compressed_data == NULL)
+        {
+            return job_fail(job, "Could not optimize output image!\n");
+        }
+
+        return true;
     }
 
-    // Filter data
-    out_filtered = filter_rgba_png(ihdr, unfiltered_data, &out_filtered_len);
+    // Filter stage left the rows to this one; unmapping a cache hit changes what job_overlaps_filter sees
+    if (job->m_filtered_data == NULL && job_overlaps_filter(job) == true)
+    {
+        job->m_compressed_data = row_overlap_filter(job_output_ihdr(job), job->m_image, &job->m_compressed_data_len);
 
-    if (out_filtered == NULL)
+        free_image(job);
+    }
+    else if (job_has_index(job) == true)
     {
-        perror("Could not filter output image!");
-        return PROGRAM_ERROR;
+        job->m_compressed_data = compress_data_indexed(&job->m_compressed_data_len, job->m_filtered_data, job_output_ihdr(job),
+                                                       job->m_index_band_rows, &job->m_seek_index);
+        job->m_seek_index.m_flags = SEEK_INDEX_FLAG_INDEPENDENT_ROWS;
+    }
+    else
+    {
+        job->m_compressed_data = compress_data(&job->m_compressed_data_len, job->m_filtered_data, job->m_filtered_data_len);
     }
 
-    for (size_t i = 0; i < ihdr.m_height; i++)
+    image_free(job->m_filtered_data);
+    job->m_filtered_data = NULL;
+
+    if (job->m_compressed_data == NULL)
     {
-        free(unfiltered_data[i]);
+        return job_fail(job, "Compression not compress output image!\n");
     }
 
-    free(unfiltered_data);
+    return true;
+}
 
-    // Compress it again
-    out_compressed_data = compress_data(&out_compressed_len, out_filtered, out_filtered_len);
+// Print data to the output file, or to stdout for the standard stream
+static bool print_decoded_data(const char *output_name, const unsigned char *const data)
+{
+    FILE *hidden_data_txt_fp = NULL;
 
-    if (out_compressed_data == NULL)
+    if (png_is_standard_stream(output_name) == true)
     {
-        perror("Compression not compress output image!\n");
-        return PROGRAM_ERROR;
+        hidden_data_txt_fp = stdout;
+    }
+    else
+    {
+        hidden_data_txt_fp = fopen(output_name, "wb");
     }
 
-    free(out_filtered);
+    if (hidden_data_txt_fp == NULL)
+    {
+        return false;
+    }
+
+    fprintf(hidden_data_txt_fp, "%s\n", data);
 
-    // Write image
-    if (png_open(input.m_output_name, "wb") == false)
+    if (hidden_data_txt_fp == stdout)
     {
-        perror("Could not open file!\n");
-        return PROGRAM_ERROR;
+        fflush(stdout);
+    }
+    else
+    {
+        fclose(hidden_data_txt_fp);
+    }
+
+    return true;
+}
+
+static bool stage_write(codec_job *job)
+{
+    bool is_buffered = job->m_io != NULL && png_is_standard_stream(job->m_output_name) == false;
+    unsigned char *buffer = NULL;
+    size_t buffer_length = 0;
+
+    if (job->m_encode == false)
+    {
+        if (print_decoded_data(job->m_output_name, job->m_decoded_data) == false)
+        {
+            return job_fail(job, "Could not write data in txt file\n");
+        }
+
+        job->m_bytes_out = job->m_decoded_data_len;
+
+        return true;
     }
 
-    if (write_png_IHDR(ihdr) == false)
+    if (is_buffered == true)
     {
-        perror("Could not write IHDR to file!\n");
-        return PROGRAM_ERROR;
+        // Failed background writes are reported by the async I/O
+        buffer = png_build_image(job_output_ihdr(job), &job->m_seek_index, job_chunks(job), job->m_compressed_data,
+                                 job->m_compressed_data_len, &buffer_length);
+
+        if (buffer == NULL || async_io_write(job->m_io, job->m_output_name, buffer, buffer_length) == false)
+        {
+            return job_fail(job, "Could not queue file for writing!\n");
+        }
+    }
+    else if (png_write_image(job->m_output_name, job_output_ihdr(job), &job->m_seek_index, job_chunks(job),
+                             job->m_compressed_data, job->m_compressed_data_len) == false)
+    {
+        return job_fail(job, "Could not write image to file!\n");
     }
 
-    if (write_png_IDAT(out_compressed_data, out_compressed_len) == false)
+    job->m_bytes_out = job->m_compressed_data_len;
+
+    image_free(job->m_compressed_data);
+    job->m_compressed_data = NULL;
+
+    return true;
+}
+
+static bool (*const g_stages[CODEC_STAGE_COUNT])(codec_job *job) = {
+    stage_read,
+    stage_inflate,
+    stage_unfilter,
+    stage_embed,
+    stage_select,
+    stage_filter,
+    stage_deflate,
+    stage_write,
+};
+
+// Stage names in statistics, the embed stage is called extract when decoding
+static const char *const g_stage_names[CODEC_STAGE_COUNT] = {
+    "read",
+    "inflate",
+    "unfilter",
+    "embed",
+    "filter_select",
+    "filter_apply",
+    "deflate",
+    "write",
+};
+
+static int run_cli_job(codec_job *job, const char *stats_name)
+{
+    FILE *stats_fp = NULL;
+    image_arena *arena = NULL;
+    int result = PROGRAM_OK;
+
+    // Reports must not end up inside an image written to stdout
+    FILE *report_fp = png_is_standard_stream(job->m_output_name) ? stderr : stdout;
+
+    // Single images get an arena too, so their large buffers follow the page policy
+    if (job->m_arena == NULL && job->m_arena_pool == NULL)
     {
-        perror("Could not write IDAT to file!\n");
-        return PROGRAM_ERROR;
+        arena = image_arena_create();
+        job->m_arena = arena;
     }
 
-    if (write_png_IEND() == false)
+    if (codec_run(job) == false)
     {
-        perror("Could not write IEND to file!\n");
-        return PROGRAM_ERROR;
+        perror(job->m_error);
+        result = PROGRAM_ERROR;
+    }
+    else if (job->m_optimize != PNG_OPTIMIZE_OFF)
+    {
+        const png_optimize_report *report = &job->m_optimize_report;
+
+        fprintf(report_fp, "Optimized: %lu -> %lu bytes (%.1f%% saved, carrier was %lu), %s filters, %s level %d strategy %d, "
+                "%u candidates\n",
+                report->m_baseline_length, report->m_best_length,
+                report->m_baseline_length > 0
+                    ? 100.0 * (report->m_baseline_length - report->m_best_length) / report->m_baseline_length
+                    : 0.0,
+                job->m_bytes_in, png_optimize_filter_name(report->m_filter), report->m_backend_name, report->m_level,
+                report->m_strategy, report->m_candidates);
     }
 
-    if (png_close() == false)
+    if (stats_name != NULL && strlen(stats_name) > 0)
     {
-        perror("Could not close file!\n");
-        return PROGRAM_ERROR;
+        stats_fp = fopen(stats_name, "ab");
+
+        if (stats_fp == NULL || codec_write_stats(stats_fp, job) == false)
+        {
+            perror("Could not write stats file!\n");
+            result = PROGRAM_ERROR;
+        }
+
+        if (stats_fp != NULL)
+        {
+            fclose(stats_fp);
+        }
     }
 
-    free(out_compressed_data);
+    codec_job_release(job);
+    image_arena_destroy(arena);
 
-    return PROGRAM_OK;
+    return result;
 }
 
-int decoding(program_inp input)
+// Header defined functions
+
+void codec_job_init(codec_job *job, const char *input_name, const char *output_name, const bool encode)
 {
-    IHDR_chunk ihdr;
+    memset(job, 0, sizeof(codec_job));
 
-    unsigned char *compressed_data = NULL;
-    unsigned long int compressed_data_len = 0;
+    job->m_input_name = input_name;
+    job->m_output_name = output_name;
+    job->m_encode = encode;
+    job->m_interlace = INTERLACE_METHOD_KEEP;
+}
+
+bool codec_run_stage(codec_job *job, const codec_stage stage)
+{
+    codec_stage_stats *stats = NULL;
+    unsigned long int alloc_start = 0;
+    double start = 0;
+    bool result = false;
 
-    unsigned char *uncompressed_data = NULL;
-    unsigned long uncompressed_data_length = 0;
+    // Failed jobs skip the remaining stages
+    if (job->m_error != NULL || stage >= CODEC_STAGE_COUNT)
+    {
+        return false;
+    }
 
-    RGBA_pixel **unfiltered_data = NULL;
+    // Take an arena for the job on its first stage
+    if (job->m_arena == NULL && job->m_arena_pool != NULL)
+    {
+        job->m_arena = image_arena_pool_acquire(job->m_arena_pool);
+    }
 
-    unsigned char *hidden_data = NULL;
-    uint32_t hidden_data_len = 0;
+    // Buffers of this stage come from the job arena, whichever thread runs it
+    image_arena_bind(job->m_arena);
 
-    FILE *hidden_data_txt_fp = NULL;
+    stats = &job->m_stats[stage];
+    stats->m_bytes_in = held_bytes(job);
+    alloc_start = image_alloc_bytes();
 
-    if (png_open(input.m_input_name, "rb") == false)
+    start = seconds_now();
+    result = g_stages[stage](job);
+    stats->m_seconds = seconds_now() - start;
+    job->m_seconds += stats->m_seconds;
+
+    image_arena_bind(NULL);
+
+    // Inputs are only freed at the end of a stage, so they count towards its peak
+    stats->m_peak_bytes = stats->m_bytes_in + (image_alloc_bytes() - alloc_start);
+    stats->m_bytes_out = held_bytes(job);
+
+    if (stage == CODEC_STAGE_READ)
     {
-        perror("File is not found!\n");
-        return PROGRAM_ERROR;
+        stats->m_bytes_in = job->m_bytes_in;
+    }
+    else if (stage == CODEC_STAGE_WRITE)
+    {
+        stats->m_bytes_out = job->m_bytes_out;
     }
 
-    // Extract IHDR
-    ihdr = read_png_IHDR();
+    return result;
+}
 
-    // Extract compressed data
-    compressed_data = (unsigned char *)extract_IDAT_raw_all(&compressed_data_len);
+bool codec_run(codec_job *job)
+{
+    for (int stage = 0; stage < CODEC_STAGE_COUNT; stage++)
+    {
+        if (codec_run_stage(job, stage) == false)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void codec_job_release(codec_job *job)
+{
+    image_arena_bind(job->m_arena);
 
-    if (compressed_data == NULL)
+    free_image(job);
+
+    image_free(job->m_compressed_data);
+    image_free(job->m_uncompressed_data);
+    image_free(job->m_filter_types);
+    image_free(job->m_filtered_data);
+    image_free(job->m_decoded_data);
+    image_free(job->m_owned_hidden_data);
+    image_free(job->m_seek_index.m_points);
+    image_free(job->m_chunks.m_spans);
+    image_free(job->m_chunks.m_data);
+
+    image_arena_bind(NULL);
+
+    // Arena is reset, not freed, and goes back for the next job
+    if (job->m_arena != NULL && job->m_arena_pool != NULL)
     {
-        perror("Extraction of IDAT raw data failed!\n");
-        return PROGRAM_ERROR;
+        image_arena_pool_release(job->m_arena_pool, job->m_arena);
+        job->m_arena = NULL;
     }
 
-    // Close image
-    png_close();
+    job->m_compressed_data = NULL;
+    job->m_uncompressed_data = NULL;
+    job->m_filter_types = NULL;
+    job->m_filtered_data = NULL;
+    job->m_decoded_data = NULL;
+    job->m_owned_hidden_data = NULL;
+    memset(&job->m_seek_index, 0, sizeof(seek_index));
+    memset(&job->m_chunks, 0, sizeof(png_chunk_index));
+}
+
+bool codec_carrier_load(codec_carrier *carrier, const char *input_name, carrier_cache *cache,
+                        const uint32_t index_band_rows)
+{
+    codec_job *job = &carrier->m_job;
+
+    memset(carrier, 0, sizeof(codec_carrier));
 
-    // Uncompress data
-    uncompressed_data = uncompress_data(ihdr, compressed_data, compressed_data_len, &uncompressed_data_length);
+    codec_job_init(job, input_name, NULL, true);
+    job->m_cache = cache;
+    job->m_index_band_rows = index_band_rows;
 
-    if (uncompressed_data == NULL)
+    // Shared rows are filtered top to bottom, whatever the carrier was
+    job->m_interlace = INTERLACE_METHOD_NONE;
+
+    for (codec_stage stage = CODEC_STAGE_READ; stage <= CODEC_STAGE_UNFILTER; stage++)
     {
-        perror("Uncompression of IDAT raw data failed!\n");
-        return PROGRAM_ERROR;
+        if (codec_run_stage(job, stage) == false)
+        {
+            return false;
+        }
+    }
+
+    // Nothing to embed, filters are picked for the carrier pixels as they are
+    if (codec_run_stage(job, CODEC_STAGE_SELECT) == false)
+    {
+        return false;
+    }
+
+    // Filter stage would free the pixels the jobs share
+    carrier->m_filtered_data = apply_rgba_png_filters(job_output_ihdr(job), job->m_image, job->m_filter_types,
+                                                      &carrier->m_filtered_data_len);
+
+    if (carrier->m_filtered_data == NULL)
+    {
+        return job_fail(job, "Could not filter carrier image!\n");
+    }
+
+    return true;
+}
+
+void codec_carrier_release(codec_carrier *carrier)
+{
+    image_free(carrier->m_filtered_data);
+    carrier->m_filtered_data = NULL;
+
+    codec_job_release(&carrier->m_job);
+}
+
+bool codec_write_stats(FILE *fp, const codec_job *job)
+{
+    bool result = false;
+
+    // One locked write per line, jobs of a batch report from several threads
+    flockfile(fp);
+
+    fprintf(fp, "{\"input\":");
+    write_json_string(fp, job->m_input_name);
+    fprintf(fp, ",\"output\":");
+    write_json_string(fp, job->m_output_name);
+    fprintf(fp, ",\"mode\":\"%s\",\"ok\":%s,\"width\":%u,\"height\":%u,\"ms\":%.3f,\"bytes_in\":%lu,\"bytes_out\":%lu",
+            job->m_encode ? "encode" : "decode", job->m_error == NULL ? "true" : "false",
+            job->m_ihdr.m_width, job->m_ihdr.m_height, job->m_seconds * 1000.0, job->m_bytes_in, job->m_bytes_out);
+
+    if (job->m_error != NULL)
+    {
+        fprintf(fp, ",\"error\":");
+        write_json_string(fp, job->m_error);
+    }
+
+    if (job->m_cache != NULL && job->m_encode == true)
+    {
+        fprintf(fp, ",\"cache\":\"%s\"", job->m_cache_hit ? "hit" : "miss");
+    }
+
+    if (job->m_arena != NULL)
+    {
+        fprintf(fp, ",\"pages\":{\"policy\":\"%s\",\"huge_bytes\":%zu,\"node\":%d}", image_arena_page_policy_name(),
+                job->m_arena->m_huge_bytes, job->m_arena->m_node);
+    }
+
+    if (job->m_optimize != PNG_OPTIMIZE_OFF && job->m_error == NULL)
+    {
+        const png_optimize_report *report = &job->m_optimize_report;
+
+        fprintf(fp, ",\"optimize\":{\"mode\":\"%s\",\"baseline_bytes\":%lu,\"best_bytes\":%lu,\"filter\":\"%s\","
+                    "\"backend\":\"%s\",\"level\":%d,\"strategy\":%d,\"candidates\":%u}",
+                png_optimize_mode_name(job->m_optimize), report->m_baseline_length, report->m_best_length,
+                png_optimize_filter_name(report->m_filter), report->m_backend_name, report->m_level,
+                report->m_strategy, report->m_candidates);
+    }
+
+    fprintf(fp, ",\"stages\":{");
+
+    for (int stage = 0; stage < CODEC_STAGE_COUNT; stage++)
+    {
+        const codec_stage_stats *stats = &job->m_stats[stage];
+
+        fprintf(fp, "%s\"%s\":{\"ms\":%.3f,\"bytes_in\":%lu,\"bytes_out\":%lu,\"peak_bytes\":%lu}",
+                stage == 0 ? "" : ",",
+                stage == CODEC_STAGE_EMBED && job->m_encode == false ? "extract" : g_stage_names[stage],
+                stats->m_seconds * 1000.0, stats->m_bytes_in, stats->m_bytes_out, stats->m_peak_bytes);
+    }
+
+    fprintf(fp, "}}\n");
+    fflush(fp);
+
+    result = ferror(fp) == 0;
+
+    funlockfile(fp);
+
+    return result;
+}
+
+int encode_image(const char *input_name, const char *output_name,
+                 const unsigned char *const hidden_data, const uint32_t hidden_data_len)
+{
+    codec_job job;
+
+    codec_job_init(&job, input_name, output_name, true);
+    job.m_hidden_data = hidden_data;
+    job.m_hidden_data_len = hidden_data_len;
+
+    return run_cli_job(&job, NULL);
+}
+
+int decode_image(const char *input_name, const char *output_name)
+{
+    codec_job job;
+
+    codec_job_init(&job, input_name, output_name, false);
+
+    return run_cli_job(&job, NULL);
+}
+
+// Key of the key file given, NULL if there is none
+static bool read_input_key(const program_inp *input, unsigned char *const key, const unsigned char **result)
+{
+    *result = NULL;
+
+    if (strlen(input->m_key_name) == 0)
+    {
+        return true;
+    }
+
+    if (payload_read_key(input->m_key_name, key) == false)
+    {
+        perror("Could not read key file!\n");
+        return false;
+    }
+
+    *result = key;
+
+    return true;
+}
+
+// Scatter order of the key file given, NULL if there is none
+static bool read_input_scatter(const program_inp *input, row_scatter *const scatter, const row_scatter **result)
+{
+    unsigned char key[PAYLOAD_KEY_LENGTH];
+
+    *result = NULL;
+
+    if (strlen(input->m_scatter_name) == 0)
+    {
+        return true;
+    }
+
+    if (payload_read_key(input->m_scatter_name, key) == false)
+    {
+        perror("Could not read scatter key file!\n");
+        return false;
     }
 
-    free(compressed_data);
+    row_scatter_init(scatter, key);
+    *result = scatter;
+
+    return true;
+}
+
+// Bands and frames embed the payload they are given, so it is packed here for them
+static int encode_outside_stages(const program_inp *input, const unsigned char *const key)
+{
+    const unsigned char *data = (const unsigned char *)input->m_operation_argument;
+    uint32_t data_length = strlen(input->m_operation_argument);
+    unsigned char *packed = NULL;
+    uint32_t flags = 0;
+    const char *error = "Could not encrypt payload!\n";
+    bool is_ok = false;
+
+    if (pack_payload(data, data_length, input->m_compress, key, &packed, &data_length, &flags) == true)
+    {
+        data = packed != NULL ? packed : data;
+
+        is_ok = input->m_band_rows != 0 ? band_encode(input->m_input_name, input->m_output_name, data, data_length,
+                                                      flags, input->m_band_rows, &error)
+                                        : apng_encode(input->m_input_name, input->m_output_name, data, data_length,
+                                                      flags, &error);
+    }
 
-    // Unfilter data
-    unfiltered_data = unfilter_rgba_png(uncompressed_data, ihdr);
+    image_free(packed);
 
-    if (unfiltered_data == NULL)
+    if (is_ok == false)
     {
-        perror("Could not unfilter image!\n");
+        perror(error);
         return PROGRAM_ERROR;
     }
 
-    free(uncompressed_data);
+    return PROGRAM_OK;
+}
+
+int encoding(program_inp input)
+{
+    carrier_cache cache;
+    codec_job job;
+    unsigned char key_buffer[PAYLOAD_KEY_LENGTH];
+    const unsigned char *key = NULL;
+    row_scatter scatter_buffer;
+    const row_scatter *scatter = NULL;
+    const char *error = NULL;
+    int result = PROGRAM_OK;
 
-    // Decode data in file
-    if (decode_data_rgba(unfiltered_data, ihdr, &hidden_data, &hidden_data_len) == false)
+    if (read_input_key(&input, key_buffer, &key) == false || read_input_scatter(&input, &scatter_buffer, &scatter) == false)
     {
-        perror("Decoding failed!\n");
         return PROGRAM_ERROR;
     }
 
-    for (size_t i = 0; i < ihdr.m_height; i++)
+    // Pixels are not touched at all. The chunk has no length header to flag a packed payload in
+    if (input.m_chunk_channel == true)
     {
-        free(unfiltered_data[i]);
+        if (input.m_compress == true)
+        {
+            perror("Chunk channel payloads cannot be compressed!\n");
+            return PROGRAM_ERROR;
+        }
+
+        if (key != NULL)
+        {
+            perror("Chunk channel payloads cannot be encrypted!\n");
+            return PROGRAM_ERROR;
+        }
+
+        if (scatter != NULL)
+        {
+            perror("Chunk channel payloads cannot be scattered!\n");
+            return PROGRAM_ERROR;
+        }
+
+        if (chunk_channel_encode(input.m_input_name, input.m_output_name, (const unsigned char *)input.m_operation_argument,
+                                 strlen(input.m_operation_argument), &error) == false)
+        {
+            perror(error);
+            return PROGRAM_ERROR;
+        }
+
+        return PROGRAM_OK;
     }
 
-    free(unfiltered_data);
+    // Image goes through a band at a time, never whole, so none of the stages apply.
+    // Frames are separate images, each one is a task of its own
+    if (input.m_band_rows != 0 || apng_is_animated(input.m_input_name) == true)
+    {
+        // Rows are embedded in file order there, a band or frame at a time
+        if (scatter != NULL)
+        {
+            perror("Band and frame payloads cannot be scattered!\n");
+            return PROGRAM_ERROR;
+        }
+
+        return encode_outside_stages(&input, key);
+    }
 
-    // Print data
-    hidden_data_txt_fp = fopen(input.m_output_name, "wb");
+    codec_job_init(&job, input.m_input_name, input.m_output_name, true);
+    job.m_hidden_data = (const unsigned char *)input.m_operation_argument;
+    job.m_hidden_data_len = strlen(input.m_operation_argument);
+    job.m_optimize = input.m_optimize;
+    job.m_index_band_rows = input.m_index_band_rows;
+    job.m_overlap_rows = input.m_image_threads > 1;
+    job.m_interlace = input.m_interlace;
+    job.m_compress = input.m_compress;
+    job.m_key = key;
+    job.m_scatter = scatter;
 
-    if (hidden_data_txt_fp == NULL)
+    if (strlen(input.m_cache_directory) > 0)
+    {
+        if (carrier_cache_open(&cache, input.m_cache_directory, input.m_cache_max_mb * CARRIER_CACHE_BYTES_IN_MEGABYTE) == false)
+        {
+            perror("Could not open carrier cache!\n");
+            return PROGRAM_ERROR;
+        }
+
+        job.m_cache = &cache;
+    }
+
+    // Calling thread works on passes too while it waits for them
+    if (input.m_image_threads > 1)
+    {
+        job.m_pass_pool = thread_pool_create(input.m_image_threads - 1);
+    }
+
+    result = run_cli_job(&job, input.m_stats_name);
+
+    if (job.m_pass_pool != NULL)
+    {
+        thread_pool_destroy(job.m_pass_pool);
+    }
+
+    if (job.m_cache != NULL)
+    {
+        carrier_cache_close(&cache);
+    }
+
+    return result;
+}
+
+int decoding(program_inp input)
+{
+    codec_job job;
+    unsigned char key_buffer[PAYLOAD_KEY_LENGTH];
+    const unsigned char *key = NULL;
+    row_scatter scatter_buffer;
+    const row_scatter *scatter = NULL;
+    unsigned char *data = NULL;
+    uint32_t data_length = 0;
+    uint32_t flags = 0;
+    const char *error = NULL;
+    bool is_chunk_channel = chunk_channel_is_used(input.m_input_name);
+    int result = PROGRAM_OK;
+
+    if (read_input_key(&input, key_buffer, &key) == false || read_input_scatter(&input, &scatter_buffer, &scatter) == false)
     {
-        perror("Could not write data in txt file\n");
         return PROGRAM_ERROR;
     }
 
-    fprintf(hidden_data_txt_fp, "%s\n", hidden_data);
+    // Payload chunk is only looked up, animation frames are decoded on their own
+    if (is_chunk_channel == true || apng_is_animated(input.m_input_name) == true)
+    {
+        if (scatter != NULL)
+        {
+            perror("Chunk channel and frame payloads are not scattered!\n");
+            return PROGRAM_ERROR;
+        }
 
-    fclose(hidden_data_txt_fp);
+        if (is_chunk_channel == true ? chunk_channel_decode(input.m_input_name, &data, &data_length, &error) == false
+                                     : apng_decode(input.m_input_name, &data, &data_length, &flags, &error) == false)
+        {
+            perror(error);
+            return PROGRAM_ERROR;
+        }
 
-    free(hidden_data);
+        // Nothing is bound to an image arena here, buffers of the payload stages are heap buffers like data
+        if (unpack_payload(&data, &data_length, flags, key, &error) == false)
+        {
+            perror(error);
+            free(data);
+            return PROGRAM_ERROR;
+        }
 
-    return PROGRAM_OK;
+        if (print_decoded_data(input.m_output_name, data) == false)
+        {
+            perror("Could not write data in txt file\n");
+            result = PROGRAM_ERROR;
+        }
+
+        free(data);
+
+        return result;
+    }
+
+    codec_job_init(&job, input.m_input_name, input.m_output_name, false);
+    job.m_overlap_rows = input.m_image_threads > 1;
+    job.m_key = key;
+    job.m_scatter = scatter;
+
+    // Calling thread works on passes too while it waits for them
+    if (input.m_image_threads > 1)
+    {
+        job.m_pass_pool = thread_pool_create(input.m_image_threads - 1);
+    }
+
+    result = run_cli_job(&job, input.m_stats_name);
+
+    if (job.m_pass_pool != NULL)
+    {
+        thread_pool_destroy(job.m_pass_pool);
+    }
+
+    return result;
 }
@@ -0,0 +1,592 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "../inc/global_config.h"
+#include "../inc/daemon.h"
+#include "../inc/codec.h"
+#include "../inc/image_arena.h"
+#include "../inc/thread_pool.h"
+#include "../inc/row_scatter.h"
+
+// Blocked reads re-check the stop flag at this interval
+#define DAEMON_POLL_INTERVAL_SEC 1
+
+// Intervals a connection may wait for its next request, or stall inside one, before it is dropped
+#define DAEMON_IDLE_POLLS 5
+#define DAEMON_STALL_POLLS 30
+
+#define FD_PATH_FORMAT "/dev/fd/%d"
+#define FD_PATH_MAX_LENGTH 32
+
+static volatile sig_atomic_t g_daemon_stop = 0;
+
+/**
+ * @brief Pool task argument for one client connection
+ */
+typedef struct
+{
+    int m_connection;
+    image_arena_pool *m_arenas;
+
+} daemon_connection;
+
+// Helper functions
+
+static void handle_stop_signal(int signal_number)
+{
+    (void)signal_number;
+
+    g_daemon_stop = 1;
+}
+
+// Timed out read is retried until the daemon stops or the read has timed out max_polls times in a row
+static inline bool is_retried(const ssize_t count, unsigned int *polls, const unsigned int max_polls)
+{
+    if (count >= 0 || g_daemon_stop != 0)
+    {
+        return false;
+    }
+
+    if (errno == EINTR)
+    {
+        return true;
+    }
+
+    return (errno == EAGAIN || errno == EWOULDBLOCK) && ++*polls < max_polls;
+}
+
+static bool read_full(const int fd, void *buffer, size_t length)
+{
+    unsigned char *dest = (unsigned char *)buffer;
+    unsigned int polls = 0;
+
+    while (length > 0)
+    {
+        ssize_t count = read(fd, dest, length);
+
+        if (is_retried(count, &polls, DAEMON_STALL_POLLS) == true)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        polls = 0;
+        dest += count;
+        length -= count;
+    }
+
+    return true;
+}
+
+static bool write_full(const int fd, const void *buffer, size_t length)
+{
+    const unsigned char *src = (const unsigned char *)buffer;
+
+    while (length > 0)
+    {
+        ssize_t count = write(fd, src, length);
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        src += count;
+        length -= count;
+    }
+
+    return true;
+}
+
+static int connect_socket(const char *socket_path)
+{
+    struct sockaddr_un address = {0};
+    int result = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+    if (connect(result, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(result);
+        return -1;
+    }
+
+    return result;
+}
+
+// Existing output is emptied, unless it is the input too, which the daemon reads before it writes
+static int open_output(const char *output_name, const int input, bool *is_created)
+{
+    struct stat input_status;
+    struct stat output_status;
+    bool is_input = fstat(input, &input_status) == 0 && stat(output_name, &output_status) == 0 &&
+                    input_status.st_dev == output_status.st_dev && input_status.st_ino == output_status.st_ino;
+    int result = open(output_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+    *is_created = result >= 0;
+
+    if (result < 0 && errno == EEXIST)
+    {
+        result = open(output_name, O_WRONLY | O_CLOEXEC | (is_input == true ? 0 : O_TRUNC));
+    }
+
+    return result;
+}
+
+// Request handling
+
+static void close_fds(int fds[DAEMON_FD_COUNT])
+{
+    for (int i = 0; i < DAEMON_FD_COUNT; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+static bool receive_request(const int connection, daemon_request *request, int fds[DAEMON_FD_COUNT])
+{
+    struct msghdr message = {0};
+    struct iovec vector = {request, sizeof(daemon_request)};
+    char control[CMSG_SPACE(DAEMON_FD_COUNT * sizeof(int))];
+    struct cmsghdr *header = NULL;
+    ssize_t count = 0;
+    unsigned int polls = 0;
+
+    fds[0] = fds[1] = -1;
+
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    // Header and descriptors arrive together. An idle connection gives its worker back
+    do
+    {
+        count = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+
+    } while (is_retried(count, &polls, DAEMON_IDLE_POLLS) == true);
+
+    if (count <= 0)
+    {
+        return false;
+    }
+
+    // Control buffer holds DAEMON_FD_COUNT descriptors at most, any other count is closed right away
+    for (header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+        {
+            int received[DAEMON_FD_COUNT] = {-1, -1};
+            size_t received_count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+            memcpy(received, CMSG_DATA(header), received_count * sizeof(int));
+
+            if (received_count == DAEMON_FD_COUNT)
+            {
+                memcpy(fds, received, sizeof(received));
+            }
+            else
+            {
+                close_fds(received);
+            }
+        }
+    }
+
+    // Rest of header if it was split
+    if (((size_t)count < sizeof(daemon_request) &&
+         read_full(connection, (unsigned char *)request + count, sizeof(daemon_request) - count) == false) ||
+        request->m_magic != DAEMON_PROTOCOL_MAGIC ||
+        request->m_input_name_length >= PATH_MAX || request->m_output_name_length >= PATH_MAX ||
+        request->m_optimize > PNG_OPTIMIZE_EXHAUSTIVE ||
+        request->m_interlace < INTERLACE_METHOD_KEEP || request->m_interlace > INTERLACE_METHOD_ADAM7)
+    {
+        close_fds(fds);
+        return false;
+    }
+
+    return true;
+}
+
+static void send_response(const int connection, const int status, const char *message)
+{
+    daemon_response response = {DAEMON_PROTOCOL_MAGIC, status, 0};
+
+    response.m_message_length = message != NULL ? strlen(message) : 0;
+
+    if (write_full(connection, &response, sizeof(response)) && response.m_message_length > 0)
+    {
+        write_full(connection, message, response.m_message_length);
+    }
+}
+
+static bool serve_request(const int connection, image_arena_pool *arenas)
+{
+    daemon_request request;
+    int fds[DAEMON_FD_COUNT] = {-1, -1};
+    unsigned char *payload = NULL;
+    char input_name[PATH_MAX + FD_PATH_MAX_LENGTH] = {0};
+    char output_name[PATH_MAX + FD_PATH_MAX_LENGTH] = {0};
+    row_scatter scatter;
+    codec_job job;
+
+    if (receive_request(connection, &request, fds) == false)
+    {
+        return false;
+    }
+
+    // + 1 so empty payloads still get a valid buffer
+    payload = (unsigned char *)malloc(request.m_payload_length + 1);
+
+    if (payload == NULL ||
+        read_full(connection, payload, request.m_payload_length) == false ||
+        read_full(connection, input_name, request.m_input_name_length) == false ||
+        read_full(connection, output_name, request.m_output_name_length) == false)
+    {
+        free(payload);
+        close_fds(fds);
+        return false;
+    }
+
+    // Passed descriptors win over paths
+    if (request.m_fd_count == DAEMON_FD_COUNT && fds[0] >= 0 && fds[1] >= 0)
+    {
+        snprintf(input_name, sizeof(input_name), FD_PATH_FORMAT, fds[0]);
+        snprintf(output_name, sizeof(output_name), FD_PATH_FORMAT, fds[1]);
+    }
+
+    codec_job_init(&job, input_name, output_name, request.m_encode != 0);
+    job.m_hidden_data = payload;
+    job.m_hidden_data_len = request.m_payload_length;
+    job.m_arena_pool = arenas;
+    job.m_optimize = (png_optimize_mode)request.m_optimize;
+    job.m_index_band_rows = request.m_index_band_rows;
+    job.m_interlace = request.m_interlace;
+    job.m_compress = (request.m_options & DAEMON_OPTION_COMPRESS) != 0;
+    job.m_key = (request.m_options & DAEMON_OPTION_KEY) != 0 ? request.m_key : NULL;
+
+    if ((request.m_options & DAEMON_OPTION_SCATTER) != 0)
+    {
+        row_scatter_init(&scatter, request.m_scatter_key);
+        job.m_scatter = &scatter;
+    }
+
+    if (codec_run(&job) == true)
+    {
+        send_response(connection, PROGRAM_OK, NULL);
+    }
+    else
+    {
+        send_response(connection, PROGRAM_ERROR, job.m_error);
+    }
+
+    codec_job_release(&job);
+
+    free(payload);
+    close_fds(fds);
+
+    return true;
+}
+
+static void serve_connection(void *argument)
+{
+    daemon_connection *connection = (daemon_connection *)argument;
+
+    // A client may send several requests over one connection
+    while (g_daemon_stop == 0 && serve_request(connection->m_connection, connection->m_arenas) == true)
+    {
+    }
+
+    close(connection->m_connection);
+    free(connection);
+}
+
+// Header defined functions
+
+int run_daemon(const char *socket_path)
+{
+    struct sockaddr_un address = {0};
+    struct sigaction action = {0};
+    struct timeval interval = {DAEMON_POLL_INTERVAL_SEC, 0};
+    sigset_t stop_signals;
+    image_arena_pool arenas;
+    thread_pool_group group = {0};
+    thread_pool *pool = NULL;
+    int listener = -1;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "[Error] Socket path is too long!\n");
+        return PROGRAM_ERROR;
+    }
+
+    // Stop signals are only taken by this thread, so accept is interrupted
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (image_arena_pool_init(&arenas) == false)
+    {
+        perror("Could not allocate arenas!\n");
+        return PROGRAM_ERROR;
+    }
+
+    pool = thread_pool_create(0);
+
+    if (pool == NULL)
+    {
+        perror("Could not create thread pool!\n");
+        image_arena_pool_free(&arenas);
+        return PROGRAM_ERROR;
+    }
+
+    pthread_sigmask(SIG_UNBLOCK, &stop_signals, NULL);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+    // Remove stale socket of a previous run
+    unlink(socket_path);
+
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listener, DAEMON_LISTEN_BACKLOG) != 0)
+    {
+        perror("Could not listen on socket!\n");
+
+        if (listener >= 0)
+        {
+            close(listener);
+        }
+
+        thread_pool_destroy(pool);
+        image_arena_pool_free(&arenas);
+        return PROGRAM_ERROR;
+    }
+
+    while (g_daemon_stop == 0)
+    {
+        daemon_connection *connection = NULL;
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+
+        if (client < 0)
+        {
+            continue;
+        }
+
+        // Idle clients must not keep workers from seeing the stop flag, or hold them for long
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &interval, sizeof(interval));
+
+        connection = (daemon_connection *)malloc(sizeof(daemon_connection));
+
+        if (connection == NULL)
+        {
+            close(client);
+            continue;
+        }
+
+        connection->m_connection = client;
+        connection->m_arenas = &arenas;
+
+        if (thread_pool_submit(pool, &group, serve_connection, connection) == false)
+        {
+            close(client);
+            free(connection);
+        }
+    }
+
+    close(listener);
+    unlink(socket_path);
+
+    thread_pool_wait(pool, &group);
+    thread_pool_destroy(pool);
+    image_arena_pool_free(&arenas);
+
+    return PROGRAM_OK;
+}
+
+int run_client(const char *socket_path, const program_inp input)
+{
+    daemon_request request = {DAEMON_PROTOCOL_MAGIC, input.m_encode, DAEMON_FD_COUNT, 0, 0, 0, 0, 0, 0, 0, {0}, {0}};
+    daemon_response response;
+    struct msghdr message = {0};
+    struct iovec vector = {&request, sizeof(request)};
+    char control[CMSG_SPACE(DAEMON_FD_COUNT * sizeof(int))] = {0};
+    struct cmsghdr *header = NULL;
+    char error_message[DAEMON_MAX_MESSAGE_LENGTH + 1] = {0};
+    int fds[DAEMON_FD_COUNT] = {-1, -1};
+    int connection = -1;
+    bool is_output_created = false;
+    int result = PROGRAM_ERROR;
+
+    request.m_optimize = input.m_optimize;
+    request.m_index_band_rows = input.m_index_band_rows;
+    request.m_interlace = input.m_interlace;
+
+    if (input.m_compress == true)
+    {
+        request.m_options |= DAEMON_OPTION_COMPRESS;
+    }
+
+    if (strlen(input.m_key_name) > 0)
+    {
+        if (payload_read_key(input.m_key_name, request.m_key) == false)
+        {
+            fprintf(stderr, "[Error] Could not read key file %s!\n", input.m_key_name);
+            return PROGRAM_ERROR;
+        }
+
+        request.m_options |= DAEMON_OPTION_KEY;
+    }
+
+    if (strlen(input.m_scatter_name) > 0)
+    {
+        if (payload_read_key(input.m_scatter_name, request.m_scatter_key) == false)
+        {
+            fprintf(stderr, "[Error] Could not read scatter key file %s!\n", input.m_scatter_name);
+            return PROGRAM_ERROR;
+        }
+
+        request.m_options |= DAEMON_OPTION_SCATTER;
+    }
+
+    // Standard streams are passed on as they are, the daemon reads pipes into memory
+    if (png_is_standard_stream(input.m_input_name) == true)
+    {
+        fds[0] = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    }
+    else
+    {
+        fds[0] = open(input.m_input_name, O_RDONLY | O_CLOEXEC);
+    }
+
+    if (fds[0] < 0)
+    {
+        perror("File is not found!\n");
+        return PROGRAM_ERROR;
+    }
+
+    if (png_is_standard_stream(input.m_output_name) == true)
+    {
+        fds[1] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    }
+    else
+    {
+        fds[1] = open_output(input.m_output_name, fds[0], &is_output_created);
+    }
+
+    if (fds[1] < 0)
+    {
+        perror("Could not open file!\n");
+        close(fds[0]);
+        return PROGRAM_ERROR;
+    }
+
+    connection = connect_socket(socket_path);
+
+    if (connection < 0)
+    {
+        perror("Could not connect to daemon!\n");
+        close(fds[0]);
+        close(fds[1]);
+
+        if (is_output_created == true)
+        {
+            unlink(input.m_output_name);
+        }
+
+        return PROGRAM_ERROR;
+    }
+
+    if (input.m_encode == true)
+    {
+        request.m_payload_length = strlen(input.m_operation_argument);
+    }
+
+    request.m_input_name_length = strlen(input.m_input_name);
+    request.m_output_name_length = strlen(input.m_output_name);
+
+    // Header carries the descriptors
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(DAEMON_FD_COUNT * sizeof(int));
+    memcpy(CMSG_DATA(header), fds, DAEMON_FD_COUNT * sizeof(int));
+
+    if (sendmsg(connection, &message, 0) == sizeof(request) &&
+        write_full(connection, input.m_operation_argument, request.m_payload_length) &&
+        write_full(connection, input.m_input_name, request.m_input_name_length) &&
+        write_full(connection, input.m_output_name, request.m_output_name_length) &&
+        read_full(connection, &response, sizeof(response)) && response.m_magic == DAEMON_PROTOCOL_MAGIC)
+    {
+        result = response.m_status;
+
+        if (response.m_message_length > 0)
+        {
+            size_t length = response.m_message_length < DAEMON_MAX_MESSAGE_LENGTH ? response.m_message_length
+                                                                                   : DAEMON_MAX_MESSAGE_LENGTH;
+
+            read_full(connection, error_message, length);
+            fprintf(stderr, "%s", error_message);
+        }
+    }
+    else
+    {
+        perror("Daemon did not answer!\n");
+    }
+
+    close(connection);
+    close(fds[0]);
+    close(fds[1]);
+
+    // Nothing is left behind for a failed job
+    if (result != PROGRAM_OK && is_output_created == true)
+    {
+        unlink(input.m_output_name);
+    }
+
+    return result;
+}
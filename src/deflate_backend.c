@@ -0,0 +1,830 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include "zlib.h"
+
+#include "../inc/deflate_backend.h"
+
+// Level range of libdeflate
+#define LIBDEFLATE_LEVEL_DEFAULT 6
+#define LIBDEFLATE_LEVEL_MAX 12
+
+// libdeflate_result value of a successful decompression
+#define LIBDEFLATE_SUCCESS 0
+
+// zlib counts the bytes of one call in 32 bits, larger buffers are handed over in pieces
+#define ZLIB_MAX_PIECE 0x40000000UL
+
+/**
+ * @brief Entry points of libdeflate, resolved at runtime
+ */
+typedef struct
+{
+    bool m_is_loaded;
+
+    void *(*m_alloc_compressor)(int level);
+    size_t (*m_zlib_compress)(void *compressor, const void *in, size_t in_nbytes, void *out, size_t out_nbytes_avail);
+    size_t (*m_zlib_compress_bound)(void *compressor, size_t in_nbytes);
+    void (*m_free_compressor)(void *compressor);
+
+    void *(*m_alloc_decompressor)(void);
+    int (*m_zlib_decompress)(void *decompressor, const void *in, size_t in_nbytes, void *out, size_t out_nbytes_avail,
+                             size_t *actual_out_nbytes);
+    void (*m_free_decompressor)(void *decompressor);
+
+} libdeflate_library;
+
+/**
+ * @brief Entry points of zlib-ng native API, resolved at runtime
+ */
+typedef struct
+{
+    bool m_is_loaded;
+
+    int32_t (*m_compress2)(uint8_t *dest, size_t *dest_length, const uint8_t *source, size_t source_length, int32_t level);
+    int32_t (*m_uncompress2)(uint8_t *dest, size_t *dest_length, const uint8_t *source, size_t *source_length);
+    size_t (*m_compress_bound)(size_t source_length);
+
+} zlib_ng_library;
+
+/**
+ * @brief Codec state of one thread, reused instead of created for every image
+ */
+typedef struct
+{
+    z_stream m_inflate;
+    z_stream m_raw_inflate;
+    z_stream m_deflate;
+    int m_deflate_level;
+    int m_deflate_strategy;
+    bool m_is_inflate_ready;
+    bool m_is_raw_inflate_ready;
+    bool m_is_deflate_ready;
+
+    // Piece by piece streams: input of m_inflate and output of m_deflate not handed to zlib yet
+    unsigned long int m_inflate_left;
+    unsigned char *m_deflate_output;
+    unsigned long int m_deflate_output_length;
+    unsigned long int m_deflate_left;
+
+    void *m_compressor;
+    int m_compressor_level;
+    void *m_decompressor;
+
+} backend_state;
+
+static libdeflate_library g_libdeflate = {0};
+static zlib_ng_library g_zlib_ng = {0};
+static pthread_once_t g_libraries_once = PTHREAD_ONCE_INIT;
+
+static pthread_key_t g_state_key;
+static pthread_once_t g_state_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local backend_state *g_state = NULL;
+
+static _Atomic(const deflate_backend *) g_current = NULL;
+
+// Library loading
+
+static void load_libdeflate()
+{
+    void *library = dlopen(DEFLATE_LIBDEFLATE_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+
+    if (library == NULL)
+    {
+        return;
+    }
+
+    g_libdeflate.m_alloc_compressor = (void *(*)(int))dlsym(library, "libdeflate_alloc_compressor");
+    g_libdeflate.m_zlib_compress =
+        (size_t(*)(void *, const void *, size_t, void *, size_t))dlsym(library, "libdeflate_zlib_compress");
+    g_libdeflate.m_zlib_compress_bound = (size_t(*)(void *, size_t))dlsym(library, "libdeflate_zlib_compress_bound");
+    g_libdeflate.m_free_compressor = (void (*)(void *))dlsym(library, "libdeflate_free_compressor");
+    g_libdeflate.m_alloc_decompressor = (void *(*)(void))dlsym(library, "libdeflate_alloc_decompressor");
+    g_libdeflate.m_zlib_decompress =
+        (int (*)(void *, const void *, size_t, void *, size_t, size_t *))dlsym(library, "libdeflate_zlib_decompress");
+    g_libdeflate.m_free_decompressor = (void (*)(void *))dlsym(library, "libdeflate_free_decompressor");
+
+    // Library stays loaded for the life of the process
+    g_libdeflate.m_is_loaded = g_libdeflate.m_alloc_compressor != NULL && g_libdeflate.m_zlib_compress != NULL &&
+                               g_libdeflate.m_zlib_compress_bound != NULL && g_libdeflate.m_free_compressor != NULL &&
+                               g_libdeflate.m_alloc_decompressor != NULL && g_libdeflate.m_zlib_decompress != NULL &&
+                               g_libdeflate.m_free_decompressor != NULL;
+}
+
+static void load_zlib_ng()
+{
+    void *library = dlopen(DEFLATE_ZLIB_NG_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+
+    if (library == NULL)
+    {
+        return;
+    }
+
+    g_zlib_ng.m_compress2 =
+        (int32_t(*)(uint8_t *, size_t *, const uint8_t *, size_t, int32_t))dlsym(library, "zng_compress2");
+    g_zlib_ng.m_uncompress2 =
+        (int32_t(*)(uint8_t *, size_t *, const uint8_t *, size_t *))dlsym(library, "zng_uncompress2");
+    g_zlib_ng.m_compress_bound = (size_t(*)(size_t))dlsym(library, "zng_compressBound");
+
+    g_zlib_ng.m_is_loaded = g_zlib_ng.m_compress2 != NULL && g_zlib_ng.m_uncompress2 != NULL &&
+                            g_zlib_ng.m_compress_bound != NULL;
+}
+
+static void load_libraries()
+{
+    load_libdeflate();
+    load_zlib_ng();
+}
+
+// Thread state
+
+static void free_backend_state(void *state)
+{
+    backend_state *thread_state = (backend_state *)state;
+
+    if (thread_state->m_is_inflate_ready == true)
+    {
+        inflateEnd(&thread_state->m_inflate);
+    }
+
+    if (thread_state->m_is_raw_inflate_ready == true)
+    {
+        inflateEnd(&thread_state->m_raw_inflate);
+    }
+
+    if (thread_state->m_is_deflate_ready == true)
+    {
+        deflateEnd(&thread_state->m_deflate);
+    }
+
+    if (thread_state->m_compressor != NULL)
+    {
+        g_libdeflate.m_free_compressor(thread_state->m_compressor);
+    }
+
+    if (thread_state->m_decompressor != NULL)
+    {
+        g_libdeflate.m_free_decompressor(thread_state->m_decompressor);
+    }
+
+    free(thread_state);
+}
+
+static void create_state_key()
+{
+    pthread_key_create(&g_state_key, free_backend_state);
+}
+
+static backend_state *get_backend_state()
+{
+    if (g_state != NULL)
+    {
+        return g_state;
+    }
+
+    pthread_once(&g_state_key_once, create_state_key);
+
+    g_state = (backend_state *)calloc(1, sizeof(backend_state));
+
+    // State is freed when the thread exits
+    if (g_state != NULL)
+    {
+        pthread_setspecific(g_state_key, g_state);
+    }
+
+    return g_state;
+}
+
+// zlib backend
+
+static z_stream *get_inflate_stream()
+{
+    backend_state *state = get_backend_state();
+
+    if (state == NULL)
+    {
+        return NULL;
+    }
+
+    if (state->m_is_inflate_ready == true)
+    {
+        return inflateReset(&state->m_inflate) == Z_OK ? &state->m_inflate : NULL;
+    }
+
+    if (inflateInit(&state->m_inflate) != Z_OK)
+    {
+        return NULL;
+    }
+
+    state->m_is_inflate_ready = true;
+
+    return &state->m_inflate;
+}
+
+static z_stream *get_raw_inflate_stream()
+{
+    backend_state *state = get_backend_state();
+
+    if (state == NULL)
+    {
+        return NULL;
+    }
+
+    if (state->m_is_raw_inflate_ready == true)
+    {
+        return inflateReset(&state->m_raw_inflate) == Z_OK ? &state->m_raw_inflate : NULL;
+    }
+
+    // Negative window bits: no zlib header or trailer
+    if (inflateInit2(&state->m_raw_inflate, -MAX_WBITS) != Z_OK)
+    {
+        return NULL;
+    }
+
+    state->m_is_raw_inflate_ready = true;
+
+    return &state->m_raw_inflate;
+}
+
+static z_stream *get_deflate_stream(const int level, const int strategy)
+{
+    backend_state *state = get_backend_state();
+
+    if (state == NULL)
+    {
+        return NULL;
+    }
+
+    if (state->m_is_deflate_ready == true)
+    {
+        if (deflateReset(&state->m_deflate) != Z_OK)
+        {
+            return NULL;
+        }
+
+        // Parameters can change while no input is pending
+        if (state->m_deflate_level != level || state->m_deflate_strategy != strategy)
+        {
+            if (deflateParams(&state->m_deflate, level, strategy) != Z_OK)
+            {
+                return NULL;
+            }
+
+            state->m_deflate_level = level;
+            state->m_deflate_strategy = strategy;
+        }
+
+        return &state->m_deflate;
+    }
+
+    if (deflateInit2(&state->m_deflate, level, Z_DEFLATED, MAX_WBITS, MAX_MEM_LEVEL, strategy) != Z_OK)
+    {
+        return NULL;
+    }
+
+    state->m_is_deflate_ready = true;
+    state->m_deflate_level = level;
+    state->m_deflate_strategy = strategy;
+
+    return &state->m_deflate;
+}
+
+/**
+ * @brief Run inflate or deflate over input and output of any length
+ *
+ * next_in and next_out are set by the caller. flush is passed once the last
+ * input piece is; calls go on while there is input left, and also while they
+ * fill their output unless flush is Z_NO_FLUSH.
+ *
+ * @return Status of the last call
+ */
+static int zlib_run(z_stream *stream, int (*step)(z_streamp, int), const int flush, unsigned long int *in_left,
+                    unsigned long int *out_left)
+{
+    int status = Z_OK;
+
+    do
+    {
+        uInt in_piece = *in_left < ZLIB_MAX_PIECE ? *in_left : ZLIB_MAX_PIECE;
+        uInt out_piece = *out_left < ZLIB_MAX_PIECE ? *out_left : ZLIB_MAX_PIECE;
+
+        stream->avail_in = in_piece;
+        stream->avail_out = out_piece;
+
+        status = step(stream, in_piece == *in_left ? flush : Z_NO_FLUSH);
+
+        *in_left -= in_piece - stream->avail_in;
+        *out_left -= out_piece - stream->avail_out;
+
+        // No progress without input only means the input is used up
+        if (status == Z_BUF_ERROR && in_piece == 0)
+        {
+            status = Z_OK;
+        }
+
+    } while (status == Z_OK && *out_left > 0 && (*in_left > 0 || (flush != Z_NO_FLUSH && stream->avail_out == 0)));
+
+    return status;
+}
+
+static unsigned long int zlib_bound(const unsigned long int length)
+{
+    return compressBound(length);
+}
+
+static bool zlib_inflate(const unsigned char *const src, const unsigned long int src_length,
+                         unsigned char *const dest, const unsigned long int dest_length, unsigned long int *out_length)
+{
+    z_stream *stream = get_inflate_stream();
+    unsigned long int in_left = src_length;
+    unsigned long int out_left = dest_length;
+
+    *out_length = 0;
+
+    if (stream == NULL)
+    {
+        return false;
+    }
+
+    // Inflate on the warm stream of this thread, in one call unless the buffers pass 1 GB
+    stream->next_in = (Bytef *)src;
+    stream->next_out = dest;
+
+    if (zlib_run(stream, inflate, Z_SYNC_FLUSH, &in_left, &out_left) != Z_STREAM_END)
+    {
+        return false;
+    }
+
+    *out_length = stream->total_out;
+
+    return true;
+}
+
+static bool zlib_deflate(const unsigned char *const src, const unsigned long int src_length,
+                         unsigned char *const dest, unsigned long int *dest_length, const int level, const int strategy)
+{
+    z_stream *stream = get_deflate_stream(level, strategy);
+    unsigned long int in_left = src_length;
+    unsigned long int out_left = *dest_length;
+
+    if (stream == NULL)
+    {
+        return false;
+    }
+
+    // Deflate on the warm stream of this thread, in one call unless the buffers pass 1 GB
+    stream->next_in = (Bytef *)src;
+    stream->next_out = dest;
+
+    if (zlib_run(stream, deflate, Z_FINISH, &in_left, &out_left) != Z_STREAM_END)
+    {
+        return false;
+    }
+
+    *dest_length = stream->total_out;
+
+    return true;
+}
+
+// zlib-ng backend
+
+static unsigned long int zlib_ng_bound(const unsigned long int length)
+{
+    return g_zlib_ng.m_compress_bound(length);
+}
+
+static bool zlib_ng_inflate(const unsigned char *const src, const unsigned long int src_length,
+                            unsigned char *const dest, const unsigned long int dest_length, unsigned long int *out_length)
+{
+    size_t source_length = src_length;
+    size_t produced = dest_length;
+
+    *out_length = 0;
+
+    if (g_zlib_ng.m_uncompress2(dest, &produced, src, &source_length) != Z_OK)
+    {
+        return false;
+    }
+
+    *out_length = produced;
+
+    return true;
+}
+
+static bool zlib_ng_deflate(const unsigned char *const src, const unsigned long int src_length,
+                            unsigned char *const dest, unsigned long int *dest_length, const int level, const int strategy)
+{
+    size_t produced = *dest_length;
+
+    (void)strategy;
+
+    if (g_zlib_ng.m_compress2(dest, &produced, src, src_length, level) != Z_OK)
+    {
+        return false;
+    }
+
+    *dest_length = produced;
+
+    return true;
+}
+
+// libdeflate backend
+
+static void *get_compressor(int level)
+{
+    backend_state *state = get_backend_state();
+
+    if (state == NULL)
+    {
+        return NULL;
+    }
+
+    // zlib levels map directly, default and out of range values are clamped
+    if (level < 0)
+    {
+        level = LIBDEFLATE_LEVEL_DEFAULT;
+    }
+    else if (level > LIBDEFLATE_LEVEL_MAX)
+    {
+        level = LIBDEFLATE_LEVEL_MAX;
+    }
+
+    if (state->m_compressor != NULL && state->m_compressor_level == level)
+    {
+        return state->m_compressor;
+    }
+
+    if (state->m_compressor != NULL)
+    {
+        g_libdeflate.m_free_compressor(state->m_compressor);
+    }
+
+    state->m_compressor = g_libdeflate.m_alloc_compressor(level);
+    state->m_compressor_level = level;
+
+    return state->m_compressor;
+}
+
+static void *get_decompressor()
+{
+    backend_state *state = get_backend_state();
+
+    if (state == NULL)
+    {
+        return NULL;
+    }
+
+    if (state->m_decompressor == NULL)
+    {
+        state->m_decompressor = g_libdeflate.m_alloc_decompressor();
+    }
+
+    return state->m_decompressor;
+}
+
+static unsigned long int libdeflate_bound(const unsigned long int length)
+{
+    void *compressor = get_compressor(DEFLATE_LEVEL_DEFAULT);
+
+    // Bound does not depend on the level, fall back to zlib's if no compressor can be made
+    return compressor != NULL ? g_libdeflate.m_zlib_compress_bound(compressor, length) : compressBound(length);
+}
+
+static bool libdeflate_inflate(const unsigned char *const src, const unsigned long int src_length,
+                               unsigned char *const dest, const unsigned long int dest_length, unsigned long int *out_length)
+{
+    void *decompressor = get_decompressor();
+    size_t produced = 0;
+
+    *out_length = 0;
+
+    if (decompressor == NULL ||
+        g_libdeflate.m_zlib_decompress(decompressor, src, src_length, dest, dest_length, &produced) != LIBDEFLATE_SUCCESS)
+    {
+        return false;
+    }
+
+    *out_length = produced;
+
+    return true;
+}
+
+static bool libdeflate_deflate(const unsigned char *const src, const unsigned long int src_length,
+                               unsigned char *const dest, unsigned long int *dest_length, const int level, const int strategy)
+{
+    void *compressor = get_compressor(level);
+    size_t produced = 0;
+
+    (void)strategy;
+
+    if (compressor == NULL)
+    {
+        return false;
+    }
+
+    // 0 means the output did not fit
+    produced = g_libdeflate.m_zlib_compress(compressor, src, src_length, dest, *dest_length);
+
+    if (produced == 0)
+    {
+        return false;
+    }
+
+    *dest_length = produced;
+
+    return true;
+}
+
+static const deflate_backend g_backends[DEFLATE_BACKEND_COUNT] = {
+    {"libdeflate", LIBDEFLATE_LEVEL_MAX, false, libdeflate_bound, libdeflate_inflate, libdeflate_deflate},
+    {"zlib-ng", DEFLATE_LEVEL_MAX, false, zlib_ng_bound, zlib_ng_inflate, zlib_ng_deflate},
+    {"zlib", DEFLATE_LEVEL_MAX, true, zlib_bound, zlib_inflate, zlib_deflate},
+};
+
+// Header defined functions
+
+const deflate_backend *deflate_backend_get(const deflate_backend_id id)
+{
+    pthread_once(&g_libraries_once, load_libraries);
+
+    switch (id)
+    {
+    case DEFLATE_BACKEND_LIBDEFLATE:
+        return g_libdeflate.m_is_loaded ? &g_backends[id] : NULL;
+
+    case DEFLATE_BACKEND_ZLIB_NG:
+        return g_zlib_ng.m_is_loaded ? &g_backends[id] : NULL;
+
+    case DEFLATE_BACKEND_ZLIB:
+        return &g_backends[id];
+
+    default:
+        return NULL;
+    }
+}
+
+const deflate_backend *deflate_backend_current()
+{
+    const deflate_backend *result = atomic_load(&g_current);
+
+    if (result != NULL)
+    {
+        return result;
+    }
+
+    // First available in order of preference, zlib always is
+    for (int id = 0; id < DEFLATE_BACKEND_COUNT && result == NULL; id++)
+    {
+        result = deflate_backend_get(id);
+    }
+
+    atomic_store(&g_current, result);
+
+    return result;
+}
+
+bool deflate_backend_select(const char *name)
+{
+    if (strcmp(name, DEFLATE_BACKEND_AUTO) == 0)
+    {
+        atomic_store(&g_current, NULL);
+        return deflate_backend_current() != NULL;
+    }
+
+    for (int id = 0; id < DEFLATE_BACKEND_COUNT; id++)
+    {
+        if (strcmp(name, g_backends[id].m_name) == 0)
+        {
+            const deflate_backend *backend = deflate_backend_get(id);
+
+            if (backend == NULL)
+            {
+                return false;
+            }
+
+            atomic_store(&g_current, backend);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+unsigned long int deflate_backend_flushed_bound(const unsigned long int length, const unsigned long int flush_count)
+{
+    return compressBound(length) + flush_count * DEFLATE_FLUSH_OVERHEAD;
+}
+
+bool deflate_backend_deflate_flushed(const unsigned char *const src, const unsigned long int src_length,
+                                     unsigned char *const dest, unsigned long int *dest_length, const int level,
+                                     const unsigned long int flush_interval, unsigned long int *const flush_offsets)
+{
+    z_stream *stream = get_deflate_stream(level, DEFLATE_STRATEGY_DEFAULT);
+    unsigned long int out_left = *dest_length;
+    unsigned long int point = 0;
+
+    if (stream == NULL || flush_interval == 0)
+    {
+        return false;
+    }
+
+    stream->next_out = dest;
+
+    for (unsigned long int offset = 0; offset < src_length;)
+    {
+        unsigned long int length = src_length - offset < flush_interval ? src_length - offset : flush_interval;
+        unsigned long int in_left = length;
+        bool is_last = offset + length == src_length;
+
+        stream->next_in = (Bytef *)&src[offset];
+
+        // A flush that fills the output may be incomplete, capacity comes from deflate_backend_flushed_bound
+        if (zlib_run(stream, deflate, is_last ? Z_FINISH : Z_FULL_FLUSH, &in_left, &out_left) !=
+                (is_last ? Z_STREAM_END : Z_OK) ||
+            in_left != 0 || (is_last == false && out_left == 0))
+        {
+            return false;
+        }
+
+        offset += length;
+
+        if (is_last == false)
+        {
+            flush_offsets[point++] = stream->total_out;
+        }
+    }
+
+    *dest_length = stream->total_out;
+
+    return true;
+}
+
+bool deflate_backend_inflate_segment(const unsigned char *const src, const unsigned long int src_length,
+                                     unsigned char *const dest, const unsigned long int dest_length)
+{
+    z_stream *stream = get_raw_inflate_stream();
+    unsigned long int in_left = src_length;
+    unsigned long int out_left = dest_length;
+    int status = Z_OK;
+
+    if (stream == NULL)
+    {
+        return false;
+    }
+
+    stream->next_in = (Bytef *)src;
+    stream->next_out = dest;
+
+    // Segments between flush points end on a block boundary, the last one on the final block
+    status = zlib_run(stream, inflate, Z_SYNC_FLUSH, &in_left, &out_left);
+
+    return (status == Z_OK || status == Z_STREAM_END) && out_left == 0;
+}
+
+bool deflate_backend_inflate_start(const unsigned char *const src, const unsigned long int src_length)
+{
+    z_stream *stream = get_inflate_stream();
+
+    if (stream == NULL)
+    {
+        return false;
+    }
+
+    stream->next_in = (Bytef *)src;
+    get_backend_state()->m_inflate_left = src_length;
+
+    return true;
+}
+
+bool deflate_backend_inflate_feed(const unsigned char *const src, const unsigned long int src_length)
+{
+    backend_state *state = get_backend_state();
+
+    // Stream of this thread must be started first
+    if (state == NULL || state->m_is_inflate_ready == false || state->m_inflate_left != 0)
+    {
+        return false;
+    }
+
+    state->m_inflate.next_in = (Bytef *)src;
+    state->m_inflate_left = src_length;
+
+    return true;
+}
+
+bool deflate_backend_inflate_next(unsigned char *const dest, const unsigned long int dest_length,
+                                  unsigned long int *out_length, bool *is_end)
+{
+    backend_state *state = get_backend_state();
+    unsigned long int out_left = dest_length;
+    int status = Z_OK;
+
+    *out_length = 0;
+    *is_end = false;
+
+    // Stream of this thread must be started first
+    if (state == NULL || state->m_is_inflate_ready == false)
+    {
+        return false;
+    }
+
+    state->m_inflate.next_out = dest;
+
+    // Either dest is filled, the stream ends, or the input given so far is used up
+    status = zlib_run(&state->m_inflate, inflate, Z_SYNC_FLUSH, &state->m_inflate_left, &out_left);
+
+    *out_length = dest_length - out_left;
+    *is_end = status == Z_STREAM_END;
+
+    return status == Z_STREAM_END || status == Z_OK;
+}
+
+bool deflate_backend_deflate_start(unsigned char *const dest, const unsigned long int dest_length, const int level)
+{
+    z_stream *stream = get_deflate_stream(level, DEFLATE_STRATEGY_DEFAULT);
+    backend_state *state = get_backend_state();
+
+    if (stream == NULL)
+    {
+        return false;
+    }
+
+    stream->next_out = dest;
+    state->m_deflate_output = dest;
+    state->m_deflate_output_length = dest_length;
+    state->m_deflate_left = dest_length;
+
+    return true;
+}
+
+bool deflate_backend_deflate_next(const unsigned char *const src, const unsigned long int src_length, const bool is_last,
+                                  unsigned long int *dest_length)
+{
+    backend_state *state = get_backend_state();
+    unsigned long int in_left = src_length;
+
+    // Stream of this thread must be started first
+    if (state == NULL || state->m_is_deflate_ready == false)
+    {
+        return false;
+    }
+
+    state->m_deflate.next_in = (Bytef *)src;
+
+    // Capacity is the bound of the whole stream, so every piece is taken at once
+    if (zlib_run(&state->m_deflate, deflate, is_last ? Z_FINISH : Z_NO_FLUSH, &in_left, &state->m_deflate_left) !=
+            (is_last ? Z_STREAM_END : Z_OK) ||
+        in_left != 0)
+    {
+        return false;
+    }
+
+    *dest_length = state->m_deflate.total_out;
+
+    return true;
+}
+
+bool deflate_backend_deflate_drain(const unsigned char *const src, const unsigned long int src_length, const bool is_last,
+                                   deflate_backend_sink sink, void *context)
+{
+    backend_state *state = get_backend_state();
+    unsigned long int in_left = src_length;
+    int status = Z_OK;
+
+    // Stream of this thread must be started first
+    if (state == NULL || state->m_is_deflate_ready == false)
+    {
+        return false;
+    }
+
+    state->m_deflate.next_in = (Bytef *)src;
+
+    do
+    {
+        status = zlib_run(&state->m_deflate, deflate, is_last ? Z_FINISH : Z_NO_FLUSH, &in_left, &state->m_deflate_left);
+
+        if (status != Z_OK && status != Z_STREAM_END)
+        {
+            return false;
+        }
+
+        // Full output is handed over and used again from its start, so is the rest once the stream ends
+        if (state->m_deflate_left == 0 || status == Z_STREAM_END)
+        {
+            if (sink(context, state->m_deflate_output, state->m_deflate_output_length - state->m_deflate_left) == false)
+            {
+                return false;
+            }
+
+            state->m_deflate.next_out = state->m_deflate_output;
+            state->m_deflate_left = state->m_deflate_output_length;
+        }
+
+    } while (status != Z_STREAM_END && (in_left > 0 || is_last == true));
+
+    return true;
+}
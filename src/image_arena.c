@@ -0,0 +1,540 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "zlib.h"
+
+#include "../inc/image_arena.h"
+#include "../inc/png_parser.h"
+
+#define ARENA_POOL_INITIAL_CAPACITY 8
+
+// NUMA, numaif.h is not always installed so mbind is called directly
+#define NUMA_ONLINE_NODES_PATH "/sys/devices/system/node/online"
+#define NUMA_MAX_NODES 1024
+#define NUMA_MASK_WORD_BITS (8 * sizeof(unsigned long int))
+#define NUMA_MPOL_PREFERRED 1
+
+// Backing of large blocks, set before worker threads start
+static image_arena_page_policy g_page_policy = IMAGE_ARENA_PAGES_TRANSPARENT;
+
+static const char *const g_page_policy_names[IMAGE_ARENA_PAGES_COUNT] = {
+    IMAGE_ARENA_PAGES_NAME_SMALL,
+    IMAGE_ARENA_PAGES_NAME_TRANSPARENT,
+    IMAGE_ARENA_PAGES_NAME_HUGETLB,
+};
+
+// Number of NUMA nodes, read once
+static pthread_once_t g_node_count_once = PTHREAD_ONCE_INIT;
+static int g_node_count = 1;
+
+// Arena bound to the calling thread
+static _Thread_local image_arena *g_bound_arena = NULL;
+
+// Bytes requested by the calling thread, with or without arena
+static _Thread_local unsigned long int g_alloc_bytes = 0;
+
+// Helper functions
+
+static inline size_t align_up(const size_t value)
+{
+    return (value + IMAGE_ARENA_ALIGNMENT - 1) & ~((size_t)IMAGE_ARENA_ALIGNMENT - 1);
+}
+
+static void read_node_count()
+{
+    FILE *fp = fopen(NUMA_ONLINE_NODES_PATH, "r");
+    int node = 0;
+
+    if (fp == NULL)
+    {
+        return;
+    }
+
+    // List of ranges like "0-3,5", the highest node sizes the node mask
+    while (fscanf(fp, "%d", &node) == 1)
+    {
+        if (node >= 0 && node < NUMA_MAX_NODES && node + 1 > g_node_count)
+        {
+            g_node_count = node + 1;
+        }
+
+        if (fgetc(fp) == EOF)
+        {
+            break;
+        }
+    }
+
+    fclose(fp);
+}
+
+static bool bind_to_node(void *block, const size_t size, const int node)
+{
+    unsigned long int mask[NUMA_MAX_NODES / NUMA_MASK_WORD_BITS] = {0};
+
+    if (node == IMAGE_ARENA_NO_NODE)
+    {
+        return false;
+    }
+
+    mask[node / NUMA_MASK_WORD_BITS] |= 1UL << (node % NUMA_MASK_WORD_BITS);
+
+    // Preferred, not strict: a full node spills over instead of failing the job
+    return syscall(SYS_mbind, block, size, NUMA_MPOL_PREFERRED, mask, NUMA_MAX_NODES, 0) == 0;
+}
+
+static unsigned char *map_block(const size_t size, bool *is_huge)
+{
+    size_t mapped_size = size + IMAGE_ARENA_HUGE_PAGE_SIZE;
+    unsigned char *mapping = NULL;
+    unsigned char *result = NULL;
+
+    *is_huge = false;
+
+    if (g_page_policy == IMAGE_ARENA_PAGES_HUGETLB)
+    {
+        result = (unsigned char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (result != MAP_FAILED)
+        {
+            *is_huge = true;
+            return result;
+        }
+    }
+
+    // Over-map and trim, so the block starts on a huge page boundary THP can back
+    mapping = (unsigned char *)mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    result = (unsigned char *)(((uintptr_t)mapping + IMAGE_ARENA_HUGE_PAGE_SIZE - 1) &
+                               ~((uintptr_t)IMAGE_ARENA_HUGE_PAGE_SIZE - 1));
+
+    if (result > mapping)
+    {
+        munmap(mapping, result - mapping);
+    }
+
+    munmap(result + size, mapping + mapped_size - (result + size));
+
+    *is_huge = madvise(result, size, MADV_HUGEPAGE) == 0;
+
+    return result;
+}
+
+static bool add_block(image_arena *arena, size_t size)
+{
+    unsigned char *block = NULL;
+    bool is_mapped = false;
+    bool is_huge = false;
+
+    if (arena->m_block_count == IMAGE_ARENA_MAX_BLOCKS)
+    {
+        return false;
+    }
+
+    if (size < IMAGE_ARENA_MIN_BLOCK_SIZE)
+    {
+        size = IMAGE_ARENA_MIN_BLOCK_SIZE;
+    }
+
+    size = align_up(size);
+
+    // Large blocks get whole huge pages, small ones are not worth a mapping
+    if (g_page_policy != IMAGE_ARENA_PAGES_SMALL && size >= IMAGE_ARENA_HUGE_PAGE_SIZE)
+    {
+        size = (size + IMAGE_ARENA_HUGE_PAGE_SIZE - 1) & ~((size_t)IMAGE_ARENA_HUGE_PAGE_SIZE - 1);
+        block = map_block(size, &is_huge);
+        is_mapped = block != NULL;
+    }
+
+    if (block == NULL)
+    {
+        block = (unsigned char *)aligned_alloc(IMAGE_ARENA_ALIGNMENT, size);
+    }
+
+    if (block == NULL)
+    {
+        return false;
+    }
+
+    // Pages are not touched yet, so binding decides where they fault in
+    if (is_mapped == true)
+    {
+        arena->m_node = image_arena_current_node();
+
+        if (bind_to_node(block, size, arena->m_node) == true)
+        {
+            arena->m_counters.m_node_local_bytes += size;
+        }
+    }
+
+    if (is_huge == true)
+    {
+        arena->m_huge_bytes += size;
+        arena->m_counters.m_huge_page_bytes += size;
+    }
+
+    arena->m_blocks[arena->m_block_count] = block;
+    arena->m_block_sizes[arena->m_block_count] = size;
+    arena->m_block_mapped[arena->m_block_count] = is_mapped;
+    arena->m_block_count++;
+    arena->m_used = 0;
+
+    arena->m_counters.m_system_alloc_count++;
+    arena->m_counters.m_system_alloc_bytes += size;
+
+    return true;
+}
+
+static void free_blocks(image_arena *arena)
+{
+    for (size_t i = 0; i < arena->m_block_count; i++)
+    {
+        if (arena->m_block_mapped[i] == true)
+        {
+            munmap(arena->m_blocks[i], arena->m_block_sizes[i]);
+        }
+        else
+        {
+            free(arena->m_blocks[i]);
+        }
+    }
+
+    arena->m_block_count = 0;
+    arena->m_used = 0;
+    arena->m_huge_bytes = 0;
+}
+
+static void add_counters(image_arena_counters *dest, const image_arena_counters *src)
+{
+    dest->m_alloc_count += src->m_alloc_count;
+    dest->m_alloc_bytes += src->m_alloc_bytes;
+    dest->m_system_alloc_count += src->m_system_alloc_count;
+    dest->m_system_alloc_bytes += src->m_system_alloc_bytes;
+    dest->m_huge_page_bytes += src->m_huge_page_bytes;
+    dest->m_node_local_bytes += src->m_node_local_bytes;
+
+    if (src->m_peak_bytes > dest->m_peak_bytes)
+    {
+        dest->m_peak_bytes = src->m_peak_bytes;
+    }
+}
+
+// Header defined functions
+
+bool image_arena_set_page_policy(const char *name)
+{
+    for (int policy = 0; policy < IMAGE_ARENA_PAGES_COUNT; policy++)
+    {
+        if (strcmp(name, g_page_policy_names[policy]) == 0)
+        {
+            g_page_policy = policy;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *image_arena_page_policy_name()
+{
+    return g_page_policy_names[g_page_policy];
+}
+
+int image_arena_current_node()
+{
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+
+    pthread_once(&g_node_count_once, read_node_count);
+
+    if (g_node_count < 2 || syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+    {
+        return IMAGE_ARENA_NO_NODE;
+    }
+
+    return node;
+}
+
+image_arena *image_arena_create()
+{
+    image_arena *result = (image_arena *)calloc(1, sizeof(image_arena));
+
+    if (result != NULL)
+    {
+        result->m_node = IMAGE_ARENA_NO_NODE;
+    }
+
+    return result;
+}
+
+void image_arena_destroy(image_arena *arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    if (g_bound_arena == arena)
+    {
+        g_bound_arena = NULL;
+    }
+
+    free_blocks(arena);
+    free(arena);
+}
+
+size_t image_arena_size_for(const IHDR_chunk ihdr)
+{
+    IHDR_chunk interlaced = ihdr;
+    size_t raw = 0;
+    size_t pixels = png_row_size(ihdr) * ihdr.m_height;
+    size_t rows = ihdr.m_height * sizeof(void *) + 12 * png_row_size(ihdr);
+
+    // Output may be interlaced whatever the input is, Adam7 adds filter type bytes of the passes
+    interlaced.m_interlace_method = INTERLACE_METHOD_ADAM7;
+    raw = png_filtered_length(interlaced);
+
+    // Compressed input and output are bounded by compressBound of the raw data
+    return align_up(compressBound(raw)) * 2 + align_up(raw) * 2 + align_up(pixels) + align_up(rows) +
+           16 * IMAGE_ARENA_ALIGNMENT;
+}
+
+bool image_arena_reserve(image_arena *arena, const size_t size)
+{
+    // Growing is only possible while no buffer points into the block
+    if (arena->m_used_total != 0)
+    {
+        return true;
+    }
+
+    if (arena->m_block_count == 1 && arena->m_block_sizes[0] >= size)
+    {
+        return true;
+    }
+
+    free_blocks(arena);
+
+    return add_block(arena, size);
+}
+
+void *image_arena_alloc(image_arena *arena, const size_t size)
+{
+    size_t aligned_size = align_up(size == 0 ? 1 : size);
+    void *result = NULL;
+
+    // Chain a new block when the current one is exhausted
+    if (arena->m_block_count == 0 ||
+        arena->m_used + aligned_size > arena->m_block_sizes[arena->m_block_count - 1])
+    {
+        if (add_block(arena, aligned_size > arena->m_used_total ? aligned_size : arena->m_used_total) == false)
+        {
+            return NULL;
+        }
+    }
+
+    result = arena->m_blocks[arena->m_block_count - 1] + arena->m_used;
+
+    arena->m_used += aligned_size;
+    arena->m_used_total += aligned_size;
+
+    arena->m_counters.m_alloc_count++;
+    arena->m_counters.m_alloc_bytes += size;
+
+    if (arena->m_used_total > arena->m_counters.m_peak_bytes)
+    {
+        arena->m_counters.m_peak_bytes = arena->m_used_total;
+    }
+
+    return result;
+}
+
+bool image_arena_owns(const image_arena *arena, const void *ptr)
+{
+    for (size_t i = 0; i < arena->m_block_count; i++)
+    {
+        if ((const unsigned char *)ptr >= arena->m_blocks[i] &&
+            (const unsigned char *)ptr < arena->m_blocks[i] + arena->m_block_sizes[i])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void image_arena_reset(image_arena *arena)
+{
+    size_t total = 0;
+
+    // Fold chained blocks into one, sized for the high-water mark
+    if (arena->m_block_count > 1)
+    {
+        for (size_t i = 0; i < arena->m_block_count; i++)
+        {
+            total += arena->m_block_sizes[i];
+        }
+
+        free_blocks(arena);
+        add_block(arena, total);
+    }
+
+    arena->m_used = 0;
+    arena->m_used_total = 0;
+}
+
+void image_arena_bind(image_arena *arena)
+{
+    g_bound_arena = arena;
+}
+
+image_arena *image_arena_bound()
+{
+    return g_bound_arena;
+}
+
+void *image_alloc(const size_t size)
+{
+    g_alloc_bytes += size;
+
+    if (g_bound_arena != NULL)
+    {
+        return image_arena_alloc(g_bound_arena, size);
+    }
+
+    return malloc(size);
+}
+
+unsigned long int image_alloc_bytes()
+{
+    return g_alloc_bytes;
+}
+
+void image_free(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    if (g_bound_arena != NULL && image_arena_owns(g_bound_arena, ptr))
+    {
+        return;
+    }
+
+    free(ptr);
+}
+
+bool image_arena_pool_init(image_arena_pool *pool)
+{
+    memset(pool, 0, sizeof(image_arena_pool));
+
+    pool->m_idle = (image_arena **)malloc(ARENA_POOL_INITIAL_CAPACITY * sizeof(image_arena *));
+
+    if (pool->m_idle == NULL)
+    {
+        return false;
+    }
+
+    pool->m_capacity = ARENA_POOL_INITIAL_CAPACITY;
+
+    pthread_mutex_init(&pool->m_lock, NULL);
+
+    return true;
+}
+
+image_arena *image_arena_pool_acquire(image_arena_pool *pool)
+{
+    image_arena *result = NULL;
+    int node = image_arena_current_node();
+
+    pthread_mutex_lock(&pool->m_lock);
+
+    if (pool->m_idle_count > 0)
+    {
+        size_t pick = pool->m_idle_count - 1;
+
+        // Memory stays on the node it was bound to, so a local arena beats the most recent one
+        for (size_t i = pool->m_idle_count; node != IMAGE_ARENA_NO_NODE && i-- > 0;)
+        {
+            if (pool->m_idle[i]->m_node == node)
+            {
+                pick = i;
+                break;
+            }
+        }
+
+        result = pool->m_idle[pick];
+        pool->m_idle[pick] = pool->m_idle[--pool->m_idle_count];
+    }
+
+    pthread_mutex_unlock(&pool->m_lock);
+
+    if (result != NULL)
+    {
+        return result;
+    }
+
+    // Pool grows up to the number of images in flight
+    result = image_arena_create();
+
+    if (result != NULL)
+    {
+        pthread_mutex_lock(&pool->m_lock);
+        pool->m_created++;
+        pthread_mutex_unlock(&pool->m_lock);
+    }
+
+    return result;
+}
+
+void image_arena_pool_release(image_arena_pool *pool, image_arena *arena)
+{
+    image_arena_reset(arena);
+
+    pthread_mutex_lock(&pool->m_lock);
+
+    if (pool->m_idle_count == pool->m_capacity)
+    {
+        image_arena **grown = (image_arena **)realloc(pool->m_idle, pool->m_capacity * 2 * sizeof(image_arena *));
+
+        if (grown == NULL)
+        {
+            add_counters(&pool->m_counters, &arena->m_counters);
+            pthread_mutex_unlock(&pool->m_lock);
+
+            image_arena_destroy(arena);
+            return;
+        }
+
+        pool->m_idle = grown;
+        pool->m_capacity *= 2;
+    }
+
+    pool->m_idle[pool->m_idle_count++] = arena;
+
+    pthread_mutex_unlock(&pool->m_lock);
+}
+
+void image_arena_pool_free(image_arena_pool *pool)
+{
+    for (size_t i = 0; i < pool->m_idle_count; i++)
+    {
+        add_counters(&pool->m_counters, &pool->m_idle[i]->m_counters);
+        image_arena_destroy(pool->m_idle[i]);
+    }
+
+    pool->m_idle_count = 0;
+
+    pthread_mutex_destroy(&pool->m_lock);
+    free(pool->m_idle);
+    pool->m_idle = NULL;
+}
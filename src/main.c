@@ -1,6 +1,15 @@
 #include "../inc/global_config.h"
 #include "../inc/program_input_parser.h"
 #include "../inc/codec.h"
+#include "../inc/batch.h"
+#include "../inc/daemon.h"
+#include "../inc/deflate_backend.h"
+#include "../inc/carrier_cache.h"
+#include "../inc/image_arena.h"
+#include "../inc/payload_cipher.h"
+
+#include <stdio.h>
+#include <string.h>
 
 int main(int argc, char const *argv[])
 {
@@ -11,6 +20,107 @@ int main(int argc, char const *argv[])
         return input.m_error_code;
     }
 
+    // Backend is chosen once, before any worker starts
+    if (strlen(input.m_backend_name) > 0 && deflate_backend_select(input.m_backend_name) == false)
+    {
+        fprintf(stderr, "[Error] Deflate backend %s is not available!\n", input.m_backend_name);
+        return PROGRAM_ERROR;
+    }
+
+    // Page policy too, arenas of every mode pick it up
+    if (strlen(input.m_page_policy) > 0 && image_arena_set_page_policy(input.m_page_policy) == false)
+    {
+        fprintf(stderr, "[Error] Page policy %s is not known!\n", input.m_page_policy);
+        return PROGRAM_ERROR;
+    }
+
+    if (strlen(input.m_daemon_socket) > 0)
+    {
+        return run_daemon(input.m_daemon_socket);
+    }
+
+    if (strlen(input.m_client_socket) > 0)
+    {
+        // Daemon jobs go through the stages, with the payload in the pixels
+        if (input.m_chunk_channel == true)
+        {
+            fprintf(stderr, "[Error] -channel chunk does not apply to daemon jobs!\n");
+            return PROGRAM_ERROR;
+        }
+
+        // Daemon runs one whole image per worker, with its own backend, pages, and no cache or statistics
+        if (strlen(input.m_batch_manifest) > 0 || strlen(input.m_fanout_manifest) > 0 || input.m_batch_pipeline == true ||
+            input.m_band_rows != 0 || input.m_image_threads > 1 || strlen(input.m_cache_directory) > 0 ||
+            strlen(input.m_stats_name) > 0 || strlen(input.m_backend_name) > 0 || strlen(input.m_page_policy) > 0 ||
+            input.m_prefetch_depth != 0 || strlen(input.m_io_backend) > 0)
+        {
+            fprintf(stderr, "[Error] -b, -fanout, -sched, -bands, -image_threads, -cache, -stats, -backend, -pages, "
+                            "-prefetch and -io do not apply to daemon jobs!\n");
+            return PROGRAM_ERROR;
+        }
+
+        return run_client(input.m_client_socket, input);
+    }
+
+    if (strlen(input.m_batch_manifest) > 0 || strlen(input.m_fanout_manifest) > 0)
+    {
+        batch_options options = {0};
+        unsigned char key[PAYLOAD_KEY_LENGTH];
+        unsigned char scatter_key[PAYLOAD_KEY_LENGTH];
+        row_scatter scatter;
+
+        // Jobs run a whole image each on one worker, with the payload in the pixels
+        if (input.m_band_rows != 0 || input.m_image_threads > 1 || input.m_chunk_channel == true)
+        {
+            fprintf(stderr, "[Error] -bands, -image_threads and -channel do not apply to batch and fan-out jobs!\n");
+            return PROGRAM_ERROR;
+        }
+
+        // Every job encrypts with the same key, read once
+        if (strlen(input.m_key_name) > 0)
+        {
+            if (payload_read_key(input.m_key_name, key) == false)
+            {
+                fprintf(stderr, "[Error] Could not read key file %s!\n", input.m_key_name);
+                return PROGRAM_ERROR;
+            }
+
+            options.m_key = key;
+        }
+
+        if (strlen(input.m_scatter_name) > 0)
+        {
+            if (payload_read_key(input.m_scatter_name, scatter_key) == false)
+            {
+                fprintf(stderr, "[Error] Could not read scatter key file %s!\n", input.m_scatter_name);
+                return PROGRAM_ERROR;
+            }
+
+            row_scatter_init(&scatter, scatter_key);
+            options.m_scatter = &scatter;
+        }
+
+        options.m_scheduler = input.m_batch_pipeline ? BATCH_SCHEDULER_PIPELINE : BATCH_SCHEDULER_POOL;
+        options.m_stats_name = input.m_stats_name;
+        options.m_optimize = input.m_optimize;
+        options.m_index_band_rows = input.m_index_band_rows;
+        options.m_interlace = input.m_interlace;
+        options.m_compress = input.m_compress;
+        options.m_cache_directory = input.m_cache_directory;
+        options.m_cache_max_bytes = input.m_cache_max_mb * CARRIER_CACHE_BYTES_IN_MEGABYTE;
+        options.m_prefetch_depth = input.m_prefetch_depth;
+        options.m_io_backend = strcmp(input.m_io_backend, ASYNC_IO_BACKEND_NAME_THREADS) == 0  ? ASYNC_IO_BACKEND_THREADS
+                               : strcmp(input.m_io_backend, ASYNC_IO_BACKEND_NAME_IO_URING) == 0 ? ASYNC_IO_BACKEND_IO_URING
+                                                                                                 : ASYNC_IO_BACKEND_AUTO;
+
+        if (strlen(input.m_fanout_manifest) > 0)
+        {
+            return run_fanout(input.m_input_name, input.m_fanout_manifest, &options);
+        }
+
+        return run_batch(input.m_batch_manifest, &options);
+    }
+
     if (input.m_encode == true)
     {
         return encoding(input);
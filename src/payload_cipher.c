@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <sys/random.h>
+
+#include "../inc/payload_cipher.h"
+#include "../inc/image_arena.h"
+
+#define CHACHA20_BLOCK_LENGTH 64
+#define CHACHA20_STATE_WORDS 16
+#define CHACHA20_DOUBLE_ROUNDS 10
+#define POLY1305_BLOCK_LENGTH 16
+#define POLY1305_KEY_LENGTH 32
+
+// Flags go in the authenticated data as four bytes, lowest first
+#define AAD_LENGTH 4
+
+// Poly1305 accumulates in five limbs of 26 bits
+#define LIMB_MASK 0x3ffffff
+
+/**
+ * @brief Entry points of libsodium, resolved at runtime
+ *
+ * Encrypt writes ciphertext and tag, decrypt checks the tag first and
+ * returns -1 without writing if it does not match.
+ */
+typedef struct
+{
+    bool m_is_loaded;
+
+    int (*m_encrypt)(unsigned char *c, unsigned long long *clen, const unsigned char *m, unsigned long long mlen,
+                     const unsigned char *ad, unsigned long long adlen, const unsigned char *nsec,
+                     const unsigned char *npub, const unsigned char *k);
+    int (*m_decrypt)(unsigned char *m, unsigned long long *mlen, unsigned char *nsec, const unsigned char *c,
+                     unsigned long long clen, const unsigned char *ad, unsigned long long adlen,
+                     const unsigned char *npub, const unsigned char *k);
+
+} sodium_library;
+
+typedef struct
+{
+    uint32_t m_r[5];
+    uint32_t m_h[5];
+    uint32_t m_pad[4];
+
+} poly1305_state;
+
+static sodium_library g_sodium = {0};
+static pthread_once_t g_sodium_once = PTHREAD_ONCE_INIT;
+
+// Library loading
+
+static void load_sodium()
+{
+    void *library = dlopen(PAYLOAD_CIPHER_SODIUM_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+    int (*init)(void) = NULL;
+
+    if (library == NULL)
+    {
+        return;
+    }
+
+    init = (int (*)(void))dlsym(library, "sodium_init");
+    g_sodium.m_encrypt = (int (*)(unsigned char *, unsigned long long *, const unsigned char *, unsigned long long,
+                                  const unsigned char *, unsigned long long, const unsigned char *,
+                                  const unsigned char *, const unsigned char *))
+        dlsym(library, "crypto_aead_chacha20poly1305_ietf_encrypt");
+    g_sodium.m_decrypt = (int (*)(unsigned char *, unsigned long long *, unsigned char *, const unsigned char *,
+                                  unsigned long long, const unsigned char *, unsigned long long,
+                                  const unsigned char *, const unsigned char *))
+        dlsym(library, "crypto_aead_chacha20poly1305_ietf_decrypt");
+
+    // Library stays loaded for the life of the process; sodium_init picks the implementation for the CPU
+    g_sodium.m_is_loaded = init != NULL && g_sodium.m_encrypt != NULL && g_sodium.m_decrypt != NULL && init() >= 0;
+}
+
+// Portable ChaCha20-Poly1305, same output as libsodium
+
+static inline uint32_t load_32(const unsigned char *const bytes)
+{
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static inline void store_32(unsigned char *const bytes, const uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        bytes[i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+static inline uint32_t rotate_32(const uint32_t value, const int count)
+{
+    return (value << count) | (value >> (32 - count));
+}
+
+#define QUARTER_ROUND(a, b, c, d)                                                                                      \
+    a += b, d = rotate_32(d ^ a, 16), c += d, b = rotate_32(b ^ c, 12);                                                \
+    a += b, d = rotate_32(d ^ a, 8), c += d, b = rotate_32(b ^ c, 7)
+
+static void chacha20_block(const unsigned char *const key, const unsigned char *const nonce, const uint32_t counter,
+                           unsigned char *const block)
+{
+    uint32_t input[CHACHA20_STATE_WORDS] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+    uint32_t x[CHACHA20_STATE_WORDS];
+
+    for (int i = 0; i < 8; i++)
+    {
+        input[4 + i] = load_32(&key[i * 4]);
+    }
+
+    input[12] = counter;
+
+    for (int i = 0; i < 3; i++)
+    {
+        input[13 + i] = load_32(&nonce[i * 4]);
+    }
+
+    memcpy(x, input, sizeof(x));
+
+    for (int i = 0; i < CHACHA20_DOUBLE_ROUNDS; i++)
+    {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < CHACHA20_STATE_WORDS; i++)
+    {
+        store_32(&block[i * 4], x[i] + input[i]);
+    }
+}
+
+// Counter 0 is the Poly1305 key, text starts at 1
+static void chacha20_xor(const unsigned char *const key, const unsigned char *const nonce,
+                         const unsigned char *const src, unsigned char *const dest, const uint32_t length)
+{
+    unsigned char block[CHACHA20_BLOCK_LENGTH];
+
+    for (uint32_t position = 0; position < length; position += CHACHA20_BLOCK_LENGTH)
+    {
+        uint32_t count = length - position < CHACHA20_BLOCK_LENGTH ? length - position : CHACHA20_BLOCK_LENGTH;
+
+        chacha20_block(key, nonce, 1 + position / CHACHA20_BLOCK_LENGTH, block);
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            dest[position + i] = src[position + i] ^ block[i];
+        }
+    }
+}
+
+static void poly1305_init(poly1305_state *state, const unsigned char *const key)
+{
+    memset(state, 0, sizeof(poly1305_state));
+
+    // r is clamped as the specification says
+    state->m_r[0] = load_32(&key[0]) & 0x3ffffff;
+    state->m_r[1] = (load_32(&key[3]) >> 2) & 0x3ffff03;
+    state->m_r[2] = (load_32(&key[6]) >> 4) & 0x3ffc0ff;
+    state->m_r[3] = (load_32(&key[9]) >> 6) & 0x3f03fff;
+    state->m_r[4] = (load_32(&key[12]) >> 8) & 0x00fffff;
+
+    for (int i = 0; i < 4; i++)
+    {
+        state->m_pad[i] = load_32(&key[16 + i * 4]);
+    }
+}
+
+static void poly1305_block(poly1305_state *state, const unsigned char *const block)
+{
+    const uint32_t *r = state->m_r;
+    uint32_t *h = state->m_h;
+    uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+    uint64_t x[5];
+    uint64_t d[5];
+    uint32_t carry = 0;
+
+    // Full blocks only, so the 2^128 bit is always set
+    h[0] += load_32(&block[0]) & LIMB_MASK;
+    h[1] += (load_32(&block[3]) >> 2) & LIMB_MASK;
+    h[2] += (load_32(&block[6]) >> 4) & LIMB_MASK;
+    h[3] += (load_32(&block[9]) >> 6) & LIMB_MASK;
+    h[4] += (load_32(&block[12]) >> 8) | (1 << 24);
+
+    for (int i = 0; i < 5; i++)
+    {
+        x[i] = h[i];
+    }
+
+    d[0] = x[0] * r[0] + x[1] * s4 + x[2] * s3 + x[3] * s2 + x[4] * s1;
+    d[1] = x[0] * r[1] + x[1] * r[0] + x[2] * s4 + x[3] * s3 + x[4] * s2;
+    d[2] = x[0] * r[2] + x[1] * r[1] + x[2] * r[0] + x[3] * s4 + x[4] * s3;
+    d[3] = x[0] * r[3] + x[1] * r[2] + x[2] * r[1] + x[3] * r[0] + x[4] * s4;
+    d[4] = x[0] * r[4] + x[1] * r[3] + x[2] * r[2] + x[3] * r[1] + x[4] * r[0];
+
+    for (int i = 0; i < 5; i++)
+    {
+        d[i] += carry;
+        carry = (uint32_t)(d[i] >> 26);
+        h[i] = (uint32_t)d[i] & LIMB_MASK;
+    }
+
+    h[0] += carry * 5;
+    carry = h[0] >> 26;
+    h[0] &= LIMB_MASK;
+    h[1] += carry;
+}
+
+// Data is padded with zeros to whole blocks, as the AEAD construction does
+static void poly1305_update(poly1305_state *state, const unsigned char *const data, const uint32_t length)
+{
+    unsigned char block[POLY1305_BLOCK_LENGTH];
+    uint32_t position = 0;
+
+    for (; position + POLY1305_BLOCK_LENGTH <= length; position += POLY1305_BLOCK_LENGTH)
+    {
+        poly1305_block(state, &data[position]);
+    }
+
+    if (position < length)
+    {
+        memset(block, 0, sizeof(block));
+        memcpy(block, &data[position], length - position);
+        poly1305_block(state, block);
+    }
+}
+
+static void poly1305_finish(poly1305_state *state, unsigned char *const tag)
+{
+    uint32_t *h = state->m_h;
+    uint32_t g[5];
+    uint32_t carry = 0;
+    uint32_t mask = 0;
+    uint64_t sum = 0;
+
+    for (int i = 1; i < 5; i++)
+    {
+        h[i] += carry;
+        carry = h[i] >> 26;
+        h[i] &= LIMB_MASK;
+    }
+
+    h[0] += carry * 5;
+    carry = h[0] >> 26;
+    h[0] &= LIMB_MASK;
+    h[1] += carry;
+
+    // g = h + 5 - 2^130, taken instead of h if it is not negative
+    carry = 5;
+
+    for (int i = 0; i < 4; i++)
+    {
+        g[i] = h[i] + carry;
+        carry = g[i] >> 26;
+        g[i] &= LIMB_MASK;
+    }
+
+    g[4] = h[4] + carry - (1 << 26);
+    mask = (g[4] >> 31) - 1;
+
+    for (int i = 0; i < 5; i++)
+    {
+        h[i] = (h[i] & ~mask) | (g[i] & mask);
+    }
+
+    // Limbs to four words, plus the pad
+    h[0] = h[0] | (h[1] << 26);
+    h[1] = (h[1] >> 6) | (h[2] << 20);
+    h[2] = (h[2] >> 12) | (h[3] << 14);
+    h[3] = (h[3] >> 18) | (h[4] << 8);
+
+    for (int i = 0; i < 4; i++)
+    {
+        sum = (uint64_t)h[i] + state->m_pad[i] + (sum >> 32);
+        store_32(&tag[i * 4], (uint32_t)sum);
+    }
+}
+
+static void compute_tag(const unsigned char *const key, const unsigned char *const nonce,
+                        const unsigned char *const aad, const unsigned char *const text, const uint32_t length,
+                        unsigned char *const tag)
+{
+    unsigned char block[CHACHA20_BLOCK_LENGTH];
+    unsigned char lengths[POLY1305_BLOCK_LENGTH];
+    poly1305_state state;
+
+    chacha20_block(key, nonce, 0, block);
+    poly1305_init(&state, block);
+
+    store_32(&lengths[0], AAD_LENGTH);
+    store_32(&lengths[4], 0);
+    store_32(&lengths[8], length);
+    store_32(&lengths[12], 0);
+
+    poly1305_update(&state, aad, AAD_LENGTH);
+    poly1305_update(&state, text, length);
+    poly1305_update(&state, lengths, POLY1305_BLOCK_LENGTH);
+    poly1305_finish(&state, tag);
+}
+
+// Helper functions
+
+static bool encrypt_portable(const unsigned char *const key, const unsigned char *const nonce,
+                             const unsigned char *const aad, const unsigned char *const data, const uint32_t length,
+                             unsigned char *const dest)
+{
+    chacha20_xor(key, nonce, data, dest, length);
+    compute_tag(key, nonce, aad, dest, length, &dest[length]);
+
+    return true;
+}
+
+static bool decrypt_portable(const unsigned char *const key, const unsigned char *const nonce,
+                             const unsigned char *const aad, const unsigned char *const data, const uint32_t length,
+                             unsigned char *const dest)
+{
+    unsigned char tag[PAYLOAD_TAG_LENGTH];
+    unsigned char difference = 0;
+
+    compute_tag(key, nonce, aad, data, length, tag);
+
+    // Compared in constant time, then decrypted only if it matches
+    for (int i = 0; i < PAYLOAD_TAG_LENGTH; i++)
+    {
+        difference |= tag[i] ^ data[length + i];
+    }
+
+    if (difference != 0)
+    {
+        return false;
+    }
+
+    chacha20_xor(key, nonce, data, dest, length);
+
+    return true;
+}
+
+// Header defined functions
+
+bool payload_read_key(const char *file_name, unsigned char *const key)
+{
+    FILE *fp = fopen(file_name, "rb");
+    bool result = false;
+
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    // One byte more must not be there
+    result = fread(key, 1, PAYLOAD_KEY_LENGTH, fp) == PAYLOAD_KEY_LENGTH && fgetc(fp) == EOF;
+
+    fclose(fp);
+
+    return result;
+}
+
+unsigned char *payload_encrypt(const unsigned char *const data, const uint32_t data_length,
+                               const unsigned char *const key, const uint32_t flags, uint32_t *encrypted_length)
+{
+    unsigned char aad[AAD_LENGTH];
+    unsigned char *result = NULL;
+    unsigned long long length = 0;
+    bool is_ok = false;
+
+    *encrypted_length = 0;
+
+    if (data_length > UINT32_MAX - PAYLOAD_CIPHER_OVERHEAD)
+    {
+        return NULL;
+    }
+
+    result = (unsigned char *)image_alloc((unsigned long int)data_length + PAYLOAD_CIPHER_OVERHEAD);
+
+    // A nonce is never used twice with a key, random ones of 96 bits make that safe enough
+    if (result == NULL || getrandom(result, PAYLOAD_NONCE_LENGTH, 0) != PAYLOAD_NONCE_LENGTH)
+    {
+        image_free(result);
+        return NULL;
+    }
+
+    store_32(aad, flags);
+
+    pthread_once(&g_sodium_once, load_sodium);
+
+    if (g_sodium.m_is_loaded == true)
+    {
+        is_ok = g_sodium.m_encrypt(&result[PAYLOAD_NONCE_LENGTH], &length, data, data_length, aad, AAD_LENGTH, NULL,
+                                   result, key) == 0;
+    }
+    else
+    {
+        is_ok = encrypt_portable(key, result, aad, data, data_length, &result[PAYLOAD_NONCE_LENGTH]);
+    }
+
+    if (is_ok == false)
+    {
+        image_free(result);
+        return NULL;
+    }
+
+    *encrypted_length = data_length + PAYLOAD_CIPHER_OVERHEAD;
+
+    return result;
+}
+
+unsigned char *payload_decrypt(const unsigned char *const data, const uint32_t data_length,
+                               const unsigned char *const key, const uint32_t flags, uint32_t *decrypted_length)
+{
+    unsigned char aad[AAD_LENGTH];
+    unsigned char *result = NULL;
+    unsigned long long length = 0;
+    uint32_t text_length = data_length - PAYLOAD_CIPHER_OVERHEAD;
+    bool is_ok = false;
+
+    *decrypted_length = 0;
+
+    if (data_length < PAYLOAD_CIPHER_OVERHEAD)
+    {
+        return NULL;
+    }
+
+    // + 1 for the '\0' appended
+    result = (unsigned char *)image_alloc((unsigned long int)text_length + 1);
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    store_32(aad, flags);
+
+    pthread_once(&g_sodium_once, load_sodium);
+
+    if (g_sodium.m_is_loaded == true)
+    {
+        is_ok = g_sodium.m_decrypt(result, &length, NULL, &data[PAYLOAD_NONCE_LENGTH],
+                                   text_length + PAYLOAD_TAG_LENGTH, aad, AAD_LENGTH, data, key) == 0;
+    }
+    else
+    {
+        is_ok = decrypt_portable(key, data, aad, &data[PAYLOAD_NONCE_LENGTH], text_length, result);
+    }
+
+    if (is_ok == false)
+    {
+        image_free(result);
+        return NULL;
+    }
+
+    result[text_length] = '\0';
+
+    *decrypted_length = text_length + 1;
+
+    return result;
+}
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../inc/payload_compression.h"
+#include "../inc/png_parser.h"
+#include "../inc/png_data_encoder.h"
+#include "../inc/deflate_backend.h"
+#include "../inc/image_arena.h"
+
+#define BITS_IN_BYTE 8
+
+// Header defined functions
+
+unsigned char *payload_compress(const unsigned char *const data, const uint32_t data_length,
+                                uint32_t *compressed_length)
+{
+    const deflate_backend *backend = deflate_backend_current();
+    unsigned long int capacity = HEADER_DATA_LEN + backend->m_bound(data_length);
+    unsigned long int stream_length = capacity - HEADER_DATA_LEN;
+    unsigned char *result = NULL;
+
+    *compressed_length = 0;
+
+    result = (unsigned char *)image_alloc(capacity);
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    // Uncompressed length lowest byte first, as the length header of encode_data_rgba
+    for (int i = 0; i < HEADER_DATA_LEN; i++)
+    {
+        result[i] = (data_length >> (i * BITS_IN_BYTE)) & 0xFF;
+    }
+
+    // Payloads are small next to the image, so the slowest level costs little
+    if (backend->m_deflate(data, data_length, &result[HEADER_DATA_LEN], &stream_length, DEFLATE_LEVEL_MAX,
+                           DEFLATE_STRATEGY_DEFAULT) == false ||
+        stream_length + HEADER_DATA_LEN >= data_length)
+    {
+        image_free(result);
+        return NULL;
+    }
+
+    *compressed_length = stream_length + HEADER_DATA_LEN;
+
+    return result;
+}
+
+unsigned char *payload_uncompress(const unsigned char *const data, const uint32_t data_length,
+                                  uint32_t *uncompressed_length)
+{
+    unsigned char *result = NULL;
+    unsigned long int out_length = 0;
+    uint32_t length = 0;
+
+    *uncompressed_length = 0;
+
+    if (data_length < HEADER_DATA_LEN)
+    {
+        return NULL;
+    }
+
+    for (int i = HEADER_DATA_LEN - 1; i >= 0; i--)
+    {
+        length = (length << BITS_IN_BYTE) | data[i];
+    }
+
+    // Length comes from the image, it must be one deflate can reach
+    if (length > PAYLOAD_LENGTH_MASK ||
+        length > (unsigned long int)(data_length - HEADER_DATA_LEN) * PAYLOAD_COMPRESSION_MAX_RATIO)
+    {
+        return NULL;
+    }
+
+    // + 1 for the '\0' appended
+    result = (unsigned char *)image_alloc((unsigned long int)length + 1);
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    if (deflate_backend_current()->m_inflate(&data[HEADER_DATA_LEN], data_length - HEADER_DATA_LEN, result, length,
+                                             &out_length) == false ||
+        out_length != length)
+    {
+        image_free(result);
+        return NULL;
+    }
+
+    result[length] = '\0';
+
+    *uncompressed_length = length + 1;
+
+    return result;
+}
@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../inc/pipeline.h"
+#include "../inc/codec.h"
+
+// Pipeline layout
+#define PIPELINE_STEP_COUNT 5
+#define PIPELINE_QUEUE_COUNT (PIPELINE_STEP_COUNT - 1)
+#define PIPELINE_MAX_STEP_WORKERS 64
+
+/**
+ * @brief Bounded blocking FIFO of jobs
+ */
+typedef struct
+{
+    codec_job **m_items;
+    size_t m_capacity;
+    size_t m_head;
+    size_t m_count;
+    bool m_closed;
+
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_not_empty;
+    pthread_cond_t m_not_full;
+
+} job_queue;
+
+/**
+ * @brief One pipeline step: a range of codec stages with its own workers
+ *
+ * m_input is NULL for the first step, m_output is NULL for the last one.
+ */
+typedef struct
+{
+    codec_stage m_first_stage;
+    codec_stage m_last_stage;
+    size_t m_worker_count;
+    size_t m_active_workers;
+
+    job_queue *m_input;
+    job_queue *m_output;
+
+    struct pipeline *m_pipeline;
+
+} pipeline_step;
+
+typedef struct pipeline
+{
+    pipeline_step m_steps[PIPELINE_STEP_COUNT];
+    job_queue m_queues[PIPELINE_QUEUE_COUNT];
+
+    codec_job *m_jobs;
+    size_t m_job_count;
+    size_t m_next_job;
+
+    pipeline_done_callback m_on_done;
+    void *m_context;
+
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_start_cond;
+    bool m_started;
+
+} pipeline;
+
+// Queue functions
+
+static bool queue_init(job_queue *queue, const size_t capacity)
+{
+    queue->m_items = (codec_job **)malloc(capacity * sizeof(codec_job *));
+
+    if (queue->m_items == NULL)
+    {
+        return false;
+    }
+
+    queue->m_capacity = capacity;
+    queue->m_head = 0;
+    queue->m_count = 0;
+    queue->m_closed = false;
+
+    pthread_mutex_init(&queue->m_lock, NULL);
+    pthread_cond_init(&queue->m_not_empty, NULL);
+    pthread_cond_init(&queue->m_not_full, NULL);
+
+    return true;
+}
+
+static void queue_free(job_queue *queue)
+{
+    pthread_mutex_destroy(&queue->m_lock);
+    pthread_cond_destroy(&queue->m_not_empty);
+    pthread_cond_destroy(&queue->m_not_full);
+    free(queue->m_items);
+}
+
+static void queue_push(job_queue *queue, codec_job *job)
+{
+    pthread_mutex_lock(&queue->m_lock);
+
+    // Backpressure: block producer while consumer is behind
+    while (queue->m_count == queue->m_capacity)
+    {
+        pthread_cond_wait(&queue->m_not_full, &queue->m_lock);
+    }
+
+    queue->m_items[(queue->m_head + queue->m_count) % queue->m_capacity] = job;
+    queue->m_count++;
+
+    pthread_cond_signal(&queue->m_not_empty);
+    pthread_mutex_unlock(&queue->m_lock);
+}
+
+static codec_job *queue_pop(job_queue *queue)
+{
+    codec_job *result = NULL;
+
+    pthread_mutex_lock(&queue->m_lock);
+
+    while (queue->m_count == 0 && queue->m_closed == false)
+    {
+        pthread_cond_wait(&queue->m_not_empty, &queue->m_lock);
+    }
+
+    // NULL once queue is closed and drained
+    if (queue->m_count > 0)
+    {
+        result = queue->m_items[queue->m_head];
+        queue->m_head = (queue->m_head + 1) % queue->m_capacity;
+        queue->m_count--;
+
+        pthread_cond_signal(&queue->m_not_full);
+    }
+
+    pthread_mutex_unlock(&queue->m_lock);
+
+    return result;
+}
+
+static void queue_close(job_queue *queue)
+{
+    pthread_mutex_lock(&queue->m_lock);
+    queue->m_closed = true;
+    pthread_cond_broadcast(&queue->m_not_empty);
+    pthread_mutex_unlock(&queue->m_lock);
+}
+
+// Step functions
+
+static codec_job *step_next_job(pipeline_step *step)
+{
+    pipeline *owner = step->m_pipeline;
+    codec_job *result = NULL;
+
+    if (step->m_input != NULL)
+    {
+        return queue_pop(step->m_input);
+    }
+
+    // First step takes jobs straight from the job list
+    pthread_mutex_lock(&owner->m_lock);
+
+    if (owner->m_next_job < owner->m_job_count)
+    {
+        result = &owner->m_jobs[owner->m_next_job++];
+    }
+
+    pthread_mutex_unlock(&owner->m_lock);
+
+    return result;
+}
+
+static void *step_main(void *argument)
+{
+    pipeline_step *step = (pipeline_step *)argument;
+    pipeline *owner = step->m_pipeline;
+    codec_job *job = NULL;
+
+    // Wait until every worker of every step exists
+    pthread_mutex_lock(&owner->m_lock);
+
+    while (owner->m_started == false)
+    {
+        pthread_cond_wait(&owner->m_start_cond, &owner->m_lock);
+    }
+
+    pthread_mutex_unlock(&owner->m_lock);
+
+    while ((job = step_next_job(step)) != NULL)
+    {
+        for (codec_stage stage = step->m_first_stage; stage <= step->m_last_stage; stage++)
+        {
+            codec_run_stage(job, stage);
+        }
+
+        if (step->m_output != NULL)
+        {
+            // Failed jobs still travel to the end, so they are reported in order of completion
+            queue_push(step->m_output, job);
+            continue;
+        }
+
+        if (owner->m_on_done != NULL)
+        {
+            owner->m_on_done(job, owner->m_context);
+        }
+
+        codec_job_release(job);
+    }
+
+    // Last worker of a step closes the queue after it
+    pthread_mutex_lock(&owner->m_lock);
+
+    if (--step->m_active_workers == 0 && step->m_output != NULL)
+    {
+        queue_close(step->m_output);
+    }
+
+    pthread_mutex_unlock(&owner->m_lock);
+
+    return NULL;
+}
+
+// Header defined functions
+
+bool run_pipeline(codec_job *const jobs, const size_t job_count, size_t queue_depth,
+                  pipeline_done_callback on_done, void *context)
+{
+    static const codec_stage step_stages[PIPELINE_STEP_COUNT][2] = {
+        {CODEC_STAGE_READ, CODEC_STAGE_READ},
+        {CODEC_STAGE_INFLATE, CODEC_STAGE_INFLATE},
+        {CODEC_STAGE_UNFILTER, CODEC_STAGE_FILTER},
+        {CODEC_STAGE_DEFLATE, CODEC_STAGE_DEFLATE},
+        {CODEC_STAGE_WRITE, CODEC_STAGE_WRITE},
+    };
+
+    pipeline owner = {0};
+    pthread_t threads[PIPELINE_STEP_COUNT][PIPELINE_MAX_STEP_WORKERS];
+    size_t compute_workers = 1;
+    long int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    bool result = true;
+
+    if (queue_depth == 0)
+    {
+        queue_depth = PIPELINE_DEFAULT_QUEUE_DEPTH;
+    }
+
+    // I/O steps are single threaded, compute steps get the cores
+    if (cores > 1)
+    {
+        compute_workers = cores < PIPELINE_MAX_STEP_WORKERS ? cores : PIPELINE_MAX_STEP_WORKERS;
+    }
+
+    owner.m_jobs = jobs;
+    owner.m_job_count = job_count;
+    owner.m_on_done = on_done;
+    owner.m_context = context;
+
+    pthread_mutex_init(&owner.m_lock, NULL);
+    pthread_cond_init(&owner.m_start_cond, NULL);
+
+    for (size_t i = 0; i < PIPELINE_QUEUE_COUNT; i++)
+    {
+        if (queue_init(&owner.m_queues[i], queue_depth) == false)
+        {
+            for (size_t j = 0; j < i; j++)
+            {
+                queue_free(&owner.m_queues[j]);
+            }
+
+            pthread_mutex_destroy(&owner.m_lock);
+            pthread_cond_destroy(&owner.m_start_cond);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < PIPELINE_STEP_COUNT; i++)
+    {
+        pipeline_step *step = &owner.m_steps[i];
+
+        step->m_first_stage = step_stages[i][0];
+        step->m_last_stage = step_stages[i][1];
+        step->m_input = i == 0 ? NULL : &owner.m_queues[i - 1];
+        step->m_output = i == PIPELINE_STEP_COUNT - 1 ? NULL : &owner.m_queues[i];
+        step->m_pipeline = &owner;
+        step->m_worker_count = (i == 0 || i == PIPELINE_STEP_COUNT - 1) ? 1 : compute_workers;
+        step->m_active_workers = step->m_worker_count;
+    }
+
+    // Start every step before any job flows
+    for (size_t i = 0; i < PIPELINE_STEP_COUNT; i++)
+    {
+        pipeline_step *step = &owner.m_steps[i];
+
+        for (size_t j = 0; j < step->m_worker_count; j++)
+        {
+            if (pthread_create(&threads[i][j], NULL, step_main, step) != 0)
+            {
+                step->m_active_workers = step->m_worker_count = j;
+                result = false;
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&owner.m_lock);
+
+    // Without a full set of workers no job is started, started workers drain and exit
+    if (result == false)
+    {
+        owner.m_job_count = 0;
+
+        for (size_t i = 0; i < PIPELINE_QUEUE_COUNT; i++)
+        {
+            queue_close(&owner.m_queues[i]);
+        }
+    }
+
+    owner.m_started = true;
+    pthread_cond_broadcast(&owner.m_start_cond);
+    pthread_mutex_unlock(&owner.m_lock);
+
+    for (size_t i = 0; i < PIPELINE_STEP_COUNT; i++)
+    {
+        for (size_t j = 0; j < owner.m_steps[i].m_worker_count; j++)
+        {
+            pthread_join(threads[i][j], NULL);
+        }
+    }
+
+    for (size_t i = 0; i < PIPELINE_QUEUE_COUNT; i++)
+    {
+        queue_free(&owner.m_queues[i]);
+    }
+
+    pthread_mutex_destroy(&owner.m_lock);
+    pthread_cond_destroy(&owner.m_start_cond);
+
+    return result;
+}
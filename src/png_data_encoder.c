@@ -3,197 +3,301 @@
 
 #include "../inc/png_data_encoder.h"
 #include "../inc/png_filtration.h"
+#include "../inc/image_arena.h"
 
 #include <string.h>
 
 #define BITS_IN_BYTE 8
 
-bool encode_data_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr,
-                      unsigned char *const data, uint32_t data_length)
-{
-    long unsigned int image_size = ihdr.m_width * ihdr.m_height;
-
-    // Check if image is big enough to hold the data
-    if ((data_length + HEADER_DATA_LEN) >= ((image_size * RGBA_PIXEL_SIZE) / BITS_IN_BYTE))
-    {
-        return false;
+/**
+ * Data goes in the lowest bits of the samples, row after row in PNG sample
+ * order, lowest bit of every byte first: the length header of
+ * HEADER_DATA_LEN bytes, then the data. 8 bit samples carry one bit, 16 bit
+ * samples two in their low byte, so at either depth a row carries as many
+ * bits as it has bytes. Kernels are generated once per bit depth so the
+ * sample stride and bit count are constants.
+ */
+#define DEFINE_PAYLOAD_KERNELS(DEPTH, BITS)                                                                            \
+    static void embed_bytes_##DEPTH(RGBA_pixel **const image, const size_t row_size, const unsigned long int first_bit, \
+                                    const unsigned char *const data, const unsigned long int length)                   \
+    {                                                                                                                  \
+        const unsigned char mask = (1 << BITS) - 1;                                                                    \
+        size_t row = first_bit / row_size;                                                                             \
+        size_t column = (first_bit % row_size) / BITS * (DEPTH / 8) + (DEPTH / 8 - 1);                                 \
+        unsigned char *samples = (unsigned char *)image[row];                                                          \
+                                                                                                                       \
+        for (unsigned long int data_i = 0; data_i < length; data_i++)                                                  \
+        {                                                                                                              \
+            for (unsigned int bit_i = 0; bit_i < BITS_IN_BYTE; bit_i += BITS)                                          \
+            {                                                                                                          \
+                if (column >= row_size)                                                                                \
+                {                                                                                                      \
+                    samples = (unsigned char *)image[++row];                                                           \
+                    column = DEPTH / 8 - 1;                                                                            \
+                }                                                                                                      \
+                                                                                                                       \
+                /* Clear the carrying bits and OR them with the next bits of data */                                   \
+                samples[column] = (samples[column] & ~mask) | ((data[data_i] >> bit_i) & mask);                        \
+                column += DEPTH / 8;                                                                                   \
+            }                                                                                                          \
+        }                                                                                                              \
+    }                                                                                                                  \
+                                                                                                                       \
+    static void extract_bytes_##DEPTH(RGBA_pixel **const image, const size_t row_size,                                 \
+                                      const unsigned long int first_bit, unsigned char *const data,                    \
+                                      const unsigned long int length)                                                  \
+    {                                                                                                                  \
+        const unsigned char mask = (1 << BITS) - 1;                                                                    \
+        size_t row = first_bit / row_size;                                                                             \
+        size_t column = (first_bit % row_size) / BITS * (DEPTH / 8) + (DEPTH / 8 - 1);                                 \
+        const unsigned char *samples = (const unsigned char *)image[row];                                              \
+                                                                                                                       \
+        for (unsigned long int data_i = 0; data_i < length; data_i++)                                                  \
+        {                                                                                                              \
+            data[data_i] = 0;                                                                                          \
+                                                                                                                       \
+            for (unsigned int bit_i = 0; bit_i < BITS_IN_BYTE; bit_i += BITS)                                          \
+            {                                                                                                          \
+                if (column >= row_size)                                                                                \
+                {                                                                                                      \
+                    samples = (const unsigned char *)image[++row];                                                     \
+                    column = DEPTH / 8 - 1;                                                                            \
+                }                                                                                                      \
+                                                                                                                       \
+                data[data_i] |= (samples[column] & mask) << bit_i;                                                     \
+                column += DEPTH / 8;                                                                                   \
+            }                                                                                                          \
+        }                                                                                                              \
     }
 
-    // Encode data length
-    {
-        long int row = 0;
-        long int column = 0;
-
-        for (long int data_i = 0, img_i = 0, bit_i = 0; data_i < HEADER_DATA_LEN; data_i++, img_i++)
-        {
-            row = img_i / ihdr.m_width;
-            column = img_i % ihdr.m_width;
+DEFINE_PAYLOAD_KERNELS(8, 1)
+DEFINE_PAYLOAD_KERNELS(16, 2)
 
-            // Set image last bit to 0 and OR it with last bit of data[i],
-            // then throw last data bit and replace it with next
-            image[row][column].m_red =
-                (image[row][column].m_red & 0xFE) | ((data_length >> bit_i++) & 0x01);
+// Helper functions
 
-            image[row][column].m_green =
-                (image[row][column].m_green & 0xFE) | ((data_length >> bit_i++) & 0x01);
+static void embed_bytes(RGBA_pixel **const image, const IHDR_chunk ihdr, const unsigned long int first_byte,
+                        const unsigned char *const data, const unsigned long int length)
+{
+    if (ihdr.m_bit_depth == BIT_DEPTH_16)
+    {
+        embed_bytes_16(image, png_row_size(ihdr), first_byte * BITS_IN_BYTE, data, length);
+    }
+    else
+    {
+        embed_bytes_8(image, png_row_size(ihdr), first_byte * BITS_IN_BYTE, data, length);
+    }
+}
 
-            image[row][column].m_blue =
-                (image[row][column].m_blue & 0xFE) | ((data_length >> bit_i++) & 0x01);
+static void extract_bytes(RGBA_pixel **const image, const IHDR_chunk ihdr, const unsigned long int first_byte,
+                          unsigned char *const data, const unsigned long int length)
+{
+    if (ihdr.m_bit_depth == BIT_DEPTH_16)
+    {
+        extract_bytes_16(image, png_row_size(ihdr), first_byte * BITS_IN_BYTE, data, length);
+    }
+    else
+    {
+        extract_bytes_8(image, png_row_size(ihdr), first_byte * BITS_IN_BYTE, data, length);
+    }
+}
 
-            image[row][column].m_alpha =
-                (image[row][column].m_alpha & 0xFE) | ((data_length >> bit_i++) & 0x01);
+// Bytes the whole image can carry, length header included
+static inline unsigned long int image_capacity(const IHDR_chunk ihdr)
+{
+    return png_row_size(ihdr) * ihdr.m_height / BITS_IN_BYTE;
+}
 
-            // Go to next pixel, since 2 pixels hold 1 byte total
-            img_i++;
-            row = img_i / ihdr.m_width;
-            column = img_i % ihdr.m_width;
+// First format repeated the low byte of the length in every header byte
+static inline bool is_first_format_header(const uint32_t header)
+{
+    return header != 0 && (header & 0xFF) * 0x01010101u == header;
+}
 
-            // Set image last bit to 0 and OR it with last bit of data[i],
-            // then throw last data bit and replace it with next
-            image[row][column].m_red =
-                (image[row][column].m_red & 0xFE) | ((data_length >> bit_i++) & 0x01);
+static inline bool fits_image(const IHDR_chunk ihdr, const uint32_t data_length)
+{
+    return ((long unsigned int)data_length + HEADER_DATA_LEN) < image_capacity(ihdr);
+}
 
-            image[row][column].m_green =
-                (image[row][column].m_green & 0xFE) | ((data_length >> bit_i++) & 0x01);
+// Length is stored lowest byte first
+static uint32_t read_header(RGBA_pixel **const image, const IHDR_chunk ihdr)
+{
+    unsigned char header[HEADER_DATA_LEN] = {0};
+    uint32_t result = 0;
 
-            image[row][column].m_blue =
-                (image[row][column].m_blue & 0xFE) | ((data_length >> bit_i++) & 0x01);
+    extract_bytes(image, ihdr, 0, header, HEADER_DATA_LEN);
 
-            image[row][column].m_alpha =
-                (image[row][column].m_alpha & 0xFE) | ((data_length >> bit_i) & 0x01);
+    for (int i = HEADER_DATA_LEN - 1; i >= 0; i--)
+    {
+        result = (result << BITS_IN_BYTE) | header[i];
+    }
 
-            bit_i = 0;
-        }
+    return result;
+}
 
-        // Encode the data
-        for (long unsigned int data_i = 0, img_i = HEADER_DATA_LEN * 2, bit_i = 0; data_i < data_length; data_i++, img_i++)
-        {
-            row = img_i / ihdr.m_width;
-            column = img_i % ihdr.m_width;
+static bool read_data_length(RGBA_pixel **const image, const IHDR_chunk ihdr, uint32_t *data_length,
+                             uint32_t *flags)
+{
+    *data_length = 0;
+    *flags = 0;
 
-            // Set image last bit to 0 and OR it with last bit of data[i],
-            // then throw last data bit and replace it with next
-            image[row][column].m_red =
-                (image[row][column].m_red & 0xFE) | ((data[data_i] >> bit_i++) & 0x01);
+    if (png_is_supported(ihdr) == false)
+    {
+        return false;
+    }
 
-            image[row][column].m_green =
-                (image[row][column].m_green & 0xFE) | ((data[data_i] >> bit_i++) & 0x01);
+    *data_length = read_header(image, ihdr);
 
-            image[row][column].m_blue =
-                (image[row][column].m_blue & 0xFE) | ((data[data_i] >> bit_i++) & 0x01);
+    // Only the current format is read, and its length must fit in image
+    if (is_first_format_header(*data_length) == true || (*data_length & PAYLOAD_FLAG_RESERVED) != 0 ||
+        fits_image(ihdr, *data_length & PAYLOAD_LENGTH_MASK) == false)
+    {
+        *data_length = 0;
+        return false;
+    }
 
-            image[row][column].m_alpha =
-                (image[row][column].m_alpha & 0xFE) | ((data[data_i] >> bit_i++) & 0x01);
+    *flags = *data_length & ~PAYLOAD_LENGTH_MASK;
+    *data_length &= PAYLOAD_LENGTH_MASK;
 
-            // Go to next pixel, since 2 pixels hold 1 byte total
-            img_i++;
-            row = img_i / ihdr.m_width;
-            column = img_i % ihdr.m_width;
+    return true;
+}
 
-            // Set image last bit to 0 and OR it with last bit of data[i],
-            // then throw last data bit and replace it with next
-            image[row][column].m_red =
-                (image[row][column].m_red & 0xFE) | ((data[data_i] >> bit_i++) & 0x01);
+// Header defined functions
 
-            image[row][column].m_green =
-                (image[row][column].m_green & 0xFE) | ((data[data_i] >> bit_i++) & 0x01);
+bool encode_data_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr,
+                      unsigned char *const data, uint32_t data_length, const uint32_t flags)
+{
+    unsigned char header[HEADER_DATA_LEN] = {0};
+    uint32_t flagged_length = data_length | flags;
+
+    // Check if image is big enough to hold the data, the length leaves the flag bits free, and the header is
+    // not taken for one of the first format
+    if (png_is_supported(ihdr) == false || data_length > PAYLOAD_LENGTH_MASK ||
+        (flags & (PAYLOAD_LENGTH_MASK | PAYLOAD_FLAG_RESERVED)) != 0 || fits_image(ihdr, data_length) == false ||
+        is_first_format_header(flagged_length) == true)
+    {
+        return false;
+    }
 
-            image[row][column].m_blue =
-                (image[row][column].m_blue & 0xFE) | ((data[data_i] >> bit_i++) & 0x01);
+    // Encode data length and flags, lowest byte first
+    for (int i = 0; i < HEADER_DATA_LEN; i++)
+    {
+        header[i] = (flagged_length >> (i * BITS_IN_BYTE)) & 0xFF;
+    }
 
-            image[row][column].m_alpha =
-                (image[row][column].m_alpha & 0xFE) | ((data[data_i] >> bit_i) & 0x01);
+    embed_bytes(image, ihdr, 0, header, HEADER_DATA_LEN);
 
-            bit_i = 0;
-        }
-    }
+    // Encode the data
+    embed_bytes(image, ihdr, HEADER_DATA_LEN, data, data_length);
 
     return true;
 }
 
 bool decode_data_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr,
-                      unsigned char **data_in, uint32_t *data_length)
+                      unsigned char **data_in, uint32_t *data_length, uint32_t *flags)
 {
     unsigned char *data = NULL;
 
     // Read data length
-    *data_length = 0;
+    if (read_data_length(image, ihdr, data_length, flags) == false)
+    {
+        return false;
+    }
+
+    // Allocate buffer
+    // Increment length by 1 for '\0' append. Might can be removed in the future
+    data = (unsigned char *)image_alloc(*data_length * sizeof(unsigned char) + 1);
 
+    if (data == NULL)
     {
-        long int row = 0;
-        long int column = 0;
-        register long int temp_len = HEADER_DATA_LEN * 2;
+        return false;
+    }
 
-        for (long int img_i = 0, bit_i = 0; img_i < temp_len; img_i++)
-        {
-            row = img_i / ihdr.m_width;
-            column = img_i % ihdr.m_width;
+    // Read from image to buffer
+    extract_bytes(image, ihdr, HEADER_DATA_LEN, data, *data_length);
+    data[*data_length] = '\0';
 
-            *data_length |= (image[row][column].m_red & 0x01) << bit_i++;
-            *data_length |= (image[row][column].m_green & 0x01) << bit_i++;
-            *data_length |= (image[row][column].m_blue & 0x01) << bit_i++;
-            *data_length |= (image[row][column].m_alpha & 0x01) << bit_i++;
+    (*data_length)++; // Increment length because of '\0' append. Might can be removed in the future
 
-            // Go to next pixel, since 2 pixels hold 1 byte total
-            img_i++;
-            row = img_i / ihdr.m_width;
-            column = img_i % ihdr.m_width;
+    // Save data state for return
+    (*data_in) = data;
 
-            *data_length |= (image[row][column].m_red & 0x01) << bit_i++;
-            *data_length |= (image[row][column].m_green & 0x01) << bit_i++;
-            *data_length |= (image[row][column].m_blue & 0x01) << bit_i++;
-            *data_length |= (image[row][column].m_alpha & 0x01) << bit_i;
+    return true;
+}
 
-            bit_i = 0;
-        }
+const char *decode_data_error_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr)
+{
+    uint32_t header = 0;
+
+    if (png_is_supported(ihdr) == false)
+    {
+        return "Decoding failed!\n";
     }
 
-    // Allocate buffer
-    // Increment length by 1 for '\0' append. Might can be removed in the future
-    data = (unsigned char *)malloc(*data_length * sizeof(unsigned char) + 1);
+    header = read_header(image, ihdr);
 
-    if (data == NULL)
+    if (is_first_format_header(header) == true)
     {
-        return false;
+        return "Payload has the one byte length header of older builds, which is not read any more!\n";
     }
 
-    // Initialize buffer to '\0'
-    memset(data, 0, (*data_length) * sizeof(unsigned char) + 1);
-
-    // Read from image to buffer
+    if ((header & PAYLOAD_FLAG_RESERVED) != 0)
     {
-        long int row = 0;
-        long int column = 0;
-        register unsigned long int temp_len = (*data_length + HEADER_DATA_LEN) * 2;
+        return "Payload has a length header of a later format!\n";
+    }
+
+    return "Decoding failed!\n";
+}
 
-        for (unsigned long int img_i = HEADER_DATA_LEN * 2, data_i = 0, bit_i = 0; img_i < temp_len; img_i++, data_i++)
-        {
-            row = img_i / ihdr.m_width;
-            column = img_i % ihdr.m_width;
+bool decode_data_length_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr, uint32_t *data_length)
+{
+    uint32_t flags = 0;
 
-            data[data_i] |= (image[row][column].m_red & 0x01) << bit_i++;
-            data[data_i] |= (image[row][column].m_green & 0x01) << bit_i++;
-            data[data_i] |= (image[row][column].m_blue & 0x01) << bit_i++;
-            data[data_i] |= (image[row][column].m_alpha & 0x01) << bit_i++;
+    return read_data_length(image, ihdr, data_length, &flags);
+}
 
-            // Go to next pixel, since 2 pixels hold 1 byte total
-            img_i++;
-            row = img_i / ihdr.m_width;
-            column = img_i % ihdr.m_width;
+unsigned long int capacity_rgba(const IHDR_chunk ihdr)
+{
+    return png_is_supported(ihdr) ? image_capacity(ihdr) : 0;
+}
 
-            data[data_i] |= (image[row][column].m_red & 0x01) << bit_i++;
-            data[data_i] |= (image[row][column].m_green & 0x01) << bit_i++;
-            data[data_i] |= (image[row][column].m_blue & 0x01) << bit_i++;
-            data[data_i] |= (image[row][column].m_alpha & 0x01) << bit_i;
+bool embed_bytes_rgba(RGBA_pixel **image, const IHDR_chunk ihdr, const unsigned long int first_byte,
+                      const unsigned char *const data, const unsigned long int data_length)
+{
+    if (png_is_supported(ihdr) == false || first_byte + data_length > image_capacity(ihdr))
+    {
+        return false;
+    }
 
-            bit_i = 0;
-        }
+    if (data_length > 0)
+    {
+        embed_bytes(image, ihdr, first_byte, data, data_length);
     }
 
-    (*data_length)++; // Increment length because of '\0' append. Might can be removed in the future
+    return true;
+}
 
-    // Save data state for return
-    (*data_in) = data;
+bool extract_bytes_rgba(RGBA_pixel **const image, const IHDR_chunk ihdr, const unsigned long int first_byte,
+                        unsigned char *const data, const unsigned long int data_length)
+{
+    if (png_is_supported(ihdr) == false || first_byte + data_length > image_capacity(ihdr))
+    {
+        return false;
+    }
+
+    if (data_length > 0)
+    {
+        extract_bytes(image, ihdr, first_byte, data, data_length);
+    }
 
     return true;
 }
+
+uint32_t data_rows_rgba(const IHDR_chunk ihdr, const uint32_t data_length)
+{
+    // A row carries one bit per byte, plus one spare byte so the fit check of decode_data_rgba passes on the rows alone
+    unsigned long int bits = ((unsigned long int)data_length + HEADER_DATA_LEN + 1) * BITS_IN_BYTE;
+    unsigned long int row_size = png_row_size(ihdr);
+    unsigned long int rows = row_size == 0 ? ihdr.m_height : (bits + row_size - 1) / row_size;
+
+    return rows < ihdr.m_height ? rows : ihdr.m_height;
+}
@@ -6,18 +6,27 @@
 
 #include "../inc/png_filtration.h"
 #include "../inc/png_parser.h"
+#include "../inc/image_arena.h"
+
+/**
+ * Filters work on bytes: the left neighbour of a byte is the same byte of the
+ * pixel before, pixel size bytes back, whatever the color type and bit depth.
+ * Kernels are generated once per pixel size so that distance is a constant and
+ * the loops carry no per byte branching; the kernel is picked once per row.
+ *
+ * src of reverse kernels and dest of apply kernels skip the filter type byte.
+ */
+typedef void (*filter_kernel)(const unsigned char *const src, const unsigned char *const prev, unsigned char *const dest,
+                              const size_t length);
+
+typedef struct
+{
+    filter_kernel m_reverse[PNG_FILTER_COUNT];
+    filter_kernel m_apply[PNG_FILTER_COUNT];
 
-// Defines of filters for filter method(0)
-#define PNG_FILTER_NONE 0
-#define PNG_FILTER_SUB 1
-#define PNG_FILTER_UP 2
-#define PNG_FILTER_AVERAGE 3
-#define PNG_FILTER_PAETH 4
-#define PNG_FILTER_COUNT 5
-
-// Reverse RGBA filtering functions
+} filter_kernels;
 
-static int paeth_predictor(const unsigned char l, const unsigned char u, const unsigned char ul)
+static inline int paeth_predictor(const unsigned char l, const unsigned char u, const unsigned char ul)
 {
     // Calculate coefficients
     int p = (l + u - ul);
@@ -41,292 +50,173 @@ static int paeth_predictor(const unsigned char l, const unsigned char u, const u
     }
 }
 
-static void reverse_rgba_png_filter_none(const unsigned char *const src, RGBA_pixel *const dest, const uint32_t width)
-{
-    // Recon(x) = Filt(x)
-
-    for (size_t i = 0; i < width; i++)
-    {
-        // + 1 in src is for skipping the filter byte
-        dest[i].m_red = src[i * RGBA_PIXEL_SIZE + 1];
-        dest[i].m_green = src[i * RGBA_PIXEL_SIZE + 2];
-        dest[i].m_blue = src[i * RGBA_PIXEL_SIZE + 3];
-        dest[i].m_alpha = src[i * RGBA_PIXEL_SIZE + 4];
-    }
-}
+// Kernels without left neighbour, the same for every pixel size
 
-static void reverse_rgba_png_filter_sub(const unsigned char *const src, RGBA_pixel *const dest, const uint32_t width)
+static void reverse_png_filter_none(const unsigned char *const src, const unsigned char *const prev,
+                                    unsigned char *const dest, const size_t length)
 {
-    // Recon(x) = (Filt(x) + Recon(l)) % 256
-
-    // Set most left bytes (the element before start of row is 0)
-    dest[0].m_red = src[1];
-    dest[0].m_green = src[2];
-    dest[0].m_blue = src[3];
-    dest[0].m_alpha = src[4];
+    // Recon(x) = Filt(x)
+    (void)prev;
 
-    for (size_t i = 1; i < width; i++)
-    {
-        // + 1 in src is for skipping the filter byte
-        dest[i].m_red = (src[i * RGBA_PIXEL_SIZE + 1] + dest[i - 1].m_red) % 256;
-        dest[i].m_green = (src[i * RGBA_PIXEL_SIZE + 2] + dest[i - 1].m_green) % 256;
-        dest[i].m_blue = (src[i * RGBA_PIXEL_SIZE + 3] + dest[i - 1].m_blue) % 256;
-        dest[i].m_alpha = (src[i * RGBA_PIXEL_SIZE + 4] + dest[i - 1].m_alpha) % 256;
-    }
+    memcpy(dest, src, length);
 }
 
-static void reverse_rgba_png_filter_up(const unsigned char *const src, const RGBA_pixel *const prev, RGBA_pixel *const dest, const uint32_t width)
+static void reverse_png_filter_up(const unsigned char *const src, const unsigned char *const prev,
+                                  unsigned char *const dest, const size_t length)
 {
     // Recon(x) = (Filt(x) + Recon(u)) % 256
 
-    for (size_t i = 0; i < width; i++)
-    {
-        // + 1 in src is for skipping the filter byte
-        dest[i].m_red = (src[i * RGBA_PIXEL_SIZE + 1] + prev[i].m_red) % 256;
-        dest[i].m_green = (src[i * RGBA_PIXEL_SIZE + 2] + prev[i].m_green) % 256;
-        dest[i].m_blue = (src[i * RGBA_PIXEL_SIZE + 3] + prev[i].m_blue) % 256;
-        dest[i].m_alpha = (src[i * RGBA_PIXEL_SIZE + 4] + prev[i].m_alpha) % 256;
-    }
-}
-
-static void reverse_rgba_png_filter_average(const unsigned char *const src, const RGBA_pixel *const prev, RGBA_pixel *const dest, const uint32_t width)
-{
-    // Recon(x) = (Filt(x) + floor((Recon(l) + Recon(u)) / 2)) % 256
-
-    // Set most left bytes (the elements before start of row and on top of first row are 0)
-    dest[0].m_red = (src[1] + prev[0].m_red / 2) % 256;
-    dest[0].m_green = (src[2] + prev[0].m_green / 2) % 256;
-    dest[0].m_blue = (src[3] + prev[0].m_blue / 2) % 256;
-    dest[0].m_alpha = (src[4] + prev[0].m_alpha / 2) % 256;
-
-    for (size_t i = 1; i < width; i++)
-    {
-        // + 1 in src is for skipping the filter byte
-        dest[i].m_red = (src[i * RGBA_PIXEL_SIZE + 1] + (dest[i - 1].m_red + prev[i].m_red) / 2) % 256;
-        dest[i].m_green = (src[i * RGBA_PIXEL_SIZE + 2] + (dest[i - 1].m_green + prev[i].m_green) / 2) % 256;
-        dest[i].m_blue = (src[i * RGBA_PIXEL_SIZE + 3] + (dest[i - 1].m_blue + prev[i].m_blue) / 2) % 256;
-        dest[i].m_alpha = (src[i * RGBA_PIXEL_SIZE + 4] + (dest[i - 1].m_alpha + prev[i].m_alpha) / 2) % 256;
-    }
-}
-
-static void reverse_rgba_png_filter_paeth(const unsigned char *const src, const RGBA_pixel *const prev, RGBA_pixel *const dest, const uint32_t width)
-{
-    // Recon(x) = (Filt(x) + PaethPredictor(Recon(l), Recon(u), Recon(ul))) % 256
-
-    // Set most left bytes (the elements before start of row and on top left of first row are 0)
-    dest[0].m_red = (src[1] + paeth_predictor(0, prev[0].m_red, 0)) % 256;
-    dest[0].m_green = (src[2] + paeth_predictor(0, prev[0].m_green, 0)) % 256;
-    dest[0].m_blue = (src[3] + paeth_predictor(0, prev[0].m_blue, 0)) % 256;
-    dest[0].m_alpha = (src[4] + paeth_predictor(0, prev[0].m_alpha, 0)) % 256;
-
-    for (size_t i = 1; i < width; i++)
+    for (size_t i = 0; i < length; i++)
     {
-        // + 1 in src is for skipping the filter byte
-        dest[i].m_red = (src[i * RGBA_PIXEL_SIZE + 1] +
-                         paeth_predictor(dest[i - 1].m_red, prev[i].m_red, prev[i - 1].m_red)) %
-                        256;
-        dest[i].m_green = (src[i * RGBA_PIXEL_SIZE + 2] +
-                           paeth_predictor(dest[i - 1].m_green, prev[i].m_green, prev[i - 1].m_green)) %
-                          256;
-        dest[i].m_blue = (src[i * RGBA_PIXEL_SIZE + 3] +
-                          paeth_predictor(dest[i - 1].m_blue, prev[i].m_blue, prev[i - 1].m_blue)) %
-                         256;
-        dest[i].m_alpha = (src[i * RGBA_PIXEL_SIZE + 4] +
-                           paeth_predictor(dest[i - 1].m_alpha, prev[i].m_alpha, prev[i - 1].m_alpha)) %
-                          256;
+        dest[i] = src[i] + prev[i];
     }
 }
 
-// Apply RGBA filtering functions
-
-static void apply_rgba_png_filter_none(const RGBA_pixel *const src, unsigned char *const dest, const uint32_t width)
+static void apply_png_filter_none(const unsigned char *const src, const unsigned char *const prev,
+                                  unsigned char *const dest, const size_t length)
 {
     // Filt(x) = Recon(x)
-    dest[0] = PNG_FILTER_NONE; // Set filter to None
+    (void)prev;
 
-    for (size_t i = 0; i < width; i++)
-    {
-        // + 1 in src is for skipping the filter byte
-        dest[i * RGBA_PIXEL_SIZE + 1] = src[i].m_red;
-        dest[i * RGBA_PIXEL_SIZE + 2] = src[i].m_green;
-        dest[i * RGBA_PIXEL_SIZE + 3] = src[i].m_blue;
-        dest[i * RGBA_PIXEL_SIZE + 4] = src[i].m_alpha;
-    }
+    memcpy(dest, src, length);
 }
 
-static void apply_rgba_png_filter_sub(const RGBA_pixel *const src, unsigned char *const dest, const uint32_t width)
-{
-    // Filt(x) = (Orig(x) - Orig(l)) % 256;
-    dest[0] = PNG_FILTER_SUB; // Set filter to Sub
-
-    // Set most left bytes (the element before start of row is 0)
-    dest[1] = src[0].m_red;
-    dest[2] = src[0].m_green;
-    dest[3] = src[0].m_blue;
-    dest[4] = src[0].m_alpha;
-
-    for (size_t i = 1; i < width; i++)
-    {
-        // + 1 in src is for skipping the filter byte
-        dest[i * RGBA_PIXEL_SIZE + 1] = (src[i].m_red - src[i - 1].m_red) % 256;
-        dest[i * RGBA_PIXEL_SIZE + 2] = (src[i].m_green - src[i - 1].m_green) % 256;
-        dest[i * RGBA_PIXEL_SIZE + 3] = (src[i].m_blue - src[i - 1].m_blue) % 256;
-        dest[i * RGBA_PIXEL_SIZE + 4] = (src[i].m_alpha - src[i - 1].m_alpha) % 256;
-    }
-}
-
-static void apply_rgba_png_filter_up(const RGBA_pixel *const src, const RGBA_pixel *const prev, unsigned char *dest, const uint32_t width)
+static void apply_png_filter_up(const unsigned char *const src, const unsigned char *const prev,
+                                unsigned char *const dest, const size_t length)
 {
     // Filt(x) = (Orig(x) - Orig(u)) % 256
-    dest[0] = PNG_FILTER_UP; // Set filter to Up
 
-    for (size_t i = 0; i < width; i++)
+    for (size_t i = 0; i < length; i++)
     {
-        // + 1 in src is for skipping the filter byte
-        dest[i * RGBA_PIXEL_SIZE + 1] = (src[i].m_red - prev[i].m_red) % 256;
-        dest[i * RGBA_PIXEL_SIZE + 2] = (src[i].m_green - prev[i].m_green) % 256;
-        dest[i * RGBA_PIXEL_SIZE + 3] = (src[i].m_blue - prev[i].m_blue) % 256;
-        dest[i * RGBA_PIXEL_SIZE + 4] = (src[i].m_alpha - prev[i].m_alpha) % 256;
+        dest[i] = src[i] - prev[i];
     }
 }
 
-static void apply_rgba_png_filter_average(const RGBA_pixel *const src, const RGBA_pixel *const prev, unsigned char *dest, const uint32_t width)
-{
-    // Filt(x) = (Orig(x) - floor((Orig(l) + Orig(u)) / 2)) % 256
-    dest[0] = PNG_FILTER_AVERAGE; // Set filter to Average
-
-    // Set most left bytes (the element before start of row is 0)
-    dest[1] = (src[0].m_red - prev[0].m_red / 2) % 256;
-    dest[2] = (src[0].m_green - prev[0].m_green / 2) % 256;
-    dest[3] = (src[0].m_blue - prev[0].m_blue / 2) % 256;
-    dest[4] = (src[0].m_alpha - prev[0].m_alpha / 2) % 256;
-
-    for (size_t i = 1; i < width; i++)
-    {
-        // + 1 in src is for skipping the filter byte
-        dest[i * RGBA_PIXEL_SIZE + 1] = (src[i].m_red - (src[i - 1].m_red + prev[i].m_red) / 2) % 256;
-        dest[i * RGBA_PIXEL_SIZE + 2] = (src[i].m_green - (src[i - 1].m_green + prev[i].m_green) / 2) % 256;
-        dest[i * RGBA_PIXEL_SIZE + 3] = (src[i].m_blue - (src[i - 1].m_blue + prev[i].m_blue) / 2) % 256;
-        dest[i * RGBA_PIXEL_SIZE + 4] = (src[i].m_alpha - (src[i - 1].m_alpha + prev[i].m_alpha) / 2) % 256;
+// Kernels with left neighbour, BPP bytes back. Bytes before start of row are 0
+
+#define DEFINE_FILTER_KERNELS(BPP)                                                                                     \
+    static void reverse_png_filter_sub_##BPP(const unsigned char *const src, const unsigned char *const prev,          \
+                                             unsigned char *const dest, const size_t length)                           \
+    {                                                                                                                  \
+        /* Recon(x) = (Filt(x) + Recon(l)) % 256 */                                                                    \
+        (void)prev;                                                                                                    \
+                                                                                                                       \
+        memcpy(dest, src, BPP);                                                                                        \
+                                                                                                                       \
+        for (size_t i = BPP; i < length; i++)                                                                          \
+        {                                                                                                              \
+            dest[i] = src[i] + dest[i - BPP];                                                                          \
+        }                                                                                                              \
+    }                                                                                                                  \
+                                                                                                                       \
+    static void reverse_png_filter_average_##BPP(const unsigned char *const src, const unsigned char *const prev,      \
+                                                 unsigned char *const dest, const size_t length)                       \
+    {                                                                                                                  \
+        /* Recon(x) = (Filt(x) + floor((Recon(l) + Recon(u)) / 2)) % 256 */                                            \
+        for (size_t i = 0; i < BPP; i++)                                                                               \
+        {                                                                                                              \
+            dest[i] = src[i] + prev[i] / 2;                                                                            \
+        }                                                                                                              \
+                                                                                                                       \
+        for (size_t i = BPP; i < length; i++)                                                                          \
+        {                                                                                                              \
+            dest[i] = src[i] + (dest[i - BPP] + prev[i]) / 2;                                                          \
+        }                                                                                                              \
+    }                                                                                                                  \
+                                                                                                                       \
+    static void reverse_png_filter_paeth_##BPP(const unsigned char *const src, const unsigned char *const prev,        \
+                                               unsigned char *const dest, const size_t length)                         \
+    {                                                                                                                  \
+        /* Recon(x) = (Filt(x) + PaethPredictor(Recon(l), Recon(u), Recon(ul))) % 256 */                               \
+        for (size_t i = 0; i < BPP; i++)                                                                               \
+        {                                                                                                              \
+            dest[i] = src[i] + paeth_predictor(0, prev[i], 0);                                                         \
+        }                                                                                                              \
+                                                                                                                       \
+        for (size_t i = BPP; i < length; i++)                                                                          \
+        {                                                                                                              \
+            dest[i] = src[i] + paeth_predictor(dest[i - BPP], prev[i], prev[i - BPP]);                                 \
+        }                                                                                                              \
+    }                                                                                                                  \
+                                                                                                                       \
+    static void apply_png_filter_sub_##BPP(const unsigned char *const src, const unsigned char *const prev,            \
+                                           unsigned char *const dest, const size_t length)                             \
+    {                                                                                                                  \
+        /* Filt(x) = (Orig(x) - Orig(l)) % 256 */                                                                      \
+        (void)prev;                                                                                                    \
+                                                                                                                       \
+        memcpy(dest, src, BPP);                                                                                        \
+                                                                                                                       \
+        for (size_t i = BPP; i < length; i++)                                                                          \
+        {                                                                                                              \
+            dest[i] = src[i] - src[i - BPP];                                                                           \
+        }                                                                                                              \
+    }                                                                                                                  \
+                                                                                                                       \
+    static void apply_png_filter_average_##BPP(const unsigned char *const src, const unsigned char *const prev,        \
+                                               unsigned char *const dest, const size_t length)                         \
+    {                                                                                                                  \
+        /* Filt(x) = (Orig(x) - floor((Orig(l) + Orig(u)) / 2)) % 256 */                                               \
+        for (size_t i = 0; i < BPP; i++)                                                                               \
+        {                                                                                                              \
+            dest[i] = src[i] - prev[i] / 2;                                                                            \
+        }                                                                                                              \
+                                                                                                                       \
+        for (size_t i = BPP; i < length; i++)                                                                          \
+        {                                                                                                              \
+            dest[i] = src[i] - (src[i - BPP] + prev[i]) / 2;                                                           \
+        }                                                                                                              \
+    }                                                                                                                  \
+                                                                                                                       \
+    static void apply_png_filter_paeth_##BPP(const unsigned char *const src, const unsigned char *const prev,          \
+                                             unsigned char *const dest, const size_t length)                           \
+    {                                                                                                                  \
+        /* Filt(x) = (Orig(x) - PaethPredictor(Orig(l), Orig(u), Orig(ul))) % 256 */                                   \
+        for (size_t i = 0; i < BPP; i++)                                                                               \
+        {                                                                                                              \
+            dest[i] = src[i] - paeth_predictor(0, prev[i], 0);                                                         \
+        }                                                                                                              \
+                                                                                                                       \
+        for (size_t i = BPP; i < length; i++)                                                                          \
+        {                                                                                                              \
+            dest[i] = src[i] - paeth_predictor(src[i - BPP], prev[i], prev[i - BPP]);                                  \
+        }                                                                                                              \
     }
-}
 
-static void apply_rgba_png_filter_paeth(const RGBA_pixel *const src, const RGBA_pixel *const prev, unsigned char *dest, const uint32_t width)
-{
-    // Filt(x) = (Orig(x) - PaethPredictor(Orig(l), Orig(u), Orig(ul))) % 256
-    dest[0] = PNG_FILTER_PAETH; // Set filter to Paeth
-
-    // Set most left bytes (the elements before start of row and on top left of first row are 0)
-    dest[1] = (src[0].m_red - paeth_predictor(0, prev[0].m_red, 0)) % 256;
-    dest[2] = (src[0].m_green - paeth_predictor(0, prev[0].m_green, 0)) % 256;
-    dest[3] = (src[0].m_blue - paeth_predictor(0, prev[0].m_blue, 0)) % 256;
-    dest[4] = (src[0].m_alpha - paeth_predictor(0, prev[0].m_alpha, 0)) % 256;
-
-    for (size_t i = 1; i < width; i++)
-    {
-        // + 1 in src is for skipping the filter byte
-        dest[i * RGBA_PIXEL_SIZE + 1] = (src[i].m_red -
-                                         paeth_predictor(src[i - 1].m_red, prev[i].m_red, prev[i - 1].m_red)) %
-                                        256;
-        dest[i * RGBA_PIXEL_SIZE + 2] = (src[i].m_green -
-                                         paeth_predictor(src[i - 1].m_green, prev[i].m_green, prev[i - 1].m_green)) %
-                                        256;
-        dest[i * RGBA_PIXEL_SIZE + 3] = (src[i].m_blue -
-                                         paeth_predictor(src[i - 1].m_blue, prev[i].m_blue, prev[i - 1].m_blue)) %
-                                        256;
-        dest[i * RGBA_PIXEL_SIZE + 4] = (src[i].m_alpha -
-                                         paeth_predictor(src[i - 1].m_alpha, prev[i].m_alpha, prev[i - 1].m_alpha)) %
-                                        256;
+#define FILTER_KERNELS(BPP)                                                                                            \
+    {                                                                                                                  \
+        {reverse_png_filter_none, reverse_png_filter_sub_##BPP, reverse_png_filter_up,                                 \
+         reverse_png_filter_average_##BPP, reverse_png_filter_paeth_##BPP},                                            \
+        {apply_png_filter_none, apply_png_filter_sub_##BPP, apply_png_filter_up, apply_png_filter_average_##BPP,       \
+         apply_png_filter_paeth_##BPP},                                                                                \
     }
-}
 
-// Apply heuristics filtering functions
+DEFINE_FILTER_KERNELS(1) // Gray 8
+DEFINE_FILTER_KERNELS(2) // Gray alpha 8, gray 16
+DEFINE_FILTER_KERNELS(3) // RGB 8
+DEFINE_FILTER_KERNELS(4) // RGBA 8, gray alpha 16
+DEFINE_FILTER_KERNELS(6) // RGB 16
+DEFINE_FILTER_KERNELS(8) // RGBA 16
 
-static void apply_heur_png_filter_none(const RGBA_pixel *const src, unsigned char *dest, const uint32_t width)
-{
-    // Filt(x) = Recon(x)
-    dest[0] = PNG_FILTER_NONE; // Set filter to None
-    register size_t temp_len = width * RGBA_PIXEL_SIZE;
-
-    for (size_t i = 0; i < temp_len; i++)
-    {
-        // + 1 in dest is for skipping the filter byte
-        dest[i + 1] = ((unsigned char *)src)[i];
-    }
-}
+// Indexed by pixel size
+static const filter_kernels g_filter_kernels[PNG_MAX_PIXEL_SIZE + 1] = {
+    [1] = FILTER_KERNELS(1), [2] = FILTER_KERNELS(2), [3] = FILTER_KERNELS(3),
+    [4] = FILTER_KERNELS(4), [6] = FILTER_KERNELS(6), [8] = FILTER_KERNELS(8),
+};
 
-static void apply_heur_png_filter_sub(const RGBA_pixel *const src, unsigned char *dest, const uint32_t width)
+static inline const filter_kernels *kernels_for(const IHDR_chunk ihdr)
 {
-    // Filt(x) = (Orig(x) - Orig(l)) % 256
-    dest[0] = PNG_FILTER_SUB; // Set filter to Sub
-
-    // Set most left byte (the element before start of row is 0)
-    dest[1] = ((unsigned char *)src)[0];
-    register size_t temp_len = width * RGBA_PIXEL_SIZE;
-
-    for (size_t i = 1; i < temp_len; i++)
-    {
-        // + 1 in dest is for skipping the filter byte
-        dest[i + 1] = (((unsigned char *)src)[i] - ((unsigned char *)src)[i - 1]) % 256;
-    }
-}
-
-static void apply_heur_png_filter_up(const RGBA_pixel *const src, const RGBA_pixel *const prev, unsigned char *dest, const uint32_t width)
-{
-    // Filt(x) = (Orig(x) - Orig(u)) % 256
-    dest[0] = PNG_FILTER_UP; // Set filter to Up
-    register size_t temp_len = width * RGBA_PIXEL_SIZE;
-
-    for (size_t i = 0; i < temp_len; i++)
-    {
-        // + 1 in dest is for skipping the filter byte
-        dest[i + 1] = (((unsigned char *)src)[i] - ((unsigned char *)prev)[i]) % 256;
-    }
-}
-
-static void apply_heur_png_filter_average(const RGBA_pixel *const src, const RGBA_pixel *const prev, unsigned char *dest, const uint32_t width)
-{
-    // Filt(x) = (Orig(x) - floor((Orig(l) + Orig(u)) / 2)) % 256
-    dest[0] = PNG_FILTER_AVERAGE; // Set filter to Average
-
-    // Set most left byte (the element before start of row is 0)
-    dest[1] = (((unsigned char *)src)[0] - ((unsigned char *)prev)[0] / 2) % 256;
-    register size_t temp_len = width * RGBA_PIXEL_SIZE;
-
-    for (size_t i = 1; i < temp_len; i++)
-    {
-        // + 1 in dest is for skipping the filter byte
-        dest[i + 1] = (((unsigned char *)src)[i] - ((((unsigned char *)src)[i - 1] + ((unsigned char *)prev)[i]) / 2)) % 256;
-    }
-}
-
-static void apply_heur_png_filter_paeth(const RGBA_pixel *const src, const RGBA_pixel *const prev, unsigned char *dest, const uint32_t width)
-{
-    // Filt(x) = (Orig(x) - PaethPredictor(Orig(l), Orig(u), Orig(ul))) % 256
-    dest[0] = PNG_FILTER_PAETH; // Set filter to Paeth
-
-    // Set most left byte (the element before start of row is 0)
-    dest[1] = (((unsigned char *)src)[0] - paeth_predictor(0, ((unsigned char *)prev)[0], 0)) % 256;
-    register size_t temp_len = width * RGBA_PIXEL_SIZE;
-
-    for (size_t i = 1; i < temp_len; i++)
-    {
-        // + 1 in dest is for skipping the filter byte
-        dest[i + 1] = (((unsigned char *)src)[i] -
-                       paeth_predictor(((unsigned char *)src)[i - 1], ((unsigned char *)prev)[i], ((unsigned char *)prev)[i - 1])) %
-                      256;
-    }
+    return &g_filter_kernels[png_pixel_size(ihdr)];
 }
 
 // Find filter type functions
 
-static inline unsigned long int sum_row_for_heuristics(unsigned char *temp_buffer, const uint32_t width)
+static inline unsigned long int sum_row_for_heuristics(unsigned char *temp_buffer, const size_t length)
 {
     unsigned long int sum = 0;
-    register size_t temp_len = width * RGBA_PIXEL_SIZE;
 
     // Sub 256 if element >= 128
-    for (size_t i = 1; i <= temp_len; i++)
+    for (size_t i = 1; i <= length; i++)
     {
         if (temp_buffer[i] >= 128)
         {
@@ -357,192 +247,199 @@ static inline int find_min(const unsigned long int arr[], const uint32_t length)
     return index;
 }
 
-static unsigned char calc_filter_type(const RGBA_pixel *const src, const RGBA_pixel *const prev, const uint32_t width)
+static unsigned char calc_filter_type(const unsigned char *const src, const unsigned char *const prev,
+                                      unsigned char *const temp_buffer, const size_t length)
 {
-    // Allocate storage for temporary row with filter
-    unsigned char *temp_buffer = (unsigned char *)malloc(width * RGBA_PIXEL_SIZE + 1);
+    // temp_buffer is caller owned storage for one filtered row, reused for every row
     unsigned long int sum[PNG_FILTER_COUNT] = {0};
 
-    if (temp_buffer == NULL)
+    // Rows are scored with the one byte kernels whatever the pixel size, as they always were
+    const filter_kernels *kernels = &g_filter_kernels[1];
+
+    for (int type = 0; type < PNG_FILTER_COUNT; type++)
     {
-        return PNG_FILTER_COUNT; // Error
+        kernels->m_apply[type](src, prev, &temp_buffer[1], length);
+
+        sum[type] = sum_row_for_heuristics(temp_buffer, length);
     }
 
-    // Call filter None for heuristics
-    apply_heur_png_filter_none(src, temp_buffer, width);
+    // Find index of min sum
+    return find_min(sum, PNG_FILTER_COUNT);
+}
 
-    sum[PNG_FILTER_NONE] = sum_row_for_heuristics(temp_buffer, width);
+// Other
 
-    // Call filter Sub for heuristics
-    apply_heur_png_filter_sub(src, temp_buffer, width);
+static bool strip_filter_per_row(const filter_kernels *const kernels, const unsigned char *filtered_row,
+                                 const unsigned char *previous_row, unsigned char *const result, const size_t length)
+{
+    // Choose defiltration for current row
+    if (filtered_row[0] >= PNG_FILTER_COUNT)
+    {
+        return false;
+    }
 
-    sum[PNG_FILTER_SUB] = sum_row_for_heuristics(temp_buffer, width);
+    // + 1 in filtered_row is for skipping the filter byte
+    kernels->m_reverse[filtered_row[0]](&filtered_row[1], previous_row, result, length);
 
-    // Call filter Up for heuristics
-    apply_heur_png_filter_up(src, prev, temp_buffer, width);
+    return true;
+}
 
-    sum[PNG_FILTER_UP] = sum_row_for_heuristics(temp_buffer, width);
+static bool apply_filter_per_row(const filter_kernels *const kernels, const unsigned char *row,
+                                 const unsigned char *previous_row, unsigned char *const result, const size_t length,
+                                 const unsigned char filter_type)
+{
+    // Apply chosen filtration for current row
+    if (filter_type >= PNG_FILTER_COUNT)
+    {
+        return false;
+    }
 
-    // Call filter Average for heuristics
-    apply_heur_png_filter_average(src, prev, temp_buffer, width);
+    result[0] = filter_type;
+    kernels->m_apply[filter_type](row, previous_row, &result[1], length);
 
-    sum[PNG_FILTER_AVERAGE] = sum_row_for_heuristics(temp_buffer, width);
+    return true;
+}
 
-    // Call filter Paeth for heuristics
-    apply_heur_png_filter_paeth(src, prev, temp_buffer, width);
+// Header defined functions
 
-    sum[PNG_FILTER_PAETH] = sum_row_for_heuristics(temp_buffer, width);
+bool select_rgba_png_filters(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image, unsigned char *const filter_types)
+{
+    size_t row_size = png_row_size(ihdr);
 
-    // Free temporary memory
-    free(temp_buffer);
+    // Scratch storage: zero row before the first one and one row for the heuristics
+    unsigned char *temp_row = (unsigned char *)image_alloc(row_size);
+    unsigned char *heur_row = (unsigned char *)image_alloc(row_size + 1);
 
-    // Find index of min sum
-    return find_min(sum, PNG_FILTER_COUNT);
-}
+    if (temp_row == NULL || heur_row == NULL)
+    {
+        image_free(temp_row);
+        image_free(heur_row);
+        return false;
+    }
 
-// Other
+    // The row before first is 0 by specifiaction
+    memset(temp_row, 0, row_size);
 
-static RGBA_pixel *
-strip_filter_per_rgba_row(const unsigned char *filtered_row, const RGBA_pixel *previous_row, const uint32_t width)
-{
-    // Allocate storage for one row
-    RGBA_pixel *result = (RGBA_pixel *)malloc(width * RGBA_PIXEL_SIZE);
+    filter_types[0] = calc_filter_type((unsigned char *)unfiltered_image[0], temp_row, heur_row, row_size);
 
-    if (result == NULL)
+    // Free memory
+    image_free(temp_row);
+
+    for (size_t i = 1; i < ihdr.m_height; i++)
     {
-        return NULL;
+        filter_types[i] = calc_filter_type((unsigned char *)unfiltered_image[i], (unsigned char *)unfiltered_image[i - 1],
+                                           heur_row, row_size);
     }
 
-    // Choose defiltration for current row
-    switch (filtered_row[0])
+    image_free(heur_row);
+
+    return true;
+}
+
+bool apply_rgba_png_filters_to(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image,
+                               const unsigned char *const filter_types, unsigned char *const filtered_buffer)
+{
+    const filter_kernels *kernels = kernels_for(ihdr);
+    size_t row_size = png_row_size(ihdr);
+
+    unsigned char *temp_row = NULL;
+
+    if (png_is_supported(ihdr) == false || ihdr.m_interlace_method != INTERLACE_METHOD_NONE)
     {
-    case PNG_FILTER_NONE:
-        reverse_rgba_png_filter_none(filtered_row, result, width);
-        break;
+        return false;
+    }
 
-    case PNG_FILTER_SUB:
-        reverse_rgba_png_filter_sub(filtered_row, result, width);
-        break;
+    // Zero row before the first one
+    temp_row = (unsigned char *)image_alloc(row_size);
 
-    case PNG_FILTER_UP:
-        reverse_rgba_png_filter_up(filtered_row, previous_row, result, width);
-        break;
+    if (temp_row == NULL)
+    {
+        return false;
+    }
 
-    case PNG_FILTER_AVERAGE:
-        reverse_rgba_png_filter_average(filtered_row, previous_row, result, width);
-        break;
+    // The row before first is 0 by specifiaction
+    memset(temp_row, 0, row_size);
 
-    case PNG_FILTER_PAETH:
-        reverse_rgba_png_filter_paeth(filtered_row, previous_row, result, width);
-        break;
+    // Filter first row
+    bool is_ok = apply_filter_per_row(kernels, (unsigned char *)unfiltered_image[0], temp_row, filtered_buffer, row_size,
+                                      filter_types[0]);
 
-    default:
-        return NULL;
-        break;
+    // Free memory
+    image_free(temp_row);
+
+    // Filter the rest of the rows
+    for (size_t i = 1; i < ihdr.m_height && is_ok; i++)
+    {
+        is_ok = apply_filter_per_row(kernels, (unsigned char *)unfiltered_image[i], (unsigned char *)unfiltered_image[i - 1],
+                                     &filtered_buffer[i * (row_size + 1)], row_size, filter_types[i]);
     }
 
-    return result;
+    return is_ok;
 }
 
-// Header defined functions
-
-unsigned char *filter_rgba_png(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image, unsigned long int *const length)
+unsigned char *apply_rgba_png_filters(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image,
+                                      const unsigned char *const filter_types, unsigned long int *const length)
 {
-    // Calculate length for filtered data buffer. Size of image * Pixels in RGBA format + filter type markers
-    *length = ihdr.m_height * ihdr.m_width * RGBA_PIXEL_SIZE * sizeof(unsigned char) + ihdr.m_height;
+    // Calculate length for filtered data buffer. Rows + filter type markers
+    *length = (png_row_size(ihdr) + 1) * ihdr.m_height;
 
     // Allocate filtered buffer
-    unsigned char *result = (unsigned char *)malloc(*length);
+    unsigned char *result = (unsigned char *)image_alloc(*length);
 
     if (result == NULL)
     {
         return NULL;
     }
 
-    // Unfilter and append every row to unfiltered image
-    RGBA_pixel *temp_row = (RGBA_pixel *)malloc(ihdr.m_width * RGBA_PIXEL_SIZE);
-
-    if (temp_row == NULL)
+    if (apply_rgba_png_filters_to(ihdr, unfiltered_image, filter_types, result) == false)
     {
+        image_free(result);
         return NULL;
     }
 
-    // The row before first is 0 by specifiaction
-    memset(temp_row, 0, ihdr.m_width * RGBA_PIXEL_SIZE);
+    return result;
+}
 
-    // Filter first row
-    switch (calc_filter_type(unfiltered_image[0], temp_row, ihdr.m_width))
+unsigned char *filter_rgba_png(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image, unsigned long int *const length)
+{
+    unsigned char *result = NULL;
+    unsigned char *filter_types = (unsigned char *)image_alloc(ihdr.m_height);
+
+    if (filter_types == NULL)
+    {
+        return NULL;
+    }
+
+    if (select_rgba_png_filters(ihdr, unfiltered_image, filter_types) == true)
     {
-    case PNG_FILTER_NONE:
-        apply_rgba_png_filter_none(unfiltered_image[0], result, ihdr.m_width);
-        break;
+        result = apply_rgba_png_filters(ihdr, unfiltered_image, filter_types, length);
+    }
 
-    case PNG_FILTER_SUB:
-        apply_rgba_png_filter_sub(unfiltered_image[0], result, ihdr.m_width);
-        break;
+    image_free(filter_types);
 
-    case PNG_FILTER_UP:
-        apply_rgba_png_filter_up(unfiltered_image[0], temp_row, result, ihdr.m_width);
-        break;
+    return result;
+}
 
-    case PNG_FILTER_AVERAGE:
-        apply_rgba_png_filter_average(unfiltered_image[0], temp_row, result, ihdr.m_width);
-        break;
+RGBA_pixel **alloc_rgba_png(const IHDR_chunk ihdr, const uint32_t row_count)
+{
+    size_t row_size = png_row_size(ihdr);
 
-    case PNG_FILTER_PAETH:
-        apply_rgba_png_filter_paeth(unfiltered_image[0], temp_row, result, ihdr.m_width);
-        break;
+    // Allocate height
+    RGBA_pixel **result = (RGBA_pixel **)image_alloc(row_count * sizeof(RGBA_pixel *));
 
-    default:
+    // All rows live in one block, so the image costs two allocations instead of one per row
+    unsigned char *pixels = (unsigned char *)image_alloc(row_size * row_count);
+
+    if (result == NULL || pixels == NULL)
+    {
+        image_free(result);
+        image_free(pixels);
         return NULL;
-        break;
     }
 
-    // Free memory
-    free(temp_row);
-
-    // Filter the rest of the rows
-    for (size_t i = 1; i < ihdr.m_height; i++)
+    for (size_t i = 0; i < row_count; i++)
     {
-        switch (calc_filter_type(unfiltered_image[i], unfiltered_image[i - 1], ihdr.m_width))
-        {
-        case PNG_FILTER_NONE:
-            apply_rgba_png_filter_none(unfiltered_image[i],
-                                       &result[i * (ihdr.m_width * RGBA_PIXEL_SIZE + 1)],
-                                       ihdr.m_width);
-            break;
-
-        case PNG_FILTER_SUB:
-            apply_rgba_png_filter_sub(unfiltered_image[i],
-                                      &result[i * (ihdr.m_width * RGBA_PIXEL_SIZE + 1)],
-                                      ihdr.m_width);
-            break;
-
-        case PNG_FILTER_UP:
-            apply_rgba_png_filter_up(unfiltered_image[i],
-                                     unfiltered_image[i - 1],
-                                     &result[i * (ihdr.m_width * RGBA_PIXEL_SIZE + 1)],
-                                     ihdr.m_width);
-            break;
-
-        case PNG_FILTER_AVERAGE:
-            apply_rgba_png_filter_average(unfiltered_image[i],
-                                          unfiltered_image[i - 1],
-                                          &result[i * (ihdr.m_width * RGBA_PIXEL_SIZE + 1)],
-                                          ihdr.m_width);
-            break;
-
-        case PNG_FILTER_PAETH:
-            apply_rgba_png_filter_paeth(unfiltered_image[i],
-                                        unfiltered_image[i - 1],
-                                        &result[i * (ihdr.m_width * RGBA_PIXEL_SIZE + 1)],
-                                        ihdr.m_width);
-            break;
-
-        default:
-            return NULL;
-            break;
-        }
+        result[i] = (RGBA_pixel *)&pixels[i * row_size];
     }
 
     return result;
@@ -550,36 +447,85 @@ unsigned char *filter_rgba_png(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_im
 
 RGBA_pixel **unfilter_rgba_png(const unsigned char *const filtered_buffer, IHDR_chunk ihdr)
 {
-    // Allocate height
-    RGBA_pixel **result = (RGBA_pixel **)malloc(ihdr.m_height * sizeof(RGBA_pixel *));
+    const filter_kernels *kernels = kernels_for(ihdr);
+    size_t row_size = png_row_size(ihdr);
+    RGBA_pixel **result = NULL;
 
-    if (result == NULL)
+    if (png_is_supported(ihdr) == false || ihdr.m_interlace_method != INTERLACE_METHOD_NONE)
     {
         return NULL;
     }
 
+    result = alloc_rgba_png(ihdr, ihdr.m_height);
+
     // Unfilter and append every row to unfiltered image
-    RGBA_pixel *temp_row = (RGBA_pixel *)malloc(ihdr.m_width * RGBA_PIXEL_SIZE);
+    unsigned char *temp_row = (unsigned char *)image_alloc(row_size);
 
-    if (temp_row == NULL)
+    if (result == NULL || temp_row == NULL)
     {
+        free_rgba_png(result);
+        image_free(temp_row);
         return NULL;
     }
 
     // The row before first is 0 by specifiaction
-    memset(temp_row, 0, ihdr.m_width * RGBA_PIXEL_SIZE);
+    memset(temp_row, 0, row_size);
 
     // Unfilter first row
-    result[0] = strip_filter_per_rgba_row(&filtered_buffer[0], temp_row, ihdr.m_width);
+    bool is_ok = strip_filter_per_row(kernels, &filtered_buffer[0], temp_row, (unsigned char *)result[0], row_size);
 
     // Free memory
-    free(temp_row);
+    image_free(temp_row);
 
     // Unfilter the rest of the rows
-    for (size_t i = 1; i < ihdr.m_height; i++)
+    for (size_t i = 1; i < ihdr.m_height && is_ok; i++)
+    {
+        is_ok = strip_filter_per_row(kernels, &filtered_buffer[i * (row_size + 1)], (unsigned char *)result[i - 1],
+                                     (unsigned char *)result[i], row_size);
+    }
+
+    if (is_ok == false)
     {
-        result[i] = strip_filter_per_rgba_row(&filtered_buffer[i * (ihdr.m_width * RGBA_PIXEL_SIZE + 1)], result[i - 1], ihdr.m_width);
+        free_rgba_png(result);
+        return NULL;
     }
 
     return result;
 }
+
+bool unfilter_rgba_row(const unsigned char *const filtered_row, const RGBA_pixel *const previous_row,
+                       RGBA_pixel *const row, const IHDR_chunk ihdr)
+{
+    return strip_filter_per_row(kernels_for(ihdr), filtered_row, (const unsigned char *)previous_row,
+                                (unsigned char *)row, png_row_size(ihdr));
+}
+
+bool filter_rgba_row(const RGBA_pixel *const row, const RGBA_pixel *const previous_row, unsigned char *const scratch,
+                     unsigned char *const filtered_row, const IHDR_chunk ihdr)
+{
+    size_t row_size = png_row_size(ihdr);
+
+    return apply_filter_per_row(kernels_for(ihdr), (const unsigned char *)row, (const unsigned char *)previous_row,
+                                filtered_row, row_size,
+                                calc_filter_type((const unsigned char *)row, (const unsigned char *)previous_row, scratch,
+                                                 row_size));
+}
+
+bool apply_rgba_row_filter(const RGBA_pixel *const row, const RGBA_pixel *const previous_row,
+                           const unsigned char filter_type, unsigned char *const filtered_row, const IHDR_chunk ihdr)
+{
+    return apply_filter_per_row(kernels_for(ihdr), (const unsigned char *)row, (const unsigned char *)previous_row,
+                                filtered_row, png_row_size(ihdr), filter_type);
+}
+
+void free_rgba_png(RGBA_pixel **image)
+{
+    if (image == NULL)
+    {
+        return;
+    }
+
+    // Rows share one block starting at the first row
+    image_free(image[0]);
+    image_free(image);
+}
@@ -0,0 +1,212 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "stdint.h"
+
+#include "../inc/png_optimizer.h"
+#include "../inc/png_filtration.h"
+#include "../inc/deflate_backend.h"
+#include "../inc/image_arena.h"
+
+#define STRATEGY_COUNT 3
+
+static const int g_strategies[STRATEGY_COUNT] = {
+    DEFLATE_STRATEGY_DEFAULT,
+    DEFLATE_STRATEGY_FILTERED,
+    DEFLATE_STRATEGY_RLE,
+};
+
+static const char *const g_filter_names[PNG_FILTER_COUNT + 1] = {
+    "none",
+    "sub",
+    "up",
+    "average",
+    "paeth",
+    "heuristic",
+};
+
+/**
+ * @brief Buffers shared by every candidate of one image
+ *
+ * m_best holds the smallest stream so far, m_scratch the one being tried;
+ * they swap when a candidate wins.
+ */
+typedef struct
+{
+    unsigned char *m_filtered;
+    unsigned long int m_filtered_length;
+    unsigned char *m_best;
+    unsigned char *m_scratch;
+    unsigned long int m_capacity;
+    png_optimize_report *m_report;
+
+} search_state;
+
+// Helper functions
+
+static unsigned long int search_capacity(const unsigned long int filtered_length)
+{
+    unsigned long int result = 0;
+
+    for (int id = 0; id < DEFLATE_BACKEND_COUNT; id++)
+    {
+        const deflate_backend *backend = deflate_backend_get(id);
+
+        if (backend != NULL && backend->m_bound(filtered_length) > result)
+        {
+            result = backend->m_bound(filtered_length);
+        }
+    }
+
+    return result;
+}
+
+static bool try_candidate(search_state *state, const deflate_backend *backend, const int level, const int strategy,
+                          const unsigned char filter)
+{
+    unsigned long int length = state->m_capacity;
+    png_optimize_report *report = state->m_report;
+    unsigned char *swap = NULL;
+
+    report->m_candidates++;
+
+    // A failing candidate is skipped, others may still succeed
+    if (backend->m_deflate(state->m_filtered, state->m_filtered_length, state->m_scratch, &length, level, strategy) == false)
+    {
+        return false;
+    }
+
+    if (report->m_best_length != 0 && length >= report->m_best_length)
+    {
+        return true;
+    }
+
+    swap = state->m_best;
+    state->m_best = state->m_scratch;
+    state->m_scratch = swap;
+
+    report->m_best_length = length;
+    report->m_filter = filter;
+    report->m_backend_name = backend->m_name;
+    report->m_level = level;
+    report->m_strategy = strategy;
+
+    return true;
+}
+
+static void try_backends(search_state *state, const png_optimize_mode mode, const unsigned char filter)
+{
+    for (int id = 0; id < DEFLATE_BACKEND_COUNT; id++)
+    {
+        const deflate_backend *backend = deflate_backend_get(id);
+
+        if (backend == NULL)
+        {
+            continue;
+        }
+
+        int level = mode == PNG_OPTIMIZE_EXHAUSTIVE ? backend->m_max_level : DEFLATE_LEVEL_MAX;
+        int strategy_count = backend->m_has_strategies ? STRATEGY_COUNT : 1;
+
+        for (int i = 0; i < strategy_count; i++)
+        {
+            try_candidate(state, backend, level, g_strategies[i], filter);
+        }
+    }
+}
+
+// Header defined functions
+
+const char *png_optimize_mode_name(const png_optimize_mode mode)
+{
+    switch (mode)
+    {
+    case PNG_OPTIMIZE_SEARCH:
+        return PNG_OPTIMIZE_NAME_SEARCH;
+
+    case PNG_OPTIMIZE_EXHAUSTIVE:
+        return PNG_OPTIMIZE_NAME_EXHAUSTIVE;
+
+    default:
+        return "off";
+    }
+}
+
+const char *png_optimize_filter_name(const unsigned char filter)
+{
+    return filter <= PNG_OPTIMIZE_FILTER_HEURISTIC ? g_filter_names[filter] : "unknown";
+}
+
+unsigned char *optimize_rgba_png(const IHDR_chunk ihdr, RGBA_pixel **unfiltered_image, const png_optimize_mode mode,
+                                 unsigned long int *const length, png_optimize_report *const report)
+{
+    search_state state;
+    unsigned char *filter_types = NULL;
+    const deflate_backend *baseline = deflate_backend_current();
+
+    memset(report, 0, sizeof(png_optimize_report));
+    memset(&state, 0, sizeof(search_state));
+
+    state.m_report = report;
+    state.m_filtered_length = (unsigned long int)ihdr.m_height * (png_row_size(ihdr) + 1);
+    state.m_capacity = search_capacity(state.m_filtered_length);
+
+    filter_types = (unsigned char *)image_alloc(ihdr.m_height);
+    state.m_filtered = (unsigned char *)image_alloc(state.m_filtered_length);
+    state.m_best = (unsigned char *)image_alloc(state.m_capacity);
+    state.m_scratch = (unsigned char *)image_alloc(state.m_capacity);
+
+    if (filter_types == NULL || state.m_filtered == NULL || state.m_best == NULL || state.m_scratch == NULL)
+    {
+        image_free(filter_types);
+        image_free(state.m_filtered);
+        image_free(state.m_best);
+        image_free(state.m_scratch);
+        return NULL;
+    }
+
+    // Heuristic first, its default compression is the baseline
+    for (int i = 0; i <= PNG_FILTER_COUNT; i++)
+    {
+        unsigned char filter = i == 0 ? PNG_OPTIMIZE_FILTER_HEURISTIC : i - 1;
+
+        if (filter == PNG_OPTIMIZE_FILTER_HEURISTIC)
+        {
+            if (select_rgba_png_filters(ihdr, unfiltered_image, filter_types) == false)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            memset(filter_types, filter, ihdr.m_height);
+        }
+
+        if (apply_rgba_png_filters_to(ihdr, unfiltered_image, filter_types, state.m_filtered) == false)
+        {
+            continue;
+        }
+
+        if (filter == PNG_OPTIMIZE_FILTER_HEURISTIC &&
+            try_candidate(&state, baseline, DEFLATE_LEVEL_DEFAULT, DEFLATE_STRATEGY_DEFAULT, filter) == true)
+        {
+            report->m_baseline_length = report->m_best_length;
+        }
+
+        try_backends(&state, mode, filter);
+    }
+
+    image_free(filter_types);
+    image_free(state.m_filtered);
+    image_free(state.m_scratch);
+
+    if (report->m_best_length == 0)
+    {
+        image_free(state.m_best);
+        return NULL;
+    }
+
+    *length = report->m_best_length;
+
+    return state.m_best;
+}
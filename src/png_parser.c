@@ -1,16 +1,43 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 #include "../inc/global_config.h"
 #include "../inc/png_parser.h"
+#include "../inc/image_arena.h"
+#include "../inc/deflate_backend.h"
 
 #include "zlib.h"
 
-// Static global variables
-static FILE *g_chunk_ptr = NULL;
-static bool g_is_image_open = false;
+// zlib stream header without preset dictionary
+#define ZLIB_HEADER_LENGTH 2
+
+// Bit 5 of the first type byte tells ancillary chunks, of the last one chunks safe to copy
+#define CHUNK_PROPERTY_BIT 0x20
+
+// Signature and IHDR
+#define IMAGE_HEAD_LENGTH (FILE_SIGNATURE_LENGTH + HEADER_LENGTH + IHDR_DATA_LENGTH + FOOTER_LENGTH)
+
+// Memory pieces gathered into one writev, well under IOV_MAX
+#define IMAGE_WRITE_MAX_PARTS 64
+
+// Block of the read and write loop copying chunks when the kernel cannot
+#define CHUNK_COPY_BLOCK_SIZE (64 * 1024)
+
+// Static global variables, thread local so independent images can be processed concurrently
+static _Thread_local FILE *g_chunk_ptr = NULL;
+static _Thread_local bool g_is_image_open = false;
+static _Thread_local bool g_is_standard_stream = false;   // stdin or stdout, flushed instead of closed
+static _Thread_local unsigned char *g_stream_data = NULL; // Whole input of a stream that cannot seek
+static _Thread_local const char *g_file_name = NULL;      // Input file, NULL if parsed from memory
 
 // Macro and other useful functions
 #define swap(x, y) \
@@ -36,6 +63,19 @@ static inline void change_endianness(void *inp, size_t len)
 
 #endif
 
+static inline uint32_t load_be32(const unsigned char *src)
+{
+    return (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 8 | (uint32_t)src[3];
+}
+
+static inline void store_be32(unsigned char *dest, const uint32_t value)
+{
+    dest[0] = value >> 24;
+    dest[1] = value >> 16;
+    dest[2] = value >> 8;
+    dest[3] = value;
+}
+
 // File pointer manipulation functions
 
 static inline FILE *chunk_pointer_get()
@@ -63,31 +103,222 @@ static inline void chunk_pointer_set(const long int position)
     fseek(chunk_pointer_get(), position, SEEK_SET);
 }
 
+static FILE *read_stream_to_memory(FILE *fp)
+{
+    unsigned char *data = NULL;
+    size_t capacity = 0;
+    size_t length = 0;
+    size_t count = 0;
+    FILE *result = NULL;
+
+    do
+    {
+        if (length == capacity)
+        {
+            unsigned char *grown = NULL;
+
+            capacity = capacity == 0 ? PNG_STREAM_READ_BLOCK_SIZE : capacity * 2;
+            grown = (unsigned char *)realloc(data, capacity);
+
+            if (grown == NULL)
+            {
+                free(data);
+                return NULL;
+            }
+
+            data = grown;
+        }
+
+        count = fread(&data[length], 1, capacity - length, fp);
+        length += count;
+
+    } while (count > 0);
+
+    if (ferror(fp) == 0 && length > 0)
+    {
+        result = fmemopen(data, length, "rb");
+    }
+
+    if (result == NULL)
+    {
+        free(data);
+        return NULL;
+    }
+
+    g_stream_data = data;
+
+    return result;
+}
+
 // Image open/close control functions
 
+bool png_is_supported(const IHDR_chunk ihdr)
+{
+    return png_pixel_size(ihdr) != 0 && ihdr.m_width != 0 && ihdr.m_height != 0 &&
+           (ihdr.m_interlace_method == INTERLACE_METHOD_NONE || ihdr.m_interlace_method == INTERLACE_METHOD_ADAM7);
+}
+
+uint32_t png_pixel_size(const IHDR_chunk ihdr)
+{
+    uint32_t channels = 0;
+
+    switch (ihdr.m_color_type)
+    {
+    case COLOR_TYPE_GRAY:
+        channels = 1;
+        break;
+
+    case COLOR_TYPE_GRAY_ALPHA:
+        channels = 2;
+        break;
+
+    case COLOR_TYPE_RGB:
+        channels = 3;
+        break;
+
+    case COLOR_TYPE_RGBA:
+        channels = 4;
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (ihdr.m_bit_depth != BIT_DEPTH_8 && ihdr.m_bit_depth != BIT_DEPTH_16)
+    {
+        return 0;
+    }
+
+    return channels * (ihdr.m_bit_depth / 8);
+}
+
+size_t png_row_size(const IHDR_chunk ihdr)
+{
+    return (size_t)ihdr.m_width * png_pixel_size(ihdr);
+}
+
+IHDR_chunk png_pass_ihdr(const IHDR_chunk ihdr, const int pass)
+{
+    IHDR_chunk result = ihdr;
+
+    result.m_width = ihdr.m_width > ADAM7_START_X[pass]
+                         ? (ihdr.m_width - ADAM7_START_X[pass] + ADAM7_STEP_X[pass] - 1) / ADAM7_STEP_X[pass]
+                         : 0;
+    result.m_height = ihdr.m_height > ADAM7_START_Y[pass]
+                          ? (ihdr.m_height - ADAM7_START_Y[pass] + ADAM7_STEP_Y[pass] - 1) / ADAM7_STEP_Y[pass]
+                          : 0;
+    result.m_interlace_method = INTERLACE_METHOD_NONE;
+
+    return result;
+}
+
+unsigned long int png_filtered_length(const IHDR_chunk ihdr)
+{
+    unsigned long int result = 0;
+
+    if (ihdr.m_interlace_method != INTERLACE_METHOD_ADAM7)
+    {
+        return (png_row_size(ihdr) + 1) * ihdr.m_height;
+    }
+
+    // Empty passes have no filter type bytes either
+    for (int pass = 0; pass < ADAM7_PASS_COUNT; pass++)
+    {
+        IHDR_chunk pass_ihdr = png_pass_ihdr(ihdr, pass);
+
+        if (pass_ihdr.m_width != 0)
+        {
+            result += (png_row_size(pass_ihdr) + 1) * pass_ihdr.m_height;
+        }
+    }
+
+    return result;
+}
+
+bool png_is_standard_stream(const char *file_name)
+{
+    return strcmp(file_name, PNG_STANDARD_STREAM_NAME) == 0;
+}
+
 bool png_open(const char *_FileName, const char *_Mode)
 {
-    g_chunk_ptr = fopen(_FileName, _Mode);
+    bool is_reading = _Mode[0] == 'r';
+
+    g_is_standard_stream = png_is_standard_stream(_FileName);
+
+    if (g_is_standard_stream == true)
+    {
+        g_chunk_ptr = is_reading ? stdin : stdout;
+    }
+    else
+    {
+        g_chunk_ptr = fopen(_FileName, _Mode);
+    }
 
     if (g_chunk_ptr == NULL)
     {
         return g_is_image_open = false;
     }
 
+    // Pipes cannot seek, parse them from memory instead
+    if (is_reading == true && fseek(g_chunk_ptr, 0, SEEK_CUR) != 0)
+    {
+        FILE *stream = g_chunk_ptr;
+
+        g_chunk_ptr = read_stream_to_memory(stream);
+
+        if (g_is_standard_stream == false)
+        {
+            fclose(stream);
+        }
+
+        g_is_standard_stream = false;
+
+        if (g_chunk_ptr == NULL)
+        {
+            return g_is_image_open = false;
+        }
+    }
+    else if (is_reading == true && g_is_standard_stream == false)
+    {
+        g_file_name = _FileName;
+    }
+
     return g_is_image_open = true;
 }
 
+bool png_open_memory(const unsigned char *data, const size_t length)
+{
+    g_is_standard_stream = false;
+    g_chunk_ptr = length > 0 ? fmemopen((void *)data, length, "rb") : NULL;
+
+    return g_is_image_open = g_chunk_ptr != NULL;
+}
+
 bool png_close()
 {
+    bool result = true;
+
     if (g_is_image_open == false)
     {
         return false;
     }
 
-    fclose(chunk_pointer_get());
+    if (g_is_standard_stream == true)
+    {
+        result = fflush(chunk_pointer_get()) == 0;
+    }
+    else
+    {
+        fclose(chunk_pointer_get());
+    }
+
+    free(g_stream_data);
+    g_stream_data = NULL;
+    g_file_name = NULL;
     g_is_image_open = false;
 
-    return true;
+    return result;
 }
 
 // Chunk manipulation functions
@@ -129,8 +360,8 @@ static outside_chunk get_outside_chunk()
 
 static outside_chunk chunk_seek(const unsigned char *const chunk_signature, bool is_reset)
 {
-    static bool is_at_end = false;
-    static long int last_address = HEADER_LENGTH; // Skip file signature chunk
+    static _Thread_local bool is_at_end = false;
+    static _Thread_local long int last_address = HEADER_LENGTH; // Skip file signature chunk
 
     outside_chunk curr_chunk = {OUTSIDE_CHUNK_DEFAULT_INIT_ARGS};
 
@@ -177,7 +408,7 @@ static outside_chunk chunk_seek(const unsigned char *const chunk_signature, bool
         // Save end of last chunk
         last_address = ftell(chunk_pointer_get());
 
-    } while (memcmp(curr_chunk.m_type, chunk_signature, TYPE_SIGNATURE_LENGTH) != 0);
+    } while (chunk_signature != NULL && memcmp(curr_chunk.m_type, chunk_signature, TYPE_SIGNATURE_LENGTH) != 0);
 
     // Reset to entry state
     chunk_pointer_set(entry_point);
@@ -243,21 +474,21 @@ IDAT_chunk read_png_IDAT(const bool is_reset)
     return IDAT;
 }
 
-unsigned char *extract_IDAT_raw(const long int address, const uint32_t length)
+outside_chunk read_png_chunk(const unsigned char *const chunk_signature, const bool is_reset)
 {
-    unsigned char *result = NULL;
+    outside_chunk result = {OUTSIDE_CHUNK_DEFAULT_INIT_ARGS};
 
     if (g_is_image_open == false)
     {
         return result;
     }
 
-    result = (unsigned char *)malloc(length * sizeof(unsigned char));
+    return chunk_seek(chunk_signature, is_reset);
+}
 
-    if (result == NULL)
-    {
-        return NULL;
-    }
+static bool read_raw(const long int address, const uint32_t length, unsigned char *dest)
+{
+    bool result = true;
 
     // Save file pointer entry state
     long int entry_point = ftell(chunk_pointer_get());
@@ -265,8 +496,11 @@ unsigned char *extract_IDAT_raw(const long int address, const uint32_t length)
     // Move pointer to start of data
     chunk_pointer_set(address);
 
-    // Copy data from file to IDAT data chunk storage
-    fread(result, sizeof(unsigned char), length, chunk_pointer_get());
+    // Copy data from file to destination
+    if (fread(dest, sizeof(unsigned char), length, chunk_pointer_get()) != length)
+    {
+        result = false;
+    }
 
     // Reset to entry state
     chunk_pointer_set(entry_point);
@@ -274,216 +508,593 @@ unsigned char *extract_IDAT_raw(const long int address, const uint32_t length)
     return result;
 }
 
-unsigned char *extract_IDAT_raw_all(unsigned long int *total_compressed_data_length)
+bool read_png_chunk_data(const outside_chunk chunk, const uint32_t skip, unsigned char *const dest)
 {
-    IDAT_chunk idat;
+    if (g_is_image_open == false || skip > chunk.m_data_length)
+    {
+        return false;
+    }
 
-    unsigned char *result = NULL;
-    unsigned char *temp_placeholder = NULL;
+    return read_raw(chunk.m_entry_point + HEADER_LENGTH + skip, chunk.m_data_length - skip, dest);
+}
 
-    uint32_t first_free_index = 0;
-    *total_compressed_data_length = 0;
+unsigned char *extract_IDAT_raw(const long int address, const uint32_t length)
+{
+    unsigned char *result = NULL;
 
     if (g_is_image_open == false)
     {
         return result;
     }
 
-    // Get first IDAT chunk
-    idat = read_png_IDAT(PNG_PARSER_RESET);
-    *total_compressed_data_length = idat.m_outside_chunk.m_data_length;
-
-    // Initial allocation
-    result = extract_IDAT_raw(idat.m_raw_inside_chunk_data_offset, idat.m_outside_chunk.m_data_length);
+    result = (unsigned char *)image_alloc(length * sizeof(unsigned char));
 
     if (result == NULL)
     {
         return NULL;
     }
 
-    while (memcmp(idat.m_outside_chunk.m_type, IEND_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0)
-    {
-
-        // Save one beyond last index for later usage
-        first_free_index = *total_compressed_data_length;
-
-        // Read chunk data
-        idat = read_png_IDAT(PNG_PARSER_NEXT);
-
-        // If current IDAT chunk contains data:
-        if (idat.m_outside_chunk.m_data_length > 0)
-        {
-            // Increase buffer size
-            *total_compressed_data_length += idat.m_outside_chunk.m_data_length;
-            result = realloc(result, *total_compressed_data_length);
-
-            if (result == NULL)
-            {
-                return NULL;
-            }
-
-            // Temporary allocates memory for new IDAT data
-            temp_placeholder = extract_IDAT_raw(idat.m_raw_inside_chunk_data_offset, idat.m_outside_chunk.m_data_length);
-
-            if (temp_placeholder == NULL)
-            {
-                return NULL;
-            }
-
-            // Copy IDAT data to buffer
-            memcpy(&result[first_free_index], temp_placeholder, idat.m_outside_chunk.m_data_length);
-
-            // Clean temporary allocated memory
-            free(temp_placeholder);
-        }
-    }
+    read_raw(address, length, result);
 
     return result;
 }
 
-unsigned char *uncompress_data(const IHDR_chunk ihdr, const Bytef *const c_d_buffer, const uLong c_d_length, uLongf *u_d_length)
+unsigned char *extract_IDAT_raw_all(unsigned long int *total_compressed_data_length)
 {
-    Bytef *result = NULL; // Uncompressed data buffer
-    *u_d_length = 0;
+    IDAT_chunk idat;
 
-    // Works only for color type RGBA(6)
-    if (ihdr.m_color_type != COLOR_TYPE_RGBA)
-    {
-        return NULL;
-    }
+    unsigned char *result = NULL;
+    unsigned long int first_free_index = 0;
 
-    // Calculate length for uncompressed data buffer. Size of image * Pixels in RGBA format + filter type markers
-    *u_d_length = ihdr.m_width * ihdr.m_height * RGBA_PIXEL_SIZE * sizeof(Bytef) + ihdr.m_height;
+    *total_compressed_data_length = 0;
 
-    // Allocate storage
-    result = (Bytef *)malloc(*u_d_length);
+    if (g_is_image_open == false)
+    {
+        return result;
+    }
 
-    if (result == NULL)
+    // First pass only walks chunk headers to size the buffer, so it is allocated once
+    for (idat = read_png_IDAT(PNG_PARSER_RESET);
+         memcmp(idat.m_outside_chunk.m_type, IEND_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0 &&
+         memcmp(idat.m_outside_chunk.m_type, NULL_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0;
+         idat = read_png_IDAT(PNG_PARSER_NEXT))
     {
-        return NULL;
+        *total_compressed_data_length += idat.m_outside_chunk.m_data_length;
     }
 
-    // Call to zlib uncompress
-    if (uncompress(result, u_d_length, c_d_buffer, c_d_length) != Z_OK)
+    if (*total_compressed_data_length == 0)
     {
         return NULL;
     }
 
-    return result;
-}
-
-unsigned char *compress_data(uLong *c_d_length, const Bytef *const u_d_buffer, uLongf u_d_length)
-{
-    unsigned char *result = NULL; // Compressed data buffer
-
-    // Calculate length for compressed data buffer
-    *c_d_length = compressBound(u_d_length);
-
-    // Allocate storage
-    result = (unsigned char *)malloc(*c_d_length);
+    result = (unsigned char *)image_alloc(*total_compressed_data_length);
 
     if (result == NULL)
     {
         return NULL;
     }
 
-    // Call to zlib compress
-    if (compress(result, c_d_length, u_d_buffer, u_d_length) != Z_OK)
+    // Second pass copies the data of every IDAT chunk in place
+    for (idat = read_png_IDAT(PNG_PARSER_RESET);
+         memcmp(idat.m_outside_chunk.m_type, IEND_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0 &&
+         memcmp(idat.m_outside_chunk.m_type, NULL_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0;
+         idat = read_png_IDAT(PNG_PARSER_NEXT))
     {
-        return NULL;
+        if (idat.m_outside_chunk.m_data_length == 0)
+        {
+            continue;
+        }
+
+        if (read_raw(idat.m_raw_inside_chunk_data_offset, idat.m_outside_chunk.m_data_length,
+                     &result[first_free_index]) == false)
+        {
+            image_free(result);
+            return NULL;
+        }
+
+        first_free_index += idat.m_outside_chunk.m_data_length;
     }
 
     return result;
 }
 
-bool write_png_IHDR(IHDR_chunk ihdr)
+static bool parse_seek_index(const unsigned char *data, const uint32_t data_length, const IHDR_chunk ihdr,
+                             const unsigned long int compressed_data_length, seek_index *index)
 {
-    uint32_t width = ihdr.m_width;
-    uint32_t height = ihdr.m_height;
-    uint32_t ihdr_len = ihdr.m_outside_chunk.m_data_length;
-    uint32_t ihdr_crc32 = ihdr.m_outside_chunk.m_CRC_32;
+    uint32_t point_count = 0;
 
-#ifdef SYSTEM_SMALL_ENDIAN
+    if (data_length < SEEK_INDEX_HEADER_LENGTH || data[0] != SEEK_INDEX_VERSION || data[1] != SEEK_INDEX_WINDOW_EMPTY)
+    {
+        return false;
+    }
 
-    change_endianness(&width, sizeof(uint32_t));
-    change_endianness(&height, sizeof(uint32_t));
-    change_endianness(&ihdr_len, sizeof(uint32_t));
-    change_endianness(&ihdr_crc32, sizeof(uint32_t));
+    point_count = load_be32(&data[8]);
 
-#endif
+    if (point_count == 0 || (data_length - SEEK_INDEX_HEADER_LENGTH) / SEEK_INDEX_POINT_LENGTH != point_count ||
+        (data_length - SEEK_INDEX_HEADER_LENGTH) % SEEK_INDEX_POINT_LENGTH != 0)
+    {
+        return false;
+    }
 
-    if (g_is_image_open == false)
+    index->m_points = (seek_index_point *)image_alloc(point_count * sizeof(seek_index_point));
+
+    if (index->m_points == NULL)
     {
         return false;
     }
 
-    // Reset to start of file
-    chunk_pointer_reset();
+    for (uint32_t i = 0; i < point_count; i++)
+    {
+        const unsigned char *point = &data[SEEK_INDEX_HEADER_LENGTH + i * SEEK_INDEX_POINT_LENGTH];
 
-    // Write file signature
-    fwrite(FILE_SIGNATURE, FILE_SIGNATURE_LENGTH, 1, chunk_pointer_get());
+        index->m_points[i].m_row = load_be32(point);
+        index->m_points[i].m_offset = load_be32(&point[4]);
 
-    // Write IHDR data
-    fwrite(&ihdr_len, HEADER_DATA_LEN, 1, chunk_pointer_get());
-    fwrite(&ihdr.m_outside_chunk.m_type, sizeof(char), HEADER_TYPE_LEN, chunk_pointer_get());
-    fwrite(&width, sizeof(uint32_t), 1, chunk_pointer_get());
-    fwrite(&height, sizeof(uint32_t), 1, chunk_pointer_get());
-    fwrite(&ihdr.m_bit_depth, sizeof(unsigned char), 1, chunk_pointer_get());
-    fwrite(&ihdr.m_color_type, sizeof(unsigned char), 1, chunk_pointer_get());
-    fwrite(&ihdr.m_compression_method, sizeof(unsigned char), 1, chunk_pointer_get());
-    fwrite(&ihdr.m_filter_method, sizeof(unsigned char), 1, chunk_pointer_get());
-    fwrite(&ihdr.m_interlace_method, sizeof(unsigned char), 1, chunk_pointer_get());
-    fwrite(&ihdr_crc32, sizeof(uint32_t), 1, chunk_pointer_get());
+        // Bands must cover the image top down and point inside the stream
+        if ((i == 0 && (index->m_points[i].m_row != 0 || index->m_points[i].m_offset != ZLIB_HEADER_LENGTH)) ||
+            (i > 0 && (index->m_points[i].m_row <= index->m_points[i - 1].m_row ||
+                       index->m_points[i].m_offset <= index->m_points[i - 1].m_offset)) ||
+            index->m_points[i].m_row >= ihdr.m_height || index->m_points[i].m_offset >= compressed_data_length)
+        {
+            image_free(index->m_points);
+            index->m_points = NULL;
+            return false;
+        }
+    }
+
+    index->m_window = data[1];
+    index->m_flags = data[2];
+    index->m_band_rows = load_be32(&data[4]);
+    index->m_point_count = point_count;
 
     return true;
 }
 
-bool write_png_IDAT(const unsigned char *const raw_data, const unsigned long int raw_data_len)
+seek_index read_png_seek_index(const IHDR_chunk ihdr, const unsigned long int compressed_data_length)
 {
-    uint32_t idat_len = raw_data_len;
-    uint32_t crc = 0;
+    seek_index result;
+    outside_chunk chunk;
+    unsigned char *data = NULL;
 
-    unsigned char *temp_buf = NULL;
+    memset(&result, 0, sizeof(seek_index));
 
-#ifdef SYSTEM_SMALL_ENDIAN
-
-    change_endianness(&idat_len, sizeof(uint32_t));
+    // Rows of interlaced images are not stored top to bottom, no index can point at them
+    if (g_is_image_open == false || ihdr.m_interlace_method != INTERLACE_METHOD_NONE)
+    {
+        return result;
+    }
 
-#endif
+    chunk = chunk_seek(stIX_SIGNATURE, PNG_PARSER_RESET);
 
-    if (g_is_image_open == false)
+    if (memcmp(chunk.m_type, stIX_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0 || chunk.m_data_length == 0)
     {
-        return false;
+        return result;
     }
 
-    // Seed CRC-32
-    crc = crc32(0L, Z_NULL, 0);
+    data = (unsigned char *)image_alloc(chunk.m_data_length);
 
-    // Temporary store raw data and chunk type in the same place
-    temp_buf = malloc((raw_data_len + HEADER_DATA_LEN) * sizeof(unsigned char));
+    if (data == NULL)
+    {
+        return result;
+    }
 
-    if (temp_buf == NULL)
+    // Unknown or damaged index is ignored, the image still decodes the slow way
+    if (read_raw(chunk.m_entry_point + HEADER_LENGTH, chunk.m_data_length, data) == true &&
+        crc32(crc32(0L, stIX_SIGNATURE, TYPE_SIGNATURE_LENGTH), data, chunk.m_data_length) == chunk.m_CRC_32 &&
+        parse_seek_index(data, chunk.m_data_length, ihdr, compressed_data_length, &result) == false)
     {
-        return false;
+        memset(&result, 0, sizeof(seek_index));
     }
 
-    memcpy(temp_buf, IDAT_SIGNATURE, HEADER_TYPE_LEN);
-    memcpy(temp_buf + HEADER_DATA_LEN, raw_data, raw_data_len);
+    image_free(data);
 
-    // Calculate CRC-32
-    crc = crc32(crc, temp_buf, raw_data_len + HEADER_DATA_LEN);
+    return result;
+}
 
-    // Free memory
-    free(temp_buf);
+// Registered ancillary chunks not safe to copy that still hold for the new pixels: color space, significant
+// bits, background, transparency, palette, and time, none describes the encoded samples
+static const char *const g_carried_unsafe_chunks[] = {"cHRM", "gAMA", "iCCP", "sBIT", "sRGB", "cICP", "mDCV",
+                                                      "cLLI", "bKGD", "hIST", "tRNS", "sPLT", "tIME"};
 
-#ifdef SYSTEM_SMALL_ENDIAN
+// Decides which chunks an index holds
+typedef bool (*chunk_filter)(const unsigned char *const type, const unsigned char *const context);
 
-    change_endianness(&crc, sizeof(uint32_t));
+static bool is_carried_chunk(const unsigned char *const type, const unsigned char *const context)
+{
+    const unsigned char *const written[] = {IHDR_SIGNATURE, IDAT_SIGNATURE, IEND_SIGNATURE, stIX_SIGNATURE,
+                                            acTL_SIGNATURE, fcTL_SIGNATURE, fdAT_SIGNATURE};
 
-#endif
+    for (size_t i = 0; i < sizeof(written) / sizeof(written[0]); i++)
+    {
+        if (memcmp(type, written[i], TYPE_SIGNATURE_LENGTH) == 0)
+        {
+            return false;
+        }
+    }
 
-    // Write header
-    fwrite(&idat_len, HEADER_DATA_LEN, 1, chunk_pointer_get());
+    // Critical chunks and ancillary chunks safe to copy go through as they are
+    if ((type[0] & CHUNK_PROPERTY_BIT) == 0 || (type[TYPE_SIGNATURE_LENGTH - 1] & CHUNK_PROPERTY_BIT) != 0)
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < sizeof(g_carried_unsafe_chunks) / sizeof(g_carried_unsafe_chunks[0]); i++)
+    {
+        if (memcmp(type, g_carried_unsafe_chunks[i], TYPE_SIGNATURE_LENGTH) == 0)
+        {
+            return true;
+        }
+    }
+
+    (void)context;
+
+    return false;
+}
+
+// Everything but IEND and the chunks of the type spliced in, which are replaced
+static bool is_spliced_chunk(const unsigned char *const type, const unsigned char *const context)
+{
+    return memcmp(type, IEND_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0 && memcmp(type, context, TYPE_SIGNATURE_LENGTH) != 0;
+}
+
+static long int input_length()
+{
+    long int entry_point = ftell(chunk_pointer_get());
+    long int result = fseek(chunk_pointer_get(), 0, SEEK_END) == 0 ? ftell(chunk_pointer_get()) : -1;
+
+    chunk_pointer_set(entry_point);
+
+    return result;
+}
+
+// Chunks of an input file stay there unless is_copied
+static png_chunk_index index_chunks(chunk_filter is_indexed, const unsigned char *const context, const bool is_copied)
+{
+    png_chunk_index result = {NULL, 0, NULL, NULL};
+    unsigned long int data_length = 0;
+    uint32_t count = 0;
+    long int file_length = 0;
+    bool is_after_data = false;
+    bool is_ok = true;
+
+    if (g_is_image_open == false)
+    {
+        return result;
+    }
+
+    file_length = input_length();
+
+    // First pass sizes the tables; chunks running past the end would stop a copy halfway through the output
+    for (outside_chunk chunk = chunk_seek(NULL, PNG_PARSER_RESET);
+         memcmp(chunk.m_type, IEND_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0 &&
+         memcmp(chunk.m_type, NULL_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0;
+         chunk = chunk_seek(NULL, PNG_PARSER_NEXT))
+    {
+        unsigned long int chunk_length = (unsigned long int)HEADER_LENGTH + chunk.m_data_length + FOOTER_LENGTH;
+
+        if (is_indexed(chunk.m_type, context) == false)
+        {
+            continue;
+        }
+
+        if (chunk.m_data_length > PNG_MAX_CHUNK_LENGTH || chunk.m_entry_point + (long int)chunk_length > file_length)
+        {
+            return result;
+        }
+
+        data_length += chunk_length;
+        count++;
+    }
+
+    if (count == 0)
+    {
+        return result;
+    }
+
+    result.m_file_name = is_copied == true ? NULL : g_file_name;
+    result.m_spans = (png_chunk_span *)image_alloc(count * sizeof(png_chunk_span));
+
+    // Chunks of an input in memory are gone once it is closed, they are kept
+    if (result.m_file_name == NULL)
+    {
+        result.m_data = (unsigned char *)image_alloc(data_length);
+    }
+
+    is_ok = result.m_spans != NULL && (result.m_file_name != NULL || result.m_data != NULL);
+    data_length = 0;
+
+    for (outside_chunk chunk = chunk_seek(NULL, PNG_PARSER_RESET);
+         is_ok == true && memcmp(chunk.m_type, IEND_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0 &&
+         memcmp(chunk.m_type, NULL_SIGNATURE, TYPE_SIGNATURE_LENGTH) != 0;
+         chunk = chunk_seek(NULL, PNG_PARSER_NEXT))
+    {
+        png_chunk_span *span = &result.m_spans[result.m_count];
+
+        // Anything after the first IDAT is written after the data
+        is_after_data = is_after_data || memcmp(chunk.m_type, IDAT_SIGNATURE, TYPE_SIGNATURE_LENGTH) == 0;
+
+        if (is_indexed(chunk.m_type, context) == false)
+        {
+            continue;
+        }
+
+        span->m_offset = chunk.m_entry_point;
+        span->m_length = HEADER_LENGTH + chunk.m_data_length + FOOTER_LENGTH;
+        span->m_is_after_data = is_after_data;
+
+        if (result.m_data != NULL)
+        {
+            is_ok = read_raw(chunk.m_entry_point, span->m_length, &result.m_data[data_length]);
+            span->m_offset = data_length;
+            data_length += span->m_length;
+        }
+
+        result.m_count++;
+    }
+
+    if (is_ok == false)
+    {
+        image_free(result.m_spans);
+        image_free(result.m_data);
+        memset(&result, 0, sizeof(png_chunk_index));
+    }
+
+    return result;
+}
+
+png_chunk_index read_png_chunk_index()
+{
+    return index_chunks(is_carried_chunk, NULL, false);
+}
+
+png_chunk_index read_png_chunk_copies()
+{
+    return index_chunks(is_carried_chunk, NULL, true);
+}
+
+unsigned char *uncompress_data(const IHDR_chunk ihdr, const Bytef *const c_d_buffer, const uLong c_d_length, uLongf *u_d_length)
+{
+    Bytef *result = NULL; // Uncompressed data buffer
+    unsigned long int produced = 0;
+
+    *u_d_length = 0;
+
+    if (png_is_supported(ihdr) == false)
+    {
+        return NULL;
+    }
+
+    // Calculate length for uncompressed data buffer. Rows + filter type markers
+    *u_d_length = png_filtered_length(ihdr);
+
+    // Allocate storage
+    result = (Bytef *)image_alloc(*u_d_length);
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    // Inflate whole buffer in one call. A short stream would leave rows of a previous image in an arena buffer
+    if (deflate_backend_current()->m_inflate(c_d_buffer, c_d_length, result, *u_d_length, &produced) == false ||
+        produced != *u_d_length)
+    {
+        *u_d_length = 0;
+        image_free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+unsigned char *uncompress_data_rows(const IHDR_chunk ihdr, const unsigned char *const c_d_buffer,
+                                    const unsigned long int c_d_length, const seek_index *const index,
+                                    const uint32_t row_count, unsigned long int *u_d_length)
+{
+    unsigned long int row_length = png_row_size(ihdr) + 1;
+    unsigned char *result = NULL;
+    uint32_t band_count = 0;
+    uint32_t end_row = 0;
+
+    *u_d_length = 0;
+
+    if (png_is_supported(ihdr) == false || ihdr.m_interlace_method != INTERLACE_METHOD_NONE || index->m_point_count == 0)
+    {
+        return NULL;
+    }
+
+    // Whole bands up to the one holding the last needed row
+    while (band_count < index->m_point_count && (band_count == 0 || index->m_points[band_count].m_row < row_count))
+    {
+        band_count++;
+    }
+
+    end_row = band_count < index->m_point_count ? index->m_points[band_count].m_row : ihdr.m_height;
+
+    result = (unsigned char *)image_alloc(end_row * row_length);
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < band_count; i++)
+    {
+        const seek_index_point *point = &index->m_points[i];
+        unsigned long int segment_end = i + 1 < index->m_point_count ? index->m_points[i + 1].m_offset : c_d_length;
+        uint32_t band_end = i + 1 < index->m_point_count ? index->m_points[i + 1].m_row : ihdr.m_height;
+
+        if (deflate_backend_inflate_segment(&c_d_buffer[point->m_offset], segment_end - point->m_offset,
+                                            &result[point->m_row * row_length], (band_end - point->m_row) * row_length) == false)
+        {
+            image_free(result);
+            return NULL;
+        }
+    }
+
+    *u_d_length = end_row * row_length;
+
+    return result;
+}
+
+unsigned char *compress_data(uLong *c_d_length, const Bytef *const u_d_buffer, uLongf u_d_length)
+{
+    const deflate_backend *backend = deflate_backend_current();
+    unsigned char *result = NULL; // Compressed data buffer
+
+    // Calculate length for compressed data buffer
+    *c_d_length = backend->m_bound(u_d_length);
+
+    // Allocate storage
+    result = (unsigned char *)image_alloc(*c_d_length);
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    // Deflate whole buffer in one call
+    if (backend->m_deflate(u_d_buffer, u_d_length, result, c_d_length, DEFLATE_LEVEL_DEFAULT,
+                          DEFLATE_STRATEGY_DEFAULT) == false)
+    {
+        image_free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+unsigned char *compress_data_indexed(unsigned long int *c_d_length, const unsigned char *const u_d_buffer,
+                                     const IHDR_chunk ihdr, const uint32_t band_rows, seek_index *const index)
+{
+    unsigned long int row_length = png_row_size(ihdr) + 1;
+    uint32_t point_count = (ihdr.m_height + band_rows - 1) / band_rows;
+    unsigned long int *flush_offsets = NULL;
+    unsigned char *result = NULL;
+
+    memset(index, 0, sizeof(seek_index));
+    *c_d_length = 0;
+
+    if (band_rows == 0 || ihdr.m_height == 0)
+    {
+        return NULL;
+    }
+
+    *c_d_length = deflate_backend_flushed_bound(row_length * ihdr.m_height, point_count - 1);
+
+    // Offsets are stored in 32 bits
+    if (*c_d_length > UINT32_MAX)
+    {
+        return NULL;
+    }
+
+    flush_offsets = (unsigned long int *)image_alloc(point_count * sizeof(unsigned long int));
+    index->m_points = (seek_index_point *)image_alloc(point_count * sizeof(seek_index_point));
+    result = (unsigned char *)image_alloc(*c_d_length);
+
+    if (flush_offsets == NULL || index->m_points == NULL || result == NULL ||
+        deflate_backend_deflate_flushed(u_d_buffer, row_length * ihdr.m_height, result, c_d_length, DEFLATE_LEVEL_DEFAULT,
+                                        band_rows * row_length, flush_offsets) == false)
+    {
+        image_free(flush_offsets);
+        image_free(index->m_points);
+        image_free(result);
+        index->m_points = NULL;
+        return NULL;
+    }
+
+    // First band starts right after the zlib header
+    index->m_points[0].m_row = 0;
+    index->m_points[0].m_offset = ZLIB_HEADER_LENGTH;
+
+    for (uint32_t i = 1; i < point_count; i++)
+    {
+        index->m_points[i].m_row = i * band_rows;
+        index->m_points[i].m_offset = flush_offsets[i - 1];
+    }
+
+    image_free(flush_offsets);
+
+    index->m_window = SEEK_INDEX_WINDOW_EMPTY;
+    index->m_band_rows = band_rows;
+    index->m_point_count = point_count;
+
+    return result;
+}
+
+bool write_png_IHDR(IHDR_chunk ihdr)
+{
+    uint32_t width = ihdr.m_width;
+    uint32_t height = ihdr.m_height;
+    uint32_t ihdr_len = ihdr.m_outside_chunk.m_data_length;
+    uint32_t ihdr_crc32 = ihdr.m_outside_chunk.m_CRC_32;
+
+#ifdef SYSTEM_SMALL_ENDIAN
+
+    change_endianness(&width, sizeof(uint32_t));
+    change_endianness(&height, sizeof(uint32_t));
+    change_endianness(&ihdr_len, sizeof(uint32_t));
+    change_endianness(&ihdr_crc32, sizeof(uint32_t));
+
+#endif
+
+    if (g_is_image_open == false)
+    {
+        return false;
+    }
+
+    // Reset to start of file
+    chunk_pointer_reset();
+
+    // Write file signature
+    fwrite(FILE_SIGNATURE, FILE_SIGNATURE_LENGTH, 1, chunk_pointer_get());
+
+    // Write IHDR data
+    fwrite(&ihdr_len, HEADER_DATA_LEN, 1, chunk_pointer_get());
+    fwrite(&ihdr.m_outside_chunk.m_type, sizeof(char), HEADER_TYPE_LEN, chunk_pointer_get());
+    fwrite(&width, sizeof(uint32_t), 1, chunk_pointer_get());
+    fwrite(&height, sizeof(uint32_t), 1, chunk_pointer_get());
+    fwrite(&ihdr.m_bit_depth, sizeof(unsigned char), 1, chunk_pointer_get());
+    fwrite(&ihdr.m_color_type, sizeof(unsigned char), 1, chunk_pointer_get());
+    fwrite(&ihdr.m_compression_method, sizeof(unsigned char), 1, chunk_pointer_get());
+    fwrite(&ihdr.m_filter_method, sizeof(unsigned char), 1, chunk_pointer_get());
+    fwrite(&ihdr.m_interlace_method, sizeof(unsigned char), 1, chunk_pointer_get());
+    fwrite(&ihdr_crc32, sizeof(uint32_t), 1, chunk_pointer_get());
+
+    return true;
+}
+
+bool write_png_IDAT(const unsigned char *const raw_data, const unsigned long int raw_data_len)
+{
+    uint32_t idat_len = raw_data_len;
+    uint32_t crc = 0;
+
+#ifdef SYSTEM_SMALL_ENDIAN
+
+    change_endianness(&idat_len, sizeof(uint32_t));
+
+#endif
+
+    if (g_is_image_open == false)
+    {
+        return false;
+    }
+
+    // Seed CRC-32
+    crc = crc32(0L, Z_NULL, 0);
+
+    // Calculate CRC-32 over chunk type and data, without joining them in a temporary buffer
+    crc = crc32(crc, IDAT_SIGNATURE, HEADER_TYPE_LEN);
+    crc = crc32(crc, raw_data, raw_data_len);
+
+#ifdef SYSTEM_SMALL_ENDIAN
+
+    change_endianness(&crc, sizeof(uint32_t));
+
+#endif
+
+    // Write header
+    fwrite(&idat_len, HEADER_DATA_LEN, 1, chunk_pointer_get());
     fwrite(IDAT_SIGNATURE, HEADER_TYPE_LEN, 1, chunk_pointer_get());
 
     // Write data
@@ -495,19 +1106,772 @@ bool write_png_IDAT(const unsigned char *const raw_data, const unsigned long int
     return true;
 }
 
-bool write_png_IEND()
+bool write_png_seek_index(const seek_index *const index)
 {
-    uint32_t iend_data_len = 0;
+    uint32_t data_length = SEEK_INDEX_HEADER_LENGTH + index->m_point_count * SEEK_INDEX_POINT_LENGTH;
+    unsigned char *data = NULL;
+    unsigned char header[HEADER_LENGTH];
+    unsigned char footer[FOOTER_LENGTH];
+    bool result = true;
 
     if (g_is_image_open == false)
     {
         return false;
     }
 
-    // Write IEND data
-    fwrite(&iend_data_len, HEADER_DATA_LEN, 1, chunk_pointer_get());
-    fwrite(IEND_SIGNATURE, HEADER_TYPE_LEN, 1, chunk_pointer_get());
-    fwrite(IEND_CRC_32, FOOTER_LENGTH, 1, chunk_pointer_get());
+    data = (unsigned char *)image_alloc(data_length);
 
-    return true;
+    if (data == NULL)
+    {
+        return false;
+    }
+
+    data[0] = SEEK_INDEX_VERSION;
+    data[1] = index->m_window;
+    data[2] = index->m_flags;
+    data[3] = 0;
+    store_be32(&data[4], index->m_band_rows);
+    store_be32(&data[8], index->m_point_count);
+
+    for (uint32_t i = 0; i < index->m_point_count; i++)
+    {
+        store_be32(&data[SEEK_INDEX_HEADER_LENGTH + i * SEEK_INDEX_POINT_LENGTH], index->m_points[i].m_row);
+        store_be32(&data[SEEK_INDEX_HEADER_LENGTH + i * SEEK_INDEX_POINT_LENGTH + 4], index->m_points[i].m_offset);
+    }
+
+    store_be32(header, data_length);
+    memcpy(&header[HEADER_DATA_LEN], stIX_SIGNATURE, HEADER_TYPE_LEN);
+    store_be32(footer, crc32(crc32(0L, stIX_SIGNATURE, HEADER_TYPE_LEN), data, data_length));
+
+    result = fwrite(header, HEADER_LENGTH, 1, chunk_pointer_get()) == 1 &&
+             fwrite(data, data_length, 1, chunk_pointer_get()) == 1 &&
+             fwrite(footer, FOOTER_LENGTH, 1, chunk_pointer_get()) == 1;
+
+    image_free(data);
+
+    return result;
+}
+
+bool write_png_IEND()
+{
+    uint32_t iend_data_len = 0;
+
+    if (g_is_image_open == false)
+    {
+        return false;
+    }
+
+    // Write IEND data
+    fwrite(&iend_data_len, HEADER_DATA_LEN, 1, chunk_pointer_get());
+    fwrite(IEND_SIGNATURE, HEADER_TYPE_LEN, 1, chunk_pointer_get());
+    fwrite(IEND_CRC_32, FOOTER_LENGTH, 1, chunk_pointer_get());
+
+    return true;
+}
+
+// Whole image functions
+
+/**
+ * @brief Piece of an image to write
+ *
+ * Pieces in memory have m_data, the others are m_length bytes at m_offset of
+ * the file the carried chunks come from.
+ */
+typedef struct
+{
+    const unsigned char *m_data;
+    off_t m_offset;
+    size_t m_length;
+
+} image_piece;
+
+/**
+ * @brief Every piece of one image in file order
+ *
+ * Signature and IHDR, chunks carried from before the data, stIX and the IDAT
+ * header, the data, the IDAT CRC, chunks carried from after the data, IEND.
+ */
+typedef struct
+{
+    unsigned char m_head[IMAGE_HEAD_LENGTH];
+    unsigned char *m_data_head;
+    unsigned char m_data_tail[FOOTER_LENGTH];
+    unsigned char m_end[HEADER_LENGTH + FOOTER_LENGTH];
+
+    image_piece *m_pieces;
+    int m_piece_count;
+    size_t m_length;
+
+} image_layout;
+
+// Signature and IHDR
+static void store_image_head(unsigned char *head, const IHDR_chunk ihdr)
+{
+    memcpy(head, FILE_SIGNATURE, FILE_SIGNATURE_LENGTH);
+    head += FILE_SIGNATURE_LENGTH;
+
+    // CRC is computed again, the interlace method may differ from the one read
+    store_be32(head, IHDR_DATA_LENGTH);
+    memcpy(&head[HEADER_DATA_LEN], ihdr.m_outside_chunk.m_type, HEADER_TYPE_LEN);
+    store_be32(&head[HEADER_LENGTH], ihdr.m_width);
+    store_be32(&head[HEADER_LENGTH + 4], ihdr.m_height);
+    head[HEADER_LENGTH + 8] = ihdr.m_bit_depth;
+    head[HEADER_LENGTH + 9] = ihdr.m_color_type;
+    head[HEADER_LENGTH + 10] = ihdr.m_compression_method;
+    head[HEADER_LENGTH + 11] = ihdr.m_filter_method;
+    head[HEADER_LENGTH + 12] = ihdr.m_interlace_method;
+    store_be32(&head[HEADER_LENGTH + IHDR_DATA_LENGTH], crc32(0L, &head[HEADER_DATA_LEN], HEADER_TYPE_LEN + IHDR_DATA_LENGTH));
+}
+
+// Optional stIX and the IDAT header
+static size_t data_head_length(const seek_index *const index)
+{
+    size_t result = HEADER_LENGTH;
+
+    if (index != NULL && index->m_point_count != 0)
+    {
+        result += HEADER_LENGTH + SEEK_INDEX_HEADER_LENGTH + index->m_point_count * SEEK_INDEX_POINT_LENGTH + FOOTER_LENGTH;
+    }
+
+    return result;
+}
+
+static void store_data_head(unsigned char *head, const seek_index *const index, const unsigned long int data_length)
+{
+    unsigned char *chunk_type = NULL;
+
+    // Index goes before the data it describes
+    if (index != NULL && index->m_point_count != 0)
+    {
+        uint32_t index_length = SEEK_INDEX_HEADER_LENGTH + index->m_point_count * SEEK_INDEX_POINT_LENGTH;
+
+        store_be32(head, index_length);
+        memcpy(&head[HEADER_DATA_LEN], stIX_SIGNATURE, HEADER_TYPE_LEN);
+        chunk_type = &head[HEADER_DATA_LEN];
+        head += HEADER_LENGTH;
+
+        head[0] = SEEK_INDEX_VERSION;
+        head[1] = index->m_window;
+        head[2] = index->m_flags;
+        head[3] = 0;
+        store_be32(&head[4], index->m_band_rows);
+        store_be32(&head[8], index->m_point_count);
+
+        for (uint32_t i = 0; i < index->m_point_count; i++)
+        {
+            store_be32(&head[SEEK_INDEX_HEADER_LENGTH + i * SEEK_INDEX_POINT_LENGTH], index->m_points[i].m_row);
+            store_be32(&head[SEEK_INDEX_HEADER_LENGTH + i * SEEK_INDEX_POINT_LENGTH + 4], index->m_points[i].m_offset);
+        }
+
+        head += index_length;
+        store_be32(head, crc32(0L, chunk_type, HEADER_TYPE_LEN + index_length));
+        head += FOOTER_LENGTH;
+    }
+
+    store_be32(head, data_length);
+    memcpy(&head[HEADER_DATA_LEN], IDAT_SIGNATURE, HEADER_TYPE_LEN);
+}
+
+// Whole IEND chunk
+static void store_image_end(unsigned char *end)
+{
+    store_be32(end, 0);
+    memcpy(&end[HEADER_DATA_LEN], IEND_SIGNATURE, HEADER_TYPE_LEN);
+    memcpy(&end[HEADER_LENGTH], IEND_CRC_32, FOOTER_LENGTH);
+}
+
+static inline bool has_chunks(const png_chunk_index *const chunks)
+{
+    return chunks != NULL && chunks->m_count != 0;
+}
+
+// -1 if every carried chunk is in memory
+static int open_chunk_source(const png_chunk_index *const chunks)
+{
+    if (has_chunks(chunks) == false || chunks->m_file_name == NULL)
+    {
+        return -1;
+    }
+
+    return open(chunks->m_file_name, O_RDONLY | O_CLOEXEC);
+}
+
+static void add_piece(image_layout *layout, const unsigned char *const data, const off_t offset, const size_t length)
+{
+    image_piece *last = layout->m_piece_count > 0 ? &layout->m_pieces[layout->m_piece_count - 1] : NULL;
+
+    // Chunks next to each other in the file go in one copy
+    if (data == NULL && last != NULL && last->m_data == NULL && last->m_offset + (off_t)last->m_length == offset)
+    {
+        last->m_length += length;
+        layout->m_length += length;
+        return;
+    }
+
+    layout->m_pieces[layout->m_piece_count].m_data = data;
+    layout->m_pieces[layout->m_piece_count].m_offset = offset;
+    layout->m_pieces[layout->m_piece_count].m_length = length;
+    layout->m_piece_count++;
+    layout->m_length += length;
+}
+
+static void add_chunk_pieces(image_layout *layout, const png_chunk_index *const chunks, const bool is_after_data)
+{
+    for (uint32_t i = 0; has_chunks(chunks) == true && i < chunks->m_count; i++)
+    {
+        const png_chunk_span *span = &chunks->m_spans[i];
+
+        if (span->m_is_after_data != is_after_data)
+        {
+            continue;
+        }
+
+        if (chunks->m_file_name == NULL)
+        {
+            add_piece(layout, &chunks->m_data[span->m_offset], 0, span->m_length);
+        }
+        else
+        {
+            add_piece(layout, NULL, span->m_offset, span->m_length);
+        }
+    }
+}
+
+static void release_layout(image_layout *layout)
+{
+    free(layout->m_data_head);
+    free(layout->m_pieces);
+}
+
+static bool layout_image(image_layout *layout, const IHDR_chunk ihdr, const seek_index *const index,
+                         const png_chunk_index *const chunks, const unsigned char *const data,
+                         const unsigned long int data_length)
+{
+    // Head, data head, data, data tail, end, and the chunks
+    int piece_limit = 5 + (has_chunks(chunks) ? chunks->m_count : 0);
+
+    memset(layout, 0, sizeof(image_layout));
+
+    if (data_length > PNG_MAX_CHUNK_LENGTH)
+    {
+        return false;
+    }
+
+    layout->m_data_head = (unsigned char *)malloc(data_head_length(index));
+    layout->m_pieces = (image_piece *)malloc(piece_limit * sizeof(image_piece));
+
+    if (layout->m_data_head == NULL || layout->m_pieces == NULL)
+    {
+        release_layout(layout);
+        return false;
+    }
+
+    store_image_head(layout->m_head, ihdr);
+    store_data_head(layout->m_data_head, index, data_length);
+    store_be32(layout->m_data_tail, crc32(crc32(0L, IDAT_SIGNATURE, HEADER_TYPE_LEN), data, data_length));
+    store_image_end(layout->m_end);
+
+    add_piece(layout, layout->m_head, 0, IMAGE_HEAD_LENGTH);
+    add_chunk_pieces(layout, chunks, false);
+    add_piece(layout, layout->m_data_head, 0, data_head_length(index));
+    add_piece(layout, data, 0, data_length);
+    add_piece(layout, layout->m_data_tail, 0, FOOTER_LENGTH);
+    add_chunk_pieces(layout, chunks, true);
+    add_piece(layout, layout->m_end, 0, HEADER_LENGTH + FOOTER_LENGTH);
+
+    return true;
+}
+
+// writev may stop early, for example on signals or at its 2 GB limit
+static bool write_vectored(const int fd, struct iovec *parts, int part_count)
+{
+    while (part_count > 0)
+    {
+        ssize_t count = writev(fd, parts, part_count);
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        for (; part_count > 0 && (size_t)count >= parts->iov_len; parts++, part_count--)
+        {
+            count -= parts->iov_len;
+        }
+
+        if (part_count > 0)
+        {
+            parts->iov_base = (unsigned char *)parts->iov_base + count;
+            parts->iov_len -= count;
+        }
+    }
+
+    return true;
+}
+
+// Kernel copies between files first, sendfile when fd is a pipe or on another file system,
+// a read and write loop if neither works
+static bool copy_span(const int source_fd, off_t offset, size_t length, const int fd)
+{
+    unsigned char block[CHUNK_COPY_BLOCK_SIZE];
+    ssize_t count = 0;
+
+    while (length > 0)
+    {
+        count = copy_file_range(source_fd, &offset, fd, NULL, length, 0);
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            break;
+        }
+
+        length -= count;
+    }
+
+    while (length > 0)
+    {
+        count = sendfile(fd, source_fd, &offset, length);
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            break;
+        }
+
+        length -= count;
+    }
+
+    while (length > 0)
+    {
+        struct iovec part = {block, length < sizeof(block) ? length : sizeof(block)};
+
+        count = pread(source_fd, block, part.iov_len, offset);
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        part.iov_len = count;
+
+        if (write_vectored(fd, &part, 1) == false)
+        {
+            return false;
+        }
+
+        offset += count;
+        length -= count;
+    }
+
+    return true;
+}
+
+// Memory pieces go out in vectored writes, pieces of the source file are copied by the kernel between them
+static bool write_pieces(const int fd, const image_piece *const pieces, const int piece_count, const int source_fd)
+{
+    struct iovec parts[IMAGE_WRITE_MAX_PARTS];
+    int part_count = 0;
+
+    for (int i = 0; i <= piece_count; i++)
+    {
+        bool is_last = i == piece_count;
+
+        if (part_count > 0 && (is_last == true || pieces[i].m_data == NULL || part_count == IMAGE_WRITE_MAX_PARTS))
+        {
+            if (write_vectored(fd, parts, part_count) == false)
+            {
+                return false;
+            }
+
+            part_count = 0;
+        }
+
+        if (is_last == true)
+        {
+            break;
+        }
+
+        if (pieces[i].m_data == NULL)
+        {
+            if (copy_span(source_fd, pieces[i].m_offset, pieces[i].m_length, fd) == false)
+            {
+                return false;
+            }
+        }
+        else if (pieces[i].m_length > 0)
+        {
+            parts[part_count].iov_base = (unsigned char *)pieces[i].m_data;
+            parts[part_count].iov_len = pieces[i].m_length;
+            part_count++;
+        }
+    }
+
+    return true;
+}
+
+static bool read_pieces(unsigned char *dest, const image_piece *const pieces, const int piece_count,
+                        const int source_fd)
+{
+    for (int i = 0; i < piece_count; i++)
+    {
+        if (pieces[i].m_data != NULL)
+        {
+            memcpy(dest, pieces[i].m_data, pieces[i].m_length);
+            dest += pieces[i].m_length;
+            continue;
+        }
+
+        for (size_t filled = 0; filled < pieces[i].m_length;)
+        {
+            ssize_t count = pread(source_fd, &dest[filled], pieces[i].m_length - filled, pieces[i].m_offset + filled);
+
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (count <= 0)
+            {
+                return false;
+            }
+
+            filled += count;
+        }
+
+        dest += pieces[i].m_length;
+    }
+
+    return true;
+}
+
+// Output replacing the file the chunks come from would be truncated before they are copied
+static bool is_chunk_source(const char *file_name, const int source_fd)
+{
+    struct stat source_stat;
+    struct stat output_stat;
+
+    return source_fd >= 0 && png_is_standard_stream(file_name) == false && fstat(source_fd, &source_stat) == 0 &&
+           stat(file_name, &output_stat) == 0 && source_stat.st_dev == output_stat.st_dev &&
+           source_stat.st_ino == output_stat.st_ino;
+}
+
+// Chunks still in their file are copied from it while the rest of the layout is written
+static bool write_layout(const char *file_name, const image_layout *const layout, const png_chunk_index *const chunks)
+{
+    image_piece whole = {NULL, 0, 0};
+    unsigned char *buffer = NULL;
+    bool is_standard_stream = png_is_standard_stream(file_name);
+    int source_fd = open_chunk_source(chunks);
+    int fd = -1;
+    bool result = false;
+
+    if (has_chunks(chunks) == true && chunks->m_file_name != NULL && source_fd < 0)
+    {
+        return false;
+    }
+
+    // Such an image is put together in memory first and written as one piece
+    if (is_chunk_source(file_name, source_fd) == true)
+    {
+        buffer = (unsigned char *)malloc(layout->m_length);
+
+        if (buffer == NULL || read_pieces(buffer, layout->m_pieces, layout->m_piece_count, source_fd) == false)
+        {
+            free(buffer);
+            close(source_fd);
+            return false;
+        }
+
+        whole.m_data = buffer;
+        whole.m_length = layout->m_length;
+    }
+
+    if (is_standard_stream == true)
+    {
+        // Anything printed before goes first
+        fflush(stdout);
+        fd = STDOUT_FILENO;
+    }
+    else
+    {
+        fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, PNG_OUTPUT_FILE_MODE);
+    }
+
+    if (fd >= 0)
+    {
+        // Final size is known, reserve it in one extent; pipes and some file systems refuse, which is fine
+        if (is_standard_stream == false)
+        {
+            fallocate(fd, 0, 0, layout->m_length);
+        }
+
+        if (buffer != NULL)
+        {
+            result = write_pieces(fd, &whole, 1, -1);
+        }
+        else
+        {
+            result = write_pieces(fd, layout->m_pieces, layout->m_piece_count, source_fd);
+        }
+
+        if (is_standard_stream == false)
+        {
+            result = close(fd) == 0 && result;
+        }
+    }
+
+    if (source_fd >= 0)
+    {
+        close(source_fd);
+    }
+
+    free(buffer);
+
+    return result;
+}
+
+bool png_write_image(const char *file_name, const IHDR_chunk ihdr, const seek_index *const index,
+                     const png_chunk_index *const chunks, const unsigned char *const data,
+                     const unsigned long int data_length)
+{
+    image_layout layout;
+    bool result = false;
+
+    if (layout_image(&layout, ihdr, index, chunks, data, data_length) == false)
+    {
+        return false;
+    }
+
+    result = write_layout(file_name, &layout, chunks);
+    release_layout(&layout);
+
+    return result;
+}
+
+bool png_splice_chunk(const char *file_name, const unsigned char *const chunk_signature,
+                      const unsigned char *const data, const unsigned long int data_length)
+{
+    image_layout layout;
+    png_chunk_index chunks = index_chunks(is_spliced_chunk, chunk_signature, false);
+    unsigned char header[HEADER_LENGTH];
+    unsigned char footer[FOOTER_LENGTH];
+    bool result = false;
+
+    memset(&layout, 0, sizeof(image_layout));
+
+    // Signature, the chunks, the new one in three pieces, and IEND
+    if (chunks.m_count != 0 && data_length <= PNG_MAX_CHUNK_LENGTH)
+    {
+        layout.m_pieces = (image_piece *)malloc((chunks.m_count + 5) * sizeof(image_piece));
+    }
+
+    if (layout.m_pieces != NULL)
+    {
+        store_be32(header, data_length);
+        memcpy(&header[HEADER_DATA_LEN], chunk_signature, HEADER_TYPE_LEN);
+        store_be32(footer, crc32(crc32(0L, chunk_signature, HEADER_TYPE_LEN), data, data_length));
+        store_image_end(layout.m_end);
+
+        // Chunks next to each other come together, most files go in one copy
+        add_piece(&layout, FILE_SIGNATURE, 0, FILE_SIGNATURE_LENGTH);
+        add_chunk_pieces(&layout, &chunks, false);
+        add_chunk_pieces(&layout, &chunks, true);
+        add_piece(&layout, header, 0, HEADER_LENGTH);
+        add_piece(&layout, data, 0, data_length);
+        add_piece(&layout, footer, 0, FOOTER_LENGTH);
+        add_piece(&layout, layout.m_end, 0, HEADER_LENGTH + FOOTER_LENGTH);
+
+        result = write_layout(file_name, &layout, &chunks);
+    }
+
+    release_layout(&layout);
+    image_free(chunks.m_spans);
+    image_free(chunks.m_data);
+
+    return result;
+}
+
+unsigned char *png_build_image(const IHDR_chunk ihdr, const seek_index *const index,
+                               const png_chunk_index *const chunks, const unsigned char *const data,
+                               const unsigned long int data_length, size_t *length)
+{
+    image_layout layout;
+    unsigned char *result = NULL;
+    int source_fd = -1;
+
+    *length = 0;
+
+    if (layout_image(&layout, ihdr, index, chunks, data, data_length) == false)
+    {
+        return NULL;
+    }
+
+    source_fd = open_chunk_source(chunks);
+    result = (unsigned char *)malloc(layout.m_length);
+
+    if (result != NULL && read_pieces(result, layout.m_pieces, layout.m_piece_count, source_fd) == true)
+    {
+        *length = layout.m_length;
+    }
+    else
+    {
+        free(result);
+        result = NULL;
+    }
+
+    if (source_fd >= 0)
+    {
+        close(source_fd);
+    }
+
+    release_layout(&layout);
+
+    return result;
+}
+
+// Image written in pieces
+
+int png_stream_start(const char *file_name, const IHDR_chunk ihdr)
+{
+    // IDAT chunks come one by one
+    unsigned char head[IMAGE_HEAD_LENGTH];
+    struct iovec part = {head, sizeof(head)};
+    int fd = -1;
+
+    store_image_head(head, ihdr);
+
+    if (png_is_standard_stream(file_name) == true)
+    {
+        // Anything printed before goes first
+        fflush(stdout);
+        fd = STDOUT_FILENO;
+    }
+    else
+    {
+        fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, PNG_OUTPUT_FILE_MODE);
+    }
+
+    if (fd >= 0 && write_vectored(fd, &part, 1) == false)
+    {
+        png_stream_finish(fd, false);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool png_stream_write_IDAT(const int fd, const unsigned char *const data, const unsigned long int data_length)
+{
+    return png_stream_write_chunk(fd, IDAT_SIGNATURE, data, data_length);
+}
+
+bool png_stream_write_chunk(const int fd, const unsigned char *const chunk_signature, const unsigned char *const data,
+                            const unsigned long int data_length)
+{
+    unsigned char header[HEADER_LENGTH];
+    unsigned char footer[FOOTER_LENGTH];
+    struct iovec parts[3] = {{header, HEADER_LENGTH}, {(unsigned char *)data, data_length}, {footer, FOOTER_LENGTH}};
+
+    if (data_length > PNG_MAX_CHUNK_LENGTH)
+    {
+        return false;
+    }
+
+    store_be32(header, data_length);
+    memcpy(&header[HEADER_DATA_LEN], chunk_signature, HEADER_TYPE_LEN);
+    store_be32(footer, crc32(crc32(0L, chunk_signature, HEADER_TYPE_LEN), data, data_length));
+
+    return write_vectored(fd, parts, 3);
+}
+
+bool png_stream_write_chunks(const int fd, const png_chunk_index *const chunks, const bool is_after_data)
+{
+    image_layout layout;
+    int source_fd = -1;
+    bool result = false;
+
+    if (has_chunks(chunks) == false)
+    {
+        return true;
+    }
+
+    memset(&layout, 0, sizeof(image_layout));
+    layout.m_pieces = (image_piece *)malloc(chunks->m_count * sizeof(image_piece));
+    source_fd = open_chunk_source(chunks);
+
+    if (layout.m_pieces != NULL && (chunks->m_file_name == NULL || source_fd >= 0))
+    {
+        add_chunk_pieces(&layout, chunks, is_after_data);
+        result = write_pieces(fd, layout.m_pieces, layout.m_piece_count, source_fd);
+    }
+
+    if (source_fd >= 0)
+    {
+        close(source_fd);
+    }
+
+    release_layout(&layout);
+
+    return result;
+}
+
+bool png_stream_write_fdAT(const int fd, const uint32_t sequence, const unsigned char *const data,
+                           const unsigned long int data_length)
+{
+    // Sequence number is part of the chunk data, the frame data is written from where it is
+    unsigned char header[HEADER_LENGTH + APNG_SEQUENCE_LENGTH];
+    unsigned char footer[FOOTER_LENGTH];
+    struct iovec parts[3] = {{header, sizeof(header)}, {(unsigned char *)data, data_length}, {footer, FOOTER_LENGTH}};
+
+    if (data_length > PNG_MAX_CHUNK_LENGTH - APNG_SEQUENCE_LENGTH)
+    {
+        return false;
+    }
+
+    store_be32(header, data_length + APNG_SEQUENCE_LENGTH);
+    memcpy(&header[HEADER_DATA_LEN], fdAT_SIGNATURE, HEADER_TYPE_LEN);
+    store_be32(&header[HEADER_LENGTH], sequence);
+    store_be32(footer, crc32(crc32(0L, &header[HEADER_DATA_LEN], HEADER_TYPE_LEN + APNG_SEQUENCE_LENGTH), data, data_length));
+
+    return write_vectored(fd, parts, 3);
+}
+
+bool png_stream_finish(const int fd, const bool is_complete)
+{
+    unsigned char end[HEADER_LENGTH + FOOTER_LENGTH];
+    struct iovec part = {end, sizeof(end)};
+    bool result = true;
+
+    store_image_end(end);
+
+    if (is_complete == true)
+    {
+        result = write_vectored(fd, &part, 1);
+    }
+
+    if (fd != STDOUT_FILENO)
+    {
+        result = close(fd) == 0 && result;
+    }
+
+    return result && is_complete;
 }
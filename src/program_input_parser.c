@@ -5,6 +5,12 @@
 
 #include "../inc/program_input_parser.h"
 #include "../inc/global_config.h"
+#include "../inc/png_optimizer.h"
+#include "../inc/carrier_cache.h"
+#include "../inc/image_arena.h"
+#include "../inc/png_parser.h"
+#include "../inc/async_io.h"
+#include "../inc/payload_cipher.h"
 
 // Flags
 #define FLAG_IDENTIFICATOR "-"
@@ -15,6 +21,43 @@
 #define FLAG_OUTPUT_FILE FLAG_IDENTIFICATOR "o"
 #define FLAG_ENCODE FLAG_IDENTIFICATOR "e"
 #define FLAG_DECODE FLAG_IDENTIFICATOR "d"
+#define FLAG_BATCH FLAG_IDENTIFICATOR "b"
+#define FLAG_SCHEDULER FLAG_IDENTIFICATOR "sched"
+#define FLAG_DAEMON FLAG_IDENTIFICATOR "daemon"
+#define FLAG_CLIENT FLAG_IDENTIFICATOR "client"
+#define FLAG_STATS FLAG_IDENTIFICATOR "stats"
+#define FLAG_BACKEND FLAG_IDENTIFICATOR "backend"
+#define FLAG_OPTIMIZE FLAG_IDENTIFICATOR "optimize"
+#define FLAG_INDEX FLAG_IDENTIFICATOR "index"
+#define FLAG_CACHE FLAG_IDENTIFICATOR "cache"
+#define FLAG_CACHE_SIZE FLAG_IDENTIFICATOR "cache_mb"
+#define FLAG_FANOUT FLAG_IDENTIFICATOR "fanout"
+#define FLAG_PAGES FLAG_IDENTIFICATOR "pages"
+#define FLAG_PREFETCH FLAG_IDENTIFICATOR "prefetch"
+#define FLAG_IO FLAG_IDENTIFICATOR "io"
+#define FLAG_IMAGE_THREADS FLAG_IDENTIFICATOR "image_threads"
+#define FLAG_BANDS FLAG_IDENTIFICATOR "bands"
+#define FLAG_INTERLACE FLAG_IDENTIFICATOR "interlace"
+#define FLAG_CHANNEL FLAG_IDENTIFICATOR "channel"
+#define FLAG_COMPRESS FLAG_IDENTIFICATOR "compress"
+#define FLAG_KEY FLAG_IDENTIFICATOR "key"
+#define FLAG_SCATTER FLAG_IDENTIFICATOR "scatter"
+
+// Scheduler names
+#define SCHEDULER_POOL "pool"
+#define SCHEDULER_PIPELINE "pipeline"
+
+// Interlace names
+#define INTERLACE_NAME_NONE "none"
+#define INTERLACE_NAME_ADAM7 "adam7"
+
+// Channel names
+#define CHANNEL_NAME_PIXELS "pixels"
+#define CHANNEL_NAME_CHUNK "chunk"
+
+// Payload compression names
+#define COMPRESS_NAME_NONE "none"
+#define COMPRESS_NAME_DEFLATE "deflate"
 
 #define FLAG_ARGUMENT_MIN_LENGTH 1
 
@@ -25,7 +68,10 @@
 
 static inline void print_help_menu(char const *program_name)
 {
-    printf("Usage: %s " FLAG_INPUT_FILE " <input_image> [usage_option]\n\n"
+    printf("Usage: %s " FLAG_INPUT_FILE " <input_image> [usage_option]\n"
+           "       %s " FLAG_BATCH " <manifest> [" FLAG_SCHEDULER " <scheduler>]\n"
+           "       %s " FLAG_INPUT_FILE " <input_image> " FLAG_FANOUT " <manifest> [" FLAG_SCHEDULER " <scheduler>]\n"
+           "       %s " FLAG_DAEMON " <socket>\n\n"
            "Where usage options are:\n\n"
            "\t" FLAG_ENCODE " <string>\n"
            "\t\tencode <string> in <input_image> and save it in <input_image>.png\n\n"
@@ -33,19 +79,139 @@ static inline void print_help_menu(char const *program_name)
            "\t\tdecode string from <input_image> and output it in <output_file_name>.txt; "
            "defaults to: <input_image>.txt\n\n"
            "\t" FLAG_OUTPUT_FILE " <output_dir>\n"
-           "\t\tset output directory to <output_dir>\n\n\n\n"
+           "\t\tset output directory to <output_dir>\n\n"
+           "\t<input_image> and <output_dir> may be " PNG_STANDARD_STREAM_NAME " to read the image from stdin and write the\n"
+           "\tresult to stdout; output goes to stdout by default when the input comes from stdin\n\n"
+           "\tAn animated <input_image> (APNG) carries the string across its frames, in file order, working\n"
+           "\ton the frames in parallel; it is read from a file only and, of the encoding options below,\n"
+           "\tonly " FLAG_COMPRESS " and " FLAG_KEY " apply\n\n"
+           "\t" FLAG_BATCH " <manifest>\n"
+           "\t\tencode every <input_image> <payload_file> <output_image> line of <manifest>\n"
+           "\t\ton a thread pool sized to the cores; refuses " FLAG_BANDS ", " FLAG_IMAGE_THREADS " and " FLAG_CHANNEL " "
+           CHANNEL_NAME_CHUNK "\n\n"
+           "\t" FLAG_SCHEDULER " <scheduler>\n"
+           "\t\tbatch scheduler: " SCHEDULER_POOL " runs whole jobs on the pool, " SCHEDULER_PIPELINE " overlaps\n"
+           "\t\tread, inflate, pixel work, deflate and write of different images; defaults to " SCHEDULER_POOL "\n\n"
+           "\t" FLAG_FANOUT " <manifest>\n"
+           "\t\tencode every <payload_file> <output_image> line of <manifest> in <input_image>,\n"
+           "\t\tdecoding <input_image> only once; takes the same options as " FLAG_BATCH "\n\n"
+           "\t" FLAG_DAEMON " <socket>\n"
+           "\t\tserve requests on unix socket <socket>, keeping buffers and threads warm\n\n"
+           "\t" FLAG_CLIENT " <socket>\n"
+           "\t\tforward this encode/decode to the daemon listening on <socket>; refuses batch, fan-out and\n"
+           "\t\tper-process options, " FLAG_BANDS ", " FLAG_IMAGE_THREADS ", " FLAG_CACHE " and the " CHANNEL_NAME_CHUNK " channel\n\n"
+           "\t" FLAG_STATS " <stats_file>\n"
+           "\t\tappend time, bytes and peak buffer bytes of every stage as one JSON line per image\n\n"
+           "\t" FLAG_BACKEND " <backend>\n"
+           "\t\tdeflate backend: libdeflate, zlib-ng or zlib; defaults to the first one available\n\n"
+           "\t" FLAG_OPTIMIZE " <mode>\n"
+           "\t\twhen encoding, search filters and deflate settings for the smallest output: " PNG_OPTIMIZE_NAME_SEARCH "\n"
+           "\t\ttries every backend at level 9, " PNG_OPTIMIZE_NAME_EXHAUSTIVE " at its slowest level\n\n"
+           "\t" FLAG_INDEX " <rows>\n"
+           "\t\twhen encoding, write a seek index with a flush point every <rows> rows, so decoding\n"
+           "\t\tinflates only the rows holding the payload; compresses with zlib\n\n"
+           "\t" FLAG_CACHE " <cache_dir>\n"
+           "\t\twhen encoding, keep decoded carriers in <cache_dir> and map them instead of decoding again\n\n"
+           "\t" FLAG_CACHE_SIZE " <megabytes>\n"
+           "\t\tsize cap of the carrier cache, least recently used carriers are evicted first;\n"
+           "\t\tdefaults to %d\n\n"
+           "\t" FLAG_PAGES " <policy>\n"
+           "\t\tpages of large image buffers: " IMAGE_ARENA_PAGES_NAME_SMALL ", " IMAGE_ARENA_PAGES_NAME_TRANSPARENT
+           " (transparent huge pages) or " IMAGE_ARENA_PAGES_NAME_HUGETLB "\n"
+           "\t\t(reserved huge pages, falls back to " IMAGE_ARENA_PAGES_NAME_TRANSPARENT "); defaults to "
+           IMAGE_ARENA_PAGES_NAME_TRANSPARENT "\n\n"
+           "\t" FLAG_PREFETCH " <depth>\n"
+           "\t\tin a batch, read up to <depth> inputs ahead and write outputs in the background,\n"
+           "\t\twith at most <depth> writes in flight; up to %d\n\n"
+           "\t" FLAG_IO " <backend>\n"
+           "\t\tasynchronous I/O of " FLAG_PREFETCH ": " ASYNC_IO_BACKEND_NAME_IO_URING " or " ASYNC_IO_BACKEND_NAME_THREADS
+           " (blocking calls on <depth> threads);\n"
+           "\t\tdefaults to " ASYNC_IO_BACKEND_NAME_IO_URING " when the kernel supports it; asking for " ASYNC_IO_BACKEND_NAME_IO_URING
+           " without that support\n"
+           "\t\twarns and falls back to " ASYNC_IO_BACKEND_NAME_THREADS "\n\n"
+           "\t" FLAG_IMAGE_THREADS " <threads>\n"
+           "\t\tthreads working on one image, up to %d: with 2, rows are inflated while earlier rows\n"
+           "\t\tare unfiltered, and filtered while earlier rows are deflated, with zlib; for huge images;\n"
+           "\t\tpasses of interlaced images are unfiltered and filtered in parallel instead; defaults to 1\n\n"
+           "\t" FLAG_BANDS " <rows>\n"
+           "\t\twhen encoding, read, work on and write the image <rows> rows at a time, for images too big\n"
+           "\t\tfor memory; compresses with zlib, encoding options other than " FLAG_COMPRESS " and " FLAG_KEY " do not apply\n\n"
+           "\t" FLAG_INTERLACE " <method>\n"
+           "\t\twhen encoding, write the image " INTERLACE_NAME_NONE " or " INTERLACE_NAME_ADAM7 " interlaced; defaults to the method\n"
+           "\t\tof <input_image>; " INTERLACE_NAME_ADAM7 " output has no seek index and cannot be optimized\n\n"
+           "\t" FLAG_CHANNEL " <channel>\n"
+           "\t\twhen encoding, hide the string in the " CHANNEL_NAME_PIXELS " or put it in a private " CHANNEL_NAME_CHUNK
+           " before IEND,\n"
+           "\t\tcopying the rest of the image as it is; decoding finds the chunk by itself. Defaults to "
+           CHANNEL_NAME_PIXELS "\n\n"
+           "\t" FLAG_COMPRESS " <method>\n"
+           "\t\twhen encoding, " COMPRESS_NAME_DEFLATE " the payload before it is hidden in the pixels, so it takes fewer rows;\n"
+           "\t\tpayloads that do not shrink are hidden as they are, decoding finds out by itself. Not for the\n"
+           "\t\t" CHANNEL_NAME_CHUNK " channel; defaults to " COMPRESS_NAME_NONE "\n\n"
+           "\t" FLAG_KEY " <key_file>\n"
+           "\t\tencrypt the payload before it is hidden in the pixels with the %d byte key in <key_file>\n"
+           "\t\t(ChaCha20-Poly1305), or decrypt it when decoding; any change to the payload makes decoding fail\n\n"
+           "\t" FLAG_SCATTER " <key_file>\n"
+           "\t\thide the payload in rows picked in a pseudo-random order derived from the %d byte key in\n"
+           "\t\t<key_file> instead of top to bottom; decoding needs the same key. Not for " FLAG_BANDS ",\n"
+           "\t\tanimated images or the " CHANNEL_NAME_CHUNK " channel\n\n\n\n"
            "*note: If no usage options are used, the program defaults to decode mode;\n"
-           "       output file name is default and output is produced in current directory!\n",
-           program_name);
+           "       output file name is default and output is produced in current directory!\n"
+           "*note: The length header now holds the whole payload length. Images encoded by builds\n"
+           "       with the one byte length header are refused and need to be encoded again!\n",
+           program_name, program_name, program_name, program_name, CARRIER_CACHE_DEFAULT_MAX_MB, ASYNC_IO_MAX_DEPTH,
+           PROGRAM_INPUT_PARSER_MAX_IMAGE_THREADS, PAYLOAD_KEY_LENGTH, PAYLOAD_KEY_LENGTH);
+}
+
+// "-" names a standard stream, anything else starting with '-' is the next flag
+static inline bool is_file_argument(const char *argument)
+{
+    return strcmp(argument, PNG_STANDARD_STREAM_NAME) == 0 ||
+           (FLAG_ARGUMENT_MIN_LENGTH < strlen(argument) && strncmp(FLAG_IDENTIFICATOR, argument, FLAG_IDENTIFICATOR_LENGTH));
+}
+
+// Output names are derived from inputs given with either separator
+static inline bool is_path_separator(const char character)
+{
+    return character == OS_PATH_SEPARATOR || character == '/';
+}
+
+static inline bool is_positive_number(const char *argument, const unsigned long int max_value)
+{
+    char *end = NULL;
+    unsigned long int value = strtoul(argument, &end, 10);
+
+    return argument[0] >= '0' && argument[0] <= '9' && *end == '\0' && value > 0 && value <= max_value;
 }
 
 program_inp parse_program_input(int argc, char const *argv[])
 {
-    program_inp result = {"", "", false, "", 0};
+    program_inp result = {"", "", false, "", "", false, "", "", "", "", PNG_OPTIMIZE_OFF, 0, "", CARRIER_CACHE_DEFAULT_MAX_MB, "", "", 0, "", 1, 0, INTERLACE_METHOD_KEEP, false, false, "", "", 0};
     int valid_args_found = 1;     // starts from 1 because 0 is name of program
     bool is_input_set = false;    // m_input_name
     bool is_output_set = false;   // m_output_name
     bool is_encoding_set = false; // m_encode
+    bool is_batch_set = false;    // m_batch_manifest
+    bool is_scheduler_set = false; // m_batch_pipeline
+    bool is_daemon_set = false;    // m_daemon_socket
+    bool is_client_set = false;    // m_client_socket
+    bool is_stats_set = false;     // m_stats_name
+    bool is_backend_set = false;   // m_backend_name
+    bool is_optimize_set = false;  // m_optimize
+    bool is_index_set = false;     // m_index_band_rows
+    bool is_cache_set = false;     // m_cache_directory
+    bool is_cache_size_set = false; // m_cache_max_mb
+    bool is_fanout_set = false;     // m_fanout_manifest
+    bool is_pages_set = false;      // m_page_policy
+    bool is_prefetch_set = false;   // m_prefetch_depth
+    bool is_io_set = false;         // m_io_backend
+    bool is_image_threads_set = false; // m_image_threads
+    bool is_bands_set = false;         // m_band_rows
+    bool is_interlace_set = false;     // m_interlace
+    bool is_channel_set = false;       // m_chunk_channel
+    bool is_compress_set = false;      // m_compress
+    bool is_key_set = false;           // m_key_name
+    bool is_scatter_set = false;       // m_scatter_name
 
     char *output_name_buff = NULL;
     int image_name_len = 0;
@@ -66,8 +232,7 @@ program_inp parse_program_input(int argc, char const *argv[])
     for (int i = 1; i < argc; i += 2)
     {
         // Parse input flag
-        if (strcmp(FLAG_INPUT_FILE, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
-            strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        if (strcmp(FLAG_INPUT_FILE, argv[i]) == 0 && i + 1 < argc && is_file_argument(argv[i + 1]))
         {
             if (is_input_set == false)
             {
@@ -85,8 +250,7 @@ program_inp parse_program_input(int argc, char const *argv[])
             }
         }
         // Parse output dir flag
-        else if (strcmp(FLAG_OUTPUT_FILE, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
-                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        else if (strcmp(FLAG_OUTPUT_FILE, argv[i]) == 0 && i + 1 < argc && is_file_argument(argv[i + 1]))
         {
             if (is_output_set == false)
             {
@@ -137,10 +301,346 @@ program_inp parse_program_input(int argc, char const *argv[])
                 result.m_operation_argument = argv[i + 1];
             }
         }
+        // Parse batch flag
+        else if (strcmp(FLAG_BATCH, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
+                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        {
+            if (is_batch_set == false)
+            {
+                is_batch_set = true;
+
+                // Check for input overflow
+                if (strlen(argv[i + 1]) > PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH)
+                {
+                    break;
+                }
+
+                valid_args_found += 2;
+
+                result.m_batch_manifest = argv[i + 1];
+            }
+        }
+        // Parse batch scheduler flag
+        else if (strcmp(FLAG_SCHEDULER, argv[i]) == 0 && i + 1 < argc &&
+                 (strcmp(SCHEDULER_POOL, argv[i + 1]) == 0 || strcmp(SCHEDULER_PIPELINE, argv[i + 1]) == 0))
+        {
+            if (is_scheduler_set == false)
+            {
+                is_scheduler_set = true;
+
+                valid_args_found += 2;
+
+                result.m_batch_pipeline = strcmp(SCHEDULER_PIPELINE, argv[i + 1]) == 0;
+            }
+        }
+        // Parse daemon flag
+        else if (strcmp(FLAG_DAEMON, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
+                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        {
+            if (is_daemon_set == false)
+            {
+                is_daemon_set = true;
+
+                // Check for input overflow
+                if (strlen(argv[i + 1]) > PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH)
+                {
+                    break;
+                }
+
+                valid_args_found += 2;
+
+                result.m_daemon_socket = argv[i + 1];
+            }
+        }
+        // Parse client flag
+        else if (strcmp(FLAG_CLIENT, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
+                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        {
+            if (is_client_set == false)
+            {
+                is_client_set = true;
+
+                // Check for input overflow
+                if (strlen(argv[i + 1]) > PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH)
+                {
+                    break;
+                }
+
+                valid_args_found += 2;
+
+                result.m_client_socket = argv[i + 1];
+            }
+        }
+        // Parse stats flag
+        else if (strcmp(FLAG_STATS, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
+                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        {
+            if (is_stats_set == false)
+            {
+                is_stats_set = true;
+
+                // Check for input overflow
+                if (strlen(argv[i + 1]) > PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH)
+                {
+                    break;
+                }
+
+                valid_args_found += 2;
+
+                result.m_stats_name = argv[i + 1];
+            }
+        }
+        // Parse backend flag
+        else if (strcmp(FLAG_BACKEND, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
+                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        {
+            if (is_backend_set == false)
+            {
+                is_backend_set = true;
+
+                // Check for input overflow
+                if (strlen(argv[i + 1]) > PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH)
+                {
+                    break;
+                }
+
+                valid_args_found += 2;
+
+                result.m_backend_name = argv[i + 1];
+            }
+        }
+        // Parse optimize flag
+        else if (strcmp(FLAG_OPTIMIZE, argv[i]) == 0 && i + 1 < argc &&
+                 (strcmp(PNG_OPTIMIZE_NAME_SEARCH, argv[i + 1]) == 0 || strcmp(PNG_OPTIMIZE_NAME_EXHAUSTIVE, argv[i + 1]) == 0))
+        {
+            if (is_optimize_set == false)
+            {
+                is_optimize_set = true;
+
+                valid_args_found += 2;
+
+                result.m_optimize = strcmp(PNG_OPTIMIZE_NAME_EXHAUSTIVE, argv[i + 1]) == 0 ? PNG_OPTIMIZE_EXHAUSTIVE
+                                                                                           : PNG_OPTIMIZE_SEARCH;
+            }
+        }
+        // Parse index flag
+        else if (strcmp(FLAG_INDEX, argv[i]) == 0 && i + 1 < argc && is_positive_number(argv[i + 1], PROGRAM_INPUT_PARSER_MAX_INDEX_BAND_ROWS))
+        {
+            if (is_index_set == false)
+            {
+                is_index_set = true;
+
+                valid_args_found += 2;
+
+                result.m_index_band_rows = strtoul(argv[i + 1], NULL, 10);
+            }
+        }
+        // Parse cache flag
+        else if (strcmp(FLAG_CACHE, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
+                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        {
+            if (is_cache_set == false)
+            {
+                is_cache_set = true;
+
+                // Check for input overflow
+                if (strlen(argv[i + 1]) > PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH)
+                {
+                    break;
+                }
+
+                valid_args_found += 2;
+
+                result.m_cache_directory = argv[i + 1];
+            }
+        }
+        // Parse cache size flag
+        else if (strcmp(FLAG_CACHE_SIZE, argv[i]) == 0 && i + 1 < argc &&
+                 is_positive_number(argv[i + 1], PROGRAM_INPUT_PARSER_MAX_CACHE_MB))
+        {
+            if (is_cache_size_set == false)
+            {
+                is_cache_size_set = true;
+
+                valid_args_found += 2;
+
+                result.m_cache_max_mb = strtoul(argv[i + 1], NULL, 10);
+            }
+        }
+        // Parse fan-out flag
+        else if (strcmp(FLAG_FANOUT, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
+                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        {
+            if (is_fanout_set == false)
+            {
+                is_fanout_set = true;
+
+                // Check for input overflow
+                if (strlen(argv[i + 1]) > PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH)
+                {
+                    break;
+                }
+
+                valid_args_found += 2;
+
+                result.m_fanout_manifest = argv[i + 1];
+            }
+        }
+        // Parse page policy flag
+        else if (strcmp(FLAG_PAGES, argv[i]) == 0 && i + 1 < argc &&
+                 (strcmp(IMAGE_ARENA_PAGES_NAME_SMALL, argv[i + 1]) == 0 ||
+                  strcmp(IMAGE_ARENA_PAGES_NAME_TRANSPARENT, argv[i + 1]) == 0 ||
+                  strcmp(IMAGE_ARENA_PAGES_NAME_HUGETLB, argv[i + 1]) == 0))
+        {
+            if (is_pages_set == false)
+            {
+                is_pages_set = true;
+
+                valid_args_found += 2;
+
+                result.m_page_policy = argv[i + 1];
+            }
+        }
+        // Parse prefetch flag
+        else if (strcmp(FLAG_PREFETCH, argv[i]) == 0 && i + 1 < argc &&
+                 is_positive_number(argv[i + 1], ASYNC_IO_MAX_DEPTH))
+        {
+            if (is_prefetch_set == false)
+            {
+                is_prefetch_set = true;
+
+                valid_args_found += 2;
+
+                result.m_prefetch_depth = strtoul(argv[i + 1], NULL, 10);
+            }
+        }
+        // Parse I/O backend flag
+        else if (strcmp(FLAG_IO, argv[i]) == 0 && i + 1 < argc &&
+                 (strcmp(ASYNC_IO_BACKEND_NAME_IO_URING, argv[i + 1]) == 0 ||
+                  strcmp(ASYNC_IO_BACKEND_NAME_THREADS, argv[i + 1]) == 0))
+        {
+            if (is_io_set == false)
+            {
+                is_io_set = true;
+
+                valid_args_found += 2;
+
+                result.m_io_backend = argv[i + 1];
+            }
+        }
+        // Parse image threads flag
+        else if (strcmp(FLAG_IMAGE_THREADS, argv[i]) == 0 && i + 1 < argc &&
+                 is_positive_number(argv[i + 1], PROGRAM_INPUT_PARSER_MAX_IMAGE_THREADS))
+        {
+            if (is_image_threads_set == false)
+            {
+                is_image_threads_set = true;
+
+                valid_args_found += 2;
+
+                result.m_image_threads = strtoul(argv[i + 1], NULL, 10);
+            }
+        }
+        // Parse bands flag
+        else if (strcmp(FLAG_BANDS, argv[i]) == 0 && i + 1 < argc &&
+                 is_positive_number(argv[i + 1], PROGRAM_INPUT_PARSER_MAX_BAND_ROWS))
+        {
+            if (is_bands_set == false)
+            {
+                is_bands_set = true;
+
+                valid_args_found += 2;
+
+                result.m_band_rows = strtoul(argv[i + 1], NULL, 10);
+            }
+        }
+        // Parse interlace flag
+        else if (strcmp(FLAG_INTERLACE, argv[i]) == 0 && i + 1 < argc &&
+                 (strcmp(INTERLACE_NAME_NONE, argv[i + 1]) == 0 || strcmp(INTERLACE_NAME_ADAM7, argv[i + 1]) == 0))
+        {
+            if (is_interlace_set == false)
+            {
+                is_interlace_set = true;
+
+                valid_args_found += 2;
+
+                result.m_interlace = strcmp(INTERLACE_NAME_ADAM7, argv[i + 1]) == 0 ? INTERLACE_METHOD_ADAM7
+                                                                                   : INTERLACE_METHOD_NONE;
+            }
+        }
+        // Parse channel flag
+        else if (strcmp(FLAG_CHANNEL, argv[i]) == 0 && i + 1 < argc &&
+                 (strcmp(CHANNEL_NAME_PIXELS, argv[i + 1]) == 0 || strcmp(CHANNEL_NAME_CHUNK, argv[i + 1]) == 0))
+        {
+            if (is_channel_set == false)
+            {
+                is_channel_set = true;
+
+                valid_args_found += 2;
+
+                result.m_chunk_channel = strcmp(CHANNEL_NAME_CHUNK, argv[i + 1]) == 0;
+            }
+        }
+        // Parse compress flag
+        else if (strcmp(FLAG_COMPRESS, argv[i]) == 0 && i + 1 < argc &&
+                 (strcmp(COMPRESS_NAME_NONE, argv[i + 1]) == 0 || strcmp(COMPRESS_NAME_DEFLATE, argv[i + 1]) == 0))
+        {
+            if (is_compress_set == false)
+            {
+                is_compress_set = true;
+
+                valid_args_found += 2;
+
+                result.m_compress = strcmp(COMPRESS_NAME_DEFLATE, argv[i + 1]) == 0;
+            }
+        }
+        // Parse key flag
+        else if (strcmp(FLAG_KEY, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
+                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        {
+            if (is_key_set == false)
+            {
+                is_key_set = true;
+
+                // Check for input overflow
+                if (strlen(argv[i + 1]) > PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH)
+                {
+                    break;
+                }
+
+                valid_args_found += 2;
+
+                result.m_key_name = argv[i + 1];
+            }
+        }
+        // Parse scatter flag
+        else if (strcmp(FLAG_SCATTER, argv[i]) == 0 && i + 1 < argc && FLAG_ARGUMENT_MIN_LENGTH < strlen(argv[i + 1]) &&
+                 strncmp(FLAG_IDENTIFICATOR, argv[i + 1], FLAG_IDENTIFICATOR_LENGTH))
+        {
+            if (is_scatter_set == false)
+            {
+                is_scatter_set = true;
+
+                // Check for input overflow
+                if (strlen(argv[i + 1]) > PROGRAM_INPUT_PARSER_MAX_INPUT_LENGTH)
+                {
+                    break;
+                }
+
+                valid_args_found += 2;
+
+                result.m_scatter_name = argv[i + 1];
+            }
+        }
     }
 
     // Verification
-    if (!is_input_set)
+    if ((is_batch_set || is_daemon_set) && valid_args_found == argc)
+    {
+        // Every job of a batch or daemon request carries its own names
+        return result;
+    }
+    else if (!is_input_set)
     {
         result.m_error_code = PROGRAM_INPUT_PARSER_ERR_CODE_NO_INPUT;
         printf("[Error] Invalid usage of program! Try: %s -help\n", argv[0]);
@@ -154,6 +654,33 @@ program_inp parse_program_input(int argc, char const *argv[])
 
         return result;
     }
+    else if (is_fanout_set)
+    {
+        // Output names come from the fan-out manifest
+        result.m_encode = true;
+
+        return result;
+    }
+
+    // Standard streams have no name to derive the output name from
+    if (png_is_standard_stream(result.m_output_name) ||
+        (png_is_standard_stream(result.m_input_name) && is_output_set == false &&
+         (result.m_encode == true || strlen(result.m_operation_argument) == 0)))
+    {
+        result.m_output_name = PNG_STANDARD_STREAM_NAME;
+
+        return result;
+    }
+
+    // Output directory alone does not name the output of an image from stdin
+    if (png_is_standard_stream(result.m_input_name) && (result.m_encode == true || strlen(result.m_operation_argument) == 0))
+    {
+        result.m_error_code = PROGRAM_INPUT_PARSER_ERR_CODE_WRONG_INPUT;
+        printf("[Error] Image from %s needs %s %s%s! Try: %s -help\n", PNG_STANDARD_STREAM_NAME, FLAG_OUTPUT_FILE,
+               PNG_STANDARD_STREAM_NAME, result.m_encode == true ? "" : " or " FLAG_DECODE " <output_file_name>", argv[0]);
+
+        return result;
+    }
 
     // Parse output path
     if (strlen(result.m_operation_argument) == 0 && result.m_encode == false)
@@ -163,7 +690,7 @@ program_inp parse_program_input(int argc, char const *argv[])
         // Find output name length
         for (int i = strlen(result.m_input_name) - 1; i >= 0; i--)
         {
-            if (result.m_input_name[i] == OS_PATH_SEPARATOR)
+            if (is_path_separator(result.m_input_name[i]))
             {
                 break;
             }
@@ -203,6 +730,17 @@ program_inp parse_program_input(int argc, char const *argv[])
         // Append file name to output directory
         {
             char *temp_storage = malloc(strlen(result.m_output_name) + strlen(output_name_buff) + 1); // + 1 for NULL character
+
+            if (temp_storage == NULL)
+            {
+                free(output_name_buff);
+
+                result.m_error_code = PROGRAM_INPUT_PARSER_ERR_CODE_WRONG_INPUT;
+                printf("[Error] Invalid usage of program! Try: %s -help\n", argv[0]);
+
+                return result;
+            }
+
             sprintf(temp_storage, "%s%s", result.m_output_name, output_name_buff);
 
             result.m_output_name = temp_storage;
@@ -215,6 +753,15 @@ program_inp parse_program_input(int argc, char const *argv[])
     else if (strlen(result.m_operation_argument) > 0 && result.m_encode == false)
     {
         char *temp_storage = malloc(strlen(result.m_output_name) + strlen(result.m_operation_argument) + 1); // + 1 for NULL character
+
+        if (temp_storage == NULL)
+        {
+            result.m_error_code = PROGRAM_INPUT_PARSER_ERR_CODE_WRONG_INPUT;
+            printf("[Error] Invalid usage of program! Try: %s -help\n", argv[0]);
+
+            return result;
+        }
+
         sprintf(temp_storage, "%s%s", result.m_output_name, result.m_operation_argument);
 
         result.m_output_name = temp_storage;
@@ -225,7 +772,7 @@ program_inp parse_program_input(int argc, char const *argv[])
         // Find output name length
         for (int i = strlen(result.m_input_name) - 1; i >= 0; i--)
         {
-            if (result.m_input_name[i] == OS_PATH_SEPARATOR)
+            if (is_path_separator(result.m_input_name[i]))
             {
                 break;
             }
@@ -265,6 +812,17 @@ program_inp parse_program_input(int argc, char const *argv[])
         // Append file name to output directory
         {
             char *temp_storage = malloc(strlen(result.m_output_name) + strlen(output_name_buff) + 1); // + 1 for NULL character
+
+            if (temp_storage == NULL)
+            {
+                free(output_name_buff);
+
+                result.m_error_code = PROGRAM_INPUT_PARSER_ERR_CODE_WRONG_INPUT;
+                printf("[Error] Invalid usage of program! Try: %s -help\n", argv[0]);
+
+                return result;
+            }
+
             sprintf(temp_storage, "%s%s", result.m_output_name, output_name_buff);
 
             result.m_output_name = temp_storage;
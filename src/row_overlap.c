@@ -0,0 +1,396 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "../inc/row_overlap.h"
+#include "../inc/png_filtration.h"
+#include "../inc/deflate_backend.h"
+#include "../inc/image_arena.h"
+
+/**
+ * @brief Lock-free single producer, single consumer ring of rows
+ *
+ * Each counter is written by one side only. Rows are published with release
+ * and picked up with acquire, in both directions, so the data of a row is
+ * visible before its counter moves.
+ */
+typedef struct
+{
+    unsigned char *m_rows;
+    size_t m_row_length;
+    uint32_t m_capacity;
+    uint32_t m_row_count;
+
+    atomic_uint m_produced;
+    atomic_uint m_consumed;
+    atomic_bool m_is_failed;
+
+} row_ring;
+
+/**
+ * @brief Work of the helper thread
+ *
+ * Inflating uses the compressed stream, filtering uses the image and scratch rows.
+ */
+typedef struct
+{
+    row_ring *m_ring;
+    IHDR_chunk m_ihdr;
+
+    const unsigned char *m_compressed_data;
+    unsigned long int m_compressed_data_length;
+
+    RGBA_pixel **m_image;
+    const RGBA_pixel *m_zero_row;
+    unsigned char *m_scratch;
+
+} overlap_task;
+
+// Ring functions
+
+static bool ring_init(row_ring *ring, const size_t row_length, const uint32_t row_count)
+{
+    uint32_t capacity = ROW_OVERLAP_RING_BYTES / row_length;
+
+    // Room for two steps at least, so both sides can work at once
+    if (capacity < 2 * ROW_OVERLAP_STEP_ROWS)
+    {
+        capacity = 2 * ROW_OVERLAP_STEP_ROWS;
+    }
+
+    ring->m_capacity = capacity < row_count ? capacity : row_count;
+    ring->m_row_length = row_length;
+    ring->m_row_count = row_count;
+    ring->m_rows = (unsigned char *)image_alloc(ring->m_capacity * row_length);
+
+    atomic_init(&ring->m_produced, 0);
+    atomic_init(&ring->m_consumed, 0);
+    atomic_init(&ring->m_is_failed, false);
+
+    return ring->m_rows != NULL;
+}
+
+static inline void wait_for_other_side(unsigned int *spins)
+{
+    // One core has to be handed over, more cores only cost a short spin
+    if (++(*spins) >= ROW_OVERLAP_SPIN_COUNT)
+    {
+        sched_yield();
+    }
+}
+
+static inline uint32_t min_rows(const uint32_t a, const uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+static unsigned char *ring_reserve(row_ring *ring, uint32_t *count)
+{
+    uint32_t produced = atomic_load_explicit(&ring->m_produced, memory_order_relaxed);
+    uint32_t slot = produced % ring->m_capacity;
+    uint32_t free_rows = 0;
+    unsigned int spins = 0;
+
+    while ((free_rows = ring->m_capacity - (produced - atomic_load_explicit(&ring->m_consumed, memory_order_acquire))) == 0)
+    {
+        if (atomic_load_explicit(&ring->m_is_failed, memory_order_relaxed) == true)
+        {
+            return NULL;
+        }
+
+        wait_for_other_side(&spins);
+    }
+
+    // Rows of one reservation are contiguous, so it stops at the end of the ring
+    *count = min_rows(min_rows(ROW_OVERLAP_STEP_ROWS, free_rows),
+                      min_rows(ring->m_capacity - slot, ring->m_row_count - produced));
+
+    return &ring->m_rows[slot * ring->m_row_length];
+}
+
+static void ring_publish(row_ring *ring, const uint32_t count)
+{
+    atomic_fetch_add_explicit(&ring->m_produced, count, memory_order_release);
+}
+
+static const unsigned char *ring_peek(row_ring *ring, uint32_t *count)
+{
+    uint32_t consumed = atomic_load_explicit(&ring->m_consumed, memory_order_relaxed);
+    uint32_t slot = consumed % ring->m_capacity;
+    uint32_t ready_rows = 0;
+    unsigned int spins = 0;
+
+    while ((ready_rows = atomic_load_explicit(&ring->m_produced, memory_order_acquire) - consumed) == 0)
+    {
+        if (atomic_load_explicit(&ring->m_is_failed, memory_order_relaxed) == true)
+        {
+            return NULL;
+        }
+
+        wait_for_other_side(&spins);
+    }
+
+    *count = min_rows(ready_rows, ring->m_capacity - slot);
+
+    return &ring->m_rows[slot * ring->m_row_length];
+}
+
+static void ring_release(row_ring *ring, const uint32_t count)
+{
+    atomic_fetch_add_explicit(&ring->m_consumed, count, memory_order_release);
+}
+
+// Either side giving up lets the other one stop waiting
+static void ring_fail(row_ring *ring)
+{
+    atomic_store(&ring->m_is_failed, true);
+}
+
+// Helper threads
+
+static void *inflate_rows(void *argument)
+{
+    overlap_task *task = (overlap_task *)argument;
+    row_ring *ring = task->m_ring;
+    unsigned long int produced_length = 0;
+    unsigned char *rows = NULL;
+    uint32_t count = 0;
+    bool is_end = false;
+
+    if (deflate_backend_inflate_start(task->m_compressed_data, task->m_compressed_data_length) == false)
+    {
+        ring_fail(ring);
+        return NULL;
+    }
+
+    for (uint32_t row = 0; row < ring->m_row_count; row += count)
+    {
+        rows = ring_reserve(ring, &count);
+
+        if (rows == NULL)
+        {
+            return NULL;
+        }
+
+        // Stream ending before the last row is as broken as one that does not inflate
+        if (deflate_backend_inflate_next(rows, count * ring->m_row_length, &produced_length, &is_end) == false ||
+            produced_length != count * ring->m_row_length)
+        {
+            ring_fail(ring);
+            return NULL;
+        }
+
+        ring_publish(ring, count);
+    }
+
+    return NULL;
+}
+
+static void *filter_rows(void *argument)
+{
+    overlap_task *task = (overlap_task *)argument;
+    row_ring *ring = task->m_ring;
+    unsigned char *rows = NULL;
+    uint32_t count = 0;
+
+    for (uint32_t row = 0; row < ring->m_row_count; row += count)
+    {
+        rows = ring_reserve(ring, &count);
+
+        if (rows == NULL)
+        {
+            return NULL;
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const RGBA_pixel *previous_row = row + i == 0 ? task->m_zero_row : task->m_image[row + i - 1];
+
+            if (filter_rgba_row(task->m_image[row + i], previous_row, task->m_scratch, &rows[i * ring->m_row_length],
+                                task->m_ihdr) == false)
+            {
+                ring_fail(ring);
+                return NULL;
+            }
+        }
+
+        ring_publish(ring, count);
+    }
+
+    return NULL;
+}
+
+// Header defined functions
+
+RGBA_pixel **row_overlap_unfilter(const IHDR_chunk ihdr, const unsigned char *const compressed_data,
+                                  const unsigned long int compressed_data_length, unsigned char *const filter_types)
+{
+    size_t row_length = png_row_size(ihdr) + 1;
+    row_ring ring;
+    overlap_task task = {&ring, ihdr, compressed_data, compressed_data_length, NULL, NULL, NULL};
+    pthread_t helper;
+    RGBA_pixel **result = NULL;
+    RGBA_pixel *zero_row = NULL;
+    uint32_t row = 0;
+    uint32_t count = 0;
+    bool is_ok = true;
+
+    if (png_is_supported(ihdr) == false || ihdr.m_interlace_method != INTERLACE_METHOD_NONE)
+    {
+        return NULL;
+    }
+
+    // Everything is taken here, the helper thread has no arena bound
+    result = alloc_rgba_png(ihdr, ihdr.m_height);
+    zero_row = (RGBA_pixel *)image_alloc(row_length - 1);
+
+    if (result == NULL || zero_row == NULL || ring_init(&ring, row_length, ihdr.m_height) == false)
+    {
+        free_rgba_png(result);
+        image_free(zero_row);
+        return NULL;
+    }
+
+    // The row before first is 0 by specifiaction
+    memset(zero_row, 0, row_length - 1);
+
+    if (pthread_create(&helper, NULL, inflate_rows, &task) != 0)
+    {
+        image_free(ring.m_rows);
+        image_free(zero_row);
+        free_rgba_png(result);
+        return NULL;
+    }
+
+    // Unfilter rows as they are inflated
+    while (is_ok == true && row < ihdr.m_height)
+    {
+        const unsigned char *rows = ring_peek(&ring, &count);
+
+        if (rows == NULL)
+        {
+            break;
+        }
+
+        for (uint32_t i = 0; i < count && is_ok == true; i++)
+        {
+            is_ok = unfilter_rgba_row(&rows[i * row_length], row == 0 ? zero_row : result[row - 1], result[row], ihdr);
+
+            if (is_ok == true && filter_types != NULL)
+            {
+                filter_types[row] = rows[i * row_length];
+            }
+
+            row += is_ok ? 1 : 0;
+        }
+
+        ring_release(&ring, count);
+    }
+
+    if (row < ihdr.m_height)
+    {
+        ring_fail(&ring);
+    }
+
+    pthread_join(helper, NULL);
+
+    image_free(ring.m_rows);
+    image_free(zero_row);
+
+    if (row < ihdr.m_height)
+    {
+        free_rgba_png(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+unsigned char *row_overlap_filter(const IHDR_chunk ihdr, RGBA_pixel **image, unsigned long int *compressed_data_length)
+{
+    size_t row_length = png_row_size(ihdr) + 1;
+    unsigned long int capacity = 0;
+    row_ring ring;
+    overlap_task task = {&ring, ihdr, NULL, 0, image, NULL, NULL};
+    pthread_t helper;
+    unsigned char *result = NULL;
+    RGBA_pixel *zero_row = NULL;
+    unsigned char *scratch = NULL;
+    uint32_t row = 0;
+    uint32_t count = 0;
+
+    *compressed_data_length = 0;
+
+    if (png_is_supported(ihdr) == false || ihdr.m_interlace_method != INTERLACE_METHOD_NONE)
+    {
+        return NULL;
+    }
+
+    // Stream is always zlib, so is its bound
+    capacity = deflate_backend_get(DEFLATE_BACKEND_ZLIB)->m_bound(row_length * ihdr.m_height);
+
+    result = (unsigned char *)image_alloc(capacity);
+    zero_row = (RGBA_pixel *)image_alloc(row_length - 1);
+    scratch = (unsigned char *)image_alloc(row_length);
+
+    if (result == NULL || zero_row == NULL || scratch == NULL || ring_init(&ring, row_length, ihdr.m_height) == false)
+    {
+        image_free(result);
+        image_free(zero_row);
+        image_free(scratch);
+        return NULL;
+    }
+
+    memset(zero_row, 0, row_length - 1);
+
+    task.m_zero_row = zero_row;
+    task.m_scratch = scratch;
+
+    if (deflate_backend_deflate_start(result, capacity, DEFLATE_LEVEL_DEFAULT) == false ||
+        pthread_create(&helper, NULL, filter_rows, &task) != 0)
+    {
+        image_free(ring.m_rows);
+        image_free(zero_row);
+        image_free(scratch);
+        image_free(result);
+        return NULL;
+    }
+
+    // Deflate rows as they are filtered
+    while (row < ihdr.m_height)
+    {
+        const unsigned char *rows = ring_peek(&ring, &count);
+
+        if (rows == NULL ||
+            deflate_backend_deflate_next(rows, count * row_length, row + count == ihdr.m_height, compressed_data_length) == false)
+        {
+            break;
+        }
+
+        row += count;
+        ring_release(&ring, count);
+    }
+
+    if (row < ihdr.m_height)
+    {
+        ring_fail(&ring);
+    }
+
+    pthread_join(helper, NULL);
+
+    image_free(ring.m_rows);
+    image_free(zero_row);
+    image_free(scratch);
+
+    if (row < ihdr.m_height)
+    {
+        image_free(result);
+        *compressed_data_length = 0;
+        return NULL;
+    }
+
+    return result;
+}
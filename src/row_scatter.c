@@ -0,0 +1,98 @@
+#include <stdlib.h>
+
+#include "../inc/row_scatter.h"
+#include "../inc/payload_cipher.h"
+#include "../inc/image_arena.h"
+
+#define BITS_IN_BYTE 8
+#define BITS_IN_HALF 32
+
+// splitmix64 finalizer, every input bit reaches every output bit
+static inline uint64_t mix64(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+
+    return x ^ (x >> 31);
+}
+
+// Bits of the halves of the network, together they cover every row number below height
+static inline uint32_t half_bits(const uint32_t height)
+{
+    uint32_t bits = 0;
+
+    while (bits < BITS_IN_HALF && ((height - 1) >> bits) != 0)
+    {
+        bits++;
+    }
+
+    return bits < 2 ? 1 : (bits + 1) / 2;
+}
+
+// Permutation of all numbers of 2 * bits bits
+static inline uint64_t feistel(const row_scatter *scatter, const uint32_t bits, const uint64_t value)
+{
+    const uint64_t mask = (1ull << bits) - 1;
+    uint64_t left = value >> bits;
+    uint64_t right = value & mask;
+
+    for (int round = 0; round < ROW_SCATTER_ROUNDS; round++)
+    {
+        uint64_t next = left ^ (mix64(right ^ scatter->m_round_keys[round]) & mask);
+
+        left = right;
+        right = next;
+    }
+
+    return (left << bits) | right;
+}
+
+// Header defined functions
+
+void row_scatter_init(row_scatter *scatter, const unsigned char *const key)
+{
+    for (int round = 0; round < ROW_SCATTER_ROUNDS; round++)
+    {
+        uint64_t word = 0;
+
+        // Key words lowest byte first, numbered so equal words give different rounds
+        for (int i = sizeof(uint64_t) - 1; i >= 0; i--)
+        {
+            word = (word << BITS_IN_BYTE) | key[(round * sizeof(uint64_t) + i) % PAYLOAD_KEY_LENGTH];
+        }
+
+        scatter->m_round_keys[round] = mix64(word + (uint64_t)round);
+    }
+}
+
+uint32_t row_scatter_row(const row_scatter *scatter, const uint32_t height, const uint32_t index)
+{
+    uint32_t bits = half_bits(height);
+    uint64_t result = index;
+
+    // Cycle walking: the network permutes a range under four times the height, step again until back inside
+    do
+    {
+        result = feistel(scatter, bits, result);
+    } while (result >= height);
+
+    return (uint32_t)result;
+}
+
+RGBA_pixel **row_scatter_view(const row_scatter *scatter, RGBA_pixel **const image, const uint32_t height,
+                              const uint32_t row_count)
+{
+    RGBA_pixel **result = (RGBA_pixel **)image_alloc((row_count > 0 ? row_count : 1) * sizeof(RGBA_pixel *));
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < row_count; i++)
+    {
+        result[i] = image[row_scatter_row(scatter, height, i)];
+    }
+
+    return result;
+}
@@ -0,0 +1,409 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../inc/thread_pool.h"
+
+/**
+ * @brief Single task entry
+ */
+typedef struct
+{
+    thread_pool_task m_task;
+    void *m_argument;
+    thread_pool_group *m_group;
+
+} pool_task;
+
+/**
+ * @brief Per-worker double ended queue
+ *
+ * m_top is the steal end, m_bottom is the owner end.
+ * Both grow monotonically and are wrapped by m_capacity.
+ */
+typedef struct
+{
+    pthread_mutex_t m_lock;
+    pool_task *m_tasks;
+    size_t m_capacity;
+    size_t m_top;
+    size_t m_bottom;
+
+} pool_deque;
+
+struct thread_pool
+{
+    pthread_t m_threads[THREAD_POOL_MAX_WORKERS];
+    pool_deque m_deques[THREAD_POOL_MAX_WORKERS];
+    size_t m_worker_count;
+
+    atomic_size_t m_queued;
+    atomic_size_t m_next_deque;
+
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_work_cond;
+    pthread_cond_t m_done_cond;
+    bool m_stop;
+};
+
+/**
+ * @brief Worker start argument
+ */
+typedef struct
+{
+    thread_pool *m_pool;
+    int m_index;
+
+} worker_start;
+
+// Thread local worker identity
+static _Thread_local int g_worker_index = -1;
+static _Thread_local thread_pool *g_worker_pool = NULL;
+
+// Deque functions
+
+static bool deque_init(pool_deque *deque)
+{
+    deque->m_tasks = (pool_task *)malloc(THREAD_POOL_DEQUE_INITIAL_CAPACITY * sizeof(pool_task));
+
+    if (deque->m_tasks == NULL)
+    {
+        return false;
+    }
+
+    deque->m_capacity = THREAD_POOL_DEQUE_INITIAL_CAPACITY;
+    deque->m_top = 0;
+    deque->m_bottom = 0;
+
+    pthread_mutex_init(&deque->m_lock, NULL);
+
+    return true;
+}
+
+static void deque_free(pool_deque *deque)
+{
+    pthread_mutex_destroy(&deque->m_lock);
+    free(deque->m_tasks);
+}
+
+static bool deque_push_bottom(pool_deque *deque, const pool_task task)
+{
+    pthread_mutex_lock(&deque->m_lock);
+
+    // Grow storage when full, keeping task order
+    if (deque->m_bottom - deque->m_top == deque->m_capacity)
+    {
+        pool_task *grown = (pool_task *)malloc(deque->m_capacity * 2 * sizeof(pool_task));
+
+        if (grown == NULL)
+        {
+            pthread_mutex_unlock(&deque->m_lock);
+            return false;
+        }
+
+        for (size_t i = deque->m_top; i < deque->m_bottom; i++)
+        {
+            grown[i % (deque->m_capacity * 2)] = deque->m_tasks[i % deque->m_capacity];
+        }
+
+        free(deque->m_tasks);
+        deque->m_tasks = grown;
+        deque->m_capacity *= 2;
+    }
+
+    deque->m_tasks[deque->m_bottom % deque->m_capacity] = task;
+    deque->m_bottom++;
+
+    pthread_mutex_unlock(&deque->m_lock);
+
+    return true;
+}
+
+static bool deque_pop_bottom(pool_deque *deque, pool_task *task)
+{
+    bool result = false;
+
+    pthread_mutex_lock(&deque->m_lock);
+
+    if (deque->m_bottom != deque->m_top)
+    {
+        deque->m_bottom--;
+        *task = deque->m_tasks[deque->m_bottom % deque->m_capacity];
+        result = true;
+    }
+
+    pthread_mutex_unlock(&deque->m_lock);
+
+    return result;
+}
+
+static bool deque_steal_top(pool_deque *deque, pool_task *task)
+{
+    bool result = false;
+
+    // Do not wait on a busy victim, try the next one instead
+    if (pthread_mutex_trylock(&deque->m_lock) != 0)
+    {
+        return false;
+    }
+
+    if (deque->m_bottom != deque->m_top)
+    {
+        *task = deque->m_tasks[deque->m_top % deque->m_capacity];
+        deque->m_top++;
+        result = true;
+    }
+
+    pthread_mutex_unlock(&deque->m_lock);
+
+    return result;
+}
+
+// Scheduling functions
+
+static bool find_task(thread_pool *pool, int own_index, pool_task *task)
+{
+    // Own deque first
+    if (own_index >= 0 && deque_pop_bottom(&pool->m_deques[own_index], task))
+    {
+        return true;
+    }
+
+    // Steal from the others, starting next to own deque
+    size_t start = own_index >= 0 ? (size_t)own_index + 1 : 0;
+
+    for (size_t i = 0; i < pool->m_worker_count; i++)
+    {
+        size_t victim = (start + i) % pool->m_worker_count;
+
+        if ((int)victim != own_index && deque_steal_top(&pool->m_deques[victim], task))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void run_task(thread_pool *pool, const pool_task task)
+{
+    atomic_fetch_sub(&pool->m_queued, 1);
+
+    task.m_task(task.m_argument);
+
+    // Wake waiters when the last task of a group finishes
+    if (task.m_group != NULL && atomic_fetch_sub(&task.m_group->m_pending, 1) == 1)
+    {
+        pthread_mutex_lock(&pool->m_lock);
+        pthread_cond_broadcast(&pool->m_done_cond);
+        pthread_mutex_unlock(&pool->m_lock);
+    }
+}
+
+static void *worker_main(void *argument)
+{
+    worker_start *start = (worker_start *)argument;
+    thread_pool *pool = start->m_pool;
+    pool_task task;
+
+    g_worker_index = start->m_index;
+    g_worker_pool = pool;
+
+    free(start);
+
+    while (true)
+    {
+        if (find_task(pool, g_worker_index, &task))
+        {
+            run_task(pool, task);
+            continue;
+        }
+
+        // Sleep until something is queued or pool is stopped
+        pthread_mutex_lock(&pool->m_lock);
+
+        while (atomic_load(&pool->m_queued) == 0 && pool->m_stop == false)
+        {
+            pthread_cond_wait(&pool->m_work_cond, &pool->m_lock);
+        }
+
+        if (atomic_load(&pool->m_queued) == 0 && pool->m_stop == true)
+        {
+            pthread_mutex_unlock(&pool->m_lock);
+            break;
+        }
+
+        pthread_mutex_unlock(&pool->m_lock);
+    }
+
+    return NULL;
+}
+
+// Header defined functions
+
+thread_pool *thread_pool_create(size_t worker_count)
+{
+    thread_pool *pool = NULL;
+
+    // Size to the online cores if not given
+    if (worker_count == 0)
+    {
+        long int cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cores > 0 ? (size_t)cores : 1;
+    }
+
+    if (worker_count > THREAD_POOL_MAX_WORKERS)
+    {
+        worker_count = THREAD_POOL_MAX_WORKERS;
+    }
+
+    pool = (thread_pool *)calloc(1, sizeof(thread_pool));
+
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->m_lock, NULL);
+    pthread_cond_init(&pool->m_work_cond, NULL);
+    pthread_cond_init(&pool->m_done_cond, NULL);
+    atomic_init(&pool->m_queued, 0);
+    atomic_init(&pool->m_next_deque, 0);
+
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        if (deque_init(&pool->m_deques[i]) == false)
+        {
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+
+        worker_start *start = (worker_start *)malloc(sizeof(worker_start));
+
+        if (start == NULL)
+        {
+            deque_free(&pool->m_deques[i]);
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+
+        start->m_pool = pool;
+        start->m_index = i;
+
+        if (pthread_create(&pool->m_threads[i], NULL, worker_main, start) != 0)
+        {
+            free(start);
+            deque_free(&pool->m_deques[i]);
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+
+        pool->m_worker_count++;
+    }
+
+    return pool;
+}
+
+bool thread_pool_submit(thread_pool *pool, thread_pool_group *group, thread_pool_task task, void *argument)
+{
+    pool_task entry = {task, argument, group};
+    size_t target = 0;
+
+    // Own deque for workers of this pool, round-robin for everybody else
+    if (g_worker_pool == pool && g_worker_index >= 0)
+    {
+        target = g_worker_index;
+    }
+    else
+    {
+        target = atomic_fetch_add(&pool->m_next_deque, 1) % pool->m_worker_count;
+    }
+
+    if (group != NULL)
+    {
+        atomic_fetch_add(&group->m_pending, 1);
+    }
+
+    atomic_fetch_add(&pool->m_queued, 1);
+
+    if (deque_push_bottom(&pool->m_deques[target], entry) == false)
+    {
+        atomic_fetch_sub(&pool->m_queued, 1);
+
+        if (group != NULL)
+        {
+            atomic_fetch_sub(&group->m_pending, 1);
+        }
+
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->m_lock);
+    pthread_cond_signal(&pool->m_work_cond);
+    pthread_cond_broadcast(&pool->m_done_cond);
+    pthread_mutex_unlock(&pool->m_lock);
+
+    return true;
+}
+
+void thread_pool_wait(thread_pool *pool, thread_pool_group *group)
+{
+    pool_task task;
+    int own_index = g_worker_pool == pool ? g_worker_index : -1;
+
+    while (atomic_load(&group->m_pending) > 0)
+    {
+        // Help with pending work instead of blocking
+        if (find_task(pool, own_index, &task))
+        {
+            run_task(pool, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->m_lock);
+
+        if (atomic_load(&group->m_pending) > 0 && atomic_load(&pool->m_queued) == 0)
+        {
+            pthread_cond_wait(&pool->m_done_cond, &pool->m_lock);
+        }
+
+        pthread_mutex_unlock(&pool->m_lock);
+    }
+}
+
+size_t thread_pool_size(const thread_pool *pool)
+{
+    return pool->m_worker_count;
+}
+
+int thread_pool_worker_index()
+{
+    return g_worker_index;
+}
+
+void thread_pool_destroy(thread_pool *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->m_lock);
+    pool->m_stop = true;
+    pthread_cond_broadcast(&pool->m_work_cond);
+    pthread_mutex_unlock(&pool->m_lock);
+
+    for (size_t i = 0; i < pool->m_worker_count; i++)
+    {
+        pthread_join(pool->m_threads[i], NULL);
+        deque_free(&pool->m_deques[i]);
+    }
+
+    pthread_mutex_destroy(&pool->m_lock);
+    pthread_cond_destroy(&pool->m_work_cond);
+    pthread_cond_destroy(&pool->m_done_cond);
+
+    free(pool);
+}
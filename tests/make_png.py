@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Write small PNG and APNG carriers for the tests, and list chunks of a PNG.
+
+    make_png.py still <path> <width> <height> [<bit_depth> <color_type>]
+    make_png.py animated <path> <width> <height> <frames>
+    make_png.py chunks <path>
+
+Carriers are noise with a tEXt chunk before the image data, 8 bit RGBA unless
+a still carrier is given another bit depth and color type.
+"""
+
+import random
+import struct
+import sys
+import zlib
+
+SIGNATURE = b"\x89PNG\r\n\x1a\n"
+
+# Samples per pixel of each color type
+CHANNELS = {0: 1, 2: 3, 4: 2, 6: 4}
+
+
+def chunk(chunk_type, data):
+    return struct.pack(">I", len(data)) + chunk_type + data + struct.pack(">I", zlib.crc32(chunk_type + data))
+
+
+def image_data(rng, width, height, depth=8, color_type=6):
+    row_bytes = width * CHANNELS[color_type] * depth // 8
+    rows = (b"\x00" + bytes(rng.randrange(256) for _ in range(row_bytes)) for _ in range(height))
+    return zlib.compress(b"".join(rows))
+
+
+def header(width, height, depth=8, color_type=6):
+    return SIGNATURE + chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, depth, color_type, 0, 0, 0)) + \
+        chunk(b"tEXt", b"Comment\x00kept by the encoder")
+
+
+def still(path, width, height, depth=8, color_type=6):
+    rng = random.Random(1)
+    data = header(width, height, depth, color_type) + \
+        chunk(b"IDAT", image_data(rng, width, height, depth, color_type)) + chunk(b"IEND", b"")
+
+    with open(path, "wb") as fp:
+        fp.write(data)
+
+
+def animated(path, width, height, frames):
+    rng = random.Random(2)
+    data = header(width, height) + chunk(b"acTL", struct.pack(">II", frames, 0))
+    sequence = 0
+
+    for frame in range(frames):
+        data += chunk(b"fcTL", struct.pack(">IIIIIHHBB", sequence, width, height, 0, 0, 1, 10, 0, 0))
+        sequence += 1
+
+        if frame == 0:
+            data += chunk(b"IDAT", image_data(rng, width, height))
+        else:
+            data += chunk(b"fdAT", struct.pack(">I", sequence) + image_data(rng, width, height))
+            sequence += 1
+
+    with open(path, "wb") as fp:
+        fp.write(data + chunk(b"IEND", b""))
+
+
+def chunks(path):
+    with open(path, "rb") as fp:
+        data = fp.read()
+
+    position = len(SIGNATURE)
+
+    while position < len(data):
+        length, = struct.unpack(">I", data[position:position + 4])
+        print(data[position + 4:position + 8].decode("latin-1"))
+        position += length + 12
+
+
+if __name__ == "__main__":
+    if sys.argv[1] == "still":
+        still(sys.argv[2], *(int(argument) for argument in sys.argv[3:7]))
+    elif sys.argv[1] == "animated":
+        animated(sys.argv[2], int(sys.argv[3]), int(sys.argv[4]), int(sys.argv[5]))
+    else:
+        chunks(sys.argv[2])
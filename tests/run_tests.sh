@@ -0,0 +1,307 @@
+#!/bin/sh
+# End to end tests of the steg executable
+#
+#   tests/run_tests.sh <steg_executable>
+#
+# Needs python3 for the carriers. Exits non-zero if any test fails.
+
+STEG=$(realpath "$1")
+TESTS=$(dirname "$(realpath "$0")")
+WORK=$(mktemp -d)
+FAILED=0
+
+trap 'rm -rf "$WORK"' EXIT
+
+pass() { echo "[PASS] $1"; }
+fail() { echo "[FAIL] $1"; FAILED=1; }
+
+make_png() { python3 "$TESTS/make_png.py" "$@"; }
+
+# Encode text into image, output lands in $WORK/out/ under the image name; options follow the text
+encode()
+{
+    image=$1
+    text=$2
+    shift 2
+    mkdir -p "$WORK/out"
+    "$STEG" -i "$image" -e "$text" -o "$WORK/out/" "$@" > /dev/null 2>&1
+}
+
+# Print text decoded from image, nothing if decoding fails; options follow the image
+decode()
+{
+    image=$1
+    shift
+    rm -f "$WORK/decoded"
+    "$STEG" -i "$image" -d decoded -o "$WORK/" "$@" > /dev/null 2>&1 && cat "$WORK/decoded"
+}
+
+# Batch jobs go through the stages, which refuse animated carriers instead of dropping their frames
+test_batch_refuses_animated_carrier()
+{
+    make_png still "$WORK/still.png" 40 30
+    make_png animated "$WORK/anim.png" 40 30 3
+    echo "batch payload" > "$WORK/payload.txt"
+    printf '%s\n%s\n' "$WORK/still.png $WORK/payload.txt $WORK/still_out.png" \
+        "$WORK/anim.png $WORK/payload.txt $WORK/anim_out.png" > "$WORK/manifest.txt"
+
+    "$STEG" -b "$WORK/manifest.txt" > "$WORK/batch.log" 2>&1
+    status=$?
+
+    if [ $status -ne 0 ] && [ -f "$WORK/still_out.png" ] && [ ! -f "$WORK/anim_out.png" ] &&
+        grep -q "1 failed" "$WORK/batch.log"; then
+        pass "batch refuses animated carrier"
+    else
+        fail "batch refuses animated carrier"
+    fi
+}
+
+test_fanout_refuses_animated_carrier()
+{
+    make_png animated "$WORK/anim.png" 40 30 3
+    echo "fan-out payload" > "$WORK/payload.txt"
+    echo "$WORK/payload.txt $WORK/fan_out.png" > "$WORK/fanout.txt"
+
+    if ! "$STEG" -i "$WORK/anim.png" -fanout "$WORK/fanout.txt" > "$WORK/fanout.log" 2>&1 &&
+        [ ! -f "$WORK/fan_out.png" ]; then
+        pass "fan-out refuses animated carrier"
+    else
+        fail "fan-out refuses animated carrier"
+    fi
+}
+
+# Ancillary chunks of an animated carrier survive encoding next to the rewritten frames
+test_animated_output_keeps_ancillary_chunks()
+{
+    make_png animated "$WORK/anim.png" 40 30 3
+    mkdir -p "$WORK/anim_out"
+
+    "$STEG" -i "$WORK/anim.png" -e "animated payload" -o "$WORK/anim_out/" > /dev/null 2>&1 &&
+        "$STEG" -i "$WORK/anim_out/anim.png" -d decoded -o "$WORK/anim_out/" > /dev/null 2>&1
+
+    if [ "$(make_png chunks "$WORK/anim_out/anim.png" | grep -c tEXt)" = 1 ] &&
+        [ "$(make_png chunks "$WORK/anim_out/anim.png" | grep -c fdAT)" = 2 ] &&
+        [ "$(cat "$WORK/anim_out/decoded" 2> /dev/null)" = "animated payload" ]; then
+        pass "animated output keeps ancillary chunks"
+    else
+        fail "animated output keeps ancillary chunks"
+    fi
+}
+
+# Every job of a batch and of a fan-out decodes to its own payload
+test_batch_and_fanout_round_trip()
+{
+    make_png still "$WORK/batch_carrier.png" 40 30
+    mkdir -p "$WORK/batch"
+    echo "first payload" > "$WORK/batch/first.txt"
+    echo "second payload" > "$WORK/batch/second.txt"
+    printf '%s\n%s\n' "$WORK/batch_carrier.png $WORK/batch/first.txt $WORK/batch/first.png" \
+        "$WORK/batch_carrier.png $WORK/batch/second.txt $WORK/batch/second.png" > "$WORK/batch/manifest.txt"
+    printf '%s\n%s\n' "$WORK/batch/first.txt $WORK/batch/fan_first.png" \
+        "$WORK/batch/second.txt $WORK/batch/fan_second.png" > "$WORK/batch/fanout.txt"
+
+    if "$STEG" -b "$WORK/batch/manifest.txt" > /dev/null 2>&1 &&
+        "$STEG" -i "$WORK/batch_carrier.png" -fanout "$WORK/batch/fanout.txt" > /dev/null 2>&1 &&
+        [ "$(decode "$WORK/batch/first.png")" = "first payload" ] &&
+        [ "$(decode "$WORK/batch/second.png")" = "second payload" ] &&
+        [ "$(decode "$WORK/batch/fan_first.png")" = "first payload" ] &&
+        [ "$(decode "$WORK/batch/fan_second.png")" = "second payload" ]; then
+        pass "batch and fan-out round trip"
+    else
+        fail "batch and fan-out round trip"
+    fi
+}
+
+# Encrypted payload decodes with its key only
+test_key_round_trip()
+{
+    make_png still "$WORK/key_carrier.png" 40 30
+    head -c 32 /dev/urandom > "$WORK/right.key"
+    head -c 32 /dev/urandom > "$WORK/wrong.key"
+
+    if encode "$WORK/key_carrier.png" "keyed payload" -key "$WORK/right.key" &&
+        [ "$(decode "$WORK/out/key_carrier.png" -key "$WORK/right.key")" = "keyed payload" ] &&
+        [ -z "$(decode "$WORK/out/key_carrier.png" -key "$WORK/wrong.key")" ] &&
+        [ -z "$(decode "$WORK/out/key_carrier.png")" ]; then
+        pass "key round trip, wrong and missing key refused"
+    else
+        fail "key round trip, wrong and missing key refused"
+    fi
+}
+
+# Deflated payload decodes and is hidden differently from the plain one
+test_compress_round_trip()
+{
+    make_png still "$WORK/compress_carrier.png" 40 30
+    text=$(printf 'compressible %.0s' $(seq 1 15))
+
+    if encode "$WORK/compress_carrier.png" "$text" &&
+        mv "$WORK/out/compress_carrier.png" "$WORK/plain.png" &&
+        encode "$WORK/compress_carrier.png" "$text" -compress deflate &&
+        ! cmp -s "$WORK/plain.png" "$WORK/out/compress_carrier.png" &&
+        [ "$(decode "$WORK/out/compress_carrier.png")" = "$text" ]; then
+        pass "compress round trip"
+    else
+        fail "compress round trip"
+    fi
+}
+
+# Scattered payload decodes with its scatter key only
+test_scatter_round_trip()
+{
+    make_png still "$WORK/scatter_carrier.png" 40 30
+    head -c 32 /dev/urandom > "$WORK/scatter.key"
+    head -c 32 /dev/urandom > "$WORK/other_scatter.key"
+
+    if encode "$WORK/scatter_carrier.png" "scattered payload" -scatter "$WORK/scatter.key" &&
+        [ "$(decode "$WORK/out/scatter_carrier.png" -scatter "$WORK/scatter.key")" = "scattered payload" ] &&
+        [ "$(decode "$WORK/out/scatter_carrier.png" -scatter "$WORK/other_scatter.key")" != "scattered payload" ] &&
+        [ "$(decode "$WORK/out/scatter_carrier.png")" != "scattered payload" ]; then
+        pass "scatter round trip"
+    else
+        fail "scatter round trip"
+    fi
+}
+
+# Chunk channel payload lands in its own chunk and decodes
+test_chunk_channel_round_trip()
+{
+    make_png still "$WORK/chunk_carrier.png" 40 30
+
+    if encode "$WORK/chunk_carrier.png" "chunk payload" -channel chunk &&
+        [ "$(make_png chunks "$WORK/out/chunk_carrier.png" | grep -c stPL)" = 1 ] &&
+        [ "$(decode "$WORK/out/chunk_carrier.png")" = "chunk payload" ]; then
+        pass "chunk channel round trip"
+    else
+        fail "chunk channel round trip"
+    fi
+}
+
+# Indexed image carries a seek index and decodes through it
+test_index_round_trip()
+{
+    make_png still "$WORK/index_carrier.png" 40 64
+
+    if encode "$WORK/index_carrier.png" "indexed payload" -index 8 &&
+        [ "$(make_png chunks "$WORK/out/index_carrier.png" | grep -c stIX)" = 1 ] &&
+        [ "$(decode "$WORK/out/index_carrier.png")" = "indexed payload" ]; then
+        pass "index round trip"
+    else
+        fail "index round trip"
+    fi
+}
+
+# Second encode of a carrier maps it from the cache, both outputs decode
+test_cache_miss_then_hit()
+{
+    make_png still "$WORK/cache_carrier.png" 40 30
+    mkdir -p "$WORK/cache"
+
+    if encode "$WORK/cache_carrier.png" "first payload" -cache "$WORK/cache" -stats "$WORK/cache.json" &&
+        [ "$(decode "$WORK/out/cache_carrier.png")" = "first payload" ] &&
+        encode "$WORK/cache_carrier.png" "second payload" -cache "$WORK/cache" -stats "$WORK/cache.json" &&
+        [ "$(decode "$WORK/out/cache_carrier.png")" = "second payload" ] &&
+        [ "$(grep -o '"cache":"[a-z]*"' "$WORK/cache.json" | tr '\n' ' ')" = '"cache":"miss" "cache":"hit" ' ]; then
+        pass "cache miss then hit"
+    else
+        fail "cache miss then hit"
+    fi
+}
+
+# Adam7 output is marked interlaced in its header and decodes
+test_interlace_adam7_round_trip()
+{
+    make_png still "$WORK/adam7_carrier.png" 40 30
+
+    if encode "$WORK/adam7_carrier.png" "interlaced payload" -interlace adam7 &&
+        [ "$(od -An -tu1 -j28 -N1 "$WORK/out/adam7_carrier.png" | tr -d ' ')" = 1 ] &&
+        [ "$(decode "$WORK/out/adam7_carrier.png")" = "interlaced payload" ]; then
+        pass "interlace adam7 round trip"
+    else
+        fail "interlace adam7 round trip"
+    fi
+}
+
+# Gray, gray+alpha and RGB carriers at 8 and 16 bits round trip
+test_depth_and_color_type_round_trip()
+{
+    ok=true
+
+    for format in "8 0" "16 0" "8 4" "16 4" "8 2" "16 2" "16 6"; do
+        make_png still "$WORK/format_carrier.png" 40 30 $format
+
+        if ! encode "$WORK/format_carrier.png" "format payload" ||
+            [ "$(decode "$WORK/out/format_carrier.png")" != "format payload" ] ||
+            ! cmp -s -i 24:24 -n 2 "$WORK/format_carrier.png" "$WORK/out/format_carrier.png"; then
+            ok=false
+        fi
+    done
+
+    if $ok; then
+        pass "16 bit and gray carriers round trip"
+    else
+        fail "16 bit and gray carriers round trip"
+    fi
+}
+
+# Image read from stdin is written to stdout, and decodes from stdin to stdout
+test_stdin_stdout_round_trip()
+{
+    make_png still "$WORK/stdio_carrier.png" 40 30
+
+    if "$STEG" -i - -e "piped payload" < "$WORK/stdio_carrier.png" > "$WORK/stdio_out.png" 2> /dev/null &&
+        [ "$(decode "$WORK/stdio_out.png")" = "piped payload" ] &&
+        [ "$("$STEG" -i - -d piped -o - < "$WORK/stdio_out.png" 2> /dev/null)" = "piped payload" ]; then
+        pass "stdin and stdout round trip"
+    else
+        fail "stdin and stdout round trip"
+    fi
+}
+
+# Client requests keep their options through the daemon
+test_client_daemon_round_trip()
+{
+    make_png still "$WORK/client_carrier.png" 40 64
+    head -c 32 /dev/urandom > "$WORK/client.key"
+    head -c 32 /dev/urandom > "$WORK/client_scatter.key"
+    text=$(printf 'through the daemon %.0s' $(seq 1 10))
+    options="-key $WORK/client.key -scatter $WORK/client_scatter.key"
+
+    "$STEG" -daemon "$WORK/steg.sock" > /dev/null 2>&1 &
+    daemon=$!
+
+    for _ in $(seq 1 50); do
+        [ -S "$WORK/steg.sock" ] && break
+        sleep 0.1
+    done
+
+    if encode "$WORK/client_carrier.png" "$text" $options -compress deflate -index 8 -client "$WORK/steg.sock" &&
+        [ "$(make_png chunks "$WORK/out/client_carrier.png" | grep -c stIX)" = 1 ] &&
+        [ "$(decode "$WORK/out/client_carrier.png" $options)" = "$text" ] &&
+        [ "$(decode "$WORK/out/client_carrier.png" $options -client "$WORK/steg.sock")" = "$text" ] &&
+        [ -z "$(decode "$WORK/out/client_carrier.png" -scatter "$WORK/client_scatter.key")" ]; then
+        pass "client against daemon round trip"
+    else
+        fail "client against daemon round trip"
+    fi
+
+    kill $daemon
+    wait $daemon 2> /dev/null
+}
+
+test_batch_refuses_animated_carrier
+test_fanout_refuses_animated_carrier
+test_animated_output_keeps_ancillary_chunks
+test_batch_and_fanout_round_trip
+test_key_round_trip
+test_compress_round_trip
+test_scatter_round_trip
+test_chunk_channel_round_trip
+test_index_round_trip
+test_cache_miss_then_hit
+test_interlace_adam7_round_trip
+test_depth_and_color_type_round_trip
+test_stdin_stdout_round_trip
+test_client_daemon_round_trip
+
+exit $FAILED